@@ -2830,6 +2830,60 @@ SYSCTL_QUAD(_kern_timer, OID_AUTO, deadline_tracking_bin_2,
     CTLFLAG_RW | CTLFLAG_LOCKED,
     &timer_deadline_tracking_bin_2, "");
 
+extern int timer_housekeeping_cpu;
+extern uint64_t timer_coalesce_aligned;
+extern uint64_t timer_housekeeping_migrated;
+extern uint64_t timer_housekeeping_resyncs;
+
+STATIC int
+sysctl_timer_housekeeping_cpu
+(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	int new_value, changed;
+	int error = sysctl_io_number(req, timer_housekeeping_cpu,
+	    sizeof(int), &new_value, &changed);
+
+	if (error == 0 && changed) {
+		if (new_value < -1 || new_value >= (int)processor_count) {
+			return EINVAL;
+		}
+		os_atomic_store(&timer_housekeeping_cpu, new_value, relaxed);
+	}
+	return error;
+}
+
+SYSCTL_PROC(_kern_timer, OID_AUTO, housekeeping_cpu,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, 0, sysctl_timer_housekeeping_cpu, "I",
+    "CPU receiving non-urgent timers from other CPUs (-1 to disable)");
+SYSCTL_QUAD(_kern_timer, OID_AUTO, coalesce_aligned,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &timer_coalesce_aligned, "Timers merged into an already programmed wakeup");
+SYSCTL_QUAD(_kern_timer, OID_AUTO, housekeeping_migrated,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &timer_housekeeping_migrated, "Timers moved to the housekeeping CPU");
+SYSCTL_QUAD(_kern_timer, OID_AUTO, housekeeping_resyncs,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &timer_housekeeping_resyncs, "Timers taken back from the housekeeping CPU");
+
+extern int thread_call_wheel_enabled;
+extern uint64_t thread_call_wheel_inserts;
+extern uint64_t thread_call_wheel_bypassed;
+extern uint64_t thread_call_wheel_expired;
+
+SYSCTL_INT(_kern_timer, OID_AUTO, thread_call_wheel,
+    CTLFLAG_RW | CTLFLAG_LOCKED,
+    &thread_call_wheel_enabled, 0, "Track delayed thread calls with leeway on a timer wheel");
+SYSCTL_QUAD(_kern_timer, OID_AUTO, thread_call_wheel_inserts,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &thread_call_wheel_inserts, "Delayed thread calls placed on the timer wheel");
+SYSCTL_QUAD(_kern_timer, OID_AUTO, thread_call_wheel_bypassed,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &thread_call_wheel_bypassed, "Delayed thread calls kept on the priority queue");
+SYSCTL_QUAD(_kern_timer, OID_AUTO, thread_call_wheel_expired,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &thread_call_wheel_expired, "Delayed thread calls fired from the timer wheel");
+
 SYSCTL_DECL(_kern_timer_longterm);
 SYSCTL_NODE(_kern_timer, OID_AUTO, longterm, CTLFLAG_RW | CTLFLAG_LOCKED, 0, "longterm");
 
@@ -4361,6 +4415,33 @@ extern uint32_t ipc_voucher_trace_contents;
 SYSCTL_INT(_kern, OID_AUTO, ipc_voucher_trace_contents,
     CTLFLAG_RW | CTLFLAG_LOCKED, &ipc_voucher_trace_contents, 0, "Enable tracing voucher contents");
 
+/*
+ * IPC space reverse hash probe lengths
+ */
+SCALABLE_COUNTER_DECLARE(ipc_hash_lookups);
+SCALABLE_COUNTER_DECLARE(ipc_hash_lookup_probes);
+SCALABLE_COUNTER_DECLARE(ipc_hash_inserts);
+SCALABLE_COUNTER_DECLARE(ipc_hash_insert_probes);
+SCALABLE_COUNTER_DECLARE(ipc_hash_resizes);
+SCALABLE_COUNTER_DECLARE(ipc_hash_migrated);
+extern uint32_t ipc_hash_probe_max;
+
+SYSCTL_SCALABLE_COUNTER(_kern, ipc_hash_lookups, ipc_hash_lookups,
+    "Lookups in ipc space reverse hashes");
+SYSCTL_SCALABLE_COUNTER(_kern, ipc_hash_lookup_probes, ipc_hash_lookup_probes,
+    "Buckets looked at by ipc space reverse hash lookups");
+SYSCTL_SCALABLE_COUNTER(_kern, ipc_hash_inserts, ipc_hash_inserts,
+    "Insertions in ipc space reverse hashes");
+SYSCTL_SCALABLE_COUNTER(_kern, ipc_hash_insert_probes, ipc_hash_insert_probes,
+    "Buckets looked at by ipc space reverse hash insertions");
+SYSCTL_SCALABLE_COUNTER(_kern, ipc_hash_resizes, ipc_hash_resizes,
+    "Times an ipc space reverse hash grew");
+SYSCTL_SCALABLE_COUNTER(_kern, ipc_hash_migrated, ipc_hash_migrated,
+    "Entries moved to a grown ipc space reverse hash");
+SYSCTL_UINT(_kern, OID_AUTO, ipc_hash_probe_max,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &ipc_hash_probe_max, 0,
+    "Longest ipc space reverse hash probe, in buckets");
+
 /*
  * Kernel stack size and depth
  */
@@ -5000,6 +5081,26 @@ SYSCTL_INT(_kern, OID_AUTO, direct_handoff,
     CTLFLAG_KERN | CTLFLAG_RW | CTLFLAG_LOCKED,
     &allow_direct_handoff, 0, "Enable direct handoff for realtime threads");
 
+extern boolean_t sched_wake_affine_enabled;
+SYSCTL_INT(_kern, OID_AUTO, sched_wake_affine,
+    CTLFLAG_KERN | CTLFLAG_RW | CTLFLAG_LOCKED,
+    &sched_wake_affine_enabled, 0, "Place woken threads near the thread that woke them");
+
+extern uint32_t sched_wake_affine_pair_threshold;
+SYSCTL_UINT(_kern, OID_AUTO, sched_wake_affine_pair_threshold,
+    CTLFLAG_KERN | CTLFLAG_RW | CTLFLAG_LOCKED,
+    &sched_wake_affine_pair_threshold, 0, "Consecutive wakeups by one thread before a pair is wake-affine");
+
+extern uint64_t sched_wake_affine_sync_placements;
+SYSCTL_QUAD(_kern, OID_AUTO, sched_wake_affine_sync_placements,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &sched_wake_affine_sync_placements, "Wakees queued on the processor of a blocking waker");
+
+extern uint64_t sched_wake_affine_cluster_placements;
+SYSCTL_QUAD(_kern, OID_AUTO, sched_wake_affine_cluster_placements,
+    CTLFLAG_RD | CTLFLAG_LOCKED,
+    &sched_wake_affine_cluster_placements, "Wakees placed in the cluster of their waker");
+
 #if DEVELOPMENT || DEBUG
 
 SYSCTL_LONG(_kern, OID_AUTO, phys_carveout_pa, CTLFLAG_RD | CTLFLAG_LOCKED,
@@ -5162,10 +5263,14 @@ int
 turnstile_get_boost_stats_sysctl(void *req);
 int
 turnstile_get_unboost_stats_sysctl(void *req);
+int
+turnstile_get_chain_stats_sysctl(void *req);
 static int
 sysctl_turnstile_boost_stats SYSCTL_HANDLER_ARGS;
 static int
 sysctl_turnstile_unboost_stats SYSCTL_HANDLER_ARGS;
+static int
+sysctl_turnstile_chain_stats SYSCTL_HANDLER_ARGS;
 extern uint64_t thread_block_on_turnstile_count;
 extern uint64_t thread_block_on_regular_waitq_count;
 
@@ -5183,10 +5288,19 @@ sysctl_turnstile_unboost_stats SYSCTL_HANDLER_ARGS
 	return turnstile_get_unboost_stats_sysctl(req);
 }
 
+static int
+sysctl_turnstile_chain_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2, oidp)
+	return turnstile_get_chain_stats_sysctl(req);
+}
+
 SYSCTL_PROC(_kern, OID_AUTO, turnstile_boost_stats, CTLFLAG_RD | CTLFLAG_ANYBODY | CTLFLAG_KERN | CTLFLAG_LOCKED | CTLTYPE_STRUCT,
     0, 0, sysctl_turnstile_boost_stats, "S", "turnstiles boost stats");
 SYSCTL_PROC(_kern, OID_AUTO, turnstile_unboost_stats, CTLFLAG_RD | CTLFLAG_ANYBODY | CTLFLAG_KERN | CTLFLAG_LOCKED | CTLTYPE_STRUCT,
     0, 0, sysctl_turnstile_unboost_stats, "S", "turnstiles unboost stats");
+SYSCTL_PROC(_kern, OID_AUTO, turnstile_chain_stats, CTLFLAG_RD | CTLFLAG_ANYBODY | CTLFLAG_KERN | CTLFLAG_LOCKED | CTLTYPE_STRUCT,
+    0, 0, sysctl_turnstile_chain_stats, "S", "turnstiles propagation walk histograms");
 SYSCTL_QUAD(_kern, OID_AUTO, thread_block_count_on_turnstile,
     CTLFLAG_RD | CTLFLAG_ANYBODY | CTLFLAG_KERN | CTLFLAG_LOCKED,
     &thread_block_on_turnstile_count, "thread blocked on turnstile count");
@@ -5391,6 +5505,142 @@ SYSCTL_PROC(_kern, OID_AUTO, test_mtx_uncontended,
     CTLTYPE_STRING | CTLFLAG_MASKED | CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
     0, 0, sysctl_test_mtx_uncontended, "A", "get statistics for uncontended mtx test");
 
+/*
+ * Input is "<iterations> <percpu> <write_every>": run the reader writer
+ * lock scalability test on a lck_rw_t, or on a lck_rw_percpu_t when
+ * percpu is set, taking it exclusive once every write_every iterations
+ * (never if 0).
+ */
+static int
+sysctl_test_rw_contended SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	char* buffer;
+	int buffer_size, offset, error, iter, percpu, write_every;
+	char input_val[40];
+
+	if (!req->newptr) {
+		return 0;
+	}
+
+	if (!req->oldptr) {
+		return EINVAL;
+	}
+
+	if (req->newlen >= sizeof(input_val)) {
+		return EINVAL;
+	}
+
+	error = SYSCTL_IN(req, input_val, req->newlen);
+	if (error) {
+		return error;
+	}
+	input_val[req->newlen] = '\0';
+
+	iter = percpu = write_every = 0;
+	error = sscanf(input_val, "%d %d %d", &iter, &percpu, &write_every);
+	if (error != 3) {
+		printf("%s invalid input\n", __func__);
+		return EINVAL;
+	}
+
+	if (iter <= 0 || write_every < 0) {
+		printf("%s requested %d iterations, write every %d, not starting the test\n",
+		    __func__, iter, write_every);
+		return EINVAL;
+	}
+
+	lck_rw_test_init();
+
+	buffer_size = 200;
+	buffer = kheap_alloc(KHEAP_TEMP, buffer_size, Z_WAITOK | Z_ZERO);
+	if (!buffer) {
+		panic("Impossible to allocate memory for %s\n", __func__);
+	}
+
+	printf("%s starting contended %s test with %d iterations, write every %d\n",
+	    __func__, percpu ? "lck_rw_percpu" : "lck_rw", iter, write_every);
+
+	offset = lck_rw_test_contended(iter, percpu, write_every, buffer, buffer_size);
+
+	error = SYSCTL_OUT(req, buffer, offset);
+
+	kheap_free(KHEAP_TEMP, buffer, buffer_size);
+
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, test_rw_contended,
+    CTLTYPE_STRING | CTLFLAG_MASKED | CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    0, 0, sysctl_test_rw_contended, "A", "get statistics for contended rw lock test");
+
+/*
+ * Input is "<iterations> <hold_ns>": two threads take turns on a mutex
+ * with statistics enabled, holding it for hold_ns each time.
+ */
+static int
+sysctl_test_mtx_spin_contended SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	char* buffer;
+	int buffer_size, offset, error, iter, hold_ns;
+	char input_val[40];
+
+	if (!req->newptr) {
+		return 0;
+	}
+
+	if (!req->oldptr) {
+		return EINVAL;
+	}
+
+	if (req->newlen >= sizeof(input_val)) {
+		return EINVAL;
+	}
+
+	error = SYSCTL_IN(req, input_val, req->newlen);
+	if (error) {
+		return error;
+	}
+	input_val[req->newlen] = '\0';
+
+	iter = hold_ns = 0;
+	error = sscanf(input_val, "%d %d", &iter, &hold_ns);
+	if (error != 2) {
+		printf("%s invalid input\n", __func__);
+		return EINVAL;
+	}
+
+	if (iter <= 0 || hold_ns < 0) {
+		printf("%s requested %d iterations, hold %d ns, not starting the test\n",
+		    __func__, iter, hold_ns);
+		return EINVAL;
+	}
+
+	lck_mtx_test_spin_init();
+
+	buffer_size = 200;
+	buffer = kheap_alloc(KHEAP_TEMP, buffer_size, Z_WAITOK | Z_ZERO);
+	if (!buffer) {
+		panic("Impossible to allocate memory for %s\n", __func__);
+	}
+
+	printf("%s starting contended spin test with %d iterations, hold %d ns\n",
+	    __func__, iter, hold_ns);
+
+	offset = lck_mtx_test_spin_contended(iter, hold_ns, buffer, buffer_size);
+
+	error = SYSCTL_OUT(req, buffer, offset);
+
+	kheap_free(KHEAP_TEMP, buffer, buffer_size);
+
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, test_mtx_spin_contended,
+    CTLTYPE_STRING | CTLFLAG_MASKED | CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    0, 0, sysctl_test_mtx_spin_contended, "A", "get statistics for contended mtx spin test");
+
 extern uint64_t MutexSpin;
 
 SYSCTL_QUAD(_kern, OID_AUTO, mutex_spin_abs, CTLFLAG_RW, &MutexSpin,
@@ -5430,6 +5680,16 @@ sysctl_high_mutex_spin_ns SYSCTL_HANDLER_ARGS
 SYSCTL_PROC(_kern, OID_AUTO, high_mutex_spin_abs, CTLFLAG_RW | CTLTYPE_QUAD, 0, 0, sysctl_high_mutex_spin_ns, "I",
     "High spin threshold in abs for acquiring a kernel mutex");
 
+#if defined (__x86_64__)
+extern uint32_t lck_mtx_adaptive_spin;
+extern uint32_t lck_mtx_spin_hold_mult;
+
+SYSCTL_UINT(_kern, OID_AUTO, mutex_adaptive_spin, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &lck_mtx_adaptive_spin, 0, "Derive mutex spin budgets from per lock group hold times");
+SYSCTL_UINT(_kern, OID_AUTO, mutex_spin_hold_mult, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &lck_mtx_spin_hold_mult, 0, "Adaptive mutex spin budget, in multiples of the learned hold time");
+#endif /* __x86_64__ */
+
 
 #if defined (__x86_64__)
 
@@ -110,6 +110,7 @@
 #include <kern/waitq.h>
 #include <kern/sched_prim.h>
 #include <kern/mpsc_queue.h>
+#include <kern/smr.h>
 #include <kern/debug.h>
 
 #include <sys/mbuf.h>
@@ -3142,6 +3143,30 @@ sysctl_mpsc_test_pingpong SYSCTL_HANDLER_ARGS
 SYSCTL_PROC(_kern, OID_AUTO, mpsc_test_pingpong, CTLTYPE_QUAD | CTLFLAG_RW | CTLFLAG_LOCKED,
     0, 0, sysctl_mpsc_test_pingpong, "Q", "MPSC tests: pingpong");
 
+static int
+sysctl_smr_test_stress SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint64_t value = 0;
+	int error;
+
+	error = SYSCTL_IN(req, &value, sizeof(value));
+	if (error) {
+		return error;
+	}
+
+	if (error == 0 && req->newptr) {
+		error = smr_test_stress(value, &value);
+		if (error == 0) {
+			error = SYSCTL_OUT(req, &value, sizeof(value));
+		}
+	}
+
+	return error;
+}
+SYSCTL_PROC(_kern, OID_AUTO, smr_test_stress, CTLTYPE_QUAD | CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, 0, sysctl_smr_test_stress, "Q", "SMR tests: stress");
+
 #endif /* DEVELOPMENT || DEBUG */
 
 /*Remote Time api*/
@@ -56,9 +56,12 @@
 #include <kern/waitq.h>
 #include <kern/sched_prim.h>
 #include <kern/turnstile.h>
+#include <kern/thread_call.h>
 #include <kern/zalloc.h>
 #include <kern/debug.h>
 
+#include <vm/vm_kern.h>
+
 #include <pexpert/pexpert.h>
 
 #define XNU_TEST_BITMAP
@@ -151,7 +154,7 @@ typedef struct ull {
 	thread_t        ull_owner; /* holds +1 thread reference */
 	ulk_t           ull_key;
 	ull_lock_t      ull_lock;
-	uint            ull_bucket_index;
+	uint32_t        ull_hash;
 	int32_t         ull_nwaiters;
 	int32_t         ull_refcount;
 	uint8_t         ull_opcode;
@@ -199,51 +202,145 @@ ull_dump(ull_t *ull)
 }
 #endif
 
+/*
+ * The ulock hash table starts small and doubles whenever there are more
+ * than ULL_HASH_LOAD live ull_t per bucket on average, up to a size
+ * derived from thread_max.
+ *
+ * Bucket lookups hold ull_hash_lock shared, which only touches a per-cpu
+ * counter.  The grow thread call takes it exclusive to rehash every ull_t
+ * into the new table, so nothing else needs to know about resizes.
+ *
+ * Buckets are cache line sized so that the locks of neighbouring
+ * buckets don't share a line.
+ */
+#define ULL_HASH_MIN_BUCKETS    256
+#define ULL_HASH_LOAD           2
+#define ULL_BUCKET_ALIGN        128     /* largest cache line of supported CPUs */
+
 typedef struct ull_bucket {
 	queue_head_t ulb_head;
 	lck_spin_t   ulb_lock;
-} ull_bucket_t;
+} __attribute__((aligned(ULL_BUCKET_ALIGN))) ull_bucket_t;
 
 static int ull_hash_buckets;
+static int ull_hash_max_buckets;
 static ull_bucket_t *ull_bucket;
 static uint32_t ull_nzalloc = 0;
+static uint32_t ull_nlive;
+static thread_call_t ull_hash_grow_call;
 static ZONE_DECLARE(ull_zone, "ulocks", sizeof(ull_t), ZC_NOENCRYPT | ZC_CACHING);
+static LCK_RW_PERCPU_DECLARE(ull_hash_lock, &ull_lck_grp);
 
 #define ull_bucket_lock(i)       lck_spin_lock_grp(&ull_bucket[i].ulb_lock, &ull_lck_grp)
 #define ull_bucket_unlock(i)     lck_spin_unlock(&ull_bucket[i].ulb_lock)
 
 static __inline__ uint32_t
-ull_hash_index(const void *key, size_t length)
+ull_hash(const void *key, size_t length)
+{
+	return os_hash_jenkins(key, length);
+}
+
+#define ULL_HASH(keyp) ull_hash(keyp, keyp->ulk_key_type == ULK_UADDR ? ULK_UADDR_LEN : ULK_XPROC_LEN)
+
+/* Must be called with ull_hash_lock held */
+#define ULL_INDEX(hash) ((hash) & (uint32_t)(ull_hash_buckets - 1))
+
+static ull_bucket_t *
+ull_bucket_table_alloc(int nbuckets)
 {
-	uint32_t hash = os_hash_jenkins(key, length);
+	vm_offset_t table_addr;
+	ull_bucket_t *table;
+
+	/* page aligned, so the buckets are cache line aligned too */
+	if (kmem_alloc(kernel_map, &table_addr, sizeof(ull_bucket_t) * nbuckets,
+	    VM_KERN_MEMORY_BSD) != KERN_SUCCESS) {
+		return NULL;
+	}
+	table = (ull_bucket_t *)table_addr;
+
+	for (int i = 0; i < nbuckets; i++) {
+		queue_init(&table[i].ulb_head);
+		lck_spin_init(&table[i].ulb_lock, &ull_lck_grp, NULL);
+	}
 
-	hash &= (ull_hash_buckets - 1);
+	return table;
+}
 
-	return hash;
+static void
+ull_bucket_table_free(ull_bucket_t *table, int nbuckets)
+{
+	for (int i = 0; i < nbuckets; i++) {
+		assert(queue_empty(&table[i].ulb_head));
+		lck_spin_destroy(&table[i].ulb_lock, &ull_lck_grp);
+	}
+
+	kmem_free(kernel_map, (vm_offset_t)table, sizeof(ull_bucket_t) * nbuckets);
 }
 
-#define ULL_INDEX(keyp) ull_hash_index(keyp, keyp->ulk_key_type == ULK_UADDR ? ULK_UADDR_LEN : ULK_XPROC_LEN)
+static void
+ull_hash_grow(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	ull_bucket_t *table, *old_table;
+	int nbuckets, old_nbuckets;
+	uint32_t nlive = os_atomic_load(&ull_nlive, relaxed);
+
+	nbuckets = ull_hash_buckets;
+	while (nbuckets < ull_hash_max_buckets &&
+	    nlive > (uint32_t)nbuckets * ULL_HASH_LOAD) {
+		nbuckets *= 2;
+	}
+	if (nbuckets == ull_hash_buckets) {
+		return;
+	}
+
+	table = ull_bucket_table_alloc(nbuckets);
+	if (table == NULL) {
+		return;
+	}
+
+	lck_rw_percpu_lock_exclusive(&ull_hash_lock);
+
+	old_table = ull_bucket;
+	old_nbuckets = ull_hash_buckets;
+
+	for (int i = 0; i < old_nbuckets; i++) {
+		ull_t *elem;
+
+		while (!queue_empty(&old_table[i].ulb_head)) {
+			elem = qe_dequeue_head(&old_table[i].ulb_head, ull_t, ull_hash_link);
+			enqueue(&table[elem->ull_hash & (uint32_t)(nbuckets - 1)].ulb_head,
+			    &elem->ull_hash_link);
+		}
+	}
+
+	ull_bucket = table;
+	ull_hash_buckets = nbuckets;
+
+	lck_rw_percpu_unlock_exclusive(&ull_hash_lock);
+
+	ull_bucket_table_free(old_table, old_nbuckets);
+}
 
 void
 ulock_initialize(void)
 {
 	assert(thread_max > 16);
-	/* Size ull_hash_buckets based on thread_max.
+	/* Bound ull_hash_buckets based on thread_max.
 	 * Round up to nearest power of 2, then divide by 4
 	 */
-	ull_hash_buckets = (1 << (bit_ceiling(thread_max) - 2));
+	ull_hash_max_buckets = MAX(1 << (bit_ceiling(thread_max) - 2), ULL_HASH_MIN_BUCKETS);
+	ull_hash_buckets = ULL_HASH_MIN_BUCKETS;
 
-	kprintf("%s>thread_max=%d, ull_hash_buckets=%d\n", __FUNCTION__, thread_max, ull_hash_buckets);
-	assert(ull_hash_buckets >= thread_max / 4);
+	kprintf("%s>thread_max=%d, ull_hash_buckets=%d, max=%d\n", __FUNCTION__,
+	    thread_max, ull_hash_buckets, ull_hash_max_buckets);
+	assert(ull_hash_max_buckets >= thread_max / 4);
 
-	ull_bucket = zalloc_permanent(sizeof(ull_bucket_t) * ull_hash_buckets,
-	    ZALIGN_PTR);
+	ull_bucket = ull_bucket_table_alloc(ull_hash_buckets);
 	assert(ull_bucket != NULL);
 
-	for (int i = 0; i < ull_hash_buckets; i++) {
-		queue_init(&ull_bucket[i].ulb_head);
-		lck_spin_init(&ull_bucket[i].ulb_lock, &ull_lck_grp, NULL);
-	}
+	ull_hash_grow_call = thread_call_allocate_with_options(ull_hash_grow, NULL,
+	    THREAD_CALL_PRIORITY_KERNEL, THREAD_CALL_OPTIONS_ONCE);
 }
 
 #if DEVELOPMENT || DEBUG
@@ -258,6 +355,7 @@ ull_hash_dump(pid_t pid)
 		kprintf("%s>total number of ull_t allocated %d\n", __FUNCTION__, ull_nzalloc);
 		kprintf("%s>BEGIN\n", __FUNCTION__);
 	}
+	lck_rw_percpu_lock_shared(&ull_hash_lock);
 	for (int i = 0; i < ull_hash_buckets; i++) {
 		ull_bucket_lock(i);
 		if (!queue_empty(&ull_bucket[i].ulb_head)) {
@@ -274,6 +372,7 @@ ull_hash_dump(pid_t pid)
 		}
 		ull_bucket_unlock(i);
 	}
+	lck_rw_percpu_unlock_shared(&ull_hash_lock);
 	if (pid == 0) {
 		kprintf("%s>END\n", __FUNCTION__);
 		ull_nzalloc = 0;
@@ -290,7 +389,7 @@ ull_alloc(ulk_t *key)
 
 	ull->ull_refcount = 1;
 	ull->ull_key = *key;
-	ull->ull_bucket_index = ULL_INDEX(key);
+	ull->ull_hash = ULL_HASH(key);
 	ull->ull_nwaiters = 0;
 	ull->ull_opcode = 0;
 
@@ -324,10 +423,14 @@ static ull_t *
 ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 {
 	ull_t *ull = NULL;
-	uint i = ULL_INDEX(key);
+	uint32_t hash = ULL_HASH(key);
 	ull_t *new_ull = (flags & ULL_MUST_EXIST) ? NULL : ull_alloc(key);
 	ull_t *elem;
+	bool grow = false;
+	uint i;
 
+	lck_rw_percpu_lock_shared(&ull_hash_lock);
+	i = ULL_INDEX(hash);
 	ull_bucket_lock(i);
 	qe_foreach_element(elem, &ull_bucket[i].ulb_head, ull_hash_link) {
 		ull_lock(elem);
@@ -342,6 +445,7 @@ ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 		if (flags & ULL_MUST_EXIST) {
 			/* Must already exist (called from wake) */
 			ull_bucket_unlock(i);
+			lck_rw_percpu_unlock_shared(&ull_hash_lock);
 			assert(new_ull == NULL);
 			assert(unused_ull == NULL);
 			return NULL;
@@ -350,12 +454,16 @@ ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 		if (new_ull == NULL) {
 			/* Alloc above failed */
 			ull_bucket_unlock(i);
+			lck_rw_percpu_unlock_shared(&ull_hash_lock);
 			return NULL;
 		}
 
 		ull = new_ull;
 		ull_lock(ull);
 		enqueue(&ull_bucket[i].ulb_head, &ull->ull_hash_link);
+		grow = os_atomic_inc(&ull_nlive, relaxed) >
+		    (uint32_t)ull_hash_buckets * ULL_HASH_LOAD &&
+		    ull_hash_buckets < ull_hash_max_buckets;
 	} else if (!(flags & ULL_MUST_EXIST)) {
 		assert(new_ull);
 		assert(unused_ull);
@@ -366,6 +474,11 @@ ull_get(ulk_t *key, uint32_t flags, ull_t **unused_ull)
 	ull->ull_refcount++;
 
 	ull_bucket_unlock(i);
+	lck_rw_percpu_unlock_shared(&ull_hash_lock);
+
+	if (grow) {
+		thread_call_enter(ull_hash_grow_call);
+	}
 
 	return ull; /* still locked */
 }
@@ -385,9 +498,13 @@ ull_put(ull_t *ull)
 		return;
 	}
 
-	ull_bucket_lock(ull->ull_bucket_index);
+	lck_rw_percpu_lock_shared(&ull_hash_lock);
+	uint i = ULL_INDEX(ull->ull_hash);
+	ull_bucket_lock(i);
 	remqueue(&ull->ull_hash_link);
-	ull_bucket_unlock(ull->ull_bucket_index);
+	ull_bucket_unlock(i);
+	lck_rw_percpu_unlock_shared(&ull_hash_lock);
+	os_atomic_dec(&ull_nlive, relaxed);
 
 	ull_free(ull);
 }
@@ -841,12 +958,13 @@ ulock_wait_continue(__unused void * parameter, wait_result_t wr)
 }
 
 int
-ulock_wake(struct proc *p, struct ulock_wake_args *args, __unused int32_t *retval)
+ulock_wake(struct proc *p, struct ulock_wake_args *args, int32_t *retval)
 {
 	uint8_t opcode = (uint8_t)(args->operation & UL_OPCODE_MASK);
 	uint flags = args->operation & UL_FLAGS_MASK;
 	int ret = 0;
 	ulk_t key;
+	uint32_t wake_count = 0;
 
 	/* involved threads - each variable holds +1 ref if not null */
 	thread_t wake_thread    = THREAD_NULL;
@@ -894,6 +1012,14 @@ ulock_wake(struct proc *p, struct ulock_wake_args *args, __unused int32_t *retva
 		goto munge_retval;
 	}
 
+	if (flags & ULF_WAKE_N) {
+		if ((flags & (ULF_WAKE_ALL | ULF_WAKE_THREAD)) || set_owner ||
+		    args->wake_value == 0 || args->wake_value > INT32_MAX) {
+			ret = EINVAL;
+			goto munge_retval;
+		}
+	}
+
 	if (flags & ULF_WAKE_ALLOW_NON_OWNER) {
 		if (!set_owner) {
 			ret = EINVAL;
@@ -997,6 +1123,22 @@ ulock_wake(struct proc *p, struct ulock_wake_args *args, __unused int32_t *retva
 		new_owner = waitq_wakeup64_identify(&ts->ts_waitq,
 		    CAST_EVENT64_T(ULOCK_TO_EVENT(ull)),
 		    THREAD_AWAKENED, WAITQ_PROMOTE_ON_WAKE);
+	} else if (flags & ULF_WAKE_N) {
+		/*
+		 * Wake waiters one at a time in priority order under
+		 * a single hold of the ull lock, rather than having
+		 * userspace redrive one syscall per waiter.
+		 */
+		while (wake_count < args->wake_value) {
+			kern_return_t kr = waitq_wakeup64_one(&ts->ts_waitq,
+			    CAST_EVENT64_T(ULOCK_TO_EVENT(ull)),
+			    THREAD_AWAKENED, WAITQ_ALL_PRIORITIES);
+			if (kr != KERN_SUCCESS) {
+				assert(kr == KERN_NOT_WAITING);
+				break;
+			}
+			wake_count++;
+		}
 	} else {
 		waitq_wakeup64_one(&ts->ts_waitq, CAST_EVENT64_T(ULOCK_TO_EVENT(ull)),
 		    THREAD_AWAKENED, WAITQ_ALL_PRIORITIES);
@@ -1027,6 +1169,10 @@ munge_retval:
 		thread_deallocate(wake_thread);
 	}
 
+	if ((flags & ULF_WAKE_N) && ret == 0) {
+		*retval = (int32_t)wake_count;
+	}
+
 	if ((flags & ULF_NO_ERRNO) && (ret != 0)) {
 		*retval = -ret;
 		ret = 0;
@@ -4234,6 +4234,7 @@ m_classifier_init(struct mbuf *m, uint32_t pktf_mask)
 	if (!(m->m_pkthdr.pkt_flags & PKTF_TS_VALID)) {
 		m->m_pkthdr.pkt_timestamp = 0;
 	}
+	m->m_pkthdr.pkt_pacing_delay = 0;
 }
 
 void
@@ -106,6 +106,8 @@
 #include <sys/malloc.h>
 #include <sys/mbuf.h>
 #include <sys/mcache.h>
+#include <sys/random.h>
+#include <sys/sysctl.h>
 #include <netinet/in.h>
 #include <netinet/ip_var.h>
 #include <netinet/ip6.h>
@@ -876,3 +878,189 @@ m_sum16(struct mbuf *m, uint32_t off, uint32_t len)
 
 	return (uint16_t)os_cpu_in_cksum_mbuf(m, len, off, 0);
 }
+
+/*
+ * Like m_copydata(), but also returns the 16-bit one's complement sum
+ * (not complemented) of the bytes copied, added to initial_sum; the data
+ * of each mbuf is copied and summed in a single pass.
+ */
+uint16_t
+m_copydata_sum(struct mbuf *m, int off, int len, void *vp,
+    uint32_t initial_sum)
+{
+	uint64_t sum = initial_sum;
+	uint32_t count, partial;
+	boolean_t odd = FALSE;
+	uint8_t *cp = vp;
+
+	if (off < 0 || len < 0) {
+		panic("%s: invalid offset %d or len %d", __func__, off, len);
+		/* NOTREACHED */
+	}
+
+	while (len > 0) {
+		if (m == NULL) {
+			panic("%s: mbuf chain too short for off+len (%d+%d)",
+			    __func__, off, len);
+			/* NOTREACHED */
+		}
+		if (off >= m->m_len) {
+			off -= m->m_len;
+			m = m->m_next;
+			continue;
+		}
+		count = MIN(m->m_len - off, len);
+		partial = os_cpu_copy_in_cksum(mtod(m, uint8_t *) + off, cp,
+		    count, 0);
+		/* a piece that starts at an odd offset sums swapped bytes */
+		if (odd) {
+			partial = ((partial & 0xff) << 8) | (partial >> 8);
+		}
+		sum += partial;
+		odd ^= (count & 1);
+		cp += count;
+		len -= count;
+		off = 0;
+		m = m->m_next;
+	}
+
+	/* fold 64-bit to 16-bit */
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return (uint16_t)sum;
+}
+
+#if (DEVELOPMENT || DEBUG)
+/*
+ * kern.ipc.copydata_sum_test: checks os_cpu_copy_in_cksum() and
+ * m_copydata_sum() against m_copydata() followed by a byte-at-a-time
+ * sum, for both the copied bytes and the folded sum.  The chain is made
+ * of odd-length pieces at odd data offsets, and every copy goes to an
+ * unaligned destination as well as an aligned one.
+ */
+static const int m_copydata_sum_test_pieces[] = {
+	1, 3, 8, 31, 64, 7, 129, 2, 57, 97
+};
+
+#define M_COPYDATA_SUM_TEST_LEN         399     /* sum of the pieces */
+#define M_COPYDATA_SUM_TEST_ALIGN       8
+
+/* the reference sum, folded but not complemented */
+static uint16_t
+m_copydata_sum_test_ref(const uint8_t *buf, int len)
+{
+	uint32_t partial = 0;
+
+	while (len > 1) {
+		partial += (uint32_t)buf[0] | ((uint32_t)buf[1] << 8);
+		buf += 2;
+		len -= 2;
+	}
+	if (len) {
+		partial += buf[0];
+	}
+	while (partial >> 16) {
+		partial = (partial >> 16) + (partial & 0xffff);
+	}
+	return (uint16_t)partial;
+}
+
+static struct mbuf *
+m_copydata_sum_test_chain(void)
+{
+	struct mbuf *m = NULL, *n, **np = &m;
+
+	for (size_t i = 0; i < sizeof(m_copydata_sum_test_pieces) /
+	    sizeof(m_copydata_sum_test_pieces[0]); i++) {
+		if ((n = m_get(M_WAITOK, MT_DATA)) == NULL) {
+			m_freem(m);
+			return NULL;
+		}
+		/* leave the data of most pieces on an odd address */
+		n->m_data += (i % 4);
+		n->m_len = m_copydata_sum_test_pieces[i];
+		read_random(mtod(n, void *), n->m_len);
+		*np = n;
+		np = &n->m_next;
+	}
+	return m;
+}
+
+static int
+sysctl_copydata_sum_test SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint8_t ref[M_COPYDATA_SUM_TEST_LEN];
+	uint8_t dst[M_COPYDATA_SUM_TEST_LEN + M_COPYDATA_SUM_TEST_ALIGN];
+	struct mbuf *m;
+	int value = 0, rounds, error;
+
+	error = SYSCTL_IN(req, &value, sizeof(value));
+	if (error || req->newptr == USER_ADDR_NULL) {
+		return error;
+	}
+	if (value <= 0 || value > 100) {
+		return EINVAL;
+	}
+
+	rounds = value;
+	value = 0;
+	while (rounds-- > 0 && error == 0) {
+		if ((m = m_copydata_sum_test_chain()) == NULL) {
+			return ENOBUFS;
+		}
+		for (int off = 0; off < M_COPYDATA_SUM_TEST_LEN && error == 0; off++) {
+			int lens[2];
+
+			/* the rest of the chain, and a short run of 1 to 67 bytes */
+			lens[0] = M_COPYDATA_SUM_TEST_LEN - off;
+			lens[1] = MIN(lens[0], 1 + off % 67);
+
+			for (int l = 0; l < 2 && error == 0; l++) {
+				int len = lens[l];
+				uint16_t sum;
+
+				m_copydata(m, off, len, ref);
+				sum = m_copydata_sum_test_ref(ref, len);
+
+				for (int align = 0; align < M_COPYDATA_SUM_TEST_ALIGN; align++) {
+					uint8_t *d = dst + align;
+
+					memset(dst, 0xa5, sizeof(dst));
+					if (m_copydata_sum(m, off, len, d, 0) != sum ||
+					    bcmp(d, ref, len) != 0) {
+						printf("%s: m_copydata_sum off %d len %d "
+						    "dst +%d mismatch\n", __func__, off, len, align);
+						error = EIO;
+						break;
+					}
+
+					memset(dst, 0xa5, sizeof(dst));
+					if (os_cpu_copy_in_cksum(ref, d, len, 0) != sum ||
+					    bcmp(d, ref, len) != 0) {
+						printf("%s: os_cpu_copy_in_cksum len %d "
+						    "dst +%d mismatch\n", __func__, len, align);
+						error = EIO;
+						break;
+					}
+					value++;
+				}
+			}
+		}
+		m_freem(m);
+	}
+
+	if (error == 0) {
+		error = SYSCTL_OUT(req, &value, sizeof(value));
+	}
+	return error;
+}
+
+SYSCTL_DECL(_kern_ipc);
+SYSCTL_PROC(_kern_ipc, OID_AUTO, copydata_sum_test,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED | CTLFLAG_MASKED,
+    0, 0, sysctl_copydata_sum_test, "I",
+    "Check m_copydata_sum against m_copydata and a reference sum");
+#endif /* (DEVELOPMENT || DEBUG) */
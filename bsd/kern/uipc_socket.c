@@ -110,6 +110,7 @@
 #include <netinet6/ip6_var.h>
 #include <netinet/flow_divert.h>
 #include <kern/zalloc.h>
+#include <kern/smr.h>
 #include <kern/locks.h>
 #include <machine/limits.h>
 #include <libkern/OSAtomic.h>
@@ -436,7 +437,13 @@ cached_sock_alloc(struct socket **so, zalloc_flags_t how)
 
 	lck_mtx_lock(&so_cache_mtx);
 
-	if (!STAILQ_EMPTY(&so_cache_head)) {
+	/*
+	 * The pcb of a cached socket may still be seen by lockless
+	 * lookups (see in_pcblookup_hash), so it can only be handed
+	 * out again once their grace period has elapsed.
+	 */
+	if (!STAILQ_EMPTY(&so_cache_head) &&
+	    smr_poll(&inpcb_smr, STAILQ_FIRST(&so_cache_head)->cache_smr_seq)) {
 		VERIFY(cached_sock_count > 0);
 
 		*so = STAILQ_FIRST(&so_cache_head);
@@ -487,7 +494,7 @@ cached_sock_free(struct socket *so)
 	if (++cached_sock_count > max_cached_sock_count) {
 		--cached_sock_count;
 		lck_mtx_unlock(&so_cache_mtx);
-		zfree(so_cache_zone, so);
+		smr_zfree(&inpcb_smr, so_cache_zone, so);
 	} else {
 		if (so_cache_hw < cached_sock_count) {
 			so_cache_hw = cached_sock_count;
@@ -496,6 +503,7 @@ cached_sock_free(struct socket *so)
 		STAILQ_INSERT_TAIL(&so_cache_head, so, so_cache_ent);
 
 		so->cache_timestamp = so_cache_time;
+		so->cache_smr_seq = smr_advance(&inpcb_smr);
 		lck_mtx_unlock(&so_cache_mtx);
 	}
 }
@@ -561,7 +569,8 @@ so_cache_timer(void)
 		VERIFY(cached_sock_count > 0);
 		p = STAILQ_FIRST(&so_cache_head);
 		if ((so_cache_time - p->cache_timestamp) <
-		    SO_CACHE_TIME_LIMIT) {
+		    SO_CACHE_TIME_LIMIT ||
+		    !smr_poll(&inpcb_smr, p->cache_smr_seq)) {
 			break;
 		}
 
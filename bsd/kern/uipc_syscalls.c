@@ -163,6 +163,8 @@ static u_int externalize_user_msghdr_array(void *, int, int, u_int,
 
 static void free_uio_array(struct uio **, u_int);
 static boolean_t uio_array_is_valid(struct uio **, u_int);
+static uio_t uio_array_gather(struct uio **, u_int);
+static void uio_array_scatter(struct uio **, u_int, user_ssize_t);
 static int recv_msg_array_is_valid(struct recv_msg_elem *, u_int);
 static int internalize_recv_msghdr_array(const void *, int, int,
     u_int, struct user_msghdr_x *, struct recv_msg_elem *);
@@ -170,6 +172,9 @@ static u_int externalize_recv_msghdr_array(struct proc *, struct socket *, void
     struct user_msghdr_x *, struct recv_msg_elem *, int *);
 static struct recv_msg_elem *alloc_recv_msg_array(u_int count);
 static void free_recv_msg_array(struct recv_msg_elem *, u_int);
+static uio_t recv_msg_array_gather(struct recv_msg_elem *, u_int);
+static void recv_msg_array_scatter(struct recv_msg_elem *, u_int,
+    user_ssize_t, int, int);
 
 SYSCTL_DECL(_kern_ipc);
 
@@ -179,6 +184,10 @@ SYSCTL_UINT(_kern_ipc, OID_AUTO, maxsendmsgx,
 static u_int somaxrecvmsgx = 100;
 SYSCTL_UINT(_kern_ipc, OID_AUTO, maxrecvmsgx,
     CTLFLAG_RW | CTLFLAG_LOCKED, &somaxrecvmsgx, 0, "");
+static u_int sostreammsgx = 1;
+SYSCTL_UINT(_kern_ipc, OID_AUTO, streammsgx,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &sostreammsgx, 0,
+    "Batch sendmsg_x/recvmsg_x on stream sockets");
 
 /*
  * System call interface to the socket abstraction.
@@ -1537,6 +1546,7 @@ sendmsg_x(struct proc *p, struct sendmsg_x_args *uap, user_ssize_t *retval)
 	void *umsgp = NULL;
 	u_int uiocnt;
 	int has_addr_or_ctl = 0;
+	uio_t stream_uio;
 
 	KERNEL_DEBUG(DBG_FNC_SENDMSG_X | DBG_FUNC_START, 0, 0, 0, 0, 0);
 
@@ -1671,6 +1681,19 @@ sendmsg_x(struct proc *p, struct sendmsg_x_args *uap, user_ssize_t *retval)
 	    has_addr_or_ctl == 0 && somaxsendmsgx == 0) {
 		error = so->so_proto->pr_usrreqs->pru_sosend_list(so, uiop,
 		    uap->cnt, uap->flags);
+	} else if (so->so_type == SOCK_STREAM && has_addr_or_ctl == 0 &&
+	    sostreammsgx != 0 && uap->cnt > 1 &&
+	    (stream_uio = uio_array_gather(uiop, uap->cnt)) != NULL) {
+		user_ssize_t len = uio_resid(stream_uio);
+
+		/*
+		 * A stream has no record boundaries: send all the
+		 * messages with a single pass through sosend
+		 */
+		error = so->so_proto->pr_usrreqs->pru_sosend(so, NULL, stream_uio,
+		    NULL, NULL, uap->flags);
+		uio_array_scatter(uiop, uap->cnt, len - uio_resid(stream_uio));
+		uio_free(stream_uio);
 	} else {
 		for (i = 0; i < uap->cnt; i++) {
 			struct user_msghdr_x *mp = user_msg_x + i;
@@ -2192,6 +2215,7 @@ recvmsg_x(struct proc *p, struct recvmsg_x_args *uap, user_ssize_t *retval)
 	void *umsgp = NULL;
 	u_int i;
 	u_int uiocnt;
+	uio_t stream_uio;
 
 	KERNEL_DEBUG(DBG_FNC_RECVMSG_X | DBG_FUNC_START, 0, 0, 0, 0, 0);
 
@@ -2297,6 +2321,24 @@ recvmsg_x(struct proc *p, struct recvmsg_x_args *uap, user_ssize_t *retval)
 	    somaxrecvmsgx == 0) {
 		error = so->so_proto->pr_usrreqs->pru_soreceive_list(so,
 		    recv_msg_array, uap->cnt, &uap->flags);
+	} else if (so->so_type == SOCK_STREAM && sostreammsgx != 0 &&
+	    uap->cnt > 1 &&
+	    !(uap->flags & (MSG_WAITALL | MSG_NEEDSA | MSG_PEEK)) &&
+	    (stream_uio = recv_msg_array_gather(recv_msg_array, uap->cnt)) != NULL) {
+		user_ssize_t len = uio_resid(stream_uio);
+		int flags = uap->flags;
+
+		/*
+		 * A stream has no record boundaries: fill as many of the
+		 * buffers as there is data for with a single soreceive.
+		 * MSG_PEEK keeps the one message at a time loop, where
+		 * every message peeks at the head of the stream.
+		 */
+		error = so->so_proto->pr_usrreqs->pru_soreceive(so, NULL,
+		    stream_uio, NULL, NULL, &flags);
+		recv_msg_array_scatter(recv_msg_array, uap->cnt,
+		    len - uio_resid(stream_uio), error, flags);
+		uio_free(stream_uio);
 	} else {
 		int flags = uap->flags;
 
@@ -3157,6 +3199,71 @@ uio_array_resid(struct uio **uiop, u_int count)
 	return len;
 }
 
+/*
+ * Copies the remaining iovecs of `auio' to `iovp' and returns their count.
+ */
+static int
+uio_copy_iovs(uio_t auio, struct user_iovec *iovp)
+{
+	int i, iovcnt = uio_iovcnt(auio);
+
+	for (i = 0; i < iovcnt; i++) {
+		(void) uio_getiov(auio, i, &iovp[i].iov_base, &iovp[i].iov_len);
+	}
+	return iovcnt;
+}
+
+/*
+ * Makes a single uio out of the iovecs of an array of messages, so that
+ * a stream socket can move them all with one call into the protocol.
+ * Returns NULL if there are too many iovecs to fit in one uio.
+ */
+static uio_t
+uio_array_gather(struct uio **uiop, u_int count)
+{
+	struct user_iovec *iovp;
+	uio_t auio;
+	int iovcnt = 0;
+	u_int i;
+
+	for (i = 0; i < count; i++) {
+		iovcnt += uio_iovcnt(uiop[i]);
+	}
+	if (iovcnt <= 0 || iovcnt > UIO_MAXIOV) {
+		return NULL;
+	}
+	auio = uio_create(iovcnt, 0, uio_spacetype(uiop[0]), uio_rw(uiop[0]));
+	if (auio == NULL) {
+		return NULL;
+	}
+	iovp = uio_iovsaddr(auio);
+	for (i = 0; i < count; i++) {
+		iovp += uio_copy_iovs(uiop[i], iovp);
+	}
+	if (uio_calculateresid(auio) != 0) {
+		uio_free(auio);
+		return NULL;
+	}
+	return auio;
+}
+
+/*
+ * Accounts `len' bytes moved through a uio made by uio_array_gather
+ * to the messages it was made of, in order.
+ */
+static void
+uio_array_scatter(struct uio **uiop, u_int count, user_ssize_t len)
+{
+	u_int i;
+
+	for (i = 0; i < count && len > 0; i++) {
+		user_ssize_t n = MIN(len, uio_resid(uiop[i]));
+
+		uio_update(uiop[i], (user_size_t)n);
+		len -= n;
+	}
+}
+
 static boolean_t
 uio_array_is_valid(struct uio **uiop, u_int count)
 {
@@ -3232,6 +3339,78 @@ recv_msg_array_resid(struct recv_msg_elem *recv_msg_array, u_int count)
 	return len;
 }
 
+/*
+ * Same as uio_array_gather for the receive side; messages that want
+ * an address or ancillary data need a soreceive each, and make this
+ * return NULL.
+ */
+static uio_t
+recv_msg_array_gather(struct recv_msg_elem *recv_msg_array, u_int count)
+{
+	struct user_iovec *iovp;
+	uio_t auio;
+	int iovcnt = 0;
+	u_int i;
+
+	for (i = 0; i < count; i++) {
+		struct recv_msg_elem *recv_msg_elem = recv_msg_array + i;
+
+		if (recv_msg_elem->which & (SOCK_MSG_SA | SOCK_MSG_CONTROL)) {
+			return NULL;
+		}
+		iovcnt += uio_iovcnt(recv_msg_elem->uio);
+	}
+	if (iovcnt <= 0 || iovcnt > UIO_MAXIOV) {
+		return NULL;
+	}
+	auio = uio_create(iovcnt, 0, uio_spacetype(recv_msg_array->uio),
+	    uio_rw(recv_msg_array->uio));
+	if (auio == NULL) {
+		return NULL;
+	}
+	iovp = uio_iovsaddr(auio);
+	for (i = 0; i < count; i++) {
+		iovp += uio_copy_iovs(recv_msg_array[i].uio, iovp);
+	}
+	if (uio_calculateresid(auio) != 0) {
+		uio_free(auio);
+		return NULL;
+	}
+	return auio;
+}
+
+/*
+ * Accounts `len' bytes received through a uio made by
+ * recv_msg_array_gather to the messages, marking the ones that got
+ * data the way the one message at a time loop of recvmsg_x does.
+ * A message without buffer space followed by ones that got data is
+ * returned empty, as that loop would, so the count stays contiguous.
+ */
+static void
+recv_msg_array_scatter(struct recv_msg_elem *recv_msg_array, u_int count,
+    user_ssize_t len, int error, int flags)
+{
+	u_int i;
+
+	/* A read of zero bytes at end of stream still returns a message */
+	if (len == 0 && error == 0) {
+		recv_msg_array->which |= SOCK_MSG_DATA;
+		recv_msg_array->flags = flags & ~MSG_DONTWAIT;
+		return;
+	}
+	for (i = 0; i < count && len > 0; i++) {
+		struct recv_msg_elem *recv_msg_elem = recv_msg_array + i;
+		user_ssize_t n = MIN(len, uio_resid(recv_msg_elem->uio));
+
+		if (n != 0) {
+			uio_update(recv_msg_elem->uio, (user_size_t)n);
+		}
+		recv_msg_elem->which |= SOCK_MSG_DATA;
+		recv_msg_elem->flags = flags & ~MSG_DONTWAIT;
+		len -= n;
+	}
+}
+
 int
 recv_msg_array_is_valid(struct recv_msg_elem *recv_msg_array, u_int count)
 {
@@ -108,7 +108,7 @@ fq_destroy(fq_t *fq)
 {
 	VERIFY(fq->fq_flags & FQF_DESTROYED);
 	VERIFY(fq_empty(fq));
-	VERIFY(!(fq->fq_flags & (FQF_NEW_FLOW | FQF_OLD_FLOW)));
+	VERIFY(!(fq->fq_flags & (FQF_NEW_FLOW | FQF_OLD_FLOW | FQF_PACED)));
 	VERIFY(fq->fq_bytes == 0);
 	mcache_free(flowq_cache, fq);
 }
@@ -118,8 +118,9 @@ fq_detect_dequeue_stall(fq_if_t *fqs, fq_t *flowq, fq_if_classq_t *fq_cl,
     u_int64_t *now)
 {
 	u_int64_t maxgetqtime;
+	/* a flow held for pacing is not dequeued on purpose */
 	if (FQ_IS_DELAYHIGH(flowq) || flowq->fq_getqtime == 0 ||
-	    fq_empty(flowq) ||
+	    fq_empty(flowq) || (flowq->fq_flags & FQF_PACED) ||
 	    flowq->fq_bytes < FQ_MIN_FC_THRESHOLD_BYTES) {
 		return;
 	}
@@ -232,6 +233,7 @@ fq_addq(fq_if_t *fqs, pktsched_pkt_t *pkt, fq_if_classq_t *fq_cl)
 {
 	int droptype = DTYPE_NODROP, fc_adv = 0, ret = CLASSQEQ_SUCCESS;
 	u_int64_t now;
+	struct timespec now_ts;
 	fq_t *fq = NULL;
 	uint64_t *pkt_timestamp;
 	volatile uint32_t *pkt_flags;
@@ -261,9 +263,13 @@ fq_addq(fq_if_t *fqs, pktsched_pkt_t *pkt, fq_if_classq_t *fq_cl)
 
 	/*
 	 * Timestamps for every packet must be set prior to entering this path.
+	 * A timestamp the sender preserved may lie in the future; the flow
+	 * state is kept in the current time regardless.
 	 */
-	now = *pkt_timestamp;
-	ASSERT(now > 0);
+	ASSERT(*pkt_timestamp > 0);
+	nanouptime(&now_ts);
+	now = (now_ts.tv_sec * NSEC_PER_SEC) + now_ts.tv_nsec;
+	now = MIN(now, *pkt_timestamp);
 
 	/* find the flowq for this packet */
 	fq = fq_if_hash_pkt(fqs, pkt_flowid, pktsched_get_pkt_svc(pkt),
@@ -434,9 +440,11 @@ fq_addq(fq_if_t *fqs, pktsched_pkt_t *pkt, fq_if_classq_t *fq_cl)
 
 	/*
 	 * If the queue is not currently active, add it to the end of new
-	 * flows list for that service class.
+	 * flows list for that service class.  A flow held for pacing is
+	 * still active; it goes back on the old flows list when its head
+	 * packet is due.
 	 */
-	if ((fq->fq_flags & (FQF_NEW_FLOW | FQF_OLD_FLOW)) == 0) {
+	if ((fq->fq_flags & (FQF_NEW_FLOW | FQF_OLD_FLOW | FQF_PACED)) == 0) {
 		VERIFY(STAILQ_NEXT(fq, fq_actlink) == NULL);
 		STAILQ_INSERT_TAIL(&fq_cl->fcl_new_flows, fq, fq_actlink);
 		fq->fq_flags |= FQF_NEW_FLOW;
@@ -484,7 +492,7 @@ void
 fq_getq_flow(fq_if_t *fqs, fq_t *fq, pktsched_pkt_t *pkt)
 {
 	fq_if_classq_t *fq_cl;
-	u_int64_t now;
+	u_int64_t now, tx_time;
 	int64_t qdelay = 0;
 	struct timespec now_ts;
 	volatile uint32_t *pkt_flags;
@@ -502,9 +510,13 @@ fq_getq_flow(fq_if_t *fqs, fq_t *fq, pktsched_pkt_t *pkt)
 	nanouptime(&now_ts);
 	now = (now_ts.tv_sec * NSEC_PER_SEC) + now_ts.tv_nsec;
 
-	/* this will compute qdelay in nanoseconds */
-	if (now > *pkt_timestamp) {
-		qdelay = now - *pkt_timestamp;
+	/*
+	 * this will compute qdelay in nanoseconds, from the time a paced
+	 * packet was allowed to leave
+	 */
+	tx_time = fq_if_pkt_tx_time(pkt->pktsched_pkt_mbuf);
+	if (now > tx_time) {
+		qdelay = now - tx_time;
 	}
 	fq_cl = &fqs->fqs_classq[fq->fq_sc_index];
 
@@ -548,6 +560,7 @@ fq_getq_flow(fq_if_t *fqs, fq_t *fq, pktsched_pkt_t *pkt)
 	switch (pkt->pktsched_ptype) {
 	case QP_MBUF:
 		*pkt_flags &= ~PKTF_PRIV_GUARDED;
+		pkt->pktsched_pkt_mbuf->m_pkthdr.pkt_pacing_delay = 0;
 		break;
 	default:
 		VERIFY(0);
@@ -57,6 +57,7 @@ typedef struct flowq {
 #define FQF_NEW_FLOW    0x04    /* Currently on new flows queue */
 #define FQF_OLD_FLOW    0x08    /* Currently on old flows queue */
 #define FQF_FLOWCTL_ON  0x10    /* Currently flow controlled */
+#define FQF_PACED       0x20    /* Held on the pacing time queue */
 #define FQF_DESTROYED   0x80    /* flowq destroyed */
 	uint8_t        fq_flags;       /* flags */
 	uint8_t        fq_sc_index; /* service_class index */
@@ -67,6 +68,7 @@ typedef struct flowq {
 	uint64_t       fq_getqtime;    /* last dequeue time */
 	SLIST_ENTRY(flowq) fq_hashlink; /* for flow queue hash table */
 	STAILQ_ENTRY(flowq) fq_actlink; /* for new/old flow queues */
+	uint64_t       fq_pacing_tick; /* pacing wheel tick while FQF_PACED */
 	uint32_t       fq_flowhash;    /* Flow hash */
 	classq_pkt_type_t       fq_ptype; /* Packet type */
 	/* temporary packet queue for dequeued packets */
@@ -743,6 +743,11 @@ SYSCTL_UINT(_net_link_generic_system, OID_AUTO, hwcksum_rx,
     CTLFLAG_RW | CTLFLAG_LOCKED, &hwcksum_rx, 0,
     "enable receive hardware checksum offload");
 
+uint32_t sw_gso = 1;
+SYSCTL_UINT(_net_link_generic_system, OID_AUTO, sw_gso,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &sw_gso, 0,
+    "segment TCP in software for interfaces without TSO");
+
 SYSCTL_PROC(_net_link_generic_system, OID_AUTO, tx_chain_len_stats,
     CTLFLAG_RD | CTLFLAG_LOCKED, 0, 9,
     sysctl_tx_chain_len_stats, "S", "");
@@ -4492,6 +4497,12 @@ dlil_ifproto_input(struct if_proto * ifproto, mbuf_t m)
 {
 	int error;
 
+	/* merge TCP segments of the same flow before they go up */
+	if (ifproto->protocol_family == PF_INET ||
+	    ifproto->protocol_family == PF_INET6) {
+		m = tcp_gro_input(ifproto->ifp, ifproto->protocol_family, m);
+	}
+
 	if (ifproto->proto_kpi == kProtoKPI_v1) {
 		/* Version 1 protocols get one packet at a time */
 		while (m != NULL) {
@@ -5322,6 +5333,23 @@ preout_again:
 	}
 
 	do {
+		/*
+		 * Cut the TCP super-segments IP marked for it into
+		 * MSS-sized packets; the segments follow this one.
+		 */
+		if (raw == 0 && GSO_MARKED(m)) {
+			mbuf_t seg_tail;
+
+			m = tcp_gso_segment(proto_family, m, &seg_tail);
+			if (m == NULL) {
+				retval = ENOBUFS;
+				goto next;
+			}
+			seg_tail->m_nextpkt = packetlist;
+			packetlist = m->m_nextpkt;
+			m->m_nextpkt = NULL;
+		}
+
 		/*
 		 * pkt_hdr is set here to point to m_data prior to
 		 * calling into the framer. This value of pkt_hdr is
@@ -7752,6 +7780,9 @@ ifnet_detach(ifnet_t ifp)
 		bzero(ifp->if_udp_stat, sizeof(*ifp->if_udp_stat));
 	}
 
+	/* Reset TCP receive coalescing statistics */
+	bzero(&ifp->if_gro_stats, sizeof(ifp->if_gro_stats));
+
 	/* Reset ifnet IPv4 stats */
 	if (ifp->if_ipv4_stat != NULL) {
 		bzero(ifp->if_ipv4_stat, sizeof(*ifp->if_ipv4_stat));
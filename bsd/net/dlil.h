@@ -224,6 +224,7 @@ extern int dlil_verbose;
 extern uint32_t hwcksum_dbg;
 extern uint32_t hwcksum_tx;
 extern uint32_t hwcksum_rx;
+extern uint32_t sw_gso;
 extern struct dlil_threading_info *dlil_main_input_thread;
 extern unsigned int net_rxpoll;
 extern uint32_t if_rxpoll;
@@ -231,6 +232,38 @@ extern uint32_t if_rxpoll_decay;
 extern uint32_t if_rxpoll_interval_pkts;
 extern uint32_t if_rcvq_maxlen;
 
+/*
+ * TCP super-segments may be sent on an interface without hardware TSO;
+ * dlil_output then segments them in software (see tcp_gso_segment.)
+ */
+#define IFNET_GSO_CAPABLE(_ifp)                                         \
+	(sw_gso != 0 && !((_ifp)->if_flags & IFF_LOOPBACK) &&           \
+	!IS_INTF_CLAT46(_ifp))
+
+#define GSO_IPV4_OK(_ifp, _m)                                           \
+	(((_m)->m_pkthdr.csum_flags & CSUM_TSO_IPV4) &&                 \
+	!((_ifp)->if_hwassist & IFNET_TSO_IPV4) && IFNET_GSO_CAPABLE(_ifp))
+
+#define GSO_IPV6_OK(_ifp, _m)                                           \
+	(((_m)->m_pkthdr.csum_flags & CSUM_TSO_IPV6) &&                 \
+	!((_ifp)->if_hwassist & IFNET_TSO_IPV6) && IFNET_GSO_CAPABLE(_ifp))
+
+/*
+ * The decision is taken once, when IP picks the outgoing interface and
+ * leaves the checksums alone, and recorded with PKTF_SW_GSO: dlil_output
+ * segments every packet so marked, whatever the interface looks like by
+ * then, and the segments get their checksums computed in software.
+ */
+#define GSO_MARK(_m, _gso) do {                                         \
+	if (_gso)                                                       \
+	        (_m)->m_pkthdr.pkt_flags |= PKTF_SW_GSO;                \
+	else                                                            \
+	        (_m)->m_pkthdr.pkt_flags &= ~PKTF_SW_GSO;               \
+} while (0)
+
+#define GSO_MARKED(_m)                                                  \
+	((_m)->m_pkthdr.pkt_flags & PKTF_SW_GSO)
+
 extern void dlil_init(void);
 
 extern errno_t ifp_if_ioctl(struct ifnet *, unsigned long, void *);
@@ -5384,6 +5384,28 @@ if_copy_netif_stats(struct ifnet *ifp, struct if_netif_stats *if_ns)
 #pragma unused(ifp)
 }
 
+void
+if_copy_gro_stats(struct ifnet *ifp, struct if_gro_stats *if_gs)
+{
+#define COPY_IF_GRO_FIELD64_ATOMIC(fld) do {                            \
+	atomic_get_64(if_gs->fld,                                       \
+	    (u_int64_t *)(void *)(uintptr_t)&ifp->if_gro_stats.fld);    \
+} while (0)
+
+	bzero(if_gs, sizeof(*if_gs));
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_segs_in);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_segs_merged);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_pkts_out);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_flush_psh);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_flush_ooo);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_flush_ts);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_flush_flags);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_flush_full);
+	COPY_IF_GRO_FIELD64_ATOMIC(ifi_gro_flush_evict);
+
+#undef COPY_IF_GRO_FIELD64_ATOMIC
+}
+
 struct ifaddr *
 ifa_remref(struct ifaddr *ifa, int locked)
 {
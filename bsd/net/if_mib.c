@@ -193,6 +193,7 @@ make_ifmibdata(struct ifnet *ifp, int *name, struct sysctl_req *req)
 		if_copy_packet_stats(ifp, &ifmd_supp->ifmd_packet_stats);
 		if_copy_rxpoll_stats(ifp, &ifmd_supp->ifmd_rxpoll_stats);
 		if_copy_netif_stats(ifp, &ifmd_supp->ifmd_netif_stats);
+		if_copy_gro_stats(ifp, &ifmd_supp->ifmd_gro_stats);
 
 		if (req->oldptr == USER_ADDR_NULL) {
 			req->oldlen = sizeof(*ifmd_supp);
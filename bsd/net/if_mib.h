@@ -78,6 +78,7 @@ struct ifmibdata_supplemental {
 	struct if_packet_stats  ifmd_packet_stats;
 	struct if_rxpoll_stats  ifmd_rxpoll_stats;
 	struct if_netif_stats   ifmd_netif_stats;
+	struct if_gro_stats     ifmd_gro_stats;
 };
 #endif /* PRIVATE */
 
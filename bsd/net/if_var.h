@@ -366,6 +366,18 @@ struct if_rxpoll_stats {
 	u_int64_t       ifi_poll_interval_time; /* poll interval (nsec) */
 };
 
+struct if_gro_stats {
+	u_int64_t       ifi_gro_segs_in;        /* TCP segments looked at */
+	u_int64_t       ifi_gro_segs_merged;    /* segments merged into others */
+	u_int64_t       ifi_gro_pkts_out;       /* coalesced packets passed up */
+	u_int64_t       ifi_gro_flush_psh;      /* flushed on PSH */
+	u_int64_t       ifi_gro_flush_ooo;      /* flushed on out-of-order seq */
+	u_int64_t       ifi_gro_flush_ts;       /* flushed on option change */
+	u_int64_t       ifi_gro_flush_flags;    /* flushed on non-mergeable seg */
+	u_int64_t       ifi_gro_flush_full;     /* flushed on size limit */
+	u_int64_t       ifi_gro_flush_evict;    /* evicted from the flow table */
+};
+
 struct if_netif_stats {
 	u_int64_t       ifn_rx_mit_interval;    /* rx mitigation ival (nsec) */
 	u_int32_t       ifn_rx_mit_mode;        /* 0: static, 1: dynamic */
@@ -1159,6 +1171,7 @@ struct ifnet {
 
 	struct tcpstat_local    *if_tcp_stat;   /* TCP specific stats */
 	struct udpstat_local    *if_udp_stat;   /* UDP specific stats */
+	struct if_gro_stats     if_gro_stats __attribute__((aligned(8)));
 
 	struct {
 		int32_t         level;          /* cached logging level */
@@ -1951,6 +1964,8 @@ __private_extern__ void if_copy_rxpoll_stats(struct ifnet *ifp,
     struct if_rxpoll_stats *if_rs);
 __private_extern__ void if_copy_netif_stats(struct ifnet *ifp,
     struct if_netif_stats *if_ns);
+__private_extern__ void if_copy_gro_stats(struct ifnet *ifp,
+    struct if_gro_stats *if_gs);
 
 __private_extern__ struct rtentry *ifnet_cached_rtlookup_inet(struct ifnet *,
     struct in_addr);
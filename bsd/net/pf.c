@@ -9053,6 +9053,7 @@ pf_route(pbuf_t **pbufp, struct pf_rule *r, int dir, struct ifnet *oifp,
 	}
 
 	if (ntohs(ip->ip_len) <= interface_mtu || TSO_IPV4_OK(ifp, m0) ||
+	    GSO_MARKED(m0) ||
 	    (!(ip->ip_off & htons(IP_DF)) &&
 	    (ifp->if_hwassist & CSUM_FRAGMENT))) {
 		ip->ip_sum = 0;
@@ -9256,7 +9257,10 @@ pf_route6(pbuf_t **pbufp, struct pf_rule *r, int dir, struct ifnet *oifp,
 	if (IN6_IS_SCOPE_EMBED(&dst->sin6_addr)) {
 		dst->sin6_addr.s6_addr16[1] = htons(ifp->if_index);
 	}
-	if ((unsigned)m0->m_pkthdr.len <= ifp->if_mtu) {
+	/* Catch routing changes wrt. software segmentation of TCP. */
+	GSO_MARK(m0, GSO_IPV6_OK(ifp, m0));
+	if ((unsigned)m0->m_pkthdr.len <= ifp->if_mtu ||
+	    TSO_IPV6_OK(ifp, m0) || GSO_MARKED(m0)) {
 		error = nd6_output(ifp, ifp, m0, dst, NULL, NULL);
 	} else {
 		in6_ifstat_inc(ifp, ifs6_in_toobig);
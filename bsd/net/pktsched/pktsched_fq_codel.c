@@ -28,6 +28,8 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/sysctl.h>
+#include <sys/kernel.h>
 #include <kern/zalloc.h>
 #include <net/ethernet.h>
 #include <net/if_var.h>
@@ -63,6 +65,19 @@
 
 static ZONE_DECLARE(fq_if_zone, "pktsched_fq_if", sizeof(fq_if_t), ZC_ZFREE_CLEARMEM);
 
+SYSCTL_NODE(_net_classq, OID_AUTO, fq_codel, CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, "FQ-CoDel");
+
+static uint32_t fq_codel_pacing = 1;
+SYSCTL_UINT(_net_classq_fq_codel, OID_AUTO, pacing,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &fq_codel_pacing, 0,
+    "Hold flows until the departure time of their head packet");
+
+static uint64_t fq_codel_pacing_horizon = NSEC_PER_SEC;
+SYSCTL_QUAD(_net_classq_fq_codel, OID_AUTO, pacing_horizon,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &fq_codel_pacing_horizon,
+    "Departure times further away than this (ns) are not honored");
+
 typedef STAILQ_HEAD(, flowq) flowq_dqlist_t;
 
 static fq_if_t *fq_if_alloc(struct ifnet *, classq_pkt_type_t);
@@ -71,7 +86,7 @@ static void fq_if_classq_init(fq_if_t *fqs, uint32_t priority,
     uint16_t quantum, uint32_t drr_max, uint32_t svc_class);
 static void fq_if_dequeue(fq_if_t *, fq_if_classq_t *, uint32_t,
     int64_t, classq_pkt_t *, classq_pkt_t *, uint32_t *,
-    uint32_t *, flowq_dqlist_t *, boolean_t drvmgmt);
+    uint32_t *, flowq_dqlist_t *, boolean_t drvmgmt, uint64_t now);
 void fq_if_stat_sc(fq_if_t *fqs, cqrq_stat_sc_t *stat);
 static void fq_if_purge(fq_if_t *);
 static void fq_if_purge_classq(fq_if_t *, fq_if_classq_t *);
@@ -91,7 +106,7 @@ static void fq_if_empty_old_flow(fq_if_t *fqs, fq_if_classq_t *fq_cl,
 typedef void (* fq_if_append_pkt_t)(classq_pkt_t *, classq_pkt_t *);
 typedef boolean_t (* fq_getq_flow_t)(fq_if_t *, fq_if_classq_t *, fq_t *,
     int64_t, u_int32_t, classq_pkt_t *, classq_pkt_t *, u_int32_t *,
-    u_int32_t *, boolean_t *, u_int32_t);
+    u_int32_t *, boolean_t *, u_int32_t, uint64_t);
 
 static void
 fq_if_append_mbuf(classq_pkt_t *pkt, classq_pkt_t *next_pkt)
@@ -99,13 +114,219 @@ fq_if_append_mbuf(classq_pkt_t *pkt, classq_pkt_t *next_pkt)
 	pkt->cp_mbuf->m_nextpkt = next_pkt->cp_mbuf;
 }
 
+/*
+ * Pacing
+ *
+ * A sender that paces its traffic (see tcp_pacing_stamp) gives each
+ * packet a departure time, as a delay in pkt_pacing_delay from the
+ * enqueue time in pkt_timestamp.  When the packet at the head of a
+ * flow is not due yet, the flow is taken off the new/old flows lists
+ * of its class and waits on the pacing wheel; a thread call releases
+ * it onto the old flows list once the wheel reaches its tick, and
+ * restarts the interface.  CoDel measures the sojourn time from the
+ * departure time, so the time spent waiting for it does not count as
+ * queueing delay.
+ */
+static inline uint64_t
+fq_if_pacing_now(void)
+{
+	struct timespec now_ts;
+
+	nanouptime(&now_ts);
+	return (now_ts.tv_sec * NSEC_PER_SEC) + now_ts.tv_nsec;
+}
+
+/*
+ * Returns the time the packet may leave: its enqueue time, plus the
+ * pacing delay if pacing is enabled and the delay is within the horizon.
+ */
+uint64_t
+fq_if_pkt_tx_time(struct mbuf *m)
+{
+	uint64_t delay = m->m_pkthdr.pkt_pacing_delay;
+
+	if (fq_codel_pacing == 0 || delay > fq_codel_pacing_horizon) {
+		delay = 0;
+	}
+	return m->m_pkthdr.pkt_timestamp + delay;
+}
+
+/*
+ * Returns TRUE if the packet at the head of the flow may not leave
+ * before a later tick of the pacing wheel.
+ */
+static inline boolean_t
+fq_if_flow_held(fq_t *fq, uint64_t now)
+{
+	if (fq_codel_pacing == 0 || fq_empty(fq)) {
+		return FALSE;
+	}
+	return FQ_IF_PACING_TICK(fq_if_pkt_tx_time(
+		   MBUFQ_FIRST(&fq->fq_mbufq))) > FQ_IF_PACING_TICK(now);
+}
+
+static void
+fq_if_pacing_arm(fq_if_t *fqs, uint64_t tick, uint64_t now)
+{
+	uint64_t when, deadline;
+
+	if (fqs->fqs_pacing_armed != 0 && fqs->fqs_pacing_armed <= tick) {
+		return;
+	}
+	fqs->fqs_pacing_armed = tick;
+
+	when = tick << FQ_IF_PACING_SLOT_SHIFT;
+	clock_interval_to_deadline((when > now) ? (uint32_t)(when - now) : 0,
+	    1, &deadline);
+	(void) thread_call_enter_delayed(fqs->fqs_pacing_tcall, deadline);
+}
+
+static void
+fq_if_pacing_insert(fq_if_t *fqs, fq_if_classq_t *fq_cl, fq_t *fq,
+    uint64_t now)
+{
+	struct mbuf *m = MBUFQ_FIRST(&fq->fq_mbufq);
+	uint64_t tick;
+
+	if (fqs->fqs_pacing_cnt == 0) {
+		fqs->fqs_pacing_tick = FQ_IF_PACING_TICK(now);
+	}
+	tick = FQ_IF_PACING_TICK(fq_if_pkt_tx_time(m));
+	tick = MAX(tick, fqs->fqs_pacing_tick);
+	tick = MIN(tick, fqs->fqs_pacing_tick + FQ_IF_PACING_SLOTS - 1);
+
+	STAILQ_INSERT_TAIL(&fqs->fqs_pacing_wheel[tick % FQ_IF_PACING_SLOTS],
+	    fq, fq_actlink);
+	fq->fq_pacing_tick = tick;
+	fq->fq_flags |= FQF_PACED;
+	fqs->fqs_pacing_cnt++;
+	fq_cl->fcl_stat.fcl_pacedflows_cnt++;
+
+	fq_if_pacing_arm(fqs, tick, now);
+}
+
+static void
+fq_if_pacing_remove(fq_if_t *fqs, fq_if_classq_t *fq_cl, fq_t *fq)
+{
+	STAILQ_REMOVE(&fqs->fqs_pacing_wheel[fq->fq_pacing_tick %
+	    FQ_IF_PACING_SLOTS], fq, flowq, fq_actlink);
+	fq->fq_flags &= ~FQF_PACED;
+	fqs->fqs_pacing_cnt--;
+	fq_cl->fcl_stat.fcl_pacedflows_cnt--;
+}
+
+/*
+ * Takes a flow whose head packet is not due yet off the new or old
+ * flows list and puts it on the pacing wheel.
+ */
+static void
+fq_if_pacing_hold(fq_if_t *fqs, fq_if_classq_t *fq_cl, fq_t *fq,
+    uint64_t now)
+{
+	if (fq->fq_flags & FQF_NEW_FLOW) {
+		fq_if_empty_new_flow(fq, fq_cl, false);
+	} else {
+		VERIFY(fq->fq_flags & FQF_OLD_FLOW);
+		STAILQ_REMOVE(&fq_cl->fcl_old_flows, fq, flowq, fq_actlink);
+		fq->fq_flags &= ~FQF_OLD_FLOW;
+		fq_cl->fcl_stat.fcl_oldflows_cnt--;
+	}
+	fq_cl->fcl_stat.fcl_paced++;
+	fq_if_pacing_insert(fqs, fq_cl, fq, now);
+}
+
+/*
+ * Moves the flows on the pacing wheel that are due by `now' back onto
+ * the old flows list of their class, and sets the timer for the ones
+ * left.  Returns the number of flows released.
+ */
+static uint32_t
+fq_if_pacing_release(fq_if_t *fqs, uint64_t now)
+{
+	uint64_t now_tick = FQ_IF_PACING_TICK(now);
+	flowq_stailq_t due;
+	fq_if_classq_t *fq_cl;
+	uint32_t released = 0;
+	uint64_t tick;
+	fq_t *fq;
+	int i;
+
+	STAILQ_INIT(&due);
+	for (i = 0; i < FQ_IF_PACING_SLOTS &&
+	    fqs->fqs_pacing_tick <= now_tick; i++) {
+		tick = fqs->fqs_pacing_tick++;
+		STAILQ_CONCAT(&due,
+		    &fqs->fqs_pacing_wheel[tick % FQ_IF_PACING_SLOTS]);
+	}
+	if (fqs->fqs_pacing_tick <= now_tick) {
+		/* went all the way around the wheel */
+		fqs->fqs_pacing_tick = now_tick + 1;
+	}
+
+	while ((fq = STAILQ_FIRST(&due)) != NULL) {
+		STAILQ_REMOVE_HEAD(&due, fq_actlink);
+		fq->fq_flags &= ~FQF_PACED;
+		fqs->fqs_pacing_cnt--;
+		fq_cl = &fqs->fqs_classq[fq->fq_sc_index];
+		fq_cl->fcl_stat.fcl_pacedflows_cnt--;
+
+		/* the departure time was past the end of the wheel */
+		if (fq_if_flow_held(fq, now)) {
+			fq_if_pacing_insert(fqs, fq_cl, fq, now);
+			continue;
+		}
+
+		STAILQ_INSERT_TAIL(&fq_cl->fcl_old_flows, fq, fq_actlink);
+		fq->fq_flags |= FQF_OLD_FLOW;
+		fq_cl->fcl_stat.fcl_oldflows_cnt++;
+		if (!(fqs->fqs_flags & FQS_DRIVER_MANAGED) &&
+		    ((fqs->fqs_bitmaps[FQ_IF_ER] | fqs->fqs_bitmaps[FQ_IF_EB]) &
+		    (1 << fq_cl->fcl_pri)) == 0) {
+			pktsched_bit_set(fq_cl->fcl_pri,
+			    &fqs->fqs_bitmaps[FQ_IF_IB]);
+		}
+		released++;
+	}
+
+	if (fqs->fqs_pacing_cnt > 0) {
+		for (tick = fqs->fqs_pacing_tick;
+		    STAILQ_EMPTY(&fqs->fqs_pacing_wheel[tick %
+		    FQ_IF_PACING_SLOTS]); tick++) {
+			;
+		}
+		fq_if_pacing_arm(fqs, tick, now);
+	}
+	return released;
+}
+
+static void
+fq_if_pacing_tcall_fn(thread_call_param_t arg0, thread_call_param_t arg1)
+{
+#pragma unused(arg1)
+	struct ifnet *ifp = arg0;
+	struct ifclassq *ifq = &ifp->if_snd;
+	uint32_t released = 0;
+	fq_if_t *fqs;
 
+	IFCQ_LOCK(ifq);
+	/* the scheduler may have been torn down since the call was set */
+	if (ifq->ifcq_type == PKTSCHEDT_FQ_CODEL &&
+	    (fqs = (fq_if_t *)ifq->ifcq_disc) != NULL) {
+		fqs->fqs_pacing_armed = 0;
+		released = fq_if_pacing_release(fqs, fq_if_pacing_now());
+	}
+	IFCQ_UNLOCK(ifq);
+
+	if (released > 0) {
+		ifnet_start(ifp);
+	}
+}
 
 static boolean_t
 fq_getq_flow_mbuf(fq_if_t *fqs, fq_if_classq_t *fq_cl, fq_t *fq,
     int64_t byte_limit, u_int32_t pkt_limit, classq_pkt_t *head,
     classq_pkt_t *tail, u_int32_t *byte_cnt, u_int32_t *pkt_cnt,
-    boolean_t *qempty, u_int32_t pflags)
+    boolean_t *qempty, u_int32_t pflags, uint64_t now)
 {
 	u_int32_t plen;
 	pktsched_pkt_t pkt;
@@ -114,7 +335,7 @@ fq_getq_flow_mbuf(fq_if_t *fqs, fq_if_classq_t *fq_cl, fq_t *fq,
 	struct ifnet *ifp = ifq->ifcq_ifp;
 
 	while (fq->fq_deficit > 0 && limit_reached == FALSE &&
-	    !MBUFQ_EMPTY(&fq->fq_mbufq)) {
+	    !MBUFQ_EMPTY(&fq->fq_mbufq) && !fq_if_flow_held(fq, now)) {
 		_PKTSCHED_PKT_INIT(&pkt);
 		fq_getq_flow(fqs, fq, &pkt);
 		ASSERT(pkt.pktsched_ptype == QP_MBUF);
@@ -153,11 +374,18 @@ fq_if_t *
 fq_if_alloc(struct ifnet *ifp, classq_pkt_type_t ptype)
 {
 	fq_if_t *fqs;
+	int i;
 
 	fqs = zalloc_flags(fq_if_zone, Z_WAITOK | Z_ZERO);
 	fqs->fqs_ifq = &ifp->if_snd;
 	fqs->fqs_ptype = ptype;
 
+	for (i = 0; i < FQ_IF_PACING_SLOTS; i++) {
+		STAILQ_INIT(&fqs->fqs_pacing_wheel[i]);
+	}
+	fqs->fqs_pacing_tcall = thread_call_allocate_with_priority(
+		fq_if_pacing_tcall_fn, ifp, THREAD_CALL_PRIORITY_KERNEL);
+
 	/* Calculate target queue delay */
 	ifclassq_calc_target_qdelay(ifp, &fqs->fqs_target_qdelay);
 
@@ -174,6 +402,12 @@ void
 fq_if_destroy(fq_if_t *fqs)
 {
 	fq_if_purge(fqs);
+	/*
+	 * A call that is already running finds the scheduler gone once
+	 * it gets the lock, and the call itself is freed after it returns.
+	 */
+	(void) thread_call_cancel(fqs->fqs_pacing_tcall);
+	(void) thread_call_free(fqs->fqs_pacing_tcall);
 	fqs->fqs_ifq = NULL;
 	zfree(fq_if_zone, fqs);
 }
@@ -372,12 +606,17 @@ fq_if_dequeue_sc_classq(struct ifclassq *ifq, mbuf_svc_class_t svc,
 	uint32_t total_pktcnt = 0, total_bytecnt = 0;
 	fq_if_classq_t *fq_cl;
 	uint8_t pri;
+	uint64_t now;
 
 	pri = fq_if_service_to_priority(fqs, svc);
 	fq_cl = &fqs->fqs_classq[pri];
 
+	now = fq_if_pacing_now();
+	if (fqs->fqs_pacing_cnt > 0) {
+		(void) fq_if_pacing_release(fqs, now);
+	}
 	fq_if_dequeue(fqs, fq_cl, 1, CLASSQ_DEQUEUE_MAX_BYTE_LIMIT,
-	    pkt, NULL, &total_pktcnt, &total_bytecnt, NULL, TRUE);
+	    pkt, NULL, &total_pktcnt, &total_bytecnt, NULL, TRUE, now);
 
 	IFCQ_XMIT_ADD(ifq, total_pktcnt, total_bytecnt);
 }
@@ -453,6 +692,7 @@ fq_if_dequeue_classq_multi(struct ifclassq *ifq, u_int32_t maxpktcnt,
 	flowq_dqlist_t fq_dqlist_head;
 	fq_if_classq_t *fq_cl;
 	fq_if_t *fqs;
+	uint64_t now;
 	int pri;
 
 	IFCQ_LOCK_ASSERT_HELD(ifq);
@@ -460,6 +700,11 @@ fq_if_dequeue_classq_multi(struct ifclassq *ifq, u_int32_t maxpktcnt,
 	fqs = (fq_if_t *)ifq->ifcq_disc;
 	STAILQ_INIT(&fq_dqlist_head);
 
+	now = fq_if_pacing_now();
+	if (fqs->fqs_pacing_cnt > 0) {
+		(void) fq_if_pacing_release(fqs, now);
+	}
+
 	switch (fqs->fqs_ptype) {
 	case QP_MBUF:
 		append_pkt = fq_if_append_mbuf;
@@ -513,7 +758,7 @@ fq_if_dequeue_classq_multi(struct ifclassq *ifq, u_int32_t maxpktcnt,
 		}
 		fq_if_dequeue(fqs, fq_cl, (maxpktcnt - total_pktcnt),
 		    (maxbytecnt - total_bytecnt), &head, &tail, &pktcnt,
-		    &bytecnt, &fq_dqlist_head, FALSE);
+		    &bytecnt, &fq_dqlist_head, FALSE, now);
 		if (head.cp_mbuf != NULL) {
 			ASSERT(STAILQ_EMPTY(&fq_dqlist_head));
 			if (first.cp_mbuf == NULL) {
@@ -585,6 +830,7 @@ fq_if_dequeue_sc_classq_multi(struct ifclassq *ifq, mbuf_svc_class_t svc,
 	classq_pkt_t last = CLASSQ_PKT_INITIALIZER(last);
 	fq_if_append_pkt_t append_pkt;
 	flowq_dqlist_t fq_dqlist_head;
+	uint64_t now;
 
 	switch (fqs->fqs_ptype) {
 	case QP_MBUF:
@@ -601,20 +847,26 @@ fq_if_dequeue_sc_classq_multi(struct ifclassq *ifq, mbuf_svc_class_t svc,
 	STAILQ_INIT(&fq_dqlist_head);
 	pri = fq_if_service_to_priority(fqs, svc);
 	fq_cl = &fqs->fqs_classq[pri];
+
+	now = fq_if_pacing_now();
+	if (fqs->fqs_pacing_cnt > 0) {
+		(void) fq_if_pacing_release(fqs, now);
+	}
 	/*
 	 * Now we have the queue for a particular service class. We need
 	 * to dequeue as many packets as needed, first from the new flows
-	 * and then from the old flows.
+	 * and then from the old flows.  Packets of flows held for pacing
+	 * are counted but cannot be dequeued yet.
 	 */
 	while (total_pktcnt < maxpktcnt && total_bytecnt < maxbytecnt &&
-	    fq_cl->fcl_stat.fcl_pkt_cnt > 0) {
+	    fq_cl->fcl_stat.fcl_pkt_cnt > 0 && !FQ_IF_CLASSQ_IDLE(fq_cl)) {
 		classq_pkt_t head = CLASSQ_PKT_INITIALIZER(head);
 		classq_pkt_t tail = CLASSQ_PKT_INITIALIZER(tail);
 		u_int32_t pktcnt = 0, bytecnt = 0;
 
 		fq_if_dequeue(fqs, fq_cl, (maxpktcnt - total_pktcnt),
 		    (maxbytecnt - total_bytecnt), &head, &tail, &pktcnt,
-		    &bytecnt, &fq_dqlist_head, TRUE);
+		    &bytecnt, &fq_dqlist_head, TRUE, now);
 		if (head.cp_mbuf != NULL) {
 			if (first.cp_mbuf == NULL) {
 				first = head;
@@ -675,6 +927,8 @@ fq_if_purge_flow(fq_if_t *fqs, fq_t *fq, u_int32_t *pktsp,
 		fq_if_empty_new_flow(fq, fq_cl, false);
 	} else if (fq->fq_flags & FQF_OLD_FLOW) {
 		fq_if_empty_old_flow(fqs, fq_cl, fq, false, true);
+	} else if (fq->fq_flags & FQF_PACED) {
+		fq_if_pacing_remove(fqs, fq_cl, fq);
 	}
 
 	fq_if_destroy_flow(fqs, fq_cl, fq, true);
@@ -698,9 +952,10 @@ static void
 fq_if_purge_classq(fq_if_t *fqs, fq_if_classq_t *fq_cl)
 {
 	fq_t *fq, *tfq;
+	int i;
 	/*
-	 * Take each flow from new/old flow list and flush mbufs
-	 * in that flow
+	 * Take each flow from new/old flow list and the pacing wheel
+	 * and flush mbufs in that flow
 	 */
 	STAILQ_FOREACH_SAFE(fq, &fq_cl->fcl_new_flows, fq_actlink, tfq) {
 		fq_if_purge_flow(fqs, fq, NULL, NULL);
@@ -708,8 +963,18 @@ fq_if_purge_classq(fq_if_t *fqs, fq_if_classq_t *fq_cl)
 	STAILQ_FOREACH_SAFE(fq, &fq_cl->fcl_old_flows, fq_actlink, tfq) {
 		fq_if_purge_flow(fqs, fq, NULL, NULL);
 	}
+	for (i = 0; i < FQ_IF_PACING_SLOTS &&
+	    fq_cl->fcl_stat.fcl_pacedflows_cnt > 0; i++) {
+		STAILQ_FOREACH_SAFE(fq, &fqs->fqs_pacing_wheel[i], fq_actlink,
+		    tfq) {
+			if (fq->fq_sc_index == fq_cl->fcl_pri) {
+				fq_if_purge_flow(fqs, fq, NULL, NULL);
+			}
+		}
+	}
 	VERIFY(STAILQ_EMPTY(&fq_cl->fcl_new_flows));
 	VERIFY(STAILQ_EMPTY(&fq_cl->fcl_old_flows));
+	VERIFY(fq_cl->fcl_stat.fcl_pacedflows_cnt == 0);
 
 	STAILQ_INIT(&fq_cl->fcl_new_flows);
 	STAILQ_INIT(&fq_cl->fcl_old_flows);
@@ -727,6 +992,7 @@ fq_if_purge(fq_if_t *fqs)
 	}
 
 	VERIFY(STAILQ_EMPTY(&fqs->fqs_fclist));
+	VERIFY(fqs->fqs_pacing_cnt == 0);
 
 	fqs->fqs_large_flow = NULL;
 	for (i = 0; i < FQ_IF_HASH_TABLE_SIZE; i++) {
@@ -1153,6 +1419,9 @@ fq_if_drop_packet(fq_if_t *fqs)
 		fqs->fqs_large_flow = NULL;
 		if (fq->fq_flags & FQF_OLD_FLOW) {
 			fq_if_empty_old_flow(fqs, fq_cl, fq, true, true);
+		} else if (fq->fq_flags & FQF_PACED) {
+			fq_if_pacing_remove(fqs, fq_cl, fq);
+			fq_if_destroy_flow(fqs, fq_cl, fq, true);
 		} else {
 			VERIFY(fq->fq_flags & FQF_NEW_FLOW);
 			fq_if_empty_new_flow(fq, fq_cl, true);
@@ -1254,7 +1523,7 @@ void
 fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
     int64_t bytelimit, classq_pkt_t *top, classq_pkt_t *bottom,
     uint32_t *retpktcnt, uint32_t *retbytecnt, flowq_dqlist_t *fq_dqlist,
-    boolean_t drvmgmt)
+    boolean_t drvmgmt, uint64_t now)
 {
 	fq_t *fq = NULL, *tfq = NULL;
 	flowq_stailq_t temp_stailq;
@@ -1306,9 +1575,11 @@ fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
 
 		limit_reached = fq_getq_flow_fn(fqs, fq_cl, fq, bytelimit,
 		    pktlimit, head, tail, &bytecnt, &pktcnt, &qempty,
-		    PKTF_NEW_FLOW);
+		    PKTF_NEW_FLOW, now);
 
-		if (fq->fq_deficit <= 0 || qempty) {
+		if (fq_if_flow_held(fq, now)) {
+			fq_if_pacing_hold(fqs, fq_cl, fq, now);
+		} else if (fq->fq_deficit <= 0 || qempty) {
 			fq_if_empty_new_flow(fq, fq_cl, true);
 		}
 		fq->fq_deficit += fq_cl->fcl_quantum;
@@ -1336,10 +1607,15 @@ fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
 		}
 
 		limit_reached = fq_getq_flow_fn(fqs, fq_cl, fq, bytelimit,
-		    pktlimit, head, tail, &bytecnt, &pktcnt, &qempty, 0);
+		    pktlimit, head, tail, &bytecnt, &pktcnt, &qempty, 0, now);
 
 		if (qempty) {
 			fq_if_empty_old_flow(fqs, fq_cl, fq, true, destroy);
+		} else if (fq_if_flow_held(fq, now)) {
+			fq_if_pacing_hold(fqs, fq_cl, fq, now);
+			if (fq->fq_deficit <= 0) {
+				fq->fq_deficit += fq_cl->fcl_quantum;
+			}
 		} else if (fq->fq_deficit <= 0) {
 			STAILQ_REMOVE(&fq_cl->fcl_old_flows, fq,
 			    flowq, fq_actlink);
@@ -1461,6 +1737,8 @@ fq_if_getqstats_ifclassq(struct ifclassq *ifq, u_int32_t qid,
 	fcls->fcls_dup_rexmts = fq_cl->fcl_stat.fcl_dup_rexmts;
 	fcls->fcls_pkts_compressible = fq_cl->fcl_stat.fcl_pkts_compressible;
 	fcls->fcls_pkts_compressed = fq_cl->fcl_stat.fcl_pkts_compressed;
+	fcls->fcls_pacedflows_cnt = fq_cl->fcl_stat.fcl_pacedflows_cnt;
+	fcls->fcls_paced = fq_cl->fcl_stat.fcl_paced;
 
 	/* Gather per flow stats */
 	flowstat_cnt = min((fcls->fcls_newflows_cnt +
@@ -1490,3 +1768,220 @@ fq_if_getqstats_ifclassq(struct ifclassq *ifq, u_int32_t qid,
 	fcls->fcls_flowstats_cnt = i;
 	return 0;
 }
+
+#if (DEVELOPMENT || DEBUG)
+#define FQ_PACING_TEST_DELAY    (50 * NSEC_PER_MSEC)
+#define FQ_PACING_TEST_PKTLEN   1500
+#define FQ_PACING_TEST_LARGE    \
+	(FQ_IF_LARGE_FLOW_BYTE_LIMIT / FQ_PACING_TEST_PKTLEN + 1)
+
+static int
+fq_if_pacing_test_enqueue(struct ifclassq *ifq, uint32_t flowid,
+    uint32_t delay, uint32_t npkts)
+{
+	classq_pkt_t pkt = CLASSQ_PKT_INITIALIZER(pkt);
+	struct timespec now_ts;
+	struct mbuf *m;
+	boolean_t pdrop;
+	uint64_t now;
+	int error;
+
+	nanouptime(&now_ts);
+	now = (now_ts.tv_sec * NSEC_PER_SEC) + now_ts.tv_nsec;
+	while (npkts-- > 0) {
+		if ((m = m_getcl(M_WAITOK, MT_DATA, M_PKTHDR)) == NULL) {
+			return ENOBUFS;
+		}
+		m->m_len = m->m_pkthdr.len = FQ_PACING_TEST_PKTLEN;
+		m->m_pkthdr.pkt_flowsrc = FLOWSRC_INPCB;
+		m->m_pkthdr.pkt_flowid = flowid;
+		m->m_pkthdr.pkt_flags |= PKTF_FLOW_ID;
+		m->m_pkthdr.pkt_timestamp = now;
+		m->m_pkthdr.pkt_pacing_delay = delay;
+		CLASSQ_PKT_INIT_MBUF(&pkt, m);
+		error = fq_if_enqueue_classq(ifq, &pkt, &pkt, 1,
+		    FQ_PACING_TEST_PKTLEN, &pdrop);
+		if (error != 0) {
+			return error;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Dequeues whatever may leave, and returns the number of packets and
+ * the flow of the last one.
+ */
+static uint32_t
+fq_if_pacing_test_dequeue(struct ifclassq *ifq, uint32_t *flowid)
+{
+	classq_pkt_t head = CLASSQ_PKT_INITIALIZER(head);
+	uint32_t cnt = 0;
+	struct mbuf *m;
+
+	IFCQ_LOCK_ASSERT_HELD(ifq);
+	(void) fq_if_dequeue_classq_multi(ifq, FQ_PACING_TEST_LARGE,
+	    CLASSQ_DEQUEUE_MAX_BYTE_LIMIT, &head, NULL, &cnt, NULL);
+	*flowid = 0;
+	for (m = head.cp_mbuf; m != NULL; m = m->m_nextpkt) {
+		*flowid = m->m_pkthdr.pkt_flowid;
+	}
+	if (head.cp_mbuf != NULL) {
+		m_freem_list(head.cp_mbuf);
+	}
+	return cnt;
+}
+
+/*
+ * Runs paced flows through a scheduler set up on the send queue of the
+ * loopback interface, which is unused unless lo0 runs with TXSTART:
+ * flows are held on the wheel and released by the thread call, a held
+ * flow is purged and another dropped, and the scheduler is torn down
+ * with a flow still held.  Returns the number of stages that passed.
+ */
+static int
+sysctl_fq_codel_pacing_test SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct ifclassq *ifq = &lo_ifp->if_snd;
+	cqrq_purge_sc_t purge = { MBUF_SC_BE, 3, 0, 0 };
+	fq_if_classq_t *fq_cl;
+	uint32_t cnt, flowid;
+	int value = 0, error, i;
+	fq_if_t *fqs;
+
+	error = SYSCTL_IN(req, &value, sizeof(value));
+	if (error || req->newptr == USER_ADDR_NULL) {
+		return error;
+	}
+	if (fq_codel_pacing == 0 || (lo_ifp->if_eflags & IFEF_TXSTART)) {
+		return ENOTSUP;
+	}
+
+	IFCQ_LOCK(ifq);
+	if (ifq->ifcq_type != PKTSCHEDT_NONE) {
+		IFCQ_UNLOCK(ifq);
+		return EBUSY;
+	}
+	error = fq_if_setup_ifclassq(ifq, 0, QP_MBUF);
+	if (error != 0) {
+		IFCQ_UNLOCK(ifq);
+		return error;
+	}
+	fqs = (fq_if_t *)ifq->ifcq_disc;
+	fqs->fqs_pkt_droplimit = if_sndq_maxlen;
+	fq_cl = &fqs->fqs_classq[fq_if_service_to_priority(fqs, MBUF_SC_BE)];
+	IFCQ_UNLOCK(ifq);
+	value = 0;
+
+	/* flows 1 and 3 wait on the wheel, flow 2 leaves right away */
+	if ((error = fq_if_pacing_test_enqueue(ifq, 1,
+	    FQ_PACING_TEST_DELAY, 1)) != 0 ||
+	    (error = fq_if_pacing_test_enqueue(ifq, 2, 0, 1)) != 0 ||
+	    (error = fq_if_pacing_test_enqueue(ifq, 3,
+	    FQ_PACING_TEST_DELAY, 1)) != 0) {
+		goto done;
+	}
+	IFCQ_LOCK(ifq);
+	cnt = fq_if_pacing_test_dequeue(ifq, &flowid);
+	if (cnt != 1 || flowid != 2 || fqs->fqs_pacing_cnt != 2 ||
+	    fq_cl->fcl_stat.fcl_pacedflows_cnt != 2) {
+		error = EIO;
+	}
+	IFCQ_UNLOCK(ifq);
+	if (error != 0) {
+		goto done;
+	}
+	value++;
+
+	/* purging a held flow takes it off the wheel */
+	IFCQ_LOCK(ifq);
+	(void) fq_if_request_classq(ifq, CLASSQRQ_PURGE_SC, &purge);
+	if (purge.packets != 1 || fqs->fqs_pacing_cnt != 1 ||
+	    fq_cl->fcl_stat.fcl_pacedflows_cnt != 1) {
+		error = EIO;
+	}
+	IFCQ_UNLOCK(ifq);
+	if (error != 0) {
+		goto done;
+	}
+	value++;
+
+	/* the thread call moves flow 1 to the old flows once it is due */
+	for (i = 0; i < 20; i++) {
+		(void) tsleep(&value, PSOCK, "fq_pacing_test", MAX(1, hz / 20));
+		IFCQ_LOCK(ifq);
+		cnt = fqs->fqs_pacing_cnt;
+		IFCQ_UNLOCK(ifq);
+		if (cnt == 0) {
+			break;
+		}
+	}
+	IFCQ_LOCK(ifq);
+	if (fqs->fqs_pacing_cnt != 0 ||
+	    fq_cl->fcl_stat.fcl_pacedflows_cnt != 0 ||
+	    fq_if_pacing_test_dequeue(ifq, &flowid) != 1 || flowid != 1) {
+		error = EIO;
+	}
+	IFCQ_UNLOCK(ifq);
+	if (error != 0) {
+		goto done;
+	}
+	value++;
+
+	/* dropping the last packet of a large held flow frees it */
+	if ((error = fq_if_pacing_test_enqueue(ifq, 4, FQ_PACING_TEST_DELAY,
+	    FQ_PACING_TEST_LARGE)) != 0) {
+		goto done;
+	}
+	IFCQ_LOCK(ifq);
+	if (fq_if_pacing_test_dequeue(ifq, &flowid) != 0 ||
+	    fqs->fqs_pacing_cnt != 1 || fqs->fqs_large_flow == NULL) {
+		error = EIO;
+	}
+	for (i = 0; error == 0 && i < FQ_PACING_TEST_LARGE &&
+	    fqs->fqs_large_flow != NULL; i++) {
+		fq_if_drop_packet(fqs);
+	}
+	if (error == 0 && (fqs->fqs_large_flow != NULL ||
+	    fqs->fqs_pacing_cnt != 0 ||
+	    fq_cl->fcl_stat.fcl_pacedflows_cnt != 0 ||
+	    fq_if_hash_pkt(fqs, 4, MBUF_SC_BE, 0, FALSE, QP_INVALID) != NULL)) {
+		error = EIO;
+	}
+	IFCQ_UNLOCK(ifq);
+	if (error != 0) {
+		goto done;
+	}
+	value++;
+
+	/* leave flow 5 on the wheel, with the timer set, for the teardown */
+	if ((error = fq_if_pacing_test_enqueue(ifq, 5,
+	    FQ_PACING_TEST_DELAY, 1)) != 0) {
+		goto done;
+	}
+	IFCQ_LOCK(ifq);
+	if (fq_if_pacing_test_dequeue(ifq, &flowid) != 0 ||
+	    fqs->fqs_pacing_cnt != 1 || fqs->fqs_pacing_armed == 0) {
+		error = EIO;
+	}
+	IFCQ_UNLOCK(ifq);
+
+done:
+	IFCQ_LOCK(ifq);
+	fq_if_teardown_ifclassq(ifq);
+	bzero(&ifq->ifcq_xmitcnt, sizeof(ifq->ifcq_xmitcnt));
+	bzero(&ifq->ifcq_dropcnt, sizeof(ifq->ifcq_dropcnt));
+	IFCQ_UNLOCK(ifq);
+
+	if (error == 0) {
+		error = SYSCTL_OUT(req, &value, sizeof(value));
+	}
+	return error;
+}
+
+SYSCTL_PROC(_net_classq_fq_codel, OID_AUTO, pacing_test,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED | CTLFLAG_MASKED,
+    0, 0, sysctl_fq_codel_pacing_test, "I",
+    "Run paced flows through a scheduler on the loopback send queue");
+#endif /* (DEVELOPMENT || DEBUG) */
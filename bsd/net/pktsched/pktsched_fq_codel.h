@@ -34,6 +34,7 @@
 #include <sys/param.h>
 
 #ifdef BSD_KERNEL_PRIVATE
+#include <kern/thread_call.h>
 #include <net/flowadv.h>
 #include <net/pktsched/pktsched.h>
 #endif /* BSD_KERNEL_PRIVATE */
@@ -64,6 +65,8 @@ struct fcl_stat {
 	u_int32_t fcl_dup_rexmts;
 	u_int32_t fcl_pkts_compressible;
 	u_int32_t fcl_pkts_compressed;
+	u_int32_t fcl_pacedflows_cnt;
+	u_int64_t fcl_paced;
 };
 
 /*
@@ -86,6 +89,16 @@ _Static_assert(FQ_IF_MAX_CLASSES < 127,
 
 #define FQ_IF_LARGE_FLOW_BYTE_LIMIT     15000
 
+/*
+ * Flows whose head packet has a departure time in the future wait on a
+ * timing wheel of FQ_IF_PACING_SLOTS slots, each 2^FQ_IF_PACING_SLOT_SHIFT
+ * nanoseconds (about 65us) wide.  A departure time past the end of the
+ * wheel waits in its last slot and is put back on the wheel from there.
+ */
+#define FQ_IF_PACING_SLOTS              256
+#define FQ_IF_PACING_SLOT_SHIFT         16
+#define FQ_IF_PACING_TICK(_ns_)         ((_ns_) >> FQ_IF_PACING_SLOT_SHIFT)
+
 struct flowq;
 typedef u_int32_t pktsched_bitmap_t;
 struct if_ifclassq_stats;
@@ -141,6 +154,12 @@ typedef struct fq_codel_sched_data {
 	struct flowadv_fclist   fqs_fclist; /* flow control state */
 	struct flowq    *fqs_large_flow; /* flow has highest number of bytes */
 	classq_pkt_type_t       fqs_ptype;
+	/* pacing time queue */
+	flowq_stailq_t  fqs_pacing_wheel[FQ_IF_PACING_SLOTS]; /* held flows */
+	u_int64_t       fqs_pacing_tick;        /* next tick to release */
+	u_int64_t       fqs_pacing_armed;       /* tick the timer is set for */
+	u_int32_t       fqs_pacing_cnt;         /* flows on the wheel */
+	thread_call_t   fqs_pacing_tcall;       /* releases held flows */
 } fq_if_t;
 
 #endif /* BSD_KERNEL_PRIVATE */
@@ -189,6 +208,8 @@ struct fq_codel_classstats {
 	struct fq_codel_flowstats fcls_flowstats[FQ_IF_MAX_FLOWSTATS];
 	u_int32_t       fcls_pkts_compressible;
 	u_int32_t       fcls_pkts_compressed;
+	u_int32_t       fcls_pacedflows_cnt;
+	u_int64_t       fcls_paced;
 };
 
 #ifdef BSD_KERNEL_PRIVATE
@@ -215,6 +236,7 @@ extern void fq_if_is_flow_heavy(fq_if_t *, struct flowq *);
 extern boolean_t fq_if_add_fcentry(fq_if_t *, pktsched_pkt_t *, uint8_t,
     struct flowq *, fq_if_classq_t *);
 extern void fq_if_flow_feedback(fq_if_t *, struct flowq *, fq_if_classq_t *);
+extern uint64_t fq_if_pkt_tx_time(struct mbuf *);
 extern int fq_if_setup_ifclassq(struct ifclassq *ifq, u_int32_t flags,
     classq_pkt_type_t ptype);
 extern void fq_if_teardown_ifclassq(struct ifclassq *ifq);
@@ -103,6 +103,9 @@ struct _mbuf {
 
 extern uint32_t os_cpu_in_cksum(const void *, uint32_t, uint32_t);
 extern uint32_t os_cpu_in_cksum_mbuf(struct _mbuf *, int, int, uint32_t);
+#ifdef KERNEL
+extern uint32_t os_cpu_copy_in_cksum(const void *, void *, uint32_t, uint32_t);
+#endif /* KERNEL */
 
 uint32_t
 os_cpu_in_cksum(const void *data, uint32_t len, uint32_t initial_sum)
@@ -190,6 +193,84 @@ os_cpu_in_cksum(const void *data, uint32_t len, uint32_t initial_sum)
 	return os_cpu_in_cksum_mbuf(&m, len, 0, initial_sum);
 }
 
+#ifdef KERNEL
+/*
+ * Copies len bytes from src to dst and returns the 16-bit one's complement
+ * sum of them (not complemented), as os_cpu_in_cksum() would, in a single
+ * pass over the data; this saves bringing the data into the cache twice
+ * when a copy is followed by a software checksum.  Neither buffer needs
+ * to be aligned.
+ */
+uint32_t
+os_cpu_copy_in_cksum(const void *src, void *dst, uint32_t len,
+    uint32_t initial_sum)
+{
+#if defined(__LP64__) && BYTE_ORDER == LITTLE_ENDIAN
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint64_t sum = initial_sum, carry = 0, w0, w1, w2, w3;
+
+	/*
+	 * 64-bit words are summed in native order; the carries out of
+	 * the accumulator are counted separately and added back at the
+	 * end, which is what the end-around carry would have done.
+	 */
+	while (len >= 32) {
+		__builtin_memcpy(&w0, s, sizeof(w0));
+		__builtin_memcpy(&w1, s + 8, sizeof(w1));
+		__builtin_memcpy(&w2, s + 16, sizeof(w2));
+		__builtin_memcpy(&w3, s + 24, sizeof(w3));
+		__builtin_memcpy(d, &w0, sizeof(w0));
+		__builtin_memcpy(d + 8, &w1, sizeof(w1));
+		__builtin_memcpy(d + 16, &w2, sizeof(w2));
+		__builtin_memcpy(d + 24, &w3, sizeof(w3));
+		sum += w0;
+		carry += (sum < w0);
+		sum += w1;
+		carry += (sum < w1);
+		sum += w2;
+		carry += (sum < w2);
+		sum += w3;
+		carry += (sum < w3);
+		s += 32;
+		d += 32;
+		len -= 32;
+	}
+	while (len >= 8) {
+		__builtin_memcpy(&w0, s, sizeof(w0));
+		__builtin_memcpy(d, &w0, sizeof(w0));
+		sum += w0;
+		carry += (sum < w0);
+		s += 8;
+		d += 8;
+		len -= 8;
+	}
+	if (len != 0) {
+		/* trailing bytes land in the low end of a zero-padded word */
+		w0 = 0;
+		bcopy(s, &w0, len);
+		bcopy(s, d, len);
+		sum += w0;
+		carry += (sum < w0);
+	}
+
+	sum += carry;
+	sum += (sum < carry);
+
+	/* fold 64-bit to 16-bit */
+	sum = (sum >> 32) + (sum & 0xffffffff);         /* 33-bit */
+	sum = (sum >> 32) + (sum & 0xffffffff);         /* 32-bit */
+	sum = (sum >> 16) + (sum & 0xffff);             /* 17-bit */
+	sum = (sum >> 16) + (sum & 0xffff);             /* 16-bit */
+
+	return (uint32_t)(sum & 0xffff);
+#else /* !__LP64__ || BYTE_ORDER != LITTLE_ENDIAN */
+	bcopy(src, dst, len);
+	return os_cpu_in_cksum(dst, len, initial_sum);
+#endif /* !__LP64__ || BYTE_ORDER != LITTLE_ENDIAN */
+}
+#endif /* KERNEL */
+
 #if defined(__i386__) || defined(__x86_64__)
 
 /*
@@ -364,6 +445,46 @@ post_initial_offset:
 }
 
 #else /* __LP64__ */
+/*
+ * Sums nblocks 64-byte blocks with 64-bit adds and returns the result
+ * folded to 32 bits.  Each block is summed into its own register through
+ * the carry flag, so that consecutive blocks overlap in the pipeline, and
+ * the carries out of the blocks are counted separately.  The kernel can't
+ * use the vector registers here, and dual-chain (ADX) variants don't do
+ * measurably better than this.
+ */
+static uint32_t
+in_cksum_blocks(const uint8_t *data, uint32_t nblocks)
+{
+	uint64_t sum = 0, carry = 0, tmp;
+
+	while (nblocks-- != 0) {
+		__asm__ (
+		    "movq	0(%[p]), %[t]\n\t"
+		    "addq	8(%[p]), %[t]\n\t"
+		    "adcq	16(%[p]), %[t]\n\t"
+		    "adcq	24(%[p]), %[t]\n\t"
+		    "adcq	32(%[p]), %[t]\n\t"
+		    "adcq	40(%[p]), %[t]\n\t"
+		    "adcq	48(%[p]), %[t]\n\t"
+		    "adcq	56(%[p]), %[t]\n\t"
+		    "adcq	$0, %[c]\n\t"
+		    "addq	%[t], %[s]\n\t"
+		    "adcq	$0, %[c]"
+		    : [s] "+r" (sum), [c] "+r" (carry), [t] "=&r" (tmp)
+		    : [p] "r" (data), "m" (*(const uint8_t (*)[64])data)
+		    : "cc");
+		data += 64;
+	}
+
+	/* add the carries back in and fold 64-bit to 32-bit */
+	sum += carry;
+	sum += (sum < carry);
+	sum = (sum >> 32) + (sum & 0xffffffff);         /* 33-bit */
+	sum = (sum >> 32) + (sum & 0xffffffff);         /* 32-bit */
+	return (uint32_t)sum;
+}
+
 /* 64-bit version */
 uint32_t
 os_cpu_in_cksum_mbuf(struct _mbuf *m, int len, int off, uint32_t initial_sum)
@@ -436,36 +557,11 @@ post_initial_offset:
 			data += 2;
 			mlen -= 2;
 		}
-		while (mlen >= 64) {
-			__builtin_prefetch(data + 32);
-			__builtin_prefetch(data + 64);
-			partial += *(uint32_t *)(void *)data;
-			partial += *(uint32_t *)(void *)(data + 4);
-			partial += *(uint32_t *)(void *)(data + 8);
-			partial += *(uint32_t *)(void *)(data + 12);
-			partial += *(uint32_t *)(void *)(data + 16);
-			partial += *(uint32_t *)(void *)(data + 20);
-			partial += *(uint32_t *)(void *)(data + 24);
-			partial += *(uint32_t *)(void *)(data + 28);
-			partial += *(uint32_t *)(void *)(data + 32);
-			partial += *(uint32_t *)(void *)(data + 36);
-			partial += *(uint32_t *)(void *)(data + 40);
-			partial += *(uint32_t *)(void *)(data + 44);
-			partial += *(uint32_t *)(void *)(data + 48);
-			partial += *(uint32_t *)(void *)(data + 52);
-			partial += *(uint32_t *)(void *)(data + 56);
-			partial += *(uint32_t *)(void *)(data + 60);
-			data += 64;
-			mlen -= 64;
-			if (PREDICT_FALSE(partial & (3ULL << 62))) {
-				if (needs_swap) {
-					partial = (partial << 8) +
-					    (partial >> 56);
-				}
-				sum += (partial >> 32);
-				sum += (partial & 0xffffffff);
-				partial = 0;
-			}
+		if (mlen >= 64) {
+			/* partial is at most 17 bits wide at this point */
+			partial += in_cksum_blocks(data, (uint32_t)mlen >> 6);
+			data += mlen & ~63;
+			mlen &= 63;
 		}
 		/*
 		 * mlen is not updated below as the remaining tests
@@ -82,6 +82,10 @@
 
 #include <libkern/OSAtomic.h>
 #include <kern/locks.h>
+#include <kern/cpu_number.h>
+#include <kern/smr.h>
+#include <kern/clock.h>
+#include <mach/mach_time.h>
 
 #include <machine/limits.h>
 
@@ -247,6 +251,36 @@ SYSCTL_PROC(_net_inet_ip_portrange, OID_AUTO, hilast,
 SYSCTL_INT(_net_inet_ip_portrange, OID_AUTO, ipport_allow_udp_port_exhaustion,
     CTLFLAG_LOCKED | CTLFLAG_RW, &allow_udp_port_exhaustion, 0, "");
 
+/*
+ * How connections and datagrams are spread across the sockets bound
+ * with SO_REUSEPORT to the same address and port (INP_LBGROUP_*).
+ */
+static int inp_reuseport_lb = INP_LBGROUP_HASH;
+SYSCTL_INT(_net_inet_ip, OID_AUTO, reuseport_lb,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &inp_reuseport_lb, 0,
+    "SO_REUSEPORT load balancing: 0 off, 1 by flow hash, 2 by CPU");
+
+#define INP_LBGROUP_HASHSIZE    64      /* buckets in ipi_lbgrouphashbase */
+#define INP_LBGROUP_SIZMIN      8       /* initial size of a group */
+
+static void in_pcblbgroup_insert(struct inpcb *);
+static void in_pcblbgroup_remove(struct inpcb *);
+static struct inpcb *in_pcblookup_hash_locked(struct inpcbinfo *,
+    struct in_addr, u_int, struct in_addr, u_int, int, struct ifnet *);
+
+/*
+ * Established flows are looked up without ipi_lock: the hash chains are
+ * walked in a read section of inpcb_smr, and pcbs, as well as the
+ * sockets TCP pcbs are cached in, are only freed or reused once no
+ * such reader can still see them.
+ */
+SMR_DEFINE(inpcb_smr, "inpcb");
+
+int inp_lookup_smr = 1;
+SYSCTL_INT(_net_inet_ip, OID_AUTO, pcblookup_smr,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &inp_lookup_smr, 0,
+    "Look up established flows without the pcbinfo lock");
+
 static uint32_t apn_fallbk_debug = 0;
 #define apn_fallbk_log(x)       do { if (apn_fallbk_debug >= 1) log x; } while (0)
 
@@ -557,6 +591,9 @@ in_pcbinfo_attach(struct inpcbinfo *ipi)
 	}
 	TAILQ_INSERT_TAIL(&inpcb_head, ipi, ipi_entry);
 	lck_mtx_unlock(&inpcb_lock);
+
+	ipi->ipi_lbgrouphashbase = hashinit(INP_LBGROUP_HASHSIZE, M_PCB,
+	    &ipi->ipi_lbgrouphashmask);
 }
 
 int
@@ -578,6 +615,12 @@ in_pcbinfo_detach(struct inpcbinfo *ipi)
 	}
 	lck_mtx_unlock(&inpcb_lock);
 
+	if (error == 0 && ipi->ipi_lbgrouphashbase != NULL) {
+		hashdestroy(ipi->ipi_lbgrouphashbase, M_PCB,
+		    ipi->ipi_lbgrouphashmask);
+		ipi->ipi_lbgrouphashbase = NULL;
+	}
+
 	return error;
 }
 
@@ -1897,7 +1940,7 @@ in_pcbdispose(struct inpcb *inp)
 		 */
 		ROUTE_RELEASE(&inp->inp_route);
 		if ((so->so_flags1 & SOF1_CACHED_IN_SOCK_LAYER) == 0) {
-			zfree(ipi->ipi_zone, inp);
+			smr_zfree(&inpcb_smr, ipi->ipi_zone, inp);
 		}
 		sodealloc(so);
 	}
@@ -2318,6 +2361,59 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	return found;
 }
 
+/*
+ * Lockless lookup of the pcb of an established flow.  A pcb found in a
+ * read section of inpcb_smr is only returned once a want reference on
+ * it is held, which keeps it from being disposed of.  A pcb moved to
+ * another chain concurrently can be missed: NULL means the caller has
+ * to look again with ipi_lock held.
+ */
+static struct inpcb *
+in_pcblookup_hash_smr(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_short fport, struct in_addr laddr, u_short lport, struct ifnet *ifp)
+{
+	struct inpcbhead *head;
+	struct inpcb *inp;
+
+	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
+	    pcbinfo->ipi_hashmask)];
+
+	smr_enter(&inpcb_smr);
+	for (inp = smr_entered_load(&head->lh_first); inp != NULL;
+	    inp = smr_entered_load(&inp->inp_hash.le_next)) {
+		if ((inp->inp_vflag & INP_IPV4) &&
+		    inp->inp_faddr.s_addr == faddr.s_addr &&
+		    inp->inp_laddr.s_addr == laddr.s_addr &&
+		    inp->inp_fport == fport &&
+		    inp->inp_lport == lport) {
+			if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) ==
+			    WNT_STOPUSING) {
+				inp = NULL;
+			}
+			break;
+		}
+	}
+	smr_leave(&inpcb_smr);
+
+	if (inp == NULL) {
+		return NULL;
+	}
+
+	/*
+	 * The policy checks of the locked lookup, done out of the read
+	 * section as NECP may block for listeners.
+	 */
+	if (inp_restricted_recv(inp, ifp)
+#if NECP
+	    || !necp_socket_is_allowed_to_recv_on_interface(inp, ifp)
+#endif /* NECP */
+	    ) {
+		in_pcb_checkstate(inp, WNT_RELEASE, 0);
+		return NULL;
+	}
+	return inp;
+}
+
 /*
  * Lookup PCB in hash list.
  */
@@ -2325,12 +2421,34 @@ struct inpcb *
 in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
     struct ifnet *ifp)
+{
+	struct inpcb *inp;
+
+	if (inp_lookup_smr) {
+		inp = in_pcblookup_hash_smr(pcbinfo, faddr, (u_short)fport_arg,
+		    laddr, (u_short)lport_arg, ifp);
+		if (inp != NULL) {
+			return inp;
+		}
+	}
+	return in_pcblookup_hash_locked(pcbinfo, faddr, fport_arg, laddr,
+	           lport_arg, wildcard, ifp);
+}
+
+/*
+ * Lookup PCB in hash list, with ipi_lock held shared.
+ */
+static struct inpcb *
+in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
+    struct ifnet *ifp)
 {
 	struct inpcbhead *head;
 	struct inpcb *inp;
 	u_short fport = (u_short)fport_arg, lport = (u_short)lport_arg;
 	struct inpcb *local_wild = NULL;
 	struct inpcb *local_wild_mapped = NULL;
+	u_int32_t lbhash;
 
 	/*
 	 * We may have found the pcb in the last lookup - check this first.
@@ -2384,6 +2502,7 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 		return NULL;
 	}
 
+	lbhash = INP_PCBLBGROUP_PKTHASH(faddr.s_addr, lport, fport);
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 	    pcbinfo->ipi_hashmask)];
 	LIST_FOREACH(inp, head, inp_hash) {
@@ -2403,6 +2522,7 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 		if (inp->inp_faddr.s_addr == INADDR_ANY &&
 		    inp->inp_lport == lport) {
 			if (inp->inp_laddr.s_addr == laddr.s_addr) {
+				inp = in_pcblbgroup_select(inp, lbhash, ifp);
 				if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) !=
 				    WNT_STOPUSING) {
 					lck_rw_done(pcbinfo->ipi_lock);
@@ -2423,6 +2543,8 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	}
 	if (local_wild == NULL) {
 		if (local_wild_mapped != NULL) {
+			local_wild_mapped = in_pcblbgroup_select(local_wild_mapped,
+			    lbhash, ifp);
 			if (in_pcb_checkstate(local_wild_mapped,
 			    WNT_ACQUIRE, 0) != WNT_STOPUSING) {
 				lck_rw_done(pcbinfo->ipi_lock);
@@ -2436,6 +2558,7 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 		lck_rw_done(pcbinfo->ipi_lock);
 		return NULL;
 	}
+	local_wild = in_pcblbgroup_select(local_wild, lbhash, ifp);
 	if (in_pcb_checkstate(local_wild, WNT_ACQUIRE, 0) != WNT_STOPUSING) {
 		lck_rw_done(pcbinfo->ipi_lock);
 		return local_wild;
@@ -2447,6 +2570,153 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	return NULL;
 }
 
+/*
+ * LIST_INSERT_HEAD for the pcb hash chains, which lockless lookups walk:
+ * the pcb is only published once its links are set.  Removal is a plain
+ * LIST_REMOVE, which leaves the links of the removed pcb intact.
+ */
+static inline void
+in_pcbhash_insert_head(struct inpcbhead *head, struct inpcb *inp)
+{
+	struct inpcb *first = head->lh_first;
+
+	inp->inp_hash.le_next = first;
+	if (first != NULL) {
+		first->inp_hash.le_prev = &inp->inp_hash.le_next;
+	}
+	inp->inp_hash.le_prev = &head->lh_first;
+	smr_serialized_store(&head->lh_first, inp);
+}
+
+#if (DEBUG | DEVELOPMENT)
+/*
+ * Lookup microbenchmark: fills a private pcbinfo with `count' established
+ * pcbs, one hash bucket per pcb as hashinit sizes it, then looks each of
+ * them up once without and once with ipi_lock, and returns the average
+ * cost of both in nanoseconds.
+ */
+#define INP_BENCH_MAX   (4 * 1024 * 1024)
+
+static LCK_GRP_DECLARE(inp_bench_lck_grp, "inpcb_bench");
+static LCK_RW_DECLARE(inp_bench_lock, &inp_bench_lck_grp);
+
+static int
+in_pcblookup_bench(uint64_t count, uint64_t *lockless_ns, uint64_t *locked_ns)
+{
+	struct inpcbinfo pcbinfo;
+	struct inpcb **inps, *inp;
+	struct in_addr faddr, laddr;
+	uint64_t start, now;
+	uint32_t i;
+	int error = 0;
+
+	if (count == 0 || count > INP_BENCH_MAX) {
+		return EINVAL;
+	}
+
+	bzero(&pcbinfo, sizeof(pcbinfo));
+	pcbinfo.ipi_lock = &inp_bench_lock;
+	pcbinfo.ipi_hashbase = hashinit((int)count, M_PCB,
+	    &pcbinfo.ipi_hashmask);
+	if (pcbinfo.ipi_hashbase == NULL) {
+		return ENOMEM;
+	}
+	inps = _MALLOC(count * sizeof(*inps), M_TEMP, M_WAITOK | M_ZERO);
+	if (inps == NULL) {
+		hashdestroy(pcbinfo.ipi_hashbase, M_PCB, pcbinfo.ipi_hashmask);
+		return ENOMEM;
+	}
+
+	laddr.s_addr = htonl(0x0a000001);
+	lck_rw_lock_exclusive(pcbinfo.ipi_lock);
+	for (i = 0; i < count; i++) {
+		inp = _MALLOC(sizeof(*inp), M_PCB, M_NOWAIT | M_ZERO);
+		if (inp == NULL) {
+			error = ENOMEM;
+			break;
+		}
+		inp->inp_vflag = INP_IPV4;
+		inp->inp_pcbinfo = &pcbinfo;
+		inp->inp_laddr = laddr;
+		inp->inp_lport = htons(443);
+		inp->inp_faddr.s_addr = htonl(0x0b000000 | (i >> 8));
+		inp->inp_fport = htons((uint16_t)(1024 + (i & 0xff)));
+		in_pcbhash_insert_head(&pcbinfo.ipi_hashbase[
+			    INP_PCBHASH(inp->inp_faddr.s_addr, inp->inp_lport,
+			    inp->inp_fport, pcbinfo.ipi_hashmask)], inp);
+		inps[i] = inp;
+	}
+	lck_rw_done(pcbinfo.ipi_lock);
+	if (error != 0) {
+		goto done;
+	}
+
+	/* the lookups take a want reference, dropped without a socket */
+	start = mach_absolute_time();
+	for (i = 0; i < count; i++) {
+		faddr = inps[i]->inp_faddr;
+		inp = in_pcblookup_hash_smr(&pcbinfo, faddr, inps[i]->inp_fport,
+		    laddr, inps[i]->inp_lport, NULL);
+		if (inp != inps[i]) {
+			error = ESRCH;
+			goto done;
+		}
+		OSDecrementAtomic(&inp->inp_wantcnt);
+	}
+	now = mach_absolute_time();
+	absolutetime_to_nanoseconds((now - start) / count, lockless_ns);
+
+	start = mach_absolute_time();
+	for (i = 0; i < count; i++) {
+		faddr = inps[i]->inp_faddr;
+		inp = in_pcblookup_hash_locked(&pcbinfo, faddr,
+		    inps[i]->inp_fport, laddr, inps[i]->inp_lport, 0, NULL);
+		if (inp != inps[i]) {
+			error = ESRCH;
+			goto done;
+		}
+		OSDecrementAtomic(&inp->inp_wantcnt);
+	}
+	now = mach_absolute_time();
+	absolutetime_to_nanoseconds((now - start) / count, locked_ns);
+
+done:
+	/* nothing but this thread ever saw the pcbs, no need to defer */
+	for (i = 0; i < count && inps[i] != NULL; i++) {
+		FREE(inps[i], M_PCB);
+	}
+	FREE(inps, M_TEMP);
+	hashdestroy(pcbinfo.ipi_hashbase, M_PCB, pcbinfo.ipi_hashmask);
+	return error;
+}
+
+static int
+sysctl_pcblookup_bench SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint64_t count = 0, result[2] = { 0, 0 };
+	int error;
+
+	error = SYSCTL_IN(req, &count, sizeof(count));
+	if (error) {
+		return error;
+	}
+
+	if (req->newptr) {
+		error = in_pcblookup_bench(count, &result[0], &result[1]);
+		if (error == 0) {
+			error = SYSCTL_OUT(req, result, sizeof(result));
+		}
+	}
+
+	return error;
+}
+SYSCTL_PROC(_net_inet_ip, OID_AUTO, pcblookup_bench,
+    CTLTYPE_OPAQUE | CTLFLAG_RW | CTLFLAG_LOCKED, 0, 0,
+    sysctl_pcblookup_bench, "Q",
+    "pcb lookup benchmark: ns per lookup without and with the lock");
+#endif /* (DEBUG | DEVELOPMENT) */
+
 /*
  * @brief	Insert PCB onto various hash lists.
  *
@@ -2536,9 +2806,11 @@ in_pcbinshash(struct inpcb *inp, int locked)
 
 	inp->inp_phd = phd;
 	LIST_INSERT_HEAD(&phd->phd_pcblist, inp, inp_portlist);
-	LIST_INSERT_HEAD(pcbhash, inp, inp_hash);
+	in_pcbhash_insert_head(pcbhash, inp);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
+	in_pcblbgroup_insert(inp);
+
 	if (!locked) {
 		lck_rw_done(pcbinfo->ipi_lock);
 	}
@@ -2551,6 +2823,195 @@ in_pcbinshash(struct inpcb *inp, int locked)
 	return 0;
 }
 
+static boolean_t
+in_pcblbgroup_match(struct inpcblbgroup *grp, struct inpcb *inp)
+{
+	if (grp->il_lport != inp->inp_lport || grp->il_vflag != inp->inp_vflag) {
+		return FALSE;
+	}
+	if (inp->inp_vflag & INP_IPV6) {
+		return IN6_ARE_ADDR_EQUAL(&grp->il_laddr, &inp->in6p_laddr);
+	}
+	return grp->il_laddr.s6_addr32[3] == inp->inp_laddr.s_addr;
+}
+
+/*
+ * Add a pcb just bound with SO_REUSEPORT to the load balancing group
+ * of its local address and port, creating the group if need be.
+ * Failing to allocate is not an error: the pcb simply stays out of
+ * any group.  Must be called with the pcbinfo lock held exclusive.
+ */
+static void
+in_pcblbgroup_insert(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct inpcblbgrouphead *head;
+	struct inpcblbgroup *grp;
+
+	/* connections being set up by a listener inherit its options */
+	if (inp->inp_lbgroup != NULL || pcbinfo->ipi_lbgrouphashbase == NULL ||
+	    !(inp->inp_socket->so_options & SO_REUSEPORT) ||
+	    inp->inp_socket->so_head != NULL ||
+	    inp->inp_fport != 0 || inp->inp_lport == 0) {
+		return;
+	}
+	if ((inp->inp_vflag & INP_IPV6) ?
+	    !IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_faddr) :
+	    inp->inp_faddr.s_addr != INADDR_ANY) {
+		return;
+	}
+
+	head = &pcbinfo->ipi_lbgrouphashbase[INP_PCBPORTHASH(inp->inp_lport,
+	    pcbinfo->ipi_lbgrouphashmask)];
+	LIST_FOREACH(grp, head, il_list) {
+		if (in_pcblbgroup_match(grp, inp)) {
+			break;
+		}
+	}
+
+	if (grp == NULL) {
+		MALLOC(grp, struct inpcblbgroup *, sizeof(*grp), M_PCB,
+		    M_WAITOK | M_ZERO);
+		if (grp == NULL) {
+			return;
+		}
+		grp->il_inp = _MALLOC(INP_LBGROUP_SIZMIN * sizeof(struct inpcb *),
+		    M_PCB, M_WAITOK | M_ZERO);
+		if (grp->il_inp == NULL) {
+			FREE(grp, M_PCB);
+			return;
+		}
+		grp->il_inpsiz = INP_LBGROUP_SIZMIN;
+		grp->il_lport = inp->inp_lport;
+		grp->il_vflag = inp->inp_vflag;
+		if (inp->inp_vflag & INP_IPV6) {
+			grp->il_laddr = inp->in6p_laddr;
+		} else {
+			grp->il_laddr.s6_addr32[3] = inp->inp_laddr.s_addr;
+		}
+		LIST_INSERT_HEAD(head, grp, il_list);
+	} else if (grp->il_inpcnt == grp->il_inpsiz) {
+		struct inpcb **inps;
+
+		inps = _MALLOC(2 * grp->il_inpsiz * sizeof(struct inpcb *),
+		    M_PCB, M_WAITOK | M_ZERO);
+		if (inps == NULL) {
+			return;
+		}
+		bcopy(grp->il_inp, inps, grp->il_inpcnt * sizeof(struct inpcb *));
+		FREE(grp->il_inp, M_PCB);
+		grp->il_inp = inps;
+		grp->il_inpsiz *= 2;
+	}
+
+	grp->il_inp[grp->il_inpcnt++] = inp;
+	inp->inp_lbgroup = grp;
+}
+
+/*
+ * Take a pcb out of its load balancing group, freeing the group when
+ * it was the last member.  Must be called with the pcbinfo lock held
+ * exclusive.
+ */
+static void
+in_pcblbgroup_remove(struct inpcb *inp)
+{
+	struct inpcblbgroup *grp = inp->inp_lbgroup;
+	u_int32_t i;
+
+	if (grp == NULL) {
+		return;
+	}
+	inp->inp_lbgroup = NULL;
+
+	for (i = 0; i < grp->il_inpcnt; i++) {
+		if (grp->il_inp[i] == inp) {
+			break;
+		}
+	}
+	VERIFY(i < grp->il_inpcnt);
+	grp->il_inpcnt--;
+	memmove(&grp->il_inp[i], &grp->il_inp[i + 1],
+	    (grp->il_inpcnt - i) * sizeof(struct inpcb *));
+
+	if (grp->il_inpcnt == 0) {
+		LIST_REMOVE(grp, il_list);
+		FREE(grp->il_inp, M_PCB);
+		FREE(grp, M_PCB);
+	}
+}
+
+/*
+ * Whether `member' may take the packets a lookup found `inp' for:
+ * besides being in the same group it has to be alive, bound to the
+ * same interface and, for a stream socket, listening.
+ */
+static inline boolean_t
+in_pcblbgroup_eligible(struct inpcb *inp, struct inpcb *member)
+{
+	struct socket *so = member->inp_socket;
+
+	return member->inp_state != INPCB_STATE_DEAD &&
+	       member->inp_vflag == inp->inp_vflag &&
+	       member->inp_boundifp == inp->inp_boundifp &&
+	       (so->so_type != SOCK_STREAM || (so->so_options & SO_ACCEPTCONN));
+}
+
+/*
+ * Given the unconnected pcb `inp' found by a wildcard lookup, pick the
+ * member of its SO_REUSEPORT group that should get the packet, by the
+ * flow hash `hash' of the packet or by the current CPU.  Returns `inp'
+ * itself when it is not in a group or when load balancing is off.
+ * Must be called with the pcbinfo lock held.
+ */
+struct inpcb *
+in_pcblbgroup_select(struct inpcb *inp, u_int32_t hash, struct ifnet *ifp)
+{
+	struct inpcblbgroup *grp = inp->inp_lbgroup;
+	struct inpcb *member;
+	u_int32_t i, n = 0, idx;
+
+	if (grp == NULL || grp->il_inpcnt < 2 ||
+	    inp_reuseport_lb == INP_LBGROUP_NONE) {
+		return inp;
+	}
+
+	for (i = 0; i < grp->il_inpcnt; i++) {
+		if (in_pcblbgroup_eligible(inp, grp->il_inp[i])) {
+			n++;
+		}
+	}
+	if (n == 0) {
+		return inp;
+	}
+
+	if (inp_reuseport_lb == INP_LBGROUP_CPU) {
+		idx = (u_int32_t)cpu_number() % n;
+	} else {
+		idx = hash % n;
+	}
+	for (i = 0, member = NULL; i < grp->il_inpcnt; i++) {
+		if (in_pcblbgroup_eligible(inp, grp->il_inp[i]) && idx-- == 0) {
+			member = grp->il_inp[i];
+			break;
+		}
+	}
+	if (member == NULL || member == inp) {
+		return inp;
+	}
+
+	/* `inp' passed these checks in the lookup; the member has to too */
+	if (inp_restricted_recv(member, ifp)) {
+		return inp;
+	}
+#if NECP
+	if (!necp_socket_is_allowed_to_recv_on_interface(member, ifp)) {
+		return inp;
+	}
+#endif /* NECP */
+	return member;
+}
+
 /*
  * Move PCB to the proper hash bucket when { faddr, fport } have  been
  * changed. NOTE: This does not handle the case of the lport changing (the
@@ -2579,9 +3040,17 @@ in_pcbrehash(struct inpcb *inp)
 	}
 
 	VERIFY(!(inp->inp_flags2 & INP2_INHASHLIST));
-	LIST_INSERT_HEAD(head, inp, inp_hash);
+	in_pcbhash_insert_head(head, inp);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
+	/*
+	 * A connected pcb only gets the packets of its own flow; it is
+	 * not put back in a group when disconnected.
+	 */
+	if (inp->inp_fport != 0 || hashkey_faddr != INADDR_ANY) {
+		in_pcblbgroup_remove(inp);
+	}
+
 #if NECP
 	// This call catches updates to the remote addresses
 	inp_update_necp_policy(inp, NULL, NULL, 0);
@@ -2607,8 +3076,8 @@ in_pcbremlists(struct inpcb *inp)
 
 		VERIFY(phd != NULL && inp->inp_lport > 0);
 
+		/* le_next stays valid for lockless lookups walking past */
 		LIST_REMOVE(inp, inp_hash);
-		inp->inp_hash.le_next = NULL;
 		inp->inp_hash.le_prev = NULL;
 
 		LIST_REMOVE(inp, inp_portlist);
@@ -2622,6 +3091,7 @@ in_pcbremlists(struct inpcb *inp)
 		inp->inp_flags2 &= ~INP2_INHASHLIST;
 	}
 	VERIFY(!(inp->inp_flags2 & INP2_INHASHLIST));
+	in_pcblbgroup_remove(inp);
 
 	if (inp->inp_flags2 & INP2_TIMEWAIT) {
 		/* Remove from time-wait queue */
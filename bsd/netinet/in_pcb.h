@@ -104,6 +104,7 @@
  */
 LIST_HEAD(inpcbhead, inpcb);
 LIST_HEAD(inpcbporthead, inpcbport);
+LIST_HEAD(inpcblbgrouphead, inpcblbgroup);
 #endif /* BSD_KERNEL_PRIVATE */
 typedef u_quad_t        inp_gen_t;
 
@@ -149,6 +150,7 @@ struct inpcb {
 	LIST_ENTRY(inpcb) inp_portlist; /* list for this PCB's local port */
 	RB_ENTRY(inpcb) infc_link;      /* link for flowhash RB tree */
 	struct inpcbport *inp_phd;      /* head of this list */
+	struct inpcblbgroup *inp_lbgroup; /* SO_REUSEPORT group, if any */
 	inp_gen_t inp_gencnt;           /* generation count of this instance */
 	int     inp_hash_element;       /* array index of pcb's hash list */
 	int     inp_wantcnt;            /* wanted count; atomically updated */
@@ -522,6 +524,22 @@ struct inpcbport {
 	u_short phd_port;
 };
 
+/*
+ * Load balancing group: the unconnected pcbs bound with SO_REUSEPORT to
+ * the same local address and port.  A lookup that lands on one of them
+ * picks a member of its group instead, so that new connections and
+ * datagrams are spread across all the sockets.
+ */
+struct inpcblbgroup {
+	LIST_ENTRY(inpcblbgroup) il_list;
+	u_short il_lport;               /* local port */
+	u_char il_vflag;                /* INP_IPV4 and/or INP_IPV6 */
+	struct in6_addr il_laddr;       /* local address, as in_dependladdr */
+	u_int32_t il_inpcnt;            /* number of members */
+	u_int32_t il_inpsiz;            /* size of il_inp */
+	struct inpcb **il_inp;          /* members, in order of joining */
+};
+
 struct intimercount {
 	u_int32_t intimer_lazy; /* lazy requests for timer scheduling */
 	u_int32_t intimer_fast; /* fast requests, can be coalesced */
@@ -596,6 +614,13 @@ struct inpcbinfo {
 	struct inpcbporthead    *ipi_porthashbase;
 	u_long                  ipi_porthashmask;
 
+	/*
+	 * Per-protocol hash of SO_REUSEPORT load balancing groups,
+	 * hashed by local port number.
+	 */
+	struct inpcblbgrouphead *ipi_lbgrouphashbase;
+	u_long                  ipi_lbgrouphashmask;
+
 	/*
 	 * Misc.
 	 */
@@ -612,6 +637,13 @@ struct inpcbinfo {
 	(((faddr) ^ ((faddr) >> 16) ^ ntohs((lport) ^ (fport))) & (mask))
 #define INP_PCBPORTHASH(lport, mask) \
 	(ntohs((lport)) & (mask))
+#define INP_PCBLBGROUP_PKTHASH(faddr, lport, fport) \
+	((faddr) ^ ((faddr) >> 16) ^ ntohs((lport) ^ (fport)))
+
+/* values of net.inet.ip.reuseport_lb */
+#define INP_LBGROUP_NONE        0       /* first pcb found gets everything */
+#define INP_LBGROUP_HASH        1       /* hash of the 4-tuple */
+#define INP_LBGROUP_CPU         2       /* CPU the packet is processed on */
 
 #define INP_IS_FLOW_CONTROLLED(_inp_) \
 	((_inp_)->inp_flags & INP_FLOW_CONTROLLED)
@@ -753,6 +785,11 @@ extern void in_pcbinit(void);
 extern void in_pcbinfo_attach(struct inpcbinfo *);
 extern int in_pcbinfo_detach(struct inpcbinfo *);
 
+/* SMR domain of the lockless pcb lookups */
+struct smr;
+extern struct smr inpcb_smr;
+extern int inp_lookup_smr;
+
 /* type of timer to be scheduled by inpcb_gc_sched and inpcb_timer_sched */
 enum {
 	INPCB_TIMER_LAZY = 0x1,
@@ -785,6 +822,8 @@ extern int in_pcblookup_hash_exists(struct inpcbinfo *, struct in_addr,
 extern void in_pcbnotifyall(struct inpcbinfo *, struct in_addr, int,
     void (*)(struct inpcb *, int));
 extern void in_pcbrehash(struct inpcb *);
+extern struct inpcb *in_pcblbgroup_select(struct inpcb *, u_int32_t,
+    struct ifnet *);
 extern int in_getpeeraddr(struct socket *, struct sockaddr **);
 extern int in_getsockaddr(struct socket *, struct sockaddr **);
 extern int in_getsockaddr_s(struct socket *, struct sockaddr_in *);
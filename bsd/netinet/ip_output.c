@@ -1548,6 +1548,7 @@ skip_ipsec:
 	 * care of the fragmentation for us, can just send directly.
 	 */
 	if ((u_short)ip->ip_len <= interface_mtu || TSO_IPV4_OK(ifp, m) ||
+	    GSO_MARKED(m) ||
 	    (!(ip->ip_off & IP_DF) && (ifp->if_hwassist & CSUM_FRAGMENT))) {
 #if BYTE_ORDER != BIG_ENDIAN
 		HTONS(ip->ip_len);
@@ -3320,6 +3321,14 @@ ip_output_checksum(struct ifnet *ifp, struct mbuf *m, int hlen, int ip_len,
 
 	m->m_pkthdr.csum_flags |= CSUM_IP;
 
+	/* also catches routing changes, see pf_route() */
+	GSO_MARK(m, GSO_IPV4_OK(ifp, m));
+	if (GSO_MARKED(m)) {
+		/* tcp_gso_segment() computes each segment's checksums */
+		*sw_csum = 0;
+		return;
+	}
+
 	if (!hwcksum_tx) {
 		/* do all in software; hardware checksum offload is disabled */
 		*sw_csum = (CSUM_DELAY_DATA | CSUM_DELAY_IP) &
@@ -310,6 +310,14 @@ struct tcp_notify_ack_complete {
 #define TCP_FASTOPEN_FORCE_ENABLE       0x218
 #define MPTCP_EXPECTED_PROGRESS_TARGET  0x219
 
+/*
+ * Select the congestion control algorithm of a connection. The value
+ * is one of the TCP_CC_ALGO_*_INDEX values from <netinet/tcp_cc.h>
+ * other than the background one, or 0 to go back to the system default.
+ * Getting it returns the algorithm the connection uses in the foreground.
+ */
+#define TCP_CC_ALGORITHM                0x21a
+
 /*
  * The TCP_INFO socket option is a private API and is subject to change
  */
@@ -443,6 +451,7 @@ struct tcp_info {
 	u_int32_t       tcpi_flowhash;          /* Unique id for the connection */
 
 	u_int64_t       tcpi_txretransmitpackets __attribute__((aligned(8)));
+	u_int64_t       tcpi_pacing_rate __attribute__((aligned(8))); /* pacing rate in bytes/sec, 0 if not paced */
 };
 
 struct tcp_measure_bw_burst {
@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * BBR congestion control (draft-cardwell-iccrg-bbr-congestion-control).
+ *
+ * Instead of reacting to loss, BBR keeps a model of the path made of
+ * the bottleneck bandwidth (the max delivery rate seen over the last
+ * ten round trips) and the propagation delay (the min RTT seen over the
+ * last ten seconds). The congestion window is a multiple of the
+ * bandwidth-delay product and t_pacing_rate is set to the bandwidth
+ * times a gain that cycles to probe for more bandwidth and then drain
+ * the queue this created.
+ *
+ * The delivery rate is sampled once per round trip, as the data
+ * cumulatively acked during the round over the time it took to ack it.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/protosw.h>
+#include <sys/socketvar.h>
+#include <sys/sysctl.h>
+
+#include <net/route.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcpip.h>
+#include <netinet/tcp_cc.h>
+
+#include <dev/random/randomdev.h>
+#include <libkern/OSAtomic.h>
+#include <mach/clock_types.h>
+
+static int tcp_bbr_init(struct tcpcb *tp);
+static int tcp_bbr_cleanup(struct tcpcb *tp);
+static void tcp_bbr_cwnd_init(struct tcpcb *tp);
+static void tcp_bbr_ack_rcvd(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_pre_fr(struct tcpcb *tp);
+static void tcp_bbr_post_fr(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_after_idle(struct tcpcb *tp);
+static void tcp_bbr_after_timeout(struct tcpcb *tp);
+static int tcp_bbr_delay_ack(struct tcpcb *tp, struct tcphdr *th);
+static void tcp_bbr_switch_cc(struct tcpcb *tp, uint16_t old_cc_index);
+
+struct tcp_cc_algo tcp_cc_bbr = {
+	.name = "bbr",
+	.init = tcp_bbr_init,
+	.cleanup = tcp_bbr_cleanup,
+	.cwnd_init = tcp_bbr_cwnd_init,
+	.congestion_avd = tcp_bbr_ack_rcvd,
+	.ack_rcvd = tcp_bbr_ack_rcvd,
+	.pre_fr = tcp_bbr_pre_fr,
+	.post_fr = tcp_bbr_post_fr,
+	.after_idle = tcp_bbr_after_idle,
+	.after_timeout = tcp_bbr_after_timeout,
+	.delay_ack = tcp_bbr_delay_ack,
+	.switch_to = tcp_bbr_switch_cc
+};
+
+/* Values of bbr_mode */
+#define TCP_BBR_STARTUP         0       /* ramp up to fill the pipe */
+#define TCP_BBR_DRAIN           1       /* drain the queue built in STARTUP */
+#define TCP_BBR_PROBE_BW        2       /* cycle the gain around 1 */
+#define TCP_BBR_PROBE_RTT       3       /* shrink inflight to see the min RTT */
+
+/* Values of bbr_flags */
+#define TCP_BBR_ROUND_STARTED   0x01    /* a round trip is being timed */
+#define TCP_BBR_APP_LIMITED     0x02    /* the sender ran out of data */
+#define TCP_BBR_FULL_BW         0x04    /* STARTUP has filled the pipe */
+#define TCP_BBR_IDLE_RESTART    0x08    /* sending resumed after idle */
+
+/* Gains are fixed point numbers in units of 1/256 */
+#define TCP_BBR_SCALE           8
+#define TCP_BBR_UNIT            (1 << TCP_BBR_SCALE)
+#define TCP_BBR_HIGH_GAIN       739     /* 2/ln(2), doubles every round */
+#define TCP_BBR_DRAIN_GAIN      88      /* 1/TCP_BBR_HIGH_GAIN */
+#define TCP_BBR_CWND_GAIN       (2 * TCP_BBR_UNIT)
+
+#define TCP_BBR_CYCLE_LEN       8
+static const u_int16_t tcp_bbr_pacing_cycle[TCP_BBR_CYCLE_LEN] = {
+	TCP_BBR_UNIT * 5 / 4,   /* probe for more bandwidth */
+	TCP_BBR_UNIT * 3 / 4,   /* drain the queue this built */
+	TCP_BBR_UNIT, TCP_BBR_UNIT, TCP_BBR_UNIT,
+	TCP_BBR_UNIT, TCP_BBR_UNIT, TCP_BBR_UNIT
+};
+
+/* STARTUP is over when the bandwidth grew less than 25% in 3 rounds */
+#define TCP_BBR_FULL_BW_THRESH  (TCP_BBR_UNIT * 5 / 4)
+#define TCP_BBR_FULL_BW_ROUNDS  3
+
+#define TCP_BBR_MIN_CWND(_tp_)  (4 * (_tp_)->t_maxseg)
+
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, bbr_min_rtt_win, CTLFLAG_RW | CTLFLAG_LOCKED,
+    static int, tcp_bbr_min_rtt_win, 10 * TCP_RETRANSHZ,
+    "Time in ms after which BBR probes for a new min RTT");
+
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, bbr_probe_rtt_time, CTLFLAG_RW | CTLFLAG_LOCKED,
+    static int, tcp_bbr_probe_rtt_time, 200,
+    "Time in ms BBR keeps inflight small to measure the min RTT");
+
+static inline u_int64_t
+tcp_bbr_uptime_us(void)
+{
+	struct timeval tv;
+
+	microuptime(&tv);
+	return (u_int64_t)tv.tv_sec * USEC_PER_SEC + tv.tv_usec;
+}
+
+/*
+ * Bottleneck bandwidth in bytes per second, the max of the delivery
+ * rate samples in the filter. Zero until the first round completes.
+ */
+uint64_t
+tcp_bbr_max_bw(struct tcpcb *tp)
+{
+	u_int64_t bw = 0;
+	int i;
+
+	for (i = 0; i < TCP_BBR_BW_ROUNDS; i++) {
+		if (tp->t_bbrstate->bbr_bw[i] > bw) {
+			bw = tp->t_bbrstate->bbr_bw[i];
+		}
+	}
+	return bw;
+}
+
+/*
+ * Bandwidth-delay product scaled by gain, or the initial window while
+ * the model does not have a sample of each yet.
+ */
+static u_int32_t
+tcp_bbr_bdp(struct tcpcb *tp, u_int64_t bw, u_int32_t gain)
+{
+	u_int64_t bdp;
+
+	if (bw == 0 || tp->t_bbrstate->bbr_min_rtt == 0) {
+		return tcp_initial_cwnd(tp);
+	}
+	bdp = bw * tp->t_bbrstate->bbr_min_rtt / TCP_RETRANSHZ;
+	bdp = (bdp * gain) >> TCP_BBR_SCALE;
+	return (u_int32_t)MIN(bdp, TCP_MAXWIN << TCP_MAX_WINSHIFT);
+}
+
+static void
+tcp_bbr_reset_model(struct tcpcb *tp)
+{
+	bzero(tp->t_bbrstate, sizeof(*tp->t_bbrstate));
+	tp->t_bbrstate->bbr_mode = TCP_BBR_STARTUP;
+	tp->t_bbrstate->bbr_pacing_gain = TCP_BBR_HIGH_GAIN;
+	tp->t_bbrstate->bbr_cwnd_gain = TCP_BBR_HIGH_GAIN;
+	tp->t_pacing_rate = 0;
+}
+
+/* Remember the window to go back to after recovery or PROBE_RTT */
+static void
+tcp_bbr_save_cwnd(struct tcpcb *tp)
+{
+	if (!IN_FASTRECOVERY(tp) &&
+	    tp->t_bbrstate->bbr_mode != TCP_BBR_PROBE_RTT) {
+		tp->t_bbrstate->bbr_prior_cwnd = tp->snd_cwnd;
+	} else {
+		tp->t_bbrstate->bbr_prior_cwnd = max(tp->snd_cwnd,
+		    tp->t_bbrstate->bbr_prior_cwnd);
+	}
+}
+
+static void
+tcp_bbr_enter_probe_bw(struct tcpcb *tp)
+{
+	u_int8_t idx;
+
+	/* Start anywhere in the cycle but in the drain phase */
+	idx = (u_int8_t)(RandomULong() % (TCP_BBR_CYCLE_LEN - 1));
+	if (idx >= 1) {
+		idx++;
+	}
+	tp->t_bbrstate->bbr_mode = TCP_BBR_PROBE_BW;
+	tp->t_bbrstate->bbr_cycle_idx = idx;
+	tp->t_bbrstate->bbr_cycle_stamp = tcp_now;
+	tp->t_bbrstate->bbr_pacing_gain = tcp_bbr_pacing_cycle[idx];
+	tp->t_bbrstate->bbr_cwnd_gain = TCP_BBR_CWND_GAIN;
+}
+
+/*
+ * Take a new RTT sample, if tcp_xmit_timer made one, and go to
+ * PROBE_RTT when the min RTT has not been seen again for a while.
+ */
+static void
+tcp_bbr_update_min_rtt(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	boolean_t expired;
+
+	expired = (bs->bbr_min_rtt != 0 &&
+	    TSTMP_GT(tcp_now, bs->bbr_min_rtt_stamp + tcp_bbr_min_rtt_win));
+
+	if (tp->t_rttupdated != bs->bbr_rtt_updates && tp->t_rttcur > 0) {
+		bs->bbr_rtt_updates = tp->t_rttupdated;
+		if (bs->bbr_min_rtt == 0 || tp->t_rttcur <= bs->bbr_min_rtt ||
+		    expired) {
+			bs->bbr_min_rtt = tp->t_rttcur;
+			bs->bbr_min_rtt_stamp = tcp_now;
+		}
+	}
+
+	if (expired && bs->bbr_mode != TCP_BBR_PROBE_RTT &&
+	    !(bs->bbr_flags & TCP_BBR_IDLE_RESTART)) {
+		tcp_bbr_save_cwnd(tp);
+		bs->bbr_mode = TCP_BBR_PROBE_RTT;
+		bs->bbr_pacing_gain = TCP_BBR_UNIT;
+		bs->bbr_cwnd_gain = TCP_BBR_UNIT;
+		bs->bbr_probe_rtt_done = 0;
+	}
+}
+
+/*
+ * Time the round trips and feed the delivery rate of each one into the
+ * max filter. Returns TRUE when this ack ended a round.
+ */
+static boolean_t
+tcp_bbr_update_bw(struct tcpcb *tp, struct tcphdr *th)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	struct sockbuf *sb = &tp->t_inpcb->inp_socket->so_snd;
+	u_int32_t inflight = tp->snd_max - th->th_ack;
+	u_int64_t now = tcp_bbr_uptime_us();
+	u_int64_t bw;
+
+	if (!(bs->bbr_flags & TCP_BBR_ROUND_STARTED)) {
+		goto new_round;
+	}
+
+	/*
+	 * A round that ran out of data or window says little about the
+	 * path; its rate only counts if it beats the current estimate.
+	 */
+	if (sb->sb_cc <= tp->snd_max - tp->snd_una + tp->t_maxseg &&
+	    inflight < tp->snd_cwnd) {
+		bs->bbr_flags |= TCP_BBR_APP_LIMITED;
+	}
+
+	if (SEQ_LT(th->th_ack, bs->bbr_round_end)) {
+		return FALSE;
+	}
+
+	if (now > bs->bbr_round_start) {
+		bw = (u_int64_t)(th->th_ack - bs->bbr_round_una) *
+		    USEC_PER_SEC / (now - bs->bbr_round_start);
+		if (!(bs->bbr_flags & TCP_BBR_APP_LIMITED) ||
+		    bw >= tcp_bbr_max_bw(tp)) {
+			bs->bbr_bw[bs->bbr_bw_idx] = bw;
+			bs->bbr_bw_idx = (bs->bbr_bw_idx + 1) % TCP_BBR_BW_ROUNDS;
+		}
+	}
+	bs->bbr_round_count++;
+
+	/* Is the pipe full yet? */
+	if (!(bs->bbr_flags & (TCP_BBR_FULL_BW | TCP_BBR_APP_LIMITED))) {
+		bw = tcp_bbr_max_bw(tp);
+		if (bw >= (bs->bbr_full_bw * TCP_BBR_FULL_BW_THRESH) >>
+		    TCP_BBR_SCALE) {
+			bs->bbr_full_bw = bw;
+			bs->bbr_full_bw_cnt = 0;
+		} else if (++bs->bbr_full_bw_cnt >= TCP_BBR_FULL_BW_ROUNDS) {
+			bs->bbr_flags |= TCP_BBR_FULL_BW;
+		}
+	}
+
+new_round:
+	bs->bbr_flags |= TCP_BBR_ROUND_STARTED;
+	bs->bbr_flags &= ~TCP_BBR_APP_LIMITED;
+	bs->bbr_round_una = th->th_ack;
+	bs->bbr_round_end = tp->snd_max;
+	bs->bbr_round_start = now;
+	return TRUE;
+}
+
+/* Move through the PROBE_BW gain cycle, one phase per min RTT */
+static void
+tcp_bbr_update_cycle(struct tcpcb *tp, u_int32_t inflight)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	u_int64_t bw = tcp_bbr_max_bw(tp);
+	boolean_t elapsed, advance;
+
+	elapsed = TSTMP_GT(tcp_now, bs->bbr_cycle_stamp +
+	    max(bs->bbr_min_rtt, 1));
+
+	if (bs->bbr_pacing_gain > TCP_BBR_UNIT) {
+		/* Keep probing until the extra data is actually in flight */
+		advance = elapsed && (inflight >= tcp_bbr_bdp(tp, bw,
+		    bs->bbr_pacing_gain) ||
+		    (bs->bbr_flags & TCP_BBR_APP_LIMITED));
+	} else if (bs->bbr_pacing_gain < TCP_BBR_UNIT) {
+		/* Stop draining as soon as the queue is gone */
+		advance = elapsed ||
+		    inflight <= tcp_bbr_bdp(tp, bw, TCP_BBR_UNIT);
+	} else {
+		advance = elapsed;
+	}
+
+	if (advance) {
+		bs->bbr_cycle_idx = (bs->bbr_cycle_idx + 1) % TCP_BBR_CYCLE_LEN;
+		bs->bbr_cycle_stamp = tcp_now;
+		bs->bbr_pacing_gain = tcp_bbr_pacing_cycle[bs->bbr_cycle_idx];
+	}
+}
+
+/*
+ * Stay in PROBE_RTT for a round and at least tcp_bbr_probe_rtt_time
+ * once inflight is down to the minimum window.
+ */
+static void
+tcp_bbr_update_probe_rtt(struct tcpcb *tp, struct tcphdr *th,
+    u_int32_t inflight)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+
+	if (bs->bbr_probe_rtt_done == 0) {
+		if (inflight <= TCP_BBR_MIN_CWND(tp)) {
+			bs->bbr_probe_rtt_done = tcp_now + tcp_bbr_probe_rtt_time;
+			if (bs->bbr_probe_rtt_done == 0) {
+				bs->bbr_probe_rtt_done = 1;
+			}
+			bs->bbr_probe_rtt_end = tp->snd_max;
+		}
+		return;
+	}
+
+	if (SEQ_GEQ(th->th_ack, bs->bbr_probe_rtt_end) &&
+	    TSTMP_GEQ(tcp_now, bs->bbr_probe_rtt_done)) {
+		bs->bbr_min_rtt_stamp = tcp_now;
+		tp->snd_cwnd = max(tp->snd_cwnd, bs->bbr_prior_cwnd);
+		if (bs->bbr_flags & TCP_BBR_FULL_BW) {
+			tcp_bbr_enter_probe_bw(tp);
+		} else {
+			bs->bbr_mode = TCP_BBR_STARTUP;
+			bs->bbr_pacing_gain = TCP_BBR_HIGH_GAIN;
+			bs->bbr_cwnd_gain = TCP_BBR_HIGH_GAIN;
+		}
+	}
+}
+
+static void
+tcp_bbr_set_pacing_rate(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	u_int64_t bw = tcp_bbr_max_bw(tp);
+	u_int64_t rate;
+
+	if (bw == 0) {
+		/* No sample yet, spread the window over the smoothed RTT */
+		u_int32_t srtt = tp->t_srtt >> TCP_RTT_SHIFT;
+
+		if (srtt == 0) {
+			return;
+		}
+		bw = (u_int64_t)tp->snd_cwnd * TCP_RETRANSHZ / srtt;
+	}
+
+	/* Pace 1% below the model to leave room for the queue to drain */
+	rate = (bw * bs->bbr_pacing_gain) >> TCP_BBR_SCALE;
+	rate = rate * 99 / 100;
+
+	/* Never slow down before the pipe is known to be full */
+	if (!(bs->bbr_flags & TCP_BBR_FULL_BW) && rate < tp->t_pacing_rate) {
+		return;
+	}
+	tp->t_pacing_rate = rate;
+}
+
+static void
+tcp_bbr_set_cwnd(struct tcpcb *tp, u_int32_t acked)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	u_int64_t bw = tcp_bbr_max_bw(tp);
+	u_int32_t target, cwnd;
+
+	/* Room for the acks a delayed or stretch acking receiver holds */
+	target = tcp_bbr_bdp(tp, bw, bs->bbr_cwnd_gain) + 3 * tp->t_maxseg;
+
+	cwnd = tp->snd_cwnd;
+	if (bs->bbr_flags & TCP_BBR_FULL_BW) {
+		cwnd = min(cwnd + acked, target);
+	} else if (cwnd < target || bw == 0) {
+		cwnd += acked;
+	}
+	cwnd = max(cwnd, TCP_BBR_MIN_CWND(tp));
+	if (bs->bbr_mode == TCP_BBR_PROBE_RTT) {
+		cwnd = min(cwnd, TCP_BBR_MIN_CWND(tp));
+	}
+	tp->snd_cwnd = min(cwnd, TCP_MAXWIN << tp->snd_scale);
+}
+
+/*
+ * Update the model on the receipt of an ack outside of recovery, then
+ * derive the congestion window and the pacing rate from it.
+ */
+static void
+tcp_bbr_ack_rcvd(struct tcpcb *tp, struct tcphdr *th)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	u_int32_t acked = BYTES_ACKED(th, tp);
+	u_int32_t inflight = tp->snd_max - th->th_ack;
+	boolean_t round_end;
+
+	round_end = tcp_bbr_update_bw(tp, th);
+
+	if (bs->bbr_mode == TCP_BBR_STARTUP && round_end &&
+	    (bs->bbr_flags & TCP_BBR_FULL_BW)) {
+		bs->bbr_mode = TCP_BBR_DRAIN;
+		bs->bbr_pacing_gain = TCP_BBR_DRAIN_GAIN;
+		bs->bbr_cwnd_gain = TCP_BBR_HIGH_GAIN;
+	}
+	if (bs->bbr_mode == TCP_BBR_DRAIN &&
+	    inflight <= tcp_bbr_bdp(tp, tcp_bbr_max_bw(tp), TCP_BBR_UNIT)) {
+		tcp_bbr_enter_probe_bw(tp);
+	}
+	if (bs->bbr_mode == TCP_BBR_PROBE_BW) {
+		tcp_bbr_update_cycle(tp, inflight);
+	}
+
+	tcp_bbr_update_min_rtt(tp);
+	if (bs->bbr_mode == TCP_BBR_PROBE_RTT) {
+		tcp_bbr_update_probe_rtt(tp, th, inflight);
+	}
+	if (acked > 0) {
+		bs->bbr_flags &= ~TCP_BBR_IDLE_RESTART;
+	}
+
+	tcp_bbr_set_pacing_rate(tp);
+	tcp_bbr_set_cwnd(tp, acked);
+}
+
+static int
+tcp_bbr_init(struct tcpcb *tp)
+{
+	OSIncrementAtomic((volatile SInt32 *)&tcp_cc_bbr.num_sockets);
+
+	VERIFY(tp->t_bbrstate != NULL);
+	tcp_bbr_reset_model(tp);
+	return 0;
+}
+
+static int
+tcp_bbr_cleanup(struct tcpcb *tp)
+{
+	OSDecrementAtomic((volatile SInt32 *)&tcp_cc_bbr.num_sockets);
+	tp->t_pacing_rate = 0;
+	return 0;
+}
+
+/*
+ * Initialize the congestion window at the beginning of a connection or
+ * when the MSS changed. The model starts over in STARTUP.
+ */
+static void
+tcp_bbr_cwnd_init(struct tcpcb *tp)
+{
+	VERIFY(tp->t_bbrstate != NULL);
+
+	tcp_bbr_reset_model(tp);
+	tcp_cc_cwnd_init_or_reset(tp);
+	tp->t_pipeack = 0;
+	tcp_clear_pipeack_state(tp);
+	tp->t_bytes_acked = 0;
+
+	/* BBR does not use a slow start threshold */
+	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+}
+
+/*
+ * Loss does not change the model. Recovery runs with the window
+ * clamped to what is in flight, and the window from before the loss
+ * is restored afterwards.
+ */
+static void
+tcp_bbr_pre_fr(struct tcpcb *tp)
+{
+	u_int32_t flight = tp->snd_max - tp->snd_una;
+
+	tcp_bbr_save_cwnd(tp);
+	tp->snd_ssthresh = max(min(flight, tp->snd_cwnd),
+	    TCP_BBR_MIN_CWND(tp));
+}
+
+static void
+tcp_bbr_post_fr(struct tcpcb *tp, struct tcphdr *th)
+{
+#pragma unused(th)
+	tp->snd_cwnd = max(tp->snd_cwnd, tp->t_bbrstate->bbr_prior_cwnd);
+	tp->snd_cwnd = min(tp->snd_cwnd, TCP_MAXWIN << tp->snd_scale);
+	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+}
+
+/*
+ * Keep the model across idle periods, but do not let the time spent
+ * idle into the next delivery rate sample, nor go to PROBE_RTT just
+ * because no RTT was measured while idle.
+ */
+static void
+tcp_bbr_after_idle(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+
+	bs->bbr_flags |= TCP_BBR_IDLE_RESTART;
+	bs->bbr_flags &= ~TCP_BBR_ROUND_STARTED;
+	if (bs->bbr_mode == TCP_BBR_PROBE_BW) {
+		tp->t_pacing_rate = tcp_bbr_max_bw(tp) * 99 / 100;
+	}
+}
+
+/*
+ * The draft keeps the whole model across a retransmission timeout.  A
+ * timeout here comes as often from the path changing under the
+ * connection, e.g. on an interface handover, as from a burst of loss, so
+ * the bandwidth side of the model starts over in STARTUP.  Only the min
+ * RTT is kept; it expires on its own if the path got longer.
+ */
+static void
+tcp_bbr_after_timeout(struct tcpcb *tp)
+{
+	struct tcp_bbr_state *bs = tp->t_bbrstate;
+	u_int32_t min_rtt, min_rtt_stamp, rtt_updates;
+
+	VERIFY(bs != NULL);
+
+	/*
+	 * Avoid adjusting congestion window due to SYN retransmissions.
+	 * If more than one byte (SYN) is outstanding then it is still
+	 * needed to adjust the window.
+	 */
+	if (tp->t_state < TCPS_ESTABLISHED &&
+	    ((int)(tp->snd_max - tp->snd_una) <= 1)) {
+		return;
+	}
+
+	min_rtt = bs->bbr_min_rtt;
+	min_rtt_stamp = bs->bbr_min_rtt_stamp;
+	rtt_updates = bs->bbr_rtt_updates;
+	tcp_bbr_reset_model(tp);
+	bs->bbr_min_rtt = min_rtt;
+	bs->bbr_min_rtt_stamp = min_rtt_stamp;
+	bs->bbr_rtt_updates = rtt_updates;
+
+	/*
+	 * Restart from one segment; STARTUP grows the window back as the
+	 * retransmissions are acked.
+	 */
+	tp->snd_cwnd = tp->t_maxseg;
+}
+
+static int
+tcp_bbr_delay_ack(struct tcpcb *tp, struct tcphdr *th)
+{
+	return tcp_cc_delay_ack(tp, th);
+}
+
+/*
+ * State left by another algorithm says nothing about the path model,
+ * start over in STARTUP from the current window.
+ */
+static void
+tcp_bbr_switch_cc(struct tcpcb *tp, uint16_t old_cc_index)
+{
+#pragma unused(old_cc_index)
+	tcp_bbr_reset_model(tp);
+	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+
+	OSIncrementAtomic((volatile SInt32 *)&tcp_cc_bbr.num_sockets);
+}
@@ -61,10 +61,19 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, cubic_sockets,
     CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_cc_cubic.num_sockets,
     0, "Number of sockets using cubic");
 
+extern struct tcp_cc_algo tcp_cc_bbr;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, bbr_sockets,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_cc_bbr.num_sockets,
+    0, "Number of sockets using BBR");
+
 SYSCTL_SKMEM_TCP_INT(OID_AUTO, use_newreno,
     CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_use_newreno, 0,
     "Use TCP NewReno by default");
 
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, use_bbr,
+    CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_use_bbr, 0,
+    "Use BBR by default");
+
 static int tcp_check_cwnd_nonvalidated = 1;
 #if (DEBUG || DEVELOPMENT)
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, cwnd_nonvalidated,
@@ -79,6 +88,7 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, cwnd_nonvalidated,
 /* Array containing pointers to currently implemented TCP CC algorithms */
 struct tcp_cc_algo* tcp_cc_algo_list[TCP_CC_ALGO_COUNT];
 struct zone *tcp_cc_zone;
+struct zone *tcp_bbr_zone;
 
 #define TCP_CCDBG_NOUNIT 0xffffffff
 static kern_ctl_ref tcp_ccdbg_ctlref = NULL;
@@ -105,6 +115,7 @@ tcp_cc_init(void)
 	tcp_cc_algo_list[TCP_CC_ALGO_NEWRENO_INDEX] = &tcp_cc_newreno;
 	tcp_cc_algo_list[TCP_CC_ALGO_BACKGROUND_INDEX] = &tcp_cc_ledbat;
 	tcp_cc_algo_list[TCP_CC_ALGO_CUBIC_INDEX] = &tcp_cc_cubic;
+	tcp_cc_algo_list[TCP_CC_ALGO_BBR_INDEX] = &tcp_cc_bbr;
 
 	tcp_cc_control_register();
 }
@@ -230,6 +241,20 @@ tcp_ccdbg_trace(struct tcpcb *tp, struct tcphdr *th, int32_t event)
 			dbg_state.u.ledbat_state.led_base_rtt =
 			    get_base_rtt(tp);
 			break;
+		case TCP_CC_ALGO_BBR_INDEX:
+			dbg_state.u.bbr_state.ccd_max_bw =
+			    (uint32_t)MIN(tcp_bbr_max_bw(tp) * 8 / 1000,
+			    UINT32_MAX);
+			dbg_state.u.bbr_state.ccd_min_rtt =
+			    tp->t_bbrstate->bbr_min_rtt;
+			dbg_state.u.bbr_state.ccd_pacing_rate =
+			    (uint32_t)MIN(tp->t_pacing_rate * 8 / 1000,
+			    UINT32_MAX);
+			dbg_state.u.bbr_state.ccd_pacing_gain =
+			    tp->t_bbrstate->bbr_pacing_gain;
+			dbg_state.u.bbr_state.ccd_mode =
+			    tp->t_bbrstate->bbr_mode;
+			break;
 		default:
 			break;
 		}
@@ -383,6 +408,10 @@ tcp_cc_delay_ack(struct tcpcb *tp, struct tcphdr *th)
 void
 tcp_cc_allocate_state(struct tcpcb *tp)
 {
+	if (tp->tcp_cc_index == TCP_CC_ALGO_BBR_INDEX &&
+	    tp->t_bbrstate == NULL) {
+		tp->t_bbrstate = zalloc_flags(tcp_bbr_zone, Z_WAITOK | Z_ZERO);
+	}
 	if (tp->tcp_cc_index == TCP_CC_ALGO_CUBIC_INDEX &&
 	    tp->t_ccstate == NULL) {
 		tp->t_ccstate = (struct tcp_ccstate *)zalloc(tcp_cc_zone);
@@ -400,6 +429,25 @@ tcp_cc_allocate_state(struct tcpcb *tp)
 	}
 }
 
+/*
+ * Pick the algorithm for a connection that is not a background transport:
+ * the one set with TCP_CC_ALGORITHM if any, otherwise the system default.
+ */
+uint16_t
+tcp_cc_foreground_index(struct tcpcb *tp)
+{
+	if (tp->t_cc_user_index != TCP_CC_ALGO_NONE) {
+		return tp->t_cc_user_index;
+	}
+	if (tcp_use_newreno) {
+		return TCP_CC_ALGO_NEWRENO_INDEX;
+	}
+	if (tcp_use_bbr) {
+		return TCP_CC_ALGO_BBR_INDEX;
+	}
+	return TCP_CC_ALGO_CUBIC_INDEX;
+}
+
 /*
  * If stretch ack was disabled automatically on long standing connections,
  * re-evaluate the situation after 15 minutes to enable it.
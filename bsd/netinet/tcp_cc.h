@@ -99,6 +99,13 @@ struct tcp_cc_debug_state {
 		struct {
 			u_int32_t led_base_rtt;
 		} ledbat_state;
+		struct {
+			uint32_t ccd_max_bw;    /* bottleneck bandwidth, kbit/s */
+			uint32_t ccd_min_rtt;   /* ms */
+			uint32_t ccd_pacing_rate; /* kbit/s */
+			uint32_t ccd_pacing_gain; /* in units of 1/256 */
+			uint32_t ccd_mode;      /* STARTUP, DRAIN, PROBE_BW, PROBE_RTT */
+		} bbr_state;
 	} u;
 };
 
@@ -109,7 +116,8 @@ struct tcp_cc_debug_state {
 #define TCP_CC_ALGO_NEWRENO_INDEX       1
 #define TCP_CC_ALGO_BACKGROUND_INDEX    2 /* CC for background transport */
 #define TCP_CC_ALGO_CUBIC_INDEX         3 /* default CC algorithm */
-#define TCP_CC_ALGO_COUNT               4 /* Count of CC algorithms */
+#define TCP_CC_ALGO_BBR_INDEX           4 /* model-based, paced CC */
+#define TCP_CC_ALGO_COUNT               5 /* Count of CC algorithms */
 
 /*
  * Values of ccd_event
@@ -218,6 +226,7 @@ struct tcp_cc_algo {
 } __attribute__((aligned(4)));
 
 extern struct zone *tcp_cc_zone;
+extern struct zone *tcp_bbr_zone;
 
 extern struct tcp_cc_algo* tcp_cc_algo_list[TCP_CC_ALGO_COUNT];
 
@@ -243,6 +252,8 @@ extern uint32_t tcp_cc_is_cwnd_nonvalidated(struct tcpcb *tp);
 extern void tcp_cc_adjust_nonvalidated_cwnd(struct tcpcb *tp);
 extern u_int32_t tcp_get_max_pipeack(struct tcpcb *tp);
 extern void tcp_clear_pipeack_state(struct tcpcb *tp);
+extern uint16_t tcp_cc_foreground_index(struct tcpcb *tp);
+extern uint64_t tcp_bbr_max_bw(struct tcpcb *tp);
 
 static inline uint32_t
 tcp_initial_cwnd(struct tcpcb *tp)
@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Software receive coalescing of TCP segments.
+ *
+ * dlil hands each protocol a list of packets received in one batch.
+ * Before that list goes to ip_input/ip6_input, in-order data segments
+ * of the same connection are merged into a single packet whose mbuf
+ * chain carries all of the payload, so that tcp_input runs once for
+ * the whole run of segments.  The merged packet keeps the headers of
+ * the first segment, takes the window of the last one, and records
+ * the number of segments in m_pkthdr.seg_cnt just like hardware LRO.
+ *
+ * Only segments whose TCP checksum was fully validated by the hardware
+ * are merged, which lets the merged packet claim a valid checksum
+ * without touching the payload.  Anything unusual (options other than
+ * timestamps, flags other than ACK/PSH, IP options or fragments) is
+ * passed up untouched and flushes the flow it belongs to first, so the
+ * order of packets within a connection never changes.
+ *
+ * Nothing is merged while the host forwards packets of the protocol
+ * family: a merged packet larger than the MTU of the outgoing interface
+ * would have to be fragmented, or dropped when DF is set.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/sysctl.h>
+#include <sys/malloc.h>
+
+#include <kern/assert.h>
+#include <libkern/OSAtomic.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/dlil.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_var.h>
+#include <netinet6/ip6_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_var.h>
+
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, gro, CTLFLAG_RW | CTLFLAG_LOCKED,
+    int, tcp_gro, 1, "Coalesce received TCP segments in software");
+
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, gro_max_segs, CTLFLAG_RW | CTLFLAG_LOCKED,
+    int, tcp_gro_max_segs, 44, "Maximum segments coalesced into one packet");
+
+#define TCP_GRO_FLOWS           8       /* flows tracked per batch */
+
+/* NOP, NOP, timestamp option: the only options we merge across */
+#define TCP_GRO_TSOPT           htonl(TCPOPT_TSTAMP_HDR)
+#define TCP_GRO_TSOPT_LEN       TCPOLEN_TSTAMP_APPA
+
+struct tcp_gro_flow {
+	struct mbuf     *tgf_head;      /* first segment, carries the headers */
+	struct mbuf     *tgf_tail;      /* last mbuf of the merged chain */
+	struct tcphdr   *tgf_th;        /* TCP header of tgf_head */
+	uint32_t        tgf_hash;
+	uint32_t        tgf_hlen;       /* IP + TCP header length */
+	uint32_t        tgf_seglen;     /* payload of the first segment */
+	uint32_t        tgf_len;        /* total payload */
+	uint32_t        tgf_segs;
+	tcp_seq         tgf_next_seq;
+	uint32_t        tgf_stamp;      /* for LRU eviction */
+	int             tgf_af;
+};
+
+struct tcp_gro_pkt {
+	int             tgp_af;
+	void            *tgp_ip;
+	struct tcphdr   *tgp_th;
+	uint32_t        tgp_hash;
+	uint32_t        tgp_hlen;
+	uint32_t        tgp_len;        /* TCP payload */
+	boolean_t       tgp_mergeable;
+};
+
+/*
+ * Parses the IP and TCP headers of a packet.  Returns FALSE for
+ * anything that isn't a TCP segment with its headers in the first mbuf;
+ * otherwise fills in the flow, and whether the segment may be merged.
+ */
+static boolean_t
+tcp_gro_parse(struct mbuf *m, int af, struct tcp_gro_pkt *pkt)
+{
+	struct tcphdr *th;
+	uint32_t iphlen, thlen, len;
+
+	if (af == PF_INET) {
+		struct ip *ip = mtod(m, struct ip *);
+
+		if (m->m_len < (int)(sizeof(*ip) + sizeof(*th)) ||
+		    ip->ip_v != IPVERSION || ip->ip_p != IPPROTO_TCP) {
+			return FALSE;
+		}
+		iphlen = ip->ip_hl << 2;
+		len = ntohs(ip->ip_len);
+		th = (struct tcphdr *)(void *)((caddr_t)ip + iphlen);
+		if (iphlen != sizeof(*ip) ||
+		    m->m_len < (int)(iphlen + sizeof(*th))) {
+			return FALSE;
+		}
+		pkt->tgp_hash = ip->ip_src.s_addr ^ ip->ip_dst.s_addr;
+		pkt->tgp_mergeable =
+		    (ip->ip_off & htons(IP_MF | IP_OFFMASK)) == 0 &&
+		    len == (uint32_t)m->m_pkthdr.len;
+		if (pkt->tgp_mergeable) {
+			uint32_t flags = m->m_pkthdr.csum_flags &
+			    (CSUM_IP_CHECKED | CSUM_IP_VALID);
+
+			if (flags == CSUM_IP_CHECKED) {
+				pkt->tgp_mergeable = FALSE;
+			} else if (flags == 0 && in_cksum_hdr(ip) != 0) {
+				pkt->tgp_mergeable = FALSE;
+			}
+		}
+		pkt->tgp_ip = ip;
+	} else {
+		struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+
+		if (m->m_len < (int)(sizeof(*ip6) + sizeof(*th)) ||
+		    (ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION ||
+		    ip6->ip6_nxt != IPPROTO_TCP) {
+			return FALSE;
+		}
+		iphlen = sizeof(*ip6);
+		len = sizeof(*ip6) + ntohs(ip6->ip6_plen);
+		th = (struct tcphdr *)(void *)(ip6 + 1);
+		pkt->tgp_hash = ip6->ip6_src.s6_addr32[3] ^
+		    ip6->ip6_dst.s6_addr32[3];
+		pkt->tgp_mergeable = len == (uint32_t)m->m_pkthdr.len;
+		pkt->tgp_ip = ip6;
+	}
+	pkt->tgp_hash ^= (th->th_sport << 16) | th->th_dport;
+	pkt->tgp_af = af;
+	pkt->tgp_th = th;
+
+	if (!pkt->tgp_mergeable) {
+		return TRUE;
+	}
+
+	thlen = th->th_off << 2;
+	if (thlen == sizeof(*th) + TCP_GRO_TSOPT_LEN) {
+		if (m->m_len < (int)(iphlen + thlen) ||
+		    *(uint32_t *)(void *)(th + 1) != TCP_GRO_TSOPT) {
+			pkt->tgp_mergeable = FALSE;
+			return TRUE;
+		}
+	} else if (thlen != sizeof(*th)) {
+		pkt->tgp_mergeable = FALSE;
+		return TRUE;
+	}
+	pkt->tgp_hlen = iphlen + thlen;
+	pkt->tgp_len = len - pkt->tgp_hlen;
+
+	/*
+	 * Only data segments whose checksum the hardware has verified over
+	 * the pseudo header; looped back packets have their own path.
+	 */
+	pkt->tgp_mergeable = len > pkt->tgp_hlen &&
+	    (th->th_flags & ~TH_PUSH) == TH_ACK &&
+	    m->m_pkthdr.seg_cnt <= 1 &&
+	    !(m->m_pkthdr.pkt_flags & PKTF_LOOP) &&
+	    (m->m_pkthdr.csum_flags & (CSUM_DATA_VALID | CSUM_PSEUDO_HDR |
+	    CSUM_PARTIAL)) == (CSUM_DATA_VALID | CSUM_PSEUDO_HDR) &&
+	    m->m_pkthdr.csum_rx_val == 0xffff &&
+	    m_tag_first(m) == NULL;
+
+	return TRUE;
+}
+
+static boolean_t
+tcp_gro_same_flow(struct tcp_gro_flow *f, struct mbuf *m,
+    struct tcp_gro_pkt *pkt)
+{
+	struct mbuf *head = f->tgf_head;
+
+	if (f->tgf_hash != pkt->tgp_hash || f->tgf_af != pkt->tgp_af ||
+	    f->tgf_th->th_sport != pkt->tgp_th->th_sport ||
+	    f->tgf_th->th_dport != pkt->tgp_th->th_dport) {
+		return FALSE;
+	}
+	if ((head->m_pkthdr.csum_flags & CSUM_VLAN_TAG_VALID) !=
+	    (m->m_pkthdr.csum_flags & CSUM_VLAN_TAG_VALID) ||
+	    head->m_pkthdr.vlan_tag != m->m_pkthdr.vlan_tag) {
+		return FALSE;
+	}
+	if (pkt->tgp_af == PF_INET) {
+		struct ip *fip = mtod(head, struct ip *);
+		struct ip *ip = pkt->tgp_ip;
+
+		return fip->ip_src.s_addr == ip->ip_src.s_addr &&
+		       fip->ip_dst.s_addr == ip->ip_dst.s_addr;
+	} else {
+		struct ip6_hdr *fip6 = mtod(head, struct ip6_hdr *);
+		struct ip6_hdr *ip6 = pkt->tgp_ip;
+
+		return IN6_ARE_ADDR_EQUAL(&fip6->ip6_src, &ip6->ip6_src) &&
+		       IN6_ARE_ADDR_EQUAL(&fip6->ip6_dst, &ip6->ip6_dst);
+	}
+}
+
+/*
+ * Returns whether the headers of a segment that continues the flow
+ * allow it to be merged; if not, sets the reason for the flush.
+ */
+static boolean_t
+tcp_gro_can_merge(struct tcp_gro_flow *f, struct tcp_gro_pkt *pkt,
+    uint64_t **reason, struct if_gro_stats *stats)
+{
+	struct tcphdr *fth = f->tgf_th, *th = pkt->tgp_th;
+	uint32_t max_segs = MIN(tcp_gro_max_segs, UINT8_MAX);
+
+	if (ntohl(th->th_seq) != f->tgf_next_seq) {
+		*reason = &stats->ifi_gro_flush_ooo;
+		return FALSE;
+	}
+	if (pkt->tgp_hlen != f->tgf_hlen) {
+		*reason = &stats->ifi_gro_flush_ts;
+		return FALSE;
+	}
+	if (pkt->tgp_af == PF_INET) {
+		struct ip *fip = mtod(f->tgf_head, struct ip *);
+		struct ip *ip = pkt->tgp_ip;
+
+		if (fip->ip_tos != ip->ip_tos || fip->ip_ttl != ip->ip_ttl) {
+			*reason = &stats->ifi_gro_flush_flags;
+			return FALSE;
+		}
+	} else {
+		struct ip6_hdr *fip6 = mtod(f->tgf_head, struct ip6_hdr *);
+		struct ip6_hdr *ip6 = pkt->tgp_ip;
+
+		if (fip6->ip6_flow != ip6->ip6_flow ||
+		    fip6->ip6_hlim != ip6->ip6_hlim) {
+			*reason = &stats->ifi_gro_flush_flags;
+			return FALSE;
+		}
+	}
+	if (fth->th_ack != th->th_ack) {
+		*reason = &stats->ifi_gro_flush_flags;
+		return FALSE;
+	}
+	if ((fth->th_off << 2) != sizeof(*fth) &&
+	    bcmp(fth + 1, th + 1, TCP_GRO_TSOPT_LEN) != 0) {
+		*reason = &stats->ifi_gro_flush_ts;
+		return FALSE;
+	}
+	if (pkt->tgp_len > f->tgf_seglen) {
+		*reason = &stats->ifi_gro_flush_flags;
+		return FALSE;
+	}
+	if (f->tgf_segs >= max_segs ||
+	    f->tgf_hlen + f->tgf_len + pkt->tgp_len > IP_MAXPACKET) {
+		*reason = &stats->ifi_gro_flush_full;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Rewrites the headers of a merged packet to cover its whole payload.
+ */
+static void
+tcp_gro_finalize(struct tcp_gro_flow *f, struct if_gro_stats *stats)
+{
+	struct mbuf *m = f->tgf_head;
+
+	if (f->tgf_segs > 1) {
+		if (f->tgf_af == PF_INET) {
+			struct ip *ip = mtod(m, struct ip *);
+
+			ip->ip_len = htons((uint16_t)m->m_pkthdr.len);
+			ip->ip_sum = 0;
+			ip->ip_sum = in_cksum_hdr(ip);
+			m->m_pkthdr.csum_flags |= CSUM_IP_CHECKED |
+			    CSUM_IP_VALID;
+		} else {
+			struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+
+			ip6->ip6_plen = htons((uint16_t)(m->m_pkthdr.len -
+			    sizeof(*ip6)));
+		}
+		m->m_pkthdr.seg_cnt = (uint8_t)f->tgf_segs;
+		stats->ifi_gro_pkts_out++;
+	}
+	f->tgf_head = NULL;
+}
+
+/*
+ * Appends a segment's payload to the flow; its headers are dropped
+ * and the mbufs are no longer a packet of their own.
+ */
+static void
+tcp_gro_merge(struct tcp_gro_flow *f, struct mbuf *m, struct tcp_gro_pkt *pkt)
+{
+	struct mbuf *head = f->tgf_head;
+
+	f->tgf_th->th_win = pkt->tgp_th->th_win;
+	f->tgf_th->th_flags |= pkt->tgp_th->th_flags;
+
+	m_adj(m, pkt->tgp_hlen);
+	m_tag_delete_chain(m, NULL);
+	m->m_flags &= ~M_PKTHDR;
+
+	f->tgf_tail->m_next = m;
+	f->tgf_tail = m_last(m);
+	head->m_pkthdr.len += pkt->tgp_len;
+	f->tgf_len += pkt->tgp_len;
+	f->tgf_next_seq += pkt->tgp_len;
+	f->tgf_segs++;
+}
+
+static void
+tcp_gro_open(struct tcp_gro_flow *f, struct mbuf *m, struct tcp_gro_pkt *pkt,
+    uint32_t stamp)
+{
+	f->tgf_head = m;
+	f->tgf_tail = m_last(m);
+	f->tgf_th = pkt->tgp_th;
+	f->tgf_hash = pkt->tgp_hash;
+	f->tgf_af = pkt->tgp_af;
+	f->tgf_hlen = pkt->tgp_hlen;
+	f->tgf_seglen = pkt->tgp_len;
+	f->tgf_len = pkt->tgp_len;
+	f->tgf_segs = 1;
+	f->tgf_next_seq = ntohl(pkt->tgp_th->th_seq) + pkt->tgp_len;
+	f->tgf_stamp = stamp;
+}
+
+static void
+tcp_gro_stats_add(struct ifnet *ifp, const struct if_gro_stats *s)
+{
+	struct if_gro_stats *d = &ifp->if_gro_stats;
+
+#define GRO_STAT_ADD(fld) do {                                          \
+	if (s->fld != 0)                                                \
+	        atomic_add_64(&d->fld, s->fld);                         \
+} while (0)
+
+	GRO_STAT_ADD(ifi_gro_segs_in);
+	GRO_STAT_ADD(ifi_gro_segs_merged);
+	GRO_STAT_ADD(ifi_gro_pkts_out);
+	GRO_STAT_ADD(ifi_gro_flush_psh);
+	GRO_STAT_ADD(ifi_gro_flush_ooo);
+	GRO_STAT_ADD(ifi_gro_flush_ts);
+	GRO_STAT_ADD(ifi_gro_flush_flags);
+	GRO_STAT_ADD(ifi_gro_flush_full);
+	GRO_STAT_ADD(ifi_gro_flush_evict);
+
+#undef GRO_STAT_ADD
+}
+
+static boolean_t
+tcp_gro_forwarding(int af)
+{
+	if (af == PF_INET) {
+		return ipforwarding != 0;
+	}
+	return ip6_forwarding != 0;
+}
+
+/*
+ * Coalesces the TCP segments in a list of packets of protocol family
+ * `af' received on `ifp', and returns the new list.
+ */
+struct mbuf *
+tcp_gro_input(struct ifnet *ifp, int af, struct mbuf *m)
+{
+	struct tcp_gro_flow flows[TCP_GRO_FLOWS];
+	struct if_gro_stats stats;
+	struct mbuf *head = NULL, **tailp = &head, *next;
+	uint32_t stamp = 0;
+
+	if (!tcp_gro || m == NULL || m->m_nextpkt == NULL ||
+	    ifp == lo_ifp || (ifp->if_flags & IFF_LOOPBACK) ||
+	    (ifp->if_capenable & IFCAP_LRO) || !hwcksum_rx ||
+	    tcp_gro_forwarding(af)) {
+		return m;
+	}
+
+	bzero(flows, sizeof(flows));
+	bzero(&stats, sizeof(stats));
+
+	for (; m != NULL; m = next) {
+		struct tcp_gro_flow *f = NULL, *lru = &flows[0];
+		struct tcp_gro_pkt pkt;
+		uint64_t *reason = NULL;
+
+		next = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		stamp++;
+
+		if (!tcp_gro_parse(m, af, &pkt)) {
+			*tailp = m;
+			tailp = &m->m_nextpkt;
+			continue;
+		}
+		stats.ifi_gro_segs_in++;
+
+		for (int i = 0; i < TCP_GRO_FLOWS; i++) {
+			if (flows[i].tgf_head == NULL) {
+				lru = &flows[i];
+				continue;
+			}
+			if (tcp_gro_same_flow(&flows[i], m, &pkt)) {
+				f = &flows[i];
+				break;
+			}
+			if (lru->tgf_head != NULL &&
+			    flows[i].tgf_stamp < lru->tgf_stamp) {
+				lru = &flows[i];
+			}
+		}
+
+		if (f != NULL) {
+			if (pkt.tgp_mergeable &&
+			    tcp_gro_can_merge(f, &pkt, &reason, &stats)) {
+				boolean_t short_seg = pkt.tgp_len < f->tgf_seglen;
+				boolean_t psh = (pkt.tgp_th->th_flags & TH_PUSH) != 0;
+
+				tcp_gro_merge(f, m, &pkt);
+				stats.ifi_gro_segs_merged++;
+				f->tgf_stamp = stamp;
+
+				/* a short segment or PSH ends the run */
+				if (psh) {
+					stats.ifi_gro_flush_psh++;
+				}
+				if (psh || short_seg) {
+					tcp_gro_finalize(f, &stats);
+				}
+				continue;
+			}
+			if (reason == NULL) {
+				reason = &stats.ifi_gro_flush_flags;
+			}
+			(*reason)++;
+			tcp_gro_finalize(f, &stats);
+		} else if (pkt.tgp_mergeable) {
+			f = lru;
+			if (f->tgf_head != NULL) {
+				stats.ifi_gro_flush_evict++;
+				tcp_gro_finalize(f, &stats);
+			}
+		}
+
+		*tailp = m;
+		tailp = &m->m_nextpkt;
+
+		if (pkt.tgp_mergeable && !(pkt.tgp_th->th_flags & TH_PUSH)) {
+			/* the head goes up where it arrived, keeping flow order */
+			VERIFY(f != NULL && f->tgf_head == NULL);
+			tcp_gro_open(f, m, &pkt, stamp);
+		}
+	}
+
+	for (int i = 0; i < TCP_GRO_FLOWS; i++) {
+		if (flows[i].tgf_head != NULL) {
+			tcp_gro_finalize(&flows[i], &stats);
+		}
+	}
+	tcp_gro_stats_add(ifp, &stats);
+
+	return head;
+}
+
+#if (DEVELOPMENT || DEBUG)
+#define TCP_GRO_TEST_SEGS       8
+#define TCP_GRO_TEST_MSS        1000
+
+/*
+ * Builds an in-order data segment of a single connection, as received
+ * by an interface that validated its checksum.
+ */
+static struct mbuf *
+tcp_gro_test_segment(int af, tcp_seq seq)
+{
+	struct tcphdr *th;
+	struct mbuf *m;
+	uint32_t iphlen;
+
+	iphlen = (af == PF_INET) ? sizeof(struct ip) : sizeof(struct ip6_hdr);
+	m = m_getcl(M_WAITOK, MT_DATA, M_PKTHDR);
+	if (m == NULL) {
+		return NULL;
+	}
+	m->m_len = m->m_pkthdr.len = iphlen + sizeof(*th) + TCP_GRO_TEST_MSS;
+	bzero(mtod(m, caddr_t), m->m_len);
+
+	if (af == PF_INET) {
+		struct ip *ip = mtod(m, struct ip *);
+
+		ip->ip_v = IPVERSION;
+		ip->ip_hl = sizeof(*ip) >> 2;
+		ip->ip_len = htons((uint16_t)m->m_len);
+		ip->ip_ttl = 64;
+		ip->ip_p = IPPROTO_TCP;
+		ip->ip_src.s_addr = htonl(0x0a000001);
+		ip->ip_dst.s_addr = htonl(0x0a000002);
+		ip->ip_sum = in_cksum_hdr(ip);
+		th = (struct tcphdr *)(void *)(ip + 1);
+	} else {
+		struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+
+		ip6->ip6_vfc = IPV6_VERSION;
+		ip6->ip6_plen = htons(sizeof(*th) + TCP_GRO_TEST_MSS);
+		ip6->ip6_nxt = IPPROTO_TCP;
+		ip6->ip6_hlim = 64;
+		ip6->ip6_src.s6_addr[15] = 1;
+		ip6->ip6_dst.s6_addr[15] = 2;
+		th = (struct tcphdr *)(void *)(ip6 + 1);
+	}
+
+	th->th_sport = htons(49152);
+	th->th_dport = htons(80);
+	th->th_seq = htonl(seq);
+	th->th_ack = htonl(1);
+	th->th_off = sizeof(*th) >> 2;
+	th->th_flags = TH_ACK;
+	th->th_win = htons(65535);
+
+	m->m_pkthdr.csum_flags = CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
+	m->m_pkthdr.csum_rx_val = 0xffff;
+	return m;
+}
+
+/*
+ * Runs TCP_GRO_TEST_SEGS segments of the protocol family written to
+ * the sysctl (4 or 6) through tcp_gro_input() on a dummy interface,
+ * and returns the number of packets that come out of it.
+ */
+static int
+sysctl_tcp_gro_test SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct mbuf *head = NULL, **tailp = &head, *m;
+	struct ifnet *ifp;
+	int value = 0, af, error;
+	uint32_t segs = 0;
+
+	error = SYSCTL_IN(req, &value, sizeof(value));
+	if (error || req->newptr == USER_ADDR_NULL) {
+		return error;
+	}
+	if (value == 4) {
+		af = PF_INET;
+	} else if (value == 6) {
+		af = PF_INET6;
+	} else {
+		return EINVAL;
+	}
+
+	ifp = _MALLOC(sizeof(*ifp), M_TEMP, M_WAITOK | M_ZERO);
+	if (ifp == NULL) {
+		return ENOMEM;
+	}
+
+	for (int i = 0; i < TCP_GRO_TEST_SEGS; i++) {
+		m = tcp_gro_test_segment(af, 1 + i * TCP_GRO_TEST_MSS);
+		if (m == NULL) {
+			error = ENOBUFS;
+			goto done;
+		}
+		*tailp = m;
+		tailp = &m->m_nextpkt;
+	}
+
+	head = tcp_gro_input(ifp, af, head);
+
+	value = 0;
+	for (m = head; m != NULL; m = m->m_nextpkt) {
+		segs += MAX(m->m_pkthdr.seg_cnt, 1);
+		value++;
+	}
+	/* merged or not, every segment must still be accounted for */
+	if (segs != TCP_GRO_TEST_SEGS) {
+		error = EIO;
+		goto done;
+	}
+
+	error = SYSCTL_OUT(req, &value, sizeof(value));
+done:
+	if (head != NULL) {
+		m_freem_list(head);
+	}
+	_FREE(ifp, M_TEMP);
+	return error;
+}
+
+SYSCTL_PROC(_net_inet_tcp, OID_AUTO, gro_test,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED | CTLFLAG_MASKED,
+    0, 0, sysctl_tcp_gro_test, "I", "Run TCP segments through GRO");
+#endif /* (DEVELOPMENT || DEBUG) */
@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Software segmentation of TCP super-segments.
+ *
+ * When an interface has no hardware TSO, tcp_output still builds
+ * segments of up to 64KB (see tcp_set_tso) and marks them with
+ * CSUM_TSO_IPV4/CSUM_TSO_IPV6 just as it would for a TSO capable NIC.
+ * IP leaves their checksums alone and marks them PKTF_SW_GSO, and
+ * dlil_output cuts them into MSS-sized packets right before the framer,
+ * so that everything above runs once per super-segment.
+ *
+ * Each segment gets a fresh header mbuf with a copy of the IP and TCP
+ * headers; the payload is shared with the original chain.  The TCP
+ * pseudo header checksum is adjusted incrementally for the length of
+ * each segment, and the checksum is then always completed here: the
+ * interface's offload capabilities may have changed since IP skipped
+ * the checksum, so they aren't relied upon.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/sysctl.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/dlil.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet6/in6.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_var.h>
+
+static uint64_t tcp_gso_packets;        /* super-segments cut up */
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, gso_packets, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &tcp_gso_packets, "TCP super-segments segmented in software");
+
+static uint64_t tcp_gso_segments;       /* packets made out of them */
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, gso_segments, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &tcp_gso_segments, "TCP segments made by software segmentation");
+
+/*
+ * Computes the TCP checksum of one segment, whose IP header checksum
+ * is already done, and leaves nothing for the interface to finish.
+ */
+static void
+tcp_gso_cksum(struct mbuf *m, int af)
+{
+	uint32_t flag = (af == PF_INET) ? CSUM_TCP : CSUM_TCPIPV6;
+
+	m->m_pkthdr.csum_flags &= ~(CSUM_TSO_IPV4 | CSUM_TSO_IPV6 |
+	    CSUM_TX_FLAGS);
+	m->m_pkthdr.csum_flags |= flag;
+	m->m_pkthdr.csum_data = offsetof(struct tcphdr, th_sum);
+	m->m_pkthdr.tso_segsz = 0;
+	m->m_pkthdr.pkt_flags &= ~PKTF_SW_GSO;
+
+	if (af == PF_INET) {
+		in_delayed_cksum(m);
+	} else {
+		in6_delayed_cksum(m);
+	}
+	m->m_pkthdr.csum_flags &= ~flag;
+}
+
+/*
+ * Cuts the super-segment `m' of family `af' into packets of at most
+ * m_pkthdr.tso_segsz bytes of payload each.  Returns the list of
+ * packets and its last element in `tailp', or NULL if memory ran out;
+ * `m' is consumed either way.
+ */
+struct mbuf *
+tcp_gso_segment(int af, struct mbuf *m, struct mbuf **tailp)
+{
+	struct mbuf *head = NULL, **nextp = &head, *seg = NULL;
+	struct mbuf *m_lastm = NULL;
+	struct tcphdr *th;
+	uint32_t iphlen, hlen, mss, paylen, off;
+	uint16_t ip_id = 0, base_sum;
+	int m_off = 0, nsegs = 0;
+	tcp_seq seq;
+
+	if (af == PF_INET) {
+		struct ip *ip = mtod(m, struct ip *);
+
+		iphlen = sizeof(*ip);
+		if (m->m_len < (int)(iphlen + sizeof(*th)) ||
+		    (ip->ip_hl << 2) != iphlen || ip->ip_p != IPPROTO_TCP) {
+			goto bad;
+		}
+		ip_id = ntohs(ip->ip_id);
+	} else {
+		struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+
+		iphlen = sizeof(*ip6);
+		if (m->m_len < (int)(iphlen + sizeof(*th)) ||
+		    ip6->ip6_nxt != IPPROTO_TCP) {
+			goto bad;
+		}
+	}
+	th = (struct tcphdr *)(void *)(mtod(m, caddr_t) + iphlen);
+	hlen = iphlen + (th->th_off << 2);
+	mss = m->m_pkthdr.tso_segsz;
+	if (m->m_len < (int)hlen || mss == 0 ||
+	    !(m->m_pkthdr.csum_flags & (CSUM_TCP | CSUM_TCPIPV6))) {
+		goto bad;
+	}
+	if ((paylen = m->m_pkthdr.len - hlen) == 0) {
+		goto bad;
+	}
+	seq = ntohl(th->th_seq);
+
+	/*
+	 * th_sum holds the pseudo header sum for the whole super-segment;
+	 * take its TCP length back out so each segment can add its own.
+	 */
+	base_sum = in_addword(th->th_sum,
+	    ~htons((uint16_t)(m->m_pkthdr.len - iphlen)) & 0xffff);
+
+	for (off = 0; off < paylen; off += mss) {
+		uint32_t len = MIN(mss, paylen - off);
+		struct tcphdr *sth;
+
+		seg = m_copym_with_hdrs(m, hlen + off, len, M_DONTWAIT,
+		    &m_lastm, &m_off, M_COPYM_NOOP_HDR);
+		if (seg == NULL) {
+			goto bad;
+		}
+		if (m_dup_pkthdr(seg, m, M_DONTWAIT) == 0) {
+			m_freem(seg);
+			goto bad;
+		}
+		seg->m_data += max_linkhdr;
+		seg->m_len = hlen;
+		seg->m_pkthdr.len = hlen + len;
+		bcopy(mtod(m, caddr_t), mtod(seg, caddr_t), hlen);
+
+		sth = (struct tcphdr *)(void *)(mtod(seg, caddr_t) + iphlen);
+		sth->th_seq = htonl(seq + off);
+		if (off + len < paylen) {
+			sth->th_flags &= ~(TH_FIN | TH_PUSH);
+		}
+		if (off != 0) {
+			sth->th_flags &= ~TH_CWR;
+		}
+		sth->th_sum = in_addword(base_sum,
+		    htons((uint16_t)(seg->m_pkthdr.len - iphlen)));
+
+		if (af == PF_INET) {
+			struct ip *ip = mtod(seg, struct ip *);
+
+			ip->ip_len = htons((uint16_t)seg->m_pkthdr.len);
+			ip->ip_id = htons((uint16_t)(ip_id + nsegs));
+			ip->ip_sum = 0;
+			ip->ip_sum = in_cksum_hdr(ip);
+		} else {
+			struct ip6_hdr *ip6 = mtod(seg, struct ip6_hdr *);
+
+			ip6->ip6_plen = htons((uint16_t)(seg->m_pkthdr.len -
+			    iphlen));
+		}
+		tcp_gso_cksum(seg, af);
+
+		*nextp = seg;
+		nextp = &seg->m_nextpkt;
+		nsegs++;
+	}
+	m_freem(m);
+
+	atomic_add_64(&tcp_gso_packets, 1);
+	atomic_add_64(&tcp_gso_segments, nsegs);
+
+	*tailp = seg;
+	return head;
+
+bad:
+	m_freem_list(head);
+	m_freem(m);
+	return NULL;
+}
+
+#if (DEVELOPMENT || DEBUG)
+#define TCP_GSO_TEST_MSS        1000
+#define TCP_GSO_TEST_LEN        (5 * TCP_GSO_TEST_MSS + 500)
+
+/*
+ * Builds a super-segment the way tcp_output and IP leave it for
+ * dlil_output: headers in the first mbuf, the payload in clusters,
+ * th_sum holding the pseudo header sum and the packet marked for GSO.
+ */
+static struct mbuf *
+tcp_gso_test_packet(int af)
+{
+	struct mbuf *m, *n, **np;
+	struct tcphdr *th;
+	uint32_t iphlen, tlen, off;
+
+	iphlen = (af == PF_INET) ? sizeof(struct ip) : sizeof(struct ip6_hdr);
+	tlen = sizeof(*th) + TCP_GSO_TEST_LEN;
+
+	m = m_gethdr(M_WAITOK, MT_DATA);
+	if (m == NULL) {
+		return NULL;
+	}
+	m->m_len = iphlen + sizeof(*th);
+	m->m_pkthdr.len = iphlen + tlen;
+	bzero(mtod(m, caddr_t), m->m_len);
+
+	np = &m->m_next;
+	for (off = 0; off < TCP_GSO_TEST_LEN; off += n->m_len) {
+		n = m_getcl(M_WAITOK, MT_DATA, 0);
+		if (n == NULL) {
+			m_freem(m);
+			return NULL;
+		}
+		n->m_len = MIN(MCLBYTES, TCP_GSO_TEST_LEN - off);
+		for (int i = 0; i < n->m_len; i++) {
+			mtod(n, uint8_t *)[i] = (uint8_t)(off + i);
+		}
+		*np = n;
+		np = &n->m_next;
+	}
+
+	if (af == PF_INET) {
+		struct ip *ip = mtod(m, struct ip *);
+
+		ip->ip_v = IPVERSION;
+		ip->ip_hl = sizeof(*ip) >> 2;
+		ip->ip_len = htons((uint16_t)m->m_pkthdr.len);
+		ip->ip_id = htons(0x1234);
+		ip->ip_ttl = 64;
+		ip->ip_p = IPPROTO_TCP;
+		ip->ip_src.s_addr = htonl(0x0a000001);
+		ip->ip_dst.s_addr = htonl(0x0a000002);
+		th = (struct tcphdr *)(void *)(ip + 1);
+		th->th_sum = in_pseudo(ip->ip_src.s_addr, ip->ip_dst.s_addr,
+		    htons((uint16_t)(tlen + IPPROTO_TCP)));
+		m->m_pkthdr.csum_flags = CSUM_TSO_IPV4 | CSUM_TCP | CSUM_IP;
+	} else {
+		struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+
+		ip6->ip6_vfc = IPV6_VERSION;
+		ip6->ip6_plen = htons((uint16_t)tlen);
+		ip6->ip6_nxt = IPPROTO_TCP;
+		ip6->ip6_hlim = 64;
+		ip6->ip6_src.s6_addr[15] = 1;
+		ip6->ip6_dst.s6_addr[15] = 2;
+		th = (struct tcphdr *)(void *)(ip6 + 1);
+		th->th_sum = in6_pseudo(&ip6->ip6_src, &ip6->ip6_dst,
+		    htonl(tlen + IPPROTO_TCP));
+		m->m_pkthdr.csum_flags = CSUM_TSO_IPV6 | CSUM_TCPIPV6;
+	}
+	th->th_sport = htons(49152);
+	th->th_dport = htons(80);
+	th->th_seq = htonl(1000);
+	th->th_ack = htonl(1);
+	th->th_off = sizeof(*th) >> 2;
+	th->th_flags = TH_ACK | TH_PUSH;
+	th->th_win = htons(65535);
+
+	m->m_pkthdr.csum_data = offsetof(struct tcphdr, th_sum);
+	m->m_pkthdr.tso_segsz = TCP_GSO_TEST_MSS;
+	m->m_pkthdr.pkt_flags |= PKTF_SW_GSO;
+	return m;
+}
+
+/*
+ * Checks one segment cut out of the test packet: its headers, that it
+ * carries the right bytes of payload, and that its checksums are done.
+ */
+static boolean_t
+tcp_gso_test_check(int af, struct mbuf *m, uint32_t off)
+{
+	uint32_t iphlen, len = MIN(TCP_GSO_TEST_MSS, TCP_GSO_TEST_LEN - off);
+	struct tcphdr *th;
+	uint8_t byte;
+
+	iphlen = (af == PF_INET) ? sizeof(struct ip) : sizeof(struct ip6_hdr);
+	if ((uint32_t)m->m_pkthdr.len != iphlen + sizeof(*th) + len ||
+	    (m->m_pkthdr.pkt_flags & PKTF_SW_GSO) ||
+	    (m->m_pkthdr.csum_flags & (CSUM_TSO_IPV4 | CSUM_TSO_IPV6 |
+	    CSUM_TCP | CSUM_TCPIPV6))) {
+		return FALSE;
+	}
+	th = (struct tcphdr *)(void *)(mtod(m, caddr_t) + iphlen);
+	if (ntohl(th->th_seq) != 1000 + off ||
+	    ((th->th_flags & TH_PUSH) != 0) != (off + len == TCP_GSO_TEST_LEN)) {
+		return FALSE;
+	}
+	m_copydata(m, iphlen + sizeof(*th), 1, &byte);
+	if (byte != (uint8_t)off) {
+		return FALSE;
+	}
+
+	if (af == PF_INET) {
+		struct ip *ip = mtod(m, struct ip *);
+
+		return in_cksum_hdr(ip) == 0 &&
+		       inet_cksum(m, IPPROTO_TCP, iphlen, sizeof(*th) + len) == 0;
+	}
+	return inet6_cksum(m, IPPROTO_TCP, iphlen, sizeof(*th) + len) == 0;
+}
+
+/*
+ * Segments a super-segment of the protocol family written to the
+ * sysctl (4 or 6), and returns the number of valid segments.
+ */
+static int
+sysctl_tcp_gso_test SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct mbuf *m, *tail;
+	int value = 0, af, error;
+	uint32_t off = 0;
+
+	error = SYSCTL_IN(req, &value, sizeof(value));
+	if (error || req->newptr == USER_ADDR_NULL) {
+		return error;
+	}
+	if (value == 4) {
+		af = PF_INET;
+	} else if (value == 6) {
+		af = PF_INET6;
+	} else {
+		return EINVAL;
+	}
+
+	if ((m = tcp_gso_test_packet(af)) == NULL) {
+		return ENOBUFS;
+	}
+	if ((m = tcp_gso_segment(af, m, &tail)) == NULL) {
+		return ENOBUFS;
+	}
+
+	value = 0;
+	for (struct mbuf *seg = m; seg != NULL; seg = seg->m_nextpkt) {
+		if (off >= TCP_GSO_TEST_LEN || !tcp_gso_test_check(af, seg, off)) {
+			error = EIO;
+			break;
+		}
+		off += TCP_GSO_TEST_MSS;
+		value++;
+	}
+	m_freem_list(m);
+
+	if (error == 0) {
+		error = SYSCTL_OUT(req, &value, sizeof(value));
+	}
+	return error;
+}
+
+SYSCTL_PROC(_net_inet_tcp, OID_AUTO, gso_test,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED | CTLFLAG_MASKED,
+    0, 0, sysctl_tcp_gso_test, "I", "Segment a TCP super-segment in software");
+#endif /* (DEVELOPMENT || DEBUG) */
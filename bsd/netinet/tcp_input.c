@@ -865,6 +865,55 @@ tcp_reduce_congestion_window(struct tcpcb *tp)
 	}
 }
 
+/*
+ * Enter fast recovery -- used on reaching the duplicate ack threshold and
+ * when the RACK reordering timer finds a hole lost.  With SACK, this also
+ * sets the congestion window that retransmission starts from; the caller
+ * sends.
+ */
+void
+tcp_enter_fast_recovery(struct tcpcb *tp, struct tcphdr *th)
+{
+	if (tp->t_flags & TF_SENTFIN) {
+		tp->snd_recover = tp->snd_max - 1;
+	} else {
+		tp->snd_recover = tp->snd_max;
+	}
+	tp->t_timer[TCPT_PTO] = 0;
+	tp->t_rtttime = 0;
+
+	tcp_rexmt_save_state(tp);
+	/*
+	 * If the current tcp cc module has
+	 * defined a hook for tasks to run
+	 * before entering FR, call it
+	 */
+	if (CC_ALGO(tp)->pre_fr != NULL) {
+		CC_ALGO(tp)->pre_fr(tp);
+	}
+	ENTER_FASTRECOVERY(tp);
+	tp->t_timer[TCPT_REXMT] = 0;
+	if (TCP_ECN_ENABLED(tp)) {
+		tp->ecn_flags |= TE_SENDCWR;
+	}
+
+	if (SACK_ENABLED(tp)) {
+		tcpstat.tcps_sack_recovery_episode++;
+		tp->t_sack_recovery_episode++;
+		if (TCP_RACK_ENABLED(tp)) {
+			tcp_rack_recovery(tp);
+		}
+		tp->sack_newdata = tp->snd_nxt;
+		if (tcp_do_better_lr) {
+			tp->snd_cwnd = tp->snd_ssthresh;
+		} else {
+			tp->snd_cwnd = tp->t_maxseg;
+		}
+		tp->t_flagsext &= ~TF_CWND_NONVALIDATED;
+		tcp_ccdbg_trace(tp, th, TCP_CC_ENTER_FASTRECOVERY);
+	}
+}
+
 /*
  * This function is called upon reception of data on a socket. It's purpose is
  * to handle the adaptive keepalive timers that monitor whether the connection
@@ -2646,6 +2695,12 @@ findpcb:
 			}
 			tp->t_inpcb->inp_flags2 |=
 			    tp0->t_inpcb->inp_flags2 & INP2_KEEPALIVE_OFFLOAD;
+			if (tp0->t_cc_user_index != TCP_CC_ALGO_NONE) {
+				tp->t_cc_user_index = tp0->t_cc_user_index;
+				if (tp->tcp_cc_index != TCP_CC_ALGO_BACKGROUND_INDEX) {
+					tcp_set_foreground_cc(so);
+				}
+			}
 
 			/* now drop the reference on the listener */
 			socket_unlock(oso, 1);
@@ -4368,7 +4423,8 @@ process_dupack:
 				if (SACK_ENABLED(tp) && tcp_do_better_lr) {
 					tp->t_new_dupacks += (sack_bytes_newly_acked / tp->t_maxseg);
 
-					if (tp->t_new_dupacks >= tp->t_rexmtthresh && IN_FASTRECOVERY(tp)) {
+					if (tp->t_new_dupacks >= tp->t_rexmtthresh && IN_FASTRECOVERY(tp) &&
+					    !TCP_RACK_ENABLED(tp)) {
 						/* Let's restart the retransmission */
 						tcp_sack_lost_rexmit(tp);
 
@@ -4422,6 +4478,22 @@ process_dupack:
 					tcp_early_rexmt_check(tp, th);
 				}
 
+				/*
+				 * With RACK, the time since the holes were
+				 * sent decides when they are lost, rather than
+				 * the number of duplicate acks.
+				 */
+				if (TCP_RACK_ENABLED(tp)) {
+					if (tcp_rack_detect_loss(tp)) {
+						if (!IN_FASTRECOVERY(tp)) {
+							tp->t_dupacks = tp->t_rexmtthresh;
+						}
+					} else if (!IN_FASTRECOVERY(tp) &&
+					    tp->t_dupacks >= tp->t_rexmtthresh) {
+						tp->t_dupacks = tp->t_rexmtthresh - 1;
+					}
+				}
+
 				/*
 				 * If we've seen exactly rexmt threshold
 				 * of duplicate acks, assume a packet
@@ -4528,21 +4600,13 @@ process_dupack:
 							break;
 						}
 					}
-					if (tp->t_flags & TF_SENTFIN) {
-						tp->snd_recover = tp->snd_max - 1;
-					} else {
-						tp->snd_recover = tp->snd_max;
-					}
-					tp->t_timer[TCPT_PTO] = 0;
-					tp->t_rtttime = 0;
-
 					/*
 					 * If the connection has seen pkt
 					 * reordering, delay recovery until
 					 * it is clear that the packet
 					 * was lost.
 					 */
-					if (SACK_ENABLED(tp) &&
+					if (SACK_ENABLED(tp) && !TCP_RACK_ENABLED(tp) &&
 					    (tp->t_flagsext &
 					    (TF_PKTS_REORDERED | TF_DELAY_RECOVERY))
 					    == TF_PKTS_REORDERED &&
@@ -4550,6 +4614,13 @@ process_dupack:
 					    tp->t_reorderwin > 0 &&
 					    (tp->t_state == TCPS_ESTABLISHED ||
 					    tp->t_state == TCPS_FIN_WAIT_1)) {
+						if (tp->t_flags & TF_SENTFIN) {
+							tp->snd_recover = tp->snd_max - 1;
+						} else {
+							tp->snd_recover = tp->snd_max;
+						}
+						tp->t_timer[TCPT_PTO] = 0;
+						tp->t_rtttime = 0;
 						tp->t_timer[TCPT_DELAYFR] =
 						    OFFSET_FROM_START(tp,
 						    tp->t_reorderwin);
@@ -4560,38 +4631,13 @@ process_dupack:
 						break;
 					}
 
-					tcp_rexmt_save_state(tp);
-					/*
-					 * If the current tcp cc module has
-					 * defined a hook for tasks to run
-					 * before entering FR, call it
-					 */
-					if (CC_ALGO(tp)->pre_fr != NULL) {
-						CC_ALGO(tp)->pre_fr(tp);
-					}
-					ENTER_FASTRECOVERY(tp);
-					tp->t_timer[TCPT_REXMT] = 0;
-					if (TCP_ECN_ENABLED(tp)) {
-						tp->ecn_flags |= TE_SENDCWR;
-					}
-
+					tcp_enter_fast_recovery(tp, th);
 					if (SACK_ENABLED(tp)) {
-						tcpstat.tcps_sack_recovery_episode++;
-						tp->t_sack_recovery_episode++;
-						tp->sack_newdata = tp->snd_nxt;
-						if (tcp_do_better_lr) {
-							tp->snd_cwnd = tp->snd_ssthresh;
-						} else {
-							tp->snd_cwnd = tp->t_maxseg;
-						}
-						tp->t_flagsext &= ~TF_CWND_NONVALIDATED;
-
 						/* Process any window updates */
 						if (tiwin > tp->snd_wnd) {
 							tcp_update_window(tp, thflags, th, tiwin, tlen);
 						}
 
-						tcp_ccdbg_trace(tp, th, TCP_CC_ENTER_FASTRECOVERY);
 						(void) tcp_output(tp);
 						goto drop;
 					}
@@ -4696,6 +4742,15 @@ process_dupack:
 			tp->t_dupacks = 0;
 			tp->t_rexmtthresh = tcprexmtthresh;
 			tp->t_new_dupacks = 0;
+
+			/*
+			 * With RACK, an advancing ack can show a hole to be
+			 * lost as well; the reordering timer enters recovery.
+			 */
+			if (TCP_RACK_ENABLED(tp) && tcp_rack_detect_loss(tp)) {
+				tp->t_timer[TCPT_DELAYFR] =
+				    OFFSET_FROM_START(tp, 1);
+			}
 		}
 
 process_ACK:
@@ -6487,11 +6542,7 @@ tcp_set_background_cc(struct socket *so)
 void
 tcp_set_foreground_cc(struct socket *so)
 {
-	if (tcp_use_newreno) {
-		tcp_set_new_cc(so, TCP_CC_ALGO_NEWRENO_INDEX);
-	} else {
-		tcp_set_new_cc(so, TCP_CC_ALGO_CUBIC_INDEX);
-	}
+	tcp_set_new_cc(so, tcp_cc_foreground_index(sototcpcb(so)));
 }
 
 static void
@@ -159,6 +159,68 @@ SYSCTL_SKMEM_TCP_INT(OID_AUTO, randomize_timestamps,
     CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_randomize_timestamps, 1,
     "Randomize TCP timestamps to prevent tracking (on: 1, off: 0)");
 
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, copy_cksum,
+    CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_copy_cksum, 1,
+    "Checksum data while copying it out of the send buffer");
+
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, pacing,
+    CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_pacing, 1,
+    "Give segments of connections with a pacing rate a departure time");
+
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, pacing_tso_usec,
+    CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_pacing_tso_usec, 1000,
+    "Largest paced TSO burst, in microseconds at the pacing rate");
+
+/*
+ * Returns TRUE if the checksum of segments going out on the connection's
+ * current route would have to be computed in software, in which case the
+ * payload is summed as it gets copied out of the send buffer.
+ */
+static inline boolean_t
+tcp_sw_cksum_on_copy(struct inpcb *inp, int isipv6)
+{
+	struct rtentry *rt;
+	struct ifnet *ifp;
+
+	if (!tcp_copy_cksum) {
+		return FALSE;
+	}
+	rt = isipv6 ? inp->in6p_route.ro_rt : inp->inp_route.ro_rt;
+	if (rt == NULL || (ifp = rt->rt_ifp) == NULL ||
+	    (ifp->if_flags & IFF_LOOPBACK) || IS_INTF_CLAT46(ifp)) {
+		return FALSE;
+	}
+	return !hwcksum_tx ||
+	       !(ifp->if_hwassist & (isipv6 ? CSUM_TCPIPV6 : CSUM_TCP));
+}
+
+/*
+ * Stamps a segment of a paced connection with the time it may leave,
+ * as a delay from now in pkt_pacing_delay.  pkt_timestamp is left to
+ * the interface queue, which stamps the enqueue time, so nothing that
+ * reads the timestamp ever sees a time in the future; FQ-CoDel holds
+ * the flow until the enqueue time plus the delay.  The next segment
+ * may leave once this one has gone out at the pacing rate; after an
+ * idle period the schedule restarts from the current time.
+ */
+static void
+tcp_pacing_stamp(struct tcpcb *tp, struct mbuf *m)
+{
+	struct timespec now_ts;
+	uint64_t now;
+
+	nanouptime(&now_ts);
+	net_timernsec(&now_ts, &now);
+	if (tp->t_pacing_next < now) {
+		tp->t_pacing_next = now;
+	}
+	m->m_pkthdr.pkt_pacing_delay =
+	    (uint32_t)MIN(tp->t_pacing_next - now, UINT32_MAX);
+
+	tp->t_pacing_next += (uint64_t)m->m_pkthdr.len * NSEC_PER_SEC /
+	    tp->t_pacing_rate;
+}
+
 static int
 sysctl_change_ecn_setting SYSCTL_HANDLER_ARGS
 {
@@ -614,6 +676,8 @@ tcp_output(struct tcpcb *tp)
 	int sotc = so->so_traffic_class;
 	boolean_t do_not_compress = FALSE;
 	boolean_t sack_rxmted = FALSE;
+	boolean_t copy_cksum = FALSE;
+	uint16_t data_sum = 0;
 
 	/*
 	 * Determine length of data that should be transmitted,
@@ -880,6 +944,11 @@ again:
 		} else {
 			len = ((int32_t)min(cwin, p->end - p->rxmit));
 		}
+		/* RACK retransmits only the part deemed lost */
+		if (TCP_RACK_ENABLED(tp) &&
+		    SEQ_GT(p->rxmit + len, tp->t_rack.lost_seq)) {
+			len = tp->t_rack.lost_seq - p->rxmit;
+		}
 		if (len > 0) {
 			off = p->rxmit - tp->snd_una;
 			sack_rxmit = 1;
@@ -1571,6 +1640,8 @@ just_return:
 	return 0;
 
 send:
+	copy_cksum = FALSE;
+
 	/*
 	 * Set TF_MAXSEGSNT flag if the segment size is greater than
 	 * the max segment size.
@@ -1937,6 +2008,20 @@ send:
 			tso_maxlen = tp->tso_max_segment_size ?
 			    tp->tso_max_segment_size : TCP_MAXWIN;
 
+			/*
+			 * A paced super-segment leaves all at once, so keep
+			 * it to tcp_pacing_tso_usec worth of the pacing rate.
+			 */
+			if (tp->t_pacing_rate != 0 && tcp_pacing) {
+				uint64_t burst;
+
+				burst = tp->t_pacing_rate * tcp_pacing_tso_usec /
+				    USEC_PER_SEC;
+				burst = MAX(burst, 2 * tp->t_maxseg);
+				tso_maxlen = (int32_t)MIN((uint64_t)tso_maxlen,
+				    hdrlen + optlen + burst);
+			}
+
 			if (len > tso_maxlen - hdrlen - optlen) {
 				len = tso_maxlen - hdrlen - optlen;
 				sendalot = 1;
@@ -2079,8 +2164,14 @@ send:
 				error = 0; /* should we return an error? */
 				goto out;
 			}
-			m_copydata(so->so_snd.sb_mb, off, (int) len,
-			    mtod(m, caddr_t) + hdrlen);
+			if (!tso && tcp_sw_cksum_on_copy(inp, isipv6)) {
+				data_sum = m_copydata_sum(so->so_snd.sb_mb,
+				    off, (int) len, mtod(m, caddr_t) + hdrlen, 0);
+				copy_cksum = TRUE;
+			} else {
+				m_copydata(so->so_snd.sb_mb, off, (int) len,
+				    mtod(m, caddr_t) + hdrlen);
+			}
 			m->m_len += len;
 		} else {
 			uint32_t copymode;
@@ -2276,7 +2367,11 @@ send:
 		}
 		tcp_rxtseg_insert(tp, p->rxmit, (p->rxmit + len - 1));
 		p->rxmit += len;
+		p->rxmit_ts = tcp_now;
 		tp->sackhint.sack_bytes_rexmit += len;
+		if (SEQ_GT(p->rxmit, tp->t_rack.rxmit_high)) {
+			tp->t_rack.rxmit_high = p->rxmit;
+		}
 	}
 	th->th_ack = htonl(tp->rcv_nxt);
 	tp->last_ack_sent = tp->rcv_nxt;
@@ -2366,6 +2461,23 @@ send:
 		}
 	}
 
+	/*
+	 * The payload was summed as it was copied out of the send buffer;
+	 * finish the checksum over the header here instead of having it
+	 * read the whole segment again on its way out.
+	 */
+	if (copy_cksum) {
+		th->th_sum = in_addword(th->th_sum, data_sum);
+		th->th_sum = in_cksum_buffer(th, sizeof(*th) + optlen);
+		m->m_pkthdr.csum_flags = 0;
+		m->m_pkthdr.csum_data = 0;
+		if (isipv6) {
+			tcp_out6_cksum_stats(len);
+		} else {
+			tcp_out_cksum_stats(len);
+		}
+	}
+
 	/*
 	 * Enable TSO and specify the size of the segments.
 	 * The TCP pseudo header checksum is always provided.
@@ -2414,6 +2526,9 @@ send:
 			tp->snd_nxt += len;
 		}
 		if (SEQ_GT(tp->snd_nxt, tp->snd_max)) {
+			if (TCP_RACK_ENABLED(tp)) {
+				tcp_rack_sent(tp);
+			}
 			tp->snd_max = tp->snd_nxt;
 			tp->t_sndtime = tcp_now;
 			/*
@@ -2510,6 +2625,9 @@ timer:
 			tp->t_flags |= TF_SENTFIN;
 		}
 		if (SEQ_GT(tp->snd_nxt + xlen, tp->snd_max)) {
+			if (TCP_RACK_ENABLED(tp)) {
+				tcp_rack_sent(tp);
+			}
 			tp->snd_max = tp->snd_nxt + len;
 			tp->t_sndtime = tcp_now;
 		}
@@ -2622,6 +2740,10 @@ timer:
 		m->m_pkthdr.tx_tcp_e_pid = 0;
 	}
 
+	if (len > 0 && tp->t_pacing_rate != 0 && tcp_pacing) {
+		tcp_pacing_stamp(tp, m);
+	}
+
 	m->m_nextpkt = NULL;
 
 	if (inp->inp_last_outifp != NULL &&
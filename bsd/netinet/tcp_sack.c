@@ -117,8 +117,39 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, sack_globalholes, CTLFLAG_RD | CTLFLAG_LOCKE
     &tcp_sack_globalholes, 0,
     "Global number of TCP SACK holes currently allocated");
 
+SYSCTL_SKMEM_TCP_INT(OID_AUTO, rack, CTLFLAG_RW | CTLFLAG_LOCKED,
+    int, tcp_rack, 0,
+    "Use RACK-TLP time based loss detection on new connections");
+
 extern struct zone *sack_hole_zone;
 
+/*
+ * The holes are disjoint, so ordering them by their start orders them
+ * by their end as well; the tree is an interval index of the scoreboard
+ * and the TAILQ links its neighbours.  Trimming the start of a hole
+ * keeps it between its neighbours and leaves the tree valid.
+ */
+static int tcp_sackhole_cmp(const struct sackhole *, const struct sackhole *);
+RB_PROTOTYPE_SC(__private_extern__, sackhole_tree, sackhole, scbnode,
+    tcp_sackhole_cmp);
+RB_GENERATE(sackhole_tree, sackhole, scbnode, tcp_sackhole_cmp);
+
+static int
+tcp_sackhole_cmp(const struct sackhole *a, const struct sackhole *b)
+{
+	if (SEQ_LT(a->start, b->start)) {
+		return -1;
+	}
+	if (SEQ_GT(a->start, b->start)) {
+		return 1;
+	}
+	return 0;
+}
+
+static void tcp_rack_sacked(struct tcpcb *, struct sackhole *, tcp_seq,
+    tcp_seq);
+static void tcp_rack_dsack(struct tcpcb *);
+
 #define TCP_VALIDATE_SACK_SEQ_NUMBERS(_tp_, _sb_, _ack_) \
     (SEQ_GT((_sb_)->end, (_sb_)->start) && \
     SEQ_GT((_sb_)->start, (_tp_)->snd_una) && \
@@ -295,12 +326,20 @@ tcp_sackhole_insert(struct tcpcb *tp, tcp_seq start, tcp_seq end,
 		return NULL;
 	}
 	hole->rxmit_start = tcp_now;
+	hole->rxmit_ts = 0;
+	if (TAILQ_EMPTY(&tp->snd_holes)) {
+		/* A new loss episode starts with nothing deemed lost */
+		tp->t_rack.lost_seq = tp->snd_una;
+		tp->t_rack.rxmit_high = tp->snd_una;
+	}
 	/* Insert the new SACK hole into scoreboard */
 	if (after != NULL) {
 		TAILQ_INSERT_AFTER(&tp->snd_holes, after, hole, scblink);
 	} else {
 		TAILQ_INSERT_TAIL(&tp->snd_holes, hole, scblink);
 	}
+	RB_INSERT(sackhole_tree, &tp->snd_holes_tree, hole);
+	tp->sackhint.sack_bytes_holes += (end - start);
 
 	/* Update SACK hint. */
 	if (tp->sackhint.nexthole == NULL) {
@@ -323,10 +362,29 @@ tcp_sackhole_remove(struct tcpcb *tp, struct sackhole *hole)
 
 	/* Remove this SACK hole. */
 	TAILQ_REMOVE(&tp->snd_holes, hole, scblink);
+	RB_REMOVE(sackhole_tree, &tp->snd_holes_tree, hole);
+	tp->sackhint.sack_bytes_holes -= (hole->end - hole->start);
 
 	/* Free this SACK hole. */
 	tcp_sackhole_free(tp, hole);
 }
+
+/*
+ * Returns the last hole that starts before `seq', or NULL if there is
+ * none.
+ */
+static struct sackhole *
+tcp_sackhole_find_before(struct tcpcb *tp, tcp_seq seq)
+{
+	struct sackhole find, *hole;
+
+	find.start = seq;
+	hole = RB_NFIND(sackhole_tree, &tp->snd_holes_tree, &find);
+	if (hole == NULL) {
+		return TAILQ_LAST(&tp->snd_holes, sackhole_head);
+	}
+	return TAILQ_PREV(hole, sackhole_head, scblink);
+}
 /*
  * When a new ack with SACK is received, check if it indicates packet
  * reordering. If there is packet reordering, the socket is marked and
@@ -380,6 +438,17 @@ tcp_sack_detect_reordering(struct tcpcb *tp, struct sackhole *s,
 		tcpstat.tcps_reordered_pkts++;
 		tp->t_reordered_pkts++;
 
+		/*
+		 * The duplicate ack threshold would have retransmitted
+		 * this data, RACK was still waiting for it.
+		 */
+		if (TCP_RACK_ENABLED(tp) &&
+		    SEQ_GEQ(s->start, tp->t_rack.lost_seq) &&
+		    snd_fack - sacked_seq >
+		    (uint32_t)((tcprexmtthresh - 1) * tp->t_maxseg)) {
+			tcpstat.tcps_rack_avoid_rxmt++;
+		}
+
 		/*
 		 * If reordering is seen on a connection wth ECN enabled,
 		 * increment the heuristic
@@ -418,14 +487,22 @@ tcp_sack_detect_reordering(struct tcpcb *tp, struct sackhole *s,
 	}
 }
 
+/*
+ * Accounts for newly SACKed data [start, end) from `hole', or from
+ * beyond snd_fack if `hole' is NULL.
+ */
 static void
-tcp_sack_update_byte_counter(struct tcpcb *tp, uint32_t start, uint32_t end,
-    uint32_t *newbytes_acked, uint32_t *towards_fr_acked)
+tcp_sack_update_byte_counter(struct tcpcb *tp, struct sackhole *hole,
+    uint32_t start, uint32_t end, uint32_t *newbytes_acked,
+    uint32_t *towards_fr_acked)
 {
 	*newbytes_acked += (end - start);
 	if (SEQ_GEQ(start, tp->send_highest_sack)) {
 		*towards_fr_acked += (end - start);
 	}
+	if (TCP_RACK_ENABLED(tp)) {
+		tcp_rack_sacked(tp, hole, start, end);
+	}
 }
 
 /*
@@ -522,7 +599,7 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 		temp = tcp_sackhole_insert(tp, tp->snd_fack, sblkp->start, NULL);
 		if (temp != NULL) {
 			tp->snd_fack = sblkp->end;
-			tcp_sack_update_byte_counter(tp, sblkp->start, sblkp->end, newbytes_acked, after_rexmit_acked);
+			tcp_sack_update_byte_counter(tp, NULL, sblkp->start, sblkp->end, newbytes_acked, after_rexmit_acked);
 
 			/* Go to the previous sack block. */
 			sblkp--;
@@ -541,13 +618,13 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 			}
 			if (sblkp >= sack_blocks &&
 			    SEQ_LT(tp->snd_fack, sblkp->end)) {
-				tcp_sack_update_byte_counter(tp, tp->snd_fack, sblkp->end, newbytes_acked, after_rexmit_acked);
+				tcp_sack_update_byte_counter(tp, NULL, tp->snd_fack, sblkp->end, newbytes_acked, after_rexmit_acked);
 				tp->snd_fack = sblkp->end;
 			}
 		}
 	} else if (SEQ_LT(tp->snd_fack, sblkp->end)) {
 		/* fack is advanced. */
-		tcp_sack_update_byte_counter(tp, tp->snd_fack, sblkp->end, newbytes_acked, after_rexmit_acked);
+		tcp_sack_update_byte_counter(tp, NULL, tp->snd_fack, sblkp->end, newbytes_acked, after_rexmit_acked);
 		tp->snd_fack = sblkp->end;
 	}
 	/* We must have at least one SACK hole in scoreboard */
@@ -568,9 +645,14 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 		if (SEQ_LEQ(sblkp->end, cur->start)) {
 			/*
 			 * SACKs data before the current hole.
-			 * Go to the previous hole.
+			 * Go to the previous hole, or look up the one
+			 * the block may overlap instead of walking over
+			 * all the holes in between.
 			 */
 			cur = TAILQ_PREV(cur, sackhole_head, scblink);
+			if (cur != NULL && SEQ_LEQ(sblkp->end, cur->start)) {
+				cur = tcp_sackhole_find_before(tp, sblkp->end);
+			}
 			continue;
 		}
 		tp->sackhint.sack_bytes_rexmit -= (cur->rxmit - cur->start);
@@ -582,7 +664,7 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 			/* Data acks at least the beginning of hole */
 			if (SEQ_GEQ(sblkp->end, cur->end)) {
 				/* Acks entire hole, so delete hole */
-				tcp_sack_update_byte_counter(tp, cur->start, cur->end, newbytes_acked, after_rexmit_acked);
+				tcp_sack_update_byte_counter(tp, cur, cur->start, cur->end, newbytes_acked, after_rexmit_acked);
 
 				tcp_sack_detect_reordering(tp, cur,
 				    cur->end, old_snd_fack);
@@ -596,9 +678,11 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 				continue;
 			} else {
 				/* Move start of hole forward */
-				tcp_sack_update_byte_counter(tp, cur->start, sblkp->end, newbytes_acked, after_rexmit_acked);
+				tcp_sack_update_byte_counter(tp, cur, cur->start, sblkp->end, newbytes_acked, after_rexmit_acked);
 				tcp_sack_detect_reordering(tp, cur,
 				    sblkp->end, old_snd_fack);
+				tp->sackhint.sack_bytes_holes -=
+				    (sblkp->end - cur->start);
 				cur->start = sblkp->end;
 				cur->rxmit = SEQ_MAX(cur->rxmit, cur->start);
 			}
@@ -606,9 +690,11 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 			/* Data acks at least the end of hole */
 			if (SEQ_GEQ(sblkp->end, cur->end)) {
 				/* Move end of hole backward */
-				tcp_sack_update_byte_counter(tp, sblkp->start, cur->end, newbytes_acked, after_rexmit_acked);
+				tcp_sack_update_byte_counter(tp, cur, sblkp->start, cur->end, newbytes_acked, after_rexmit_acked);
 				tcp_sack_detect_reordering(tp, cur,
 				    cur->end, old_snd_fack);
+				tp->sackhint.sack_bytes_holes -=
+				    (cur->end - sblkp->start);
 				cur->end = sblkp->start;
 				cur->rxmit = SEQ_MIN(cur->rxmit, cur->end);
 			} else {
@@ -621,13 +707,15 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 				temp = tcp_sackhole_insert(tp, sblkp->end,
 				    cur->end, cur);
 				if (temp != NULL) {
-					tcp_sack_update_byte_counter(tp, sblkp->start, sblkp->end, newbytes_acked, after_rexmit_acked);
+					tcp_sack_update_byte_counter(tp, cur, sblkp->start, sblkp->end, newbytes_acked, after_rexmit_acked);
 					if (SEQ_GT(cur->rxmit, temp->rxmit)) {
 						temp->rxmit = cur->rxmit;
 						tp->sackhint.sack_bytes_rexmit
 						        += (temp->rxmit
 						    - temp->start);
 					}
+					tp->sackhint.sack_bytes_holes -=
+					    (cur->end - sblkp->start);
 					cur->end = sblkp->start;
 					cur->rxmit = SEQ_MIN(cur->rxmit,
 					    cur->end);
@@ -638,6 +726,7 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 					 * window correctly
 					 */
 					temp->rxmit_start = cur->rxmit_start;
+					temp->rxmit_ts = cur->rxmit_ts;
 				}
 			}
 		}
@@ -719,12 +808,16 @@ tcp_sack_partialack(struct tcpcb *tp, struct tcphdr *th)
 			tp->snd_fack = tp->snd_recover;
 		}
 	}
+	if (TCP_RACK_ENABLED(tp)) {
+		(void) tcp_rack_detect_loss(tp);
+	}
 	(void) tcp_output(tp);
 }
 
 /*
- * Debug version of tcp_sack_output() that walks the scoreboard. Used for
- * now to sanity check the hint.
+ * Debug version of tcp_sack_output() that walks the scoreboard. Used to
+ * sanity check the hint, and to recompute it if tcp_sack_hint_valid()
+ * finds it inconsistent.
  */
 static struct sackhole *
 tcp_sack_output_debug(struct tcpcb *tp, int *sack_bytes_rexmt)
@@ -745,6 +838,33 @@ tcp_sack_output_debug(struct tcpcb *tp, int *sack_bytes_rexmt)
 	return p;
 }
 
+/*
+ * Cheap consistency check of the hint, in place of the scoreboard walk:
+ * the hole before the next one to retransmit must have been retransmitted
+ * in full, and no more can have been retransmitted than is missing.
+ */
+static boolean_t
+tcp_sack_hint_valid(struct tcpcb *tp)
+{
+	struct sackhole *hole = tp->sackhint.nexthole, *prev;
+
+	if (tp->sackhint.sack_bytes_rexmit < 0 ||
+	    (u_int32_t)tp->sackhint.sack_bytes_rexmit >
+	    tp->sackhint.sack_bytes_holes) {
+		return FALSE;
+	}
+	if (hole == NULL) {
+		prev = TAILQ_LAST(&tp->snd_holes, sackhole_head);
+	} else {
+		if (SEQ_LT(hole->rxmit, hole->start) ||
+		    SEQ_GT(hole->rxmit, hole->end)) {
+			return FALSE;
+		}
+		prev = TAILQ_PREV(hole, sackhole_head, scblink);
+	}
+	return prev == NULL || SEQ_GEQ(prev->rxmit, prev->end);
+}
+
 /*
  * Returns the next hole to retransmit and the number of retransmitted bytes
  * from the scoreboard. We store both the next hole and the number of
@@ -765,10 +885,18 @@ tcp_sack_output_debug(struct tcpcb *tp, int *sack_bytes_rexmt)
 struct sackhole *
 tcp_sack_output(struct tcpcb *tp, int *sack_bytes_rexmt)
 {
-	struct sackhole *hole = NULL, *dbg_hole = NULL;
+	struct sackhole *hole = NULL;
+#if DEVELOPMENT || DEBUG
+	struct sackhole *dbg_hole = NULL;
 	int dbg_bytes_rexmt;
 
 	dbg_hole = tcp_sack_output_debug(tp, &dbg_bytes_rexmt);
+#else
+	if (__improbable(!tcp_sack_hint_valid(tp))) {
+		tp->sackhint.nexthole = tcp_sack_output_debug(tp,
+		    &tp->sackhint.sack_bytes_rexmit);
+	}
+#endif /* DEVELOPMENT || DEBUG */
 	*sack_bytes_rexmt = tp->sackhint.sack_bytes_rexmit;
 	hole = tp->sackhint.nexthole;
 	if (hole == NULL || SEQ_LT(hole->rxmit, hole->end)) {
@@ -781,6 +909,7 @@ tcp_sack_output(struct tcpcb *tp, int *sack_bytes_rexmt)
 		}
 	}
 out:
+#if DEVELOPMENT || DEBUG
 	if (dbg_hole != hole) {
 		printf("%s: Computed sack hole not the same as cached value\n", __func__);
 		hole = dbg_hole;
@@ -791,6 +920,12 @@ out:
 		    __func__, dbg_bytes_rexmt, *sack_bytes_rexmt);
 		*sack_bytes_rexmt = dbg_bytes_rexmt;
 	}
+#endif /* DEVELOPMENT || DEBUG */
+	/* With RACK, only what has been deemed lost is retransmitted */
+	if (hole != NULL && TCP_RACK_ENABLED(tp) &&
+	    SEQ_GEQ(hole->rxmit, tp->t_rack.lost_seq)) {
+		hole = NULL;
+	}
 	return hole;
 }
 
@@ -819,9 +954,9 @@ tcp_sack_lost_rexmit(struct tcpcb *tp)
 void
 tcp_sack_adjust(struct tcpcb *tp)
 {
-	struct sackhole *p, *cur = TAILQ_FIRST(&tp->snd_holes);
+	struct sackhole *p, *cur;
 
-	if (cur == NULL) {
+	if (TAILQ_EMPTY(&tp->snd_holes)) {
 		return; /* No holes */
 	}
 	if (SEQ_GEQ(tp->snd_nxt, tp->snd_fack)) {
@@ -832,21 +967,15 @@ tcp_sack_adjust(struct tcpcb *tp)
 	 * i) snd_nxt lies between end of one hole and beginning of another
 	 * ii) snd_nxt lies between end of last hole and snd_fack
 	 */
-	while ((p = TAILQ_NEXT(cur, scblink)) != NULL) {
-		if (SEQ_LT(tp->snd_nxt, cur->end)) {
-			return;
-		}
-		if (SEQ_GEQ(tp->snd_nxt, p->start)) {
-			cur = p;
-		} else {
-			tp->snd_nxt = p->start;
-			return;
-		}
-	}
-	if (SEQ_LT(tp->snd_nxt, cur->end)) {
+	cur = tcp_sackhole_find_before(tp, tp->snd_nxt + 1);
+	if (cur == NULL || SEQ_LT(tp->snd_nxt, cur->end)) {
 		return;
 	}
-	tp->snd_nxt = tp->snd_fack;
+	if ((p = TAILQ_NEXT(cur, scblink)) != NULL) {
+		tp->snd_nxt = p->start;
+	} else {
+		tp->snd_nxt = tp->snd_fack;
+	}
 	return;
 }
 
@@ -857,8 +986,8 @@ tcp_sack_adjust(struct tcpcb *tp)
 boolean_t
 tcp_sack_byte_islost(struct tcpcb *tp)
 {
-	u_int32_t unacked_bytes, sndhole_bytes = 0;
-	struct sackhole *sndhole;
+	u_int32_t unacked_bytes, sndhole_bytes;
+
 	if (!SACK_ENABLED(tp) || IN_FASTRECOVERY(tp) ||
 	    TAILQ_EMPTY(&tp->snd_holes) ||
 	    (tp->t_flagsext & TF_PKTS_REORDERED)) {
@@ -866,10 +995,7 @@ tcp_sack_byte_islost(struct tcpcb *tp)
 	}
 
 	unacked_bytes = tp->snd_max - tp->snd_una;
-
-	TAILQ_FOREACH(sndhole, &tp->snd_holes, scblink) {
-		sndhole_bytes += (sndhole->end - sndhole->start);
-	}
+	sndhole_bytes = tp->sackhint.sack_bytes_holes;
 
 	VERIFY(unacked_bytes >= sndhole_bytes);
 	return (unacked_bytes - sndhole_bytes) >
@@ -980,6 +1106,306 @@ tcp_sack_process_dsack(struct tcpcb *tp, struct tcpopt *to,
 		return TRUE;
 	} else {
 		tcp_rxtseg_set_spurious(tp, first_sack.start, (first_sack.end - 1));
+		if (TCP_RACK_ENABLED(tp)) {
+			tcp_rack_dsack(tp);
+		}
 	}
 	return TRUE;
 }
+
+/*
+ * Records that new data is being sent at snd_max.  Data sent within
+ * 1/8th of an RTT shares a sample, whose time is that of the last
+ * send, so the samples give an upper bound on when any byte was sent.
+ */
+void
+tcp_rack_sent(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+	int32_t gran;
+	int i;
+
+	/* Forget the ranges that have been acknowledged */
+	while (rack->nsamples > 1 &&
+	    SEQ_LEQ(rack->samples[(rack->first + 1) %
+	    TCP_RACK_NSAMPLES].seq, tp->snd_una)) {
+		rack->first = (rack->first + 1) % TCP_RACK_NSAMPLES;
+		rack->nsamples--;
+	}
+
+	gran = (tp->t_srtt >> TCP_RTT_SHIFT) >> 3;
+	if (gran < 1) {
+		gran = 1;
+	}
+	if (rack->nsamples > 0 &&
+	    timer_diff(tcp_now, 0, rack->sample_start, 0) < gran) {
+		i = (rack->first + rack->nsamples - 1) % TCP_RACK_NSAMPLES;
+		rack->samples[i].ts = tcp_now;
+		return;
+	}
+
+	if (rack->nsamples == TCP_RACK_NSAMPLES) {
+		rack->first = (rack->first + 1) % TCP_RACK_NSAMPLES;
+		rack->nsamples--;
+	}
+	i = (rack->first + rack->nsamples) % TCP_RACK_NSAMPLES;
+	rack->samples[i].seq = tp->snd_max;
+	rack->samples[i].ts = tcp_now;
+	rack->nsamples++;
+	rack->sample_start = tcp_now;
+}
+
+/*
+ * Returns the latest time at which the original transmission of `seq'
+ * could have been sent.
+ */
+static u_int32_t
+tcp_rack_sent_ts(struct tcpcb *tp, tcp_seq seq)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+	u_int32_t ts = tcp_now;
+	int i, n;
+
+	for (n = 0; n < rack->nsamples; n++) {
+		i = (rack->first + n) % TCP_RACK_NSAMPLES;
+		if (n > 0 && SEQ_GT(rack->samples[i].seq, seq)) {
+			break;
+		}
+		ts = rack->samples[i].ts;
+	}
+	return ts;
+}
+
+/*
+ * Updates the most recently sent data known to be delivered
+ * (RFC 8985, 6.2 step 2).
+ */
+static void
+tcp_rack_advance(struct tcpcb *tp, u_int32_t ts, tcp_seq end_seq)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+	int32_t rtt;
+
+	rtt = timer_diff(tcp_now, 0, ts, 0);
+	if (rtt < 0) {
+		return;
+	}
+	if (rtt == 0) {
+		rtt = 1;
+	}
+	if (rack->min_rtt == 0 || (u_int32_t)rtt < rack->min_rtt) {
+		rack->min_rtt = rtt;
+	}
+	if (rack->rtt == 0 || TSTMP_GT(ts, rack->xmit_ts) ||
+	    (ts == rack->xmit_ts && SEQ_GT(end_seq, rack->end_seq))) {
+		rack->xmit_ts = ts;
+		rack->end_seq = end_seq;
+		rack->rtt = rtt;
+	}
+}
+
+/*
+ * Called for data [start, end) newly SACKed out of `hole' (NULL if it
+ * was beyond snd_fack).  The part below hole->rxmit was retransmitted;
+ * an ack for it that comes back faster than the path allows was for
+ * the original transmission and can not be timed.
+ */
+static void
+tcp_rack_sacked(struct tcpcb *tp, struct sackhole *hole, tcp_seq start,
+    tcp_seq end)
+{
+	/* After a timeout everything was sent again, nothing can be timed */
+	if (tp->t_rxtshift > 0) {
+		return;
+	}
+	if (hole != NULL && SEQ_LT(start, hole->rxmit)) {
+		if (timer_diff(tcp_now, 0, hole->rxmit_ts, 0) >=
+		    (int32_t)tp->t_rack.min_rtt) {
+			tcp_rack_advance(tp, hole->rxmit_ts,
+			    SEQ_MIN(end, hole->rxmit));
+		}
+		if (SEQ_LEQ(end, hole->rxmit)) {
+			return;
+		}
+	}
+	tcp_rack_advance(tp, tcp_rack_sent_ts(tp, end - 1), end);
+}
+
+/*
+ * A DSACK reported a spurious retransmission: widen the reordering
+ * window, at most once per round trip (RFC 8985, 6.2 step 4).
+ */
+static void
+tcp_rack_dsack(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+
+	if (rack->dsack_round != 0 && SEQ_LT(tp->snd_una, rack->dsack_round)) {
+		return;
+	}
+	rack->dsack_round = tp->snd_max;
+	if (rack->reo_wnd_mult < UINT8_MAX) {
+		rack->reo_wnd_mult++;
+	}
+	rack->reo_wnd_persist = 16;
+	tcpstat.tcps_rack_reo_wnd_grow++;
+}
+
+/*
+ * Returns the reordering window, in ms.  Until reordering has been seen
+ * it is left out once the losses are obvious from the SACKs.
+ */
+static u_int32_t
+tcp_rack_reo_wnd(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+	u_int32_t span, sacked = 0;
+
+	if (!(tp->t_flagsext & TF_PKTS_REORDERED)) {
+		span = tp->snd_fack - tp->snd_una;
+		if (span > tp->sackhint.sack_bytes_holes) {
+			sacked = span - tp->sackhint.sack_bytes_holes;
+		}
+		if (IN_FASTRECOVERY(tp) ||
+		    sacked >= (u_int32_t)(tcprexmtthresh * tp->t_maxseg)) {
+			return 0;
+		}
+	}
+	return min(rack->reo_wnd_mult * rack->min_rtt / 4,
+	           tp->t_srtt >> TCP_RTT_SHIFT);
+}
+
+/*
+ * RACK loss detection (RFC 8985, 6.2 step 5): data is lost once data
+ * sent after it was delivered and the reordering window has passed
+ * since it was sent.  Original transmissions go out in sequence order,
+ * so the lost ones all lie below t_rack.lost_seq, which the sender
+ * retransmits up to.  Retransmissions are checked against their own
+ * send times and sent again when lost.
+ *
+ * Returns TRUE if there is lost data to retransmit.  Otherwise the
+ * reordering timer, TCPT_DELAYFR, is armed for when the next hole
+ * would be deemed lost.
+ */
+boolean_t
+tcp_rack_detect_loss(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+	struct sackhole *hole, *first_lost = NULL;
+	u_int32_t reo_wnd, ts, rtt, xmit_ts;
+	int32_t left, timeout = 0;
+	boolean_t lost = FALSE;
+	tcp_seq end, end_seq;
+	int i, n;
+
+	if (TAILQ_EMPTY(&tp->snd_holes)) {
+		return FALSE;
+	}
+	rtt = rack->rtt;
+	xmit_ts = rack->xmit_ts;
+	end_seq = rack->end_seq;
+	if (rtt == 0) {
+		/*
+		 * No delivery was timed yet, e.g. the first SACKs only
+		 * cover data sent before an earlier timeout: go by the
+		 * smoothed RTT and the send time of the highest data
+		 * SACKed, so that the reordering timer still gets armed.
+		 */
+		rtt = tp->t_srtt >> TCP_RTT_SHIFT;
+		if (rtt == 0 || SEQ_LEQ(tp->snd_fack, tp->snd_una)) {
+			return FALSE;
+		}
+		xmit_ts = tcp_rack_sent_ts(tp, tp->snd_fack - 1);
+		end_seq = tp->snd_fack;
+	}
+	reo_wnd = tcp_rack_reo_wnd(tp);
+	if (SEQ_LT(rack->lost_seq, tp->snd_una)) {
+		rack->lost_seq = tp->snd_una;
+	}
+
+	for (n = 0; n < rack->nsamples; n++) {
+		i = (rack->first + n) % TCP_RACK_NSAMPLES;
+		ts = rack->samples[i].ts;
+		end = (n + 1 < rack->nsamples) ?
+		    rack->samples[(i + 1) % TCP_RACK_NSAMPLES].seq :
+		    tp->snd_max;
+		if (SEQ_LEQ(end, rack->lost_seq)) {
+			continue;
+		}
+		/* Nothing sent after the latest delivery can be judged */
+		if (TSTMP_GT(ts, xmit_ts)) {
+			break;
+		}
+		if (ts == xmit_ts && SEQ_GT(end, end_seq)) {
+			end = end_seq;
+		}
+		left = timer_diff(ts + rtt + reo_wnd, 0, tcp_now, 0);
+		if (left > 0) {
+			timeout = left;
+			break;
+		}
+		end = SEQ_MIN(end, tp->snd_fack);
+		if (SEQ_GT(end, rack->lost_seq)) {
+			rack->lost_seq = end;
+		}
+	}
+	hole = TAILQ_FIRST(&tp->snd_holes);
+	if (SEQ_LT(hole->start, rack->lost_seq)) {
+		lost = TRUE;
+	}
+
+	/*
+	 * Holes are retransmitted in sequence order, so the walk stops at
+	 * the first retransmission that is not lost yet.
+	 */
+	for (; hole != NULL && SEQ_LT(hole->start, rack->rxmit_high);
+	    hole = TAILQ_NEXT(hole, scblink)) {
+		if (hole->rxmit == hole->start) {
+			continue;
+		}
+		if (TSTMP_GEQ(hole->rxmit_ts, xmit_ts)) {
+			break;
+		}
+		left = timer_diff(hole->rxmit_ts + rtt + reo_wnd, 0,
+		    tcp_now, 0);
+		if (left > 0) {
+			if (timeout == 0 || left < timeout) {
+				timeout = left;
+			}
+			break;
+		}
+		tp->sackhint.sack_bytes_rexmit -= (hole->rxmit - hole->start);
+		if (tp->sackhint.sack_bytes_rexmit < 0) {
+			tp->sackhint.sack_bytes_rexmit = 0;
+		}
+		hole->rxmit = hole->start;
+		tcpstat.tcps_rack_lost_rexmit++;
+		if (first_lost == NULL) {
+			first_lost = hole;
+		}
+		lost = TRUE;
+	}
+	if (first_lost != NULL && (tp->sackhint.nexthole == NULL ||
+	    SEQ_LT(first_lost->start, tp->sackhint.nexthole->start))) {
+		tp->sackhint.nexthole = first_lost;
+	}
+
+	if (timeout > 0) {
+		tp->t_timer[TCPT_DELAYFR] = OFFSET_FROM_START(tp, timeout);
+	}
+	return lost;
+}
+
+/*
+ * Called when RACK puts the connection into recovery.
+ */
+void
+tcp_rack_recovery(struct tcpcb *tp)
+{
+	struct tcp_rack *rack = &tp->t_rack;
+
+	tcpstat.tcps_rack_recovery_episode++;
+	if (rack->reo_wnd_persist > 0 && --rack->reo_wnd_persist == 0) {
+		rack->reo_wnd_mult = 1;
+	}
+}
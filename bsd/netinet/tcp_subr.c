@@ -88,6 +88,7 @@
 
 #include <net/route.h>
 #include <net/if.h>
+#include <net/dlil.h>
 #include <net/content_filter.h>
 #include <net/ntstat.h>
 #include <net/multi_layer_pkt_log.h>
@@ -536,6 +537,9 @@ tcp_init(struct protosw *pp, struct domain *dp)
 	str_size = (vm_size_t)P2ROUNDUP(sizeof(struct tcp_ccstate), sizeof(u_int64_t));
 	tcp_cc_zone = zone_create("tcp_cc_zone", str_size, ZC_NONE);
 
+	str_size = (vm_size_t)P2ROUNDUP(sizeof(struct tcp_bbr_state), sizeof(u_int64_t));
+	tcp_bbr_zone = zone_create("tcp_bbr_zone", str_size, ZC_NONE);
+
 	str_size = (vm_size_t)P2ROUNDUP(sizeof(struct tcp_rxt_seg), sizeof(u_int64_t));
 	tcp_rxt_seg_zone = zone_create("tcp_rxt_seg_zone", str_size, ZC_NONE);
 
@@ -552,8 +556,9 @@ tcp_init(struct protosw *pp, struct domain *dp)
 	/* Initialize time wait and timer lists */
 	TAILQ_INIT(&tcp_tw_tailq);
 
+	/* all the slots of the timer wheel start out empty */
 	bzero(&tcp_timer_list, sizeof(tcp_timer_list));
-	LIST_INIT(&tcp_timer_list.lhead);
+	tcp_timer_list.wheel_time = tcp_now;
 	/*
 	 * allocate lock group attribute, group and attribute for
 	 * the tcp timer list
@@ -1049,8 +1054,13 @@ tcp_newtcpcb(struct inpcb *inp)
 
 	tp->t_flags = (TF_REQ_SCALE | TF_REQ_TSTMP);
 	tp->t_flagsext |= TF_SACK_ENABLE;
+	if (tcp_rack) {
+		tp->t_flagsext |= TF_RACK;
+	}
+	tp->t_rack.reo_wnd_mult = 1;
 
 	TAILQ_INIT(&tp->snd_holes);
+	RB_INIT(&tp->snd_holes_tree);
 	SLIST_INIT(&tp->t_rxt_segments);
 	SLIST_INIT(&tp->t_notify_ack);
 	tp->t_inpcb = inp;
@@ -1065,12 +1075,7 @@ tcp_newtcpcb(struct inpcb *inp)
 	tp->t_rttmin = tcp_TCPTV_MIN;
 	tp->t_rxtcur = TCPTV_RTOBASE;
 
-	if (tcp_use_newreno) {
-		/* use newreno by default */
-		tp->tcp_cc_index = TCP_CC_ALGO_NEWRENO_INDEX;
-	} else {
-		tp->tcp_cc_index = TCP_CC_ALGO_CUBIC_INDEX;
-	}
+	tp->tcp_cc_index = (u_int8_t)tcp_cc_foreground_index(tp);
 
 	tcp_cc_allocate_state(tp);
 
@@ -1606,6 +1611,10 @@ no_valid_rt:
 		zfree(tcp_cc_zone, tp->t_ccstate);
 		tp->t_ccstate = NULL;
 	}
+	if (tp->t_bbrstate != NULL) {
+		zfree(tcp_bbr_zone, tp->t_bbrstate);
+		tp->t_bbrstate = NULL;
+	}
 	tp->tcp_cc_index = TCP_CC_ALGO_NONE;
 
 	/* Can happen if we close the socket before receiving the third ACK */
@@ -3302,6 +3311,10 @@ tcp_set_tso(struct tcpcb *tp, struct ifnet *ifp)
 			} else {
 				tp->tso_max_segment_size = TCP_MAXWIN;
 			}
+		} else if (IFNET_GSO_CAPABLE(ifp)) {
+			/* dlil_output will segment it in software */
+			tp->t_flags |= TF_TSO;
+			tp->tso_max_segment_size = TCP_MAXWIN;
 		}
 	} else {
 		if (ifp->if_hwassist & IFNET_TSO_IPV4) {
@@ -3315,6 +3328,9 @@ tcp_set_tso(struct tcpcb *tp, struct ifnet *ifp)
 				tp->tso_max_segment_size -=
 				    CLAT46_HDR_EXPANSION_OVERHD;
 			}
+		} else if (IFNET_GSO_CAPABLE(ifp)) {
+			tp->t_flags |= TF_TSO;
+			tp->tso_max_segment_size = TCP_MAXWIN;
 		}
 	}
 
@@ -75,7 +75,9 @@
 #include <sys/queue.h>
 #include <kern/locks.h>
 #include <kern/cpu_number.h>    /* before tcp_seq.h, for tcp_random18() */
+#include <kern/clock.h>
 #include <mach/boolean.h>
+#include <mach/mach_time.h>
 
 #include <net/route.h>
 #include <net/if_var.h>
@@ -262,6 +264,44 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, tcp_resched_timerlist,
     CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_resched_timerlist, 0,
     "Number of times timer list was rescheduled as part of processing a packet");
 
+/*
+ * Timer wheel statistics, a run being one call of tcp_run_timerlist.
+ */
+static uint64_t tcp_timer_wheel_runs = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_runs,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_runs,
+    "Number of runs of the timer wheel");
+
+static uint64_t tcp_timer_wheel_slots = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_slots,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_slots,
+    "Number of timer wheel slots run");
+
+static uint64_t tcp_timer_wheel_expired = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_expired,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_expired,
+    "Number of connections whose timers were run");
+
+static uint64_t tcp_timer_wheel_cascaded = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_cascaded,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_cascaded,
+    "Number of connections moved down the timer wheel");
+
+static uint64_t tcp_timer_wheel_run_ns = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_run_ns,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_run_ns,
+    "Time spent in runs of the timer wheel, in nanoseconds");
+
+static uint64_t tcp_timer_wheel_run_ns_last = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_run_ns_last,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_run_ns_last,
+    "Duration of the last run of the timer wheel, in nanoseconds");
+
+static uint64_t tcp_timer_wheel_run_ns_max = 0;
+SYSCTL_QUAD(_net_inet_tcp, OID_AUTO, timer_wheel_run_ns_max,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &tcp_timer_wheel_run_ns_max,
+    "Duration of the longest run of the timer wheel, in nanoseconds");
+
 SYSCTL_SKMEM_TCP_INT(OID_AUTO, pmtud_blackhole_detection,
     CTLFLAG_RW | CTLFLAG_LOCKED, int, tcp_pmtud_black_hole_detect, 1,
     "Path MTU Discovery Black Hole Detection");
@@ -306,6 +346,7 @@ int     tcp_jack_rxmt = TCP_RETRANSHZ / 2;
 static boolean_t tcp_itimer_done = FALSE;
 
 static void tcp_remove_timer(struct tcpcb *tp);
+static void tcp_move_timer(struct tcpcb *tp);
 static void tcp_sched_timerlist(uint32_t offset);
 static u_int32_t tcp_run_conn_timer(struct tcpcb *tp, u_int16_t *mode,
     u_int16_t probe_if_index);
@@ -394,6 +435,11 @@ struct tcp_last_report_stats {
 /* Returns true if the timer is on the timer list */
 #define TIMER_IS_ON_LIST(tp) ((tp)->t_flags & TF_TIMER_ONLIST)
 
+/* The slot holding the entry is due well after its deadline */
+#define TIMER_SLOT_IS_LATE(te) \
+	(timer_diff((te)->slot_time, 0, (te)->runtime, 0) >= \
+	TCP_TIMER_WHEEL_QUANTUM)
+
 /* Run the TCP timerlist atleast once every hour */
 #define TCP_TIMERLIST_MAX_OFFSET (60 * 60 * TCP_RETRANSHZ)
 
@@ -492,6 +538,184 @@ timer_diff(uint32_t t1, uint32_t toff1, uint32_t t2, uint32_t toff2)
 	return (int32_t)((t1 + toff1) - (t2 + toff2));
 }
 
+/*
+ * Timer wheel primitives, called with the timer list lock held.
+ */
+
+/* Slot in which wheel tick `tick' is run or cascaded from */
+static struct timerlisthead *
+tcp_timer_wheel_slot(struct tcptimerlist *listp, uint32_t tick)
+{
+	uint32_t delta = tick - listp->wheel_tick;
+	int level;
+
+	if (delta < TCP_TIMER_WHEEL_REACH(0)) {
+		return &listp->wheel0[tick & TCP_TIMER_WHEEL_L0_MASK];
+	}
+	for (level = 1; level < TCP_TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < TCP_TIMER_WHEEL_REACH(level)) {
+			break;
+		}
+	}
+	return &listp->wheeln[level - 1][(tick >> (TCP_TIMER_WHEEL_L0_BITS +
+	       (level - 1) * TCP_TIMER_WHEEL_LN_BITS)) & TCP_TIMER_WHEEL_LN_MASK];
+}
+
+/* Puts a timer entry in the slot of its deadline */
+static void
+tcp_timer_wheel_insert(struct tcptimerlist *listp, struct tcptimerentry *te)
+{
+	int32_t diff = timer_diff(te->runtime, 0, listp->wheel_time, 0);
+	uint32_t ticks = 0;
+
+	if (diff > 0) {
+		/*
+		 * Deadlines past the top level are parked in its last slot,
+		 * and placed again when that slot is cascaded.
+		 */
+		ticks = howmany((uint32_t)diff, TCP_TIMER_WHEEL_QUANTUM);
+		ticks = min(ticks,
+		    TCP_TIMER_WHEEL_REACH(TCP_TIMER_WHEEL_LEVELS - 1) - 1);
+		te->slot_time = listp->wheel_time +
+		    ticks * TCP_TIMER_WHEEL_QUANTUM;
+	} else {
+		te->slot_time = te->runtime;
+	}
+	LIST_INSERT_HEAD(tcp_timer_wheel_slot(listp, listp->wheel_tick + ticks),
+	    te, le);
+}
+
+/* Moves all the entries of a slot onto another list */
+static void
+tcp_timer_wheel_splice(struct timerlisthead *from, struct timerlisthead *to)
+{
+	struct tcptimerentry *te;
+
+	while ((te = LIST_FIRST(from)) != NULL) {
+		LIST_REMOVE(te, le);
+		LIST_INSERT_HEAD(to, te, le);
+	}
+}
+
+/* Spreads the entries of a higher level slot over the levels below */
+static void
+tcp_timer_wheel_cascade(struct tcptimerlist *listp,
+    struct timerlisthead *head)
+{
+	struct tcptimerentry *te;
+
+	while ((te = LIST_FIRST(head)) != NULL) {
+		LIST_REMOVE(te, le);
+		tcp_timer_wheel_insert(listp, te);
+		tcp_timer_wheel_cascaded++;
+	}
+}
+
+/*
+ * Runs the slot of the current wheel tick, after cascading the slots of
+ * the higher levels that start with it: its entries go to `expired'.
+ */
+static void
+tcp_timer_wheel_advance(struct tcptimerlist *listp,
+    struct timerlisthead *expired)
+{
+	uint32_t tick = listp->wheel_tick;
+	int level, shift;
+
+	for (level = 1; level < TCP_TIMER_WHEEL_LEVELS; level++) {
+		shift = TCP_TIMER_WHEEL_L0_BITS +
+		    (level - 1) * TCP_TIMER_WHEEL_LN_BITS;
+		if ((tick & ((1U << shift) - 1)) != 0) {
+			break;
+		}
+		tcp_timer_wheel_cascade(listp, &listp->wheeln[level - 1]
+		    [(tick >> shift) & TCP_TIMER_WHEEL_LN_MASK]);
+	}
+	tcp_timer_wheel_splice(&listp->wheel0[tick & TCP_TIMER_WHEEL_L0_MASK],
+	    expired);
+
+	listp->wheel_tick++;
+	listp->wheel_time += TCP_TIMER_WHEEL_QUANTUM;
+	tcp_timer_wheel_slots++;
+}
+
+/* Takes all the entries off the wheel, onto `list' */
+static void
+tcp_timer_wheel_collect(struct tcptimerlist *listp, struct timerlisthead *list)
+{
+	int level, i;
+
+	for (i = 0; i < TCP_TIMER_WHEEL_L0_SIZE; i++) {
+		tcp_timer_wheel_splice(&listp->wheel0[i], list);
+	}
+	for (level = 1; level < TCP_TIMER_WHEEL_LEVELS; level++) {
+		for (i = 0; i < TCP_TIMER_WHEEL_LN_SIZE; i++) {
+			tcp_timer_wheel_splice(&listp->wheeln[level - 1][i],
+			    list);
+		}
+	}
+}
+
+/*
+ * Returns the number of wheel ticks until there is a slot to run or to
+ * cascade, UINT32_MAX if the wheel is empty, and in `mode' the modes of
+ * the connections that this concerns within the next 500 ms.
+ */
+static uint32_t
+tcp_timer_wheel_next(struct tcptimerlist *listp, uint32_t *mode)
+{
+	struct timerlisthead *head;
+	struct tcptimerentry *te;
+	uint32_t tick = listp->wheel_tick, next = UINT32_MAX, k, at;
+	int level, shift;
+
+	*mode = 0;
+	for (k = 0; k < TCP_TIMER_WHEEL_L0_SIZE; k++) {
+		if (k * TCP_TIMER_WHEEL_QUANTUM >= TCP_TIMER_500MS_QUANTUM &&
+		    next != UINT32_MAX) {
+			break;
+		}
+		head = &listp->wheel0[(tick + k) & TCP_TIMER_WHEEL_L0_MASK];
+		if (LIST_EMPTY(head)) {
+			continue;
+		}
+		if (next == UINT32_MAX) {
+			next = k;
+		}
+		if (k * TCP_TIMER_WHEEL_QUANTUM < TCP_TIMER_500MS_QUANTUM) {
+			LIST_FOREACH(te, head, le) {
+				*mode |= te->mode;
+			}
+		}
+	}
+
+	for (level = 1; level < TCP_TIMER_WHEEL_LEVELS; level++) {
+		shift = TCP_TIMER_WHEEL_L0_BITS +
+		    (level - 1) * TCP_TIMER_WHEEL_LN_BITS;
+		for (k = 1; k <= TCP_TIMER_WHEEL_LN_SIZE; k++) {
+			/* a slot is cascaded when the wheel reaches its start */
+			at = (((tick >> shift) + k) << shift) - tick;
+			if (at >= next) {
+				break;
+			}
+			head = &listp->wheeln[level - 1]
+			    [((tick >> shift) + k) & TCP_TIMER_WHEEL_LN_MASK];
+			if (LIST_EMPTY(head)) {
+				continue;
+			}
+			next = at;
+			if (at * TCP_TIMER_WHEEL_QUANTUM <
+			    TCP_TIMER_500MS_QUANTUM) {
+				LIST_FOREACH(te, head, le) {
+					*mode |= te->mode;
+				}
+			}
+			break;
+		}
+	}
+	return next;
+}
+
 /*
  * Add to tcp timewait list, delay is given in milliseconds.
  */
@@ -1740,6 +1964,32 @@ fc_output:
 	case TCPT_DELAYFR:
 		tp->t_flagsext &= ~TF_DELAY_RECOVERY;
 
+		/*
+		 * With RACK this is the reordering timer: enter
+		 * recovery, or retransmit more of it, if a hole has
+		 * now been outstanding for longer than the reordering
+		 * window.
+		 */
+		if (TCP_RACK_ENABLED(tp)) {
+			tcpstat.tcps_rack_reorder_timeout++;
+			if (tp->t_rxtshift > 0 || !tcp_rack_detect_loss(tp)) {
+				break;
+			}
+			if (IN_FASTRECOVERY(tp)) {
+				(void) tcp_output(tp);
+				break;
+			}
+
+			/*
+			 * Enter recovery as on reaching the duplicate ack
+			 * threshold: the reordering window already did the
+			 * waiting that delayed recovery is for.
+			 */
+			tcp_enter_fast_recovery(tp, NULL);
+			(void) tcp_output(tp);
+			break;
+		}
+
 		/*
 		 * Don't do anything if one of the following is true:
 		 * - the connection is already in recovery
@@ -1804,10 +2054,6 @@ tcp_remove_timer(struct tcpcb *tp)
 		return;
 	}
 
-	if (listp->next_te != NULL && listp->next_te == &tp->tentry) {
-		listp->next_te = LIST_NEXT(&tp->tentry, le);
-	}
-
 	LIST_REMOVE(&tp->tentry, le);
 	tp->t_flags &= ~(TF_TIMER_ONLIST);
 
@@ -1818,6 +2064,25 @@ tcp_remove_timer(struct tcpcb *tp)
 	lck_mtx_unlock(listp->mtx);
 }
 
+/* Move a timer entry to the wheel slot of its current deadline */
+static void
+tcp_move_timer(struct tcpcb *tp)
+{
+	struct tcptimerlist *listp = &tcp_timer_list;
+
+	socket_lock_assert_owned(tp->t_inpcb->inp_socket);
+	if (!(TIMER_IS_ON_LIST(tp))) {
+		return;
+	}
+	lck_mtx_lock(listp->mtx);
+	if (TIMER_IS_ON_LIST(tp)) {
+		LIST_REMOVE(&tp->tentry, le);
+		tcp_timer_wheel_insert(listp, &tp->tentry);
+	}
+	lck_mtx_unlock(listp->mtx);
+	tp->tentry.sched_runtime = tp->tentry.runtime;
+}
+
 /*
  * Function to check if the timerlist needs to be rescheduled to run
  * the timer entry correctly. Basically, this is to check if we can avoid
@@ -2024,9 +2289,13 @@ tcp_run_conn_timer(struct tcpcb *tp, u_int16_t *te_mode,
 	}
 
 done:
-	if (tp != NULL && tp->tentry.index == TCPT_NONE) {
-		tcp_remove_timer(tp);
-		offset = 0;
+	if (tp != NULL) {
+		if (tp->tentry.index == TCPT_NONE) {
+			tcp_remove_timer(tp);
+			offset = 0;
+		} else {
+			tcp_move_timer(tp);
+		}
 	}
 
 	socket_unlock(so, 1);
@@ -2037,13 +2306,15 @@ void
 tcp_run_timerlist(void * arg1, void * arg2)
 {
 #pragma unused(arg1, arg2)
-	struct tcptimerentry *te, *next_te;
+	struct timerlisthead expired;
+	struct tcptimerentry *te;
 	struct tcptimerlist *listp = &tcp_timer_list;
 	struct tcpcb *tp;
 	uint32_t next_timer = 0; /* offset of the next timer on the list */
 	u_int16_t te_mode = 0;  /* modes of all active timers in a tcpcb */
 	u_int16_t list_mode = 0; /* cumulative of modes of all tcpcbs */
 	uint32_t active_count = 0;
+	uint64_t run_start, run_ns;
 
 	calculate_tcp_clock();
 
@@ -2071,23 +2342,40 @@ tcp_run_timerlist(void * arg1, void * arg2)
 	}
 
 	listp->running = TRUE;
+	run_start = mach_absolute_time();
 
-	LIST_FOREACH_SAFE(te, &listp->lhead, le, next_te) {
+	/*
+	 * Gather the entries of all the slots that are due.  Connections
+	 * over an interface to probe have to be looked at whatever their
+	 * deadline, and after a long sleep placing every entry again is
+	 * cheaper than going through all the slots that went by.
+	 */
+	LIST_INIT(&expired);
+	if (listp->probe_if_index != 0 ||
+	    timer_diff(tcp_now, 0, listp->wheel_time, 0) >=
+	    (int32_t)(TCP_TIMER_WHEEL_REACH(1) * TCP_TIMER_WHEEL_QUANTUM)) {
+		tcp_timer_wheel_collect(listp, &expired);
+		listp->wheel_time = tcp_now;
+	}
+	while (timer_diff(tcp_now, 0, listp->wheel_time, 0) >= 0) {
+		tcp_timer_wheel_advance(listp, &expired);
+	}
+
+	while ((te = LIST_FIRST(&expired)) != NULL) {
 		uint32_t offset = 0;
-		uint32_t runtime = te->runtime;
 
 		tp = TIMERENTRY_TO_TP(te);
+		LIST_REMOVE(te, le);
 
 		/*
-		 * An interface probe may need to happen before the previously scheduled runtime
+		 * The deadline may have been pushed back since the entry was
+		 * put in its slot, in which case it just moves to a later
+		 * one.  An interface probe may need to happen before the
+		 * previously scheduled runtime.
 		 */
-		if (te->index < TCPT_NONE && TSTMP_GT(runtime, tcp_now) &&
+		if (te->index < TCPT_NONE && TSTMP_GT(te->runtime, tcp_now) &&
 		    !TCP_IF_STATE_CHANGED(tp, listp->probe_if_index)) {
-			offset = timer_diff(runtime, 0, tcp_now, 0);
-			if (next_timer == 0 || offset < next_timer) {
-				next_timer = offset;
-			}
-			list_mode |= te->mode;
+			tcp_timer_wheel_insert(listp, te);
 			continue;
 		}
 
@@ -2104,28 +2392,23 @@ tcp_run_timerlist(void * arg1, void * arg2)
 			 * protected by the timer list lock, we can
 			 * do it here without the socket lock.
 			 */
-			if (TIMER_IS_ON_LIST(tp)) {
-				tp->t_flags &= ~(TF_TIMER_ONLIST);
-				LIST_REMOVE(&tp->tentry, le);
-				listp->entries--;
+			tp->t_flags &= ~(TF_TIMER_ONLIST);
+			listp->entries--;
 
-				tp->tentry.le.le_next = NULL;
-				tp->tentry.le.le_prev = NULL;
-			}
+			tp->tentry.le.le_next = NULL;
+			tp->tentry.le.le_prev = NULL;
 			continue;
 		}
 		active_count++;
 
 		/*
-		 * Store the next timerentry pointer before releasing the
-		 * list lock. If that entry has to be removed when we
-		 * release the lock, this pointer will be updated to the
-		 * element after that.
+		 * Keep the entry in the slot that runs next while its
+		 * timers run without the list lock; tcp_run_conn_timer
+		 * moves it on to the slot of its next deadline.
 		 */
-		listp->next_te = next_te;
-
-		VERIFY_NEXT_LINK(&tp->tentry, le);
-		VERIFY_PREV_LINK(&tp->tentry, le);
+		LIST_INSERT_HEAD(&listp->wheel0[listp->wheel_tick &
+		    TCP_TIMER_WHEEL_L0_MASK], te, le);
+		te->slot_time = listp->wheel_time;
 
 		lck_mtx_unlock(listp->mtx);
 
@@ -2134,9 +2417,6 @@ tcp_run_timerlist(void * arg1, void * arg2)
 
 		lck_mtx_lock(listp->mtx);
 
-		next_te = listp->next_te;
-		listp->next_te = NULL;
-
 		if (offset > 0 && te_mode != 0) {
 			list_mode |= te_mode;
 
@@ -2146,8 +2426,21 @@ tcp_run_timerlist(void * arg1, void * arg2)
 		}
 	}
 
-	if (!LIST_EMPTY(&listp->lhead)) {
-		uint32_t next_mode = 0;
+	if (listp->entries > 0) {
+		uint32_t next_mode = 0, wheel_mode = 0, ticks;
+
+		ticks = tcp_timer_wheel_next(listp, &wheel_mode);
+		if (ticks != UINT32_MAX) {
+			int32_t diff = timer_diff(listp->wheel_time,
+			    ticks * TCP_TIMER_WHEEL_QUANTUM, tcp_now, 0);
+			uint32_t offset = (diff > 0) ? (uint32_t)diff : 1;
+
+			if (next_timer == 0 || offset < next_timer) {
+				next_timer = offset;
+			}
+			list_mode |= wheel_mode;
+		}
+
 		if ((list_mode & TCP_TIMERLIST_10MS_MODE) ||
 		    (listp->pref_mode & TCP_TIMERLIST_10MS_MODE)) {
 			next_mode = TCP_TIMERLIST_10MS_MODE;
@@ -2202,6 +2495,15 @@ tcp_run_timerlist(void * arg1, void * arg2)
 	listp->pref_offset = 0;
 	listp->probe_if_index = 0;
 
+	absolutetime_to_nanoseconds(mach_absolute_time() - run_start, &run_ns);
+	tcp_timer_wheel_runs++;
+	tcp_timer_wheel_expired += active_count;
+	tcp_timer_wheel_run_ns += run_ns;
+	tcp_timer_wheel_run_ns_last = run_ns;
+	if (run_ns > tcp_timer_wheel_run_ns_max) {
+		tcp_timer_wheel_run_ns_max = run_ns;
+	}
+
 	lck_mtx_unlock(listp->mtx);
 }
 
@@ -2216,6 +2518,7 @@ tcp_sched_timers(struct tcpcb *tp)
 	u_int16_t index = te->index;
 	u_int16_t mode = te->mode;
 	struct tcptimerlist *listp = &tcp_timer_list;
+	uint32_t sched_runtime = te->sched_runtime;
 	int32_t offset = 0;
 	boolean_t list_locked = FALSE;
 
@@ -2242,6 +2545,7 @@ tcp_sched_timers(struct tcpcb *tp)
 		offset = 1;
 		tcp_timer_advanced++;
 	}
+	te->sched_runtime = te->runtime;
 
 	if (!TIMER_IS_ON_LIST(tp)) {
 		if (!list_locked) {
@@ -2250,7 +2554,11 @@ tcp_sched_timers(struct tcpcb *tp)
 		}
 
 		if (!TIMER_IS_ON_LIST(tp)) {
-			LIST_INSERT_HEAD(&listp->lhead, te, le);
+			if (listp->entries == 0 && !listp->running) {
+				/* the wheel stands still while it is empty */
+				listp->wheel_time = tcp_now;
+			}
+			tcp_timer_wheel_insert(listp, te);
 			tp->t_flags |= TF_TIMER_ONLIST;
 
 			listp->entries++;
@@ -2263,6 +2571,26 @@ tcp_sched_timers(struct tcpcb *tp)
 				goto schedule;
 			}
 		}
+	} else if (sched_runtime == 0 ||
+	    TSTMP_LT(te->runtime, sched_runtime) || TIMER_SLOT_IS_LATE(te)) {
+		/*
+		 * The deadline was brought forward: the entry may have to
+		 * move to an earlier slot.  The run and the cascade of the
+		 * wheel place entries by a runtime read without the socket
+		 * lock, and slot_time changes under the list lock only, so
+		 * the slot is checked under the list lock: either the wheel
+		 * has placed the entry by the old deadline and it is moved
+		 * here, or it places it by the new one.  Deadlines pushed
+		 * back are left to the wheel, which moves the entry when it
+		 * reaches its slot.
+		 */
+		lck_mtx_lock(listp->mtx);
+		list_locked = TRUE;
+
+		if (TIMER_IS_ON_LIST(tp) && TIMER_SLOT_IS_LATE(te)) {
+			LIST_REMOVE(te, le);
+			tcp_timer_wheel_insert(listp, te);
+		}
 	}
 
 	/*
@@ -232,17 +232,45 @@ static char *tcptimers[] =
 struct tcptimerlist;
 
 struct tcptimerentry {
-	LIST_ENTRY(tcptimerentry) le;   /* links for timer list */
+	LIST_ENTRY(tcptimerentry) le;   /* links for timer wheel slot */
 	uint32_t timer_start;   /* tcp clock when the timer was started */
 	uint16_t index;         /* index of lowest timer that needs to run first */
 	uint16_t mode;          /* Bit-wise OR of timers that are active */
 	uint32_t runtime;       /* deadline at which the first timer has to fire */
+	uint32_t slot_time;     /* tcp clock at which its wheel slot is due */
+	uint32_t sched_runtime; /* runtime last scheduled, under the socket lock */
 };
 
 LIST_HEAD(timerlisthead, tcptimerentry);
 
+/*
+ * The timer list is a hierarchical timing wheel.  Level 0 has a slot for
+ * each TCP_TIMER_WHEEL_QUANTUM of the next 2.56 seconds; each level above
+ * has 64 slots spanning the whole of the level below, for a total of about
+ * 7.7 days.  A connection sits in the slot of its earliest deadline, and
+ * the slots of the higher levels are spread over the lower ones as the
+ * wheel turns, so that connections with far away timers are only looked
+ * at a handful of times.
+ */
+#define TCP_TIMER_WHEEL_QUANTUM TCP_TIMER_10MS_QUANTUM
+#define TCP_TIMER_WHEEL_L0_BITS 8
+#define TCP_TIMER_WHEEL_L0_SIZE (1 << TCP_TIMER_WHEEL_L0_BITS)
+#define TCP_TIMER_WHEEL_L0_MASK (TCP_TIMER_WHEEL_L0_SIZE - 1)
+#define TCP_TIMER_WHEEL_LN_BITS 6
+#define TCP_TIMER_WHEEL_LN_SIZE (1 << TCP_TIMER_WHEEL_LN_BITS)
+#define TCP_TIMER_WHEEL_LN_MASK (TCP_TIMER_WHEEL_LN_SIZE - 1)
+#define TCP_TIMER_WHEEL_LEVELS  4
+
+/* first wheel tick past the reach of level `l' */
+#define TCP_TIMER_WHEEL_REACH(l) \
+	(1U << (TCP_TIMER_WHEEL_L0_BITS + (l) * TCP_TIMER_WHEEL_LN_BITS))
+
 struct tcptimerlist {
-	struct timerlisthead lhead;     /* head of the list */
+	struct timerlisthead wheel0[TCP_TIMER_WHEEL_L0_SIZE];
+	struct timerlisthead wheeln[TCP_TIMER_WHEEL_LEVELS - 1]
+	[TCP_TIMER_WHEEL_LN_SIZE];
+	uint32_t wheel_tick;    /* next wheel slot to run */
+	uint32_t wheel_time;    /* tcp clock at which that slot is due */
 	lck_mtx_t *mtx;         /* lock to protect the list */
 	lck_attr_t *mtx_attr;   /* mutex attributes */
 	lck_grp_t *mtx_grp;     /* mutex group definition */
@@ -263,7 +291,6 @@ struct tcptimerlist {
 	uint32_t pref_mode;     /* Preferred mode set by a connection */
 	uint32_t pref_offset;   /* Preferred offset set by a connection */
 	uint32_t idleruns;      /* Number of times the list has been idle in fast mode */
-	struct tcptimerentry *next_te;  /* next timer entry pointer to process */
 	u_int16_t probe_if_index; /* Interface index that needs to send probes */
 };
 
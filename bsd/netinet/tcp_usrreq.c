@@ -1719,6 +1719,7 @@ tcp_fill_info(struct tcpcb *tp, struct tcp_info *ti)
 		ti->tcpi_reordered_pkts = tp->t_reordered_pkts;
 		ti->tcpi_dsack_sent = tp->t_dsack_sent;
 		ti->tcpi_dsack_recvd = tp->t_dsack_recvd;
+		ti->tcpi_pacing_rate = tp->t_pacing_rate;
 	}
 }
 
@@ -2533,6 +2534,25 @@ tcp_ctloutput(struct socket *so, struct sockopt *sopt)
 				tp->t_rxt_minimum_timeout *= TCP_RETRANSHZ;
 			}
 			break;
+		case TCP_CC_ALGORITHM:
+			error = sooptcopyin(sopt, &optval, sizeof(optval),
+			    sizeof(optval));
+			if (error) {
+				break;
+			}
+			if (optval != TCP_CC_ALGO_NONE &&
+			    optval != TCP_CC_ALGO_NEWRENO_INDEX &&
+			    optval != TCP_CC_ALGO_CUBIC_INDEX &&
+			    optval != TCP_CC_ALGO_BBR_INDEX) {
+				error = EINVAL;
+				break;
+			}
+			tp->t_cc_user_index = (u_int8_t)optval;
+			/* background transport keeps LEDBAT until it goes foreground */
+			if (tp->tcp_cc_index != TCP_CC_ALGO_BACKGROUND_INDEX) {
+				tcp_set_foreground_cc(so);
+			}
+			break;
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -2706,6 +2726,13 @@ tcp_ctloutput(struct socket *so, struct sockopt *sopt)
 		case TCP_RXT_MINIMUM_TIMEOUT:
 			optval = tp->t_rxt_minimum_timeout / TCP_RETRANSHZ;
 			break;
+		case TCP_CC_ALGORITHM:
+			/*
+			 * A background connection runs LEDBAT, which can not
+			 * be set: report the algorithm it runs in foreground.
+			 */
+			optval = tcp_cc_foreground_index(tp);
+			break;
 		default:
 			error = ENOPROTOOPT;
 			break;
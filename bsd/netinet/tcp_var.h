@@ -66,6 +66,7 @@
 #include <sys/types.h>
 #include <sys/appleapiopts.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include <netinet/in_pcb.h>
 #include <netinet/tcp.h>
 #include <netinet/tcp_timer.h>
@@ -171,13 +172,42 @@ struct sackhole {
 	tcp_seq end;            /* end seq no. */
 	tcp_seq rxmit;          /* next seq. no in hole to be retransmitted */
 	u_int32_t rxmit_start;  /* timestamp of first retransmission */
+	u_int32_t rxmit_ts;     /* timestamp of last retransmission */
 	TAILQ_ENTRY(sackhole) scblink;  /* scoreboard linkage */
+	RB_ENTRY(sackhole) scbnode;     /* scoreboard index, by start */
 };
 
 struct sackhint {
 	struct sackhole *nexthole;
 	int     sack_bytes_rexmit;
 	int sack_bytes_acked;
+	u_int32_t sack_bytes_holes;     /* bytes in all the holes */
+};
+
+/*
+ * RACK-TLP (RFC 8985) loss detection state.  Send times of original
+ * transmissions are kept as a small ring of sequence ranges, each with
+ * the time its data was last sent, at a granularity of a fraction of
+ * the RTT.
+ */
+#define TCP_RACK_NSAMPLES       16
+struct tcp_rack {
+	u_int32_t       xmit_ts;        /* send time of the latest data delivered */
+	tcp_seq         end_seq;        /* and its end sequence number */
+	u_int32_t       rtt;            /* RTT of that delivery, 0 if none yet */
+	u_int32_t       min_rtt;        /* smallest RTT seen by RACK */
+	tcp_seq         lost_seq;       /* original data below this is lost */
+	tcp_seq         rxmit_high;     /* highest hole retransmission sent */
+	tcp_seq         dsack_round;    /* snd_max when the window last grew */
+	u_int8_t        reo_wnd_mult;   /* reordering window, in min_rtt/4 */
+	u_int8_t        reo_wnd_persist; /* recoveries left before it shrinks */
+	u_int8_t        first;          /* oldest sample */
+	u_int8_t        nsamples;       /* samples in use */
+	u_int32_t       sample_start;   /* time the newest sample was started */
+	struct {
+		tcp_seq         seq;    /* start of the range */
+		u_int32_t       ts;     /* last time data in it was sent */
+	} samples[TCP_RACK_NSAMPLES];
 };
 
 struct tcp_rxt_seg {
@@ -224,6 +254,35 @@ struct mpt_dsn_map {
 };
 #define tcp6cb          tcpcb  /* for KAME src sync over BSD*'s */
 
+/*
+ * BBR congestion control state.  It is much larger than the state of the
+ * other algorithms, so it comes from a zone of its own rather than from
+ * the tcp_ccstate union.
+ */
+#define TCP_BBR_BW_ROUNDS       10      /* rounds in the max bandwidth filter */
+struct tcp_bbr_state {
+	u_int64_t bbr_bw[TCP_BBR_BW_ROUNDS]; /* delivery rate of recent rounds, bytes/sec */
+	u_int64_t bbr_full_bw;   /* bandwidth at the last 25% growth */
+	u_int64_t bbr_round_start; /* uptime in usec at the start of the round */
+	tcp_seq   bbr_round_una; /* snd_una at the start of the round */
+	tcp_seq   bbr_round_end; /* round ends when this is acked */
+	u_int32_t bbr_round_count; /* rounds since the model was reset */
+	u_int32_t bbr_min_rtt;   /* min RTT in ms, 0 if unknown */
+	u_int32_t bbr_min_rtt_stamp; /* TS of the min RTT sample */
+	u_int32_t bbr_rtt_updates; /* t_rttupdated at the last sample */
+	u_int32_t bbr_cycle_stamp; /* TS of the start of the gain phase */
+	u_int32_t bbr_probe_rtt_done; /* TS at which PROBE_RTT may end */
+	tcp_seq   bbr_probe_rtt_end; /* PROBE_RTT lasts until this is acked */
+	u_int32_t bbr_prior_cwnd; /* cwnd before recovery or PROBE_RTT */
+	u_int16_t bbr_pacing_gain; /* in units of 1/256 */
+	u_int16_t bbr_cwnd_gain; /* in units of 1/256 */
+	u_int8_t  bbr_mode;      /* STARTUP, DRAIN, PROBE_BW or PROBE_RTT */
+	u_int8_t  bbr_cycle_idx; /* phase of the PROBE_BW gain cycle */
+	u_int8_t  bbr_full_bw_cnt; /* rounds without bandwidth growth */
+	u_int8_t  bbr_bw_idx;    /* next slot of bbr_bw */
+	u_int8_t  bbr_flags;
+};
+
 struct tcp_ccstate {
 	union {
 		struct tcp_cubic_state {
@@ -361,6 +420,7 @@ struct tcpcb {
 	u_int8_t        t_adaptive_rtimo;       /* Read timeout used as a multiple of RTT */
 	u_int8_t        t_adaptive_wtimo;       /* Write timeout used as a multiple of RTT */
 	u_int8_t        t_stretchack_delayed;   /* stretch ack delayed */
+	u_int8_t        t_cc_user_index;        /* CC algorithm set by TCP_CC_ALGORITHM */
 
 /* State for limiting early retransmits when SACK is not enabled */
 	u_int16_t       t_early_rexmt_count; /* count of early rexmts */
@@ -437,6 +497,8 @@ struct tcpcb {
 	                                 *   episode starts at this seq number */
 	TAILQ_HEAD(sackhole_head, sackhole) snd_holes;
 	/* SACK scoreboard (sorted) */
+	RB_HEAD(sackhole_tree, sackhole) snd_holes_tree;
+	/* the same holes, indexed for lookups */
 	tcp_seq snd_fack;               /* last seq number(+1) sack'd by rcv'r*/
 	int     rcv_numsacks;           /* # distinct sack blks present */
 	struct sackblk sackblks[MAX_SACK_BLKS]; /* seq nos. of sack blocks */
@@ -500,6 +562,7 @@ struct tcpcb {
 #define TF_REASS_INPROG         0x800000        /* Reassembly is in progress */
 #define TF_FASTOPEN_FORCE_ENABLE 0x1000000      /* Force-enable TCP Fastopen */
 #define TF_LOGGED_CONN_SUMMARY  0x2000000       /* Connection summary was logged */
+#define TF_RACK                 0x4000000       /* RACK loss detection */
 
 #if TRAFFIC_MGT
 	/* Inter-arrival jitter related state */
@@ -516,9 +579,13 @@ struct tcpcb {
 	tcp_seq         t_idleat;               /* rcv_nxt at idle time */
 	TAILQ_ENTRY(tcpcb) t_twentry;           /* link for time wait queue */
 	struct tcp_ccstate      *t_ccstate;     /* congestion control related state */
+	struct tcp_bbr_state    *t_bbrstate;    /* BBR state, allocated on first use */
+	u_int64_t       t_pacing_rate;          /* pacing rate in bytes/sec, 0 if not paced */
+	u_int64_t       t_pacing_next;          /* departure time of next paced segment (ns) */
 /* Tail loss probe related state */
 	tcp_seq         t_tlphighrxt;           /* snd_nxt after PTO */
 	u_int32_t       t_tlpstart;             /* timestamp at PTO */
+	struct tcp_rack t_rack;                 /* RACK loss detection state */
 /* DSACK data receiver state */
 	tcp_seq         t_dsack_lseq;           /* DSACK left sequence */
 	tcp_seq         t_dsack_rseq;           /* DSACK right sequence */
@@ -653,6 +720,9 @@ struct tcpcb {
 
 #define IN_FASTRECOVERY(tp)     (tp->t_flags & TF_FASTRECOVERY)
 #define SACK_ENABLED(tp)        (tp->t_flagsext & TF_SACK_ENABLE)
+#define TCP_RACK_ENABLED(tp) \
+	(((tp)->t_flagsext & (TF_RACK | TF_SACK_ENABLE)) == \
+	    (TF_RACK | TF_SACK_ENABLE))
 
 /*
  * If the connection is in a throttled state due to advisory feedback from
@@ -1188,6 +1258,13 @@ struct  tcpstat {
 	u_int32_t       tcps_ka_offload_drops;  /* Keep alive drops for timeout reported by firmware */
 
 	u_int32_t       tcps_mptcp_triggered_cell;      /* Total number of times an MPTCP-connection triggered cell bringup */
+
+	/* RACK-TLP loss detection statistics */
+	u_int32_t       tcps_rack_recovery_episode;     /* Recoveries entered on a RACK detected loss */
+	u_int32_t       tcps_rack_lost_rexmit;  /* Retransmissions found lost by RACK */
+	u_int32_t       tcps_rack_reorder_timeout;      /* RACK reordering timer fired */
+	u_int32_t       tcps_rack_avoid_rxmt;   /* Duplicate ack threshold retransmissions avoided */
+	u_int32_t       tcps_rack_reo_wnd_grow; /* Reordering window grown on DSACK */
 };
 
 
@@ -1494,6 +1571,7 @@ extern lck_spin_t *tcp_uptime_lock;
 extern int tcp_delack_enabled;
 extern int maxseg_unacked;
 extern int tcp_use_newreno;
+extern int tcp_use_bbr;
 extern struct zone *tcp_reass_zone;
 extern struct zone *tcp_rxt_seg_zone;
 extern int tcp_ecn_outbound;
@@ -1510,6 +1588,7 @@ extern int tcp_randomize_timestamps;
 #define TCP_ACK_COMPRESSION_DUMMY 1
 
 extern int tcp_do_better_lr;
+extern int tcp_rack;
 extern int tcp_cubic_minor_fixes;
 extern int tcp_cubic_rfc_compliant;
 extern int tcp_flow_control_response;
@@ -1575,6 +1654,9 @@ struct sackhole *tcp_sack_output(struct tcpcb *tp, int *sack_bytes_rexmt);
 void     tcp_sack_partialack(struct tcpcb *, struct tcphdr *);
 void     tcp_free_sackholes(struct tcpcb *tp);
 void     tcp_sack_lost_rexmit(struct tcpcb *tp);
+void     tcp_rack_sent(struct tcpcb *tp);
+boolean_t tcp_rack_detect_loss(struct tcpcb *tp);
+void     tcp_rack_recovery(struct tcpcb *tp);
 int32_t  tcp_sbspace(struct tcpcb *tp);
 void     tcp_set_tso(struct tcpcb *tp, struct ifnet *ifp);
 void     tcp_set_ecn(struct tcpcb *tp, struct ifnet *ifp);
@@ -1620,6 +1702,8 @@ extern  u_int32_t tcp_recvspace;
 tcp_seq tcp_new_isn(struct tcpcb *);
 
 extern int tcp_input_checksum(int, struct mbuf *, struct tcphdr *, int, int);
+extern struct mbuf *tcp_gro_input(struct ifnet *, int, struct mbuf *);
+extern struct mbuf *tcp_gso_segment(int, struct mbuf *, struct mbuf **);
 extern void tcp_getconninfo(struct socket *, struct conninfo_tcp *);
 extern void add_to_time_wait(struct tcpcb *, uint32_t delay);
 extern void tcp_pmtud_revert_segment_size(struct tcpcb *tp);
@@ -1631,6 +1715,7 @@ extern boolean_t tcp_rxtseg_detect_bad_rexmt(struct tcpcb *, tcp_seq);
 extern boolean_t tcp_rxtseg_dsack_for_tlp(struct tcpcb *);
 extern u_int32_t tcp_rxtseg_total_size(struct tcpcb *tp);
 extern void tcp_rexmt_save_state(struct tcpcb *tp);
+extern void tcp_enter_fast_recovery(struct tcpcb *tp, struct tcphdr *th);
 extern void tcp_interface_send_probe(u_int16_t if_index_available);
 extern void tcp_probe_connectivity(struct ifnet *ifp, u_int32_t enable);
 extern void tcp_get_connectivity_status(struct tcpcb *,
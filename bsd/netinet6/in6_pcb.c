@@ -127,6 +127,7 @@
 
 #include <kern/kern_types.h>
 #include <kern/zalloc.h>
+#include <kern/smr.h>
 
 #if IPSEC
 #include <netinet6/ipsec.h>
@@ -1283,6 +1284,52 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	return 0;
 }
 
+/*
+ * Lockless lookup of the pcb of an established flow, see
+ * in_pcblookup_hash_smr().  NULL means the caller has to look
+ * again with ipi_lock held.
+ */
+static struct inpcb *
+in6_pcblookup_hash_smr(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
+    uint16_t fport, struct in6_addr *laddr, uint16_t lport, struct ifnet *ifp)
+{
+	struct inpcbhead *head;
+	struct inpcb *inp;
+
+	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
+	    lport, fport, pcbinfo->ipi_hashmask)];
+
+	smr_enter(&inpcb_smr);
+	for (inp = smr_entered_load(&head->lh_first); inp != NULL;
+	    inp = smr_entered_load(&inp->inp_hash.le_next)) {
+		if ((inp->inp_vflag & INP_IPV6) &&
+		    IN6_ARE_ADDR_EQUAL(&inp->in6p_faddr, faddr) &&
+		    IN6_ARE_ADDR_EQUAL(&inp->in6p_laddr, laddr) &&
+		    inp->inp_fport == fport &&
+		    inp->inp_lport == lport) {
+			if (in_pcb_checkstate(inp, WNT_ACQUIRE, 0) ==
+			    WNT_STOPUSING) {
+				inp = NULL;
+			}
+			break;
+		}
+	}
+	smr_leave(&inpcb_smr);
+
+	if (inp == NULL) {
+		return NULL;
+	}
+	if (inp_restricted_recv(inp, ifp)
+#if NECP
+	    || !necp_socket_is_allowed_to_recv_on_interface(inp, ifp)
+#endif /* NECP */
+	    ) {
+		in_pcb_checkstate(inp, WNT_RELEASE, 0);
+		return NULL;
+	}
+	return inp;
+}
+
 /*
  * Lookup PCB in hash list.
  */
@@ -1295,6 +1342,14 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	struct inpcb *inp;
 	uint16_t fport = (uint16_t)fport_arg, lport = (uint16_t)lport_arg;
 
+	if (inp_lookup_smr) {
+		inp = in6_pcblookup_hash_smr(pcbinfo, faddr, fport, laddr,
+		    lport, ifp);
+		if (inp != NULL) {
+			return inp;
+		}
+	}
+
 	lck_rw_lock_shared(pcbinfo->ipi_lock);
 
 	/*
@@ -1337,6 +1392,8 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	}
 	if (wildcard) {
 		struct inpcb *local_wild = NULL;
+		u_int32_t lbhash = INP_PCBLBGROUP_PKTHASH(
+			faddr->s6_addr32[3] /* XXX */, lport, fport);
 
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
@@ -1359,6 +1416,8 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 			    inp->inp_lport == lport) {
 				if (IN6_ARE_ADDR_EQUAL(&inp->in6p_laddr,
 				    laddr)) {
+					inp = in_pcblbgroup_select(inp,
+					    lbhash, ifp);
 					if (in_pcb_checkstate(inp, WNT_ACQUIRE,
 					    0) != WNT_STOPUSING) {
 						lck_rw_done(pcbinfo->ipi_lock);
@@ -1374,6 +1433,10 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 				}
 			}
 		}
+		if (local_wild != NULL) {
+			local_wild = in_pcblbgroup_select(local_wild,
+			    lbhash, ifp);
+		}
 		if (local_wild && in_pcb_checkstate(local_wild,
 		    WNT_ACQUIRE, 0) != WNT_STOPUSING) {
 			lck_rw_done(pcbinfo->ipi_lock);
@@ -1737,8 +1737,9 @@ ip6_fragment_packet(struct mbuf **mptr, struct ip6_pktopts *opt,
 	/*
 	 * transmit packet without fragmentation
 	 */
+	GSO_MARK(m, GSO_IPV6_OK(ifp, m));
 	if (dontfrag ||
-	    (tlen <= mtu || TSO_IPV6_OK(ifp, m) ||
+	    (tlen <= mtu || TSO_IPV6_OK(ifp, m) || GSO_MARKED(m) ||
 	    (ifp->if_hwassist & CSUM_FRAGMENT_IPV6))) {
 		/*
 		 * mppn not updated in this case because no new chain is formed
@@ -4199,6 +4200,11 @@ ip6_output_checksum(struct ifnet *ifp, uint32_t mtu, struct mbuf *m,
 	uint32_t sw_csum, hwcap = ifp->if_hwassist;
 	int tso = TSO_IPV6_OK(ifp, m);
 
+	if (GSO_MARKED(m)) {
+		/* tcp_gso_segment() computes each segment's checksum */
+		return;
+	}
+
 	if (!hwcksum_tx) {
 		/* do all in software; checksum offload is disabled */
 		sw_csum = CSUM_DELAY_IPV6_DATA & m->m_pkthdr.csum_flags;
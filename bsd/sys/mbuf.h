@@ -449,7 +449,7 @@ struct pkthdr {
 	union builtin_mtag builtin_mtag;
 
 	uint32_t comp_gencnt;
-	uint32_t padding;
+	uint32_t pkt_pacing_delay;      /* TX: ns after enqueue the pkt may leave */
 	/*
 	 * Module private scratch space (32-bit aligned), currently 16-bytes
 	 * large. Anything stored here is not guaranteed to survive across
@@ -536,6 +536,7 @@ struct pkthdr {
 #define PKTF_INET6_RESOLVE      0x80    /* IPv6 resolver packet */
 #define PKTF_RESOLVE_RTR        0x100   /* pkt is for resolving router */
 #define PKTF_SKIP_PKTAP         0x200   /* pkt has already passed through pktap */
+#define PKTF_SW_GSO             0x400   /* TCP super-segment dlil_output must segment */
 #define PKTF_MPTCP              0x800   /* TCP with MPTCP metadata */
 #define PKTF_MPSO               0x1000  /* MPTCP socket meta data */
 #define PKTF_LOOP               0x2000  /* loopbacked packet */
@@ -1559,6 +1560,8 @@ __private_extern__ mbuf_traffic_class_t m_get_traffic_class(struct mbuf *);
 __private_extern__ u_int16_t m_adj_sum16(struct mbuf *, u_int32_t,
     u_int32_t, u_int32_t, u_int32_t);
 __private_extern__ u_int16_t m_sum16(struct mbuf *, u_int32_t, u_int32_t);
+__private_extern__ u_int16_t m_copydata_sum(struct mbuf *, int, int, void *,
+    u_int32_t);
 
 __private_extern__ void m_set_ext(struct mbuf *, struct ext_ref *,
     m_ext_free_func_t, caddr_t);
@@ -1396,6 +1396,11 @@ extern int socket_delegate(int, int, int, pid_t);
  * recvmsg_x() returns the number of datagrams that have been received,
  * or -1 if an error occurred.
  *
+ * On a SOCK_STREAM socket, the data is spread in order over the buffers of
+ * the messages, a message with no buffer space counting as received when
+ * later ones got data.  With MSG_PEEK, every message peeks at the head of
+ * the stream.
+ *
  * NOTE: This a private system call, the API is subject to change.
  */
 ssize_t recvmsg_x(int s, const struct msghdr_x *msgp, u_int cnt, int flags);
@@ -215,6 +215,7 @@ struct socket {
 	STAILQ_ENTRY(socket) so_cache_ent;      /* socache entry */
 	caddr_t         so_saved_pcb;           /* Saved pcb when cacheing */
 	u_int32_t       cache_timestamp;        /* time socket was cached */
+	unsigned long   cache_smr_seq;          /* inpcb_smr goal when cached */
 
 	pid_t           last_pid;       /* pid of most recent accessor */
 	u_int64_t       last_upid;      /* upid of most recent accessor */
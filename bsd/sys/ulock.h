@@ -91,10 +91,17 @@ extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
 
 /*
  * operation bits [15, 8] contain the flags for __ulock_wake
+ *
+ * @const ULF_WAKE_N
+ * Wake up to `wake_value` waiters in priority order, while holding the
+ * ulock once.  Not valid for UL_UNFAIR_LOCK, or with ULF_WAKE_ALL or
+ * ULF_WAKE_THREAD.  On success, __ulock_wake returns the number of
+ * threads that were woken.
  */
 #define ULF_WAKE_ALL                    0x00000100
 #define ULF_WAKE_THREAD                 0x00000200
 #define ULF_WAKE_ALLOW_NON_OWNER        0x00000400
+#define ULF_WAKE_N                      0x00000800
 
 /*
  * operation bits [23, 16] contain the flags for __ulock_wait
@@ -134,7 +141,8 @@ extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
 #define ULF_WAKE_MASK           (ULF_NO_ERRNO | \
 	                         ULF_WAKE_ALL | \
 	                         ULF_WAKE_THREAD | \
-	                         ULF_WAKE_ALLOW_NON_OWNER)
+	                         ULF_WAKE_ALLOW_NON_OWNER | \
+	                         ULF_WAKE_N)
 
 #endif /* PRIVATE */
 
@@ -144,9 +144,12 @@ struct  nchstats nchstats;              /* cache effectiveness statistics */
 #endif
 
 
-/* vars for name cache list lock */
+/*
+ * vars for name cache list lock: lookups take it shared on every
+ * path component, entries are only added or purged exclusive.
+ */
 static LCK_GRP_DECLARE(namecache_lck_grp, "Name Cache");
-static LCK_RW_DECLARE(namecache_rw_lock, &namecache_lck_grp);
+static LCK_RW_PERCPU_DECLARE(namecache_rw_lock, &namecache_lck_grp);
 
 static LCK_GRP_DECLARE(strcache_lck_grp, "String Cache");
 static LCK_ATTR_DECLARE(strcache_lck_attr, 0, 0);
@@ -2416,19 +2419,19 @@ nchinit(void)
 void
 name_cache_lock_shared(void)
 {
-	lck_rw_lock_shared(&namecache_rw_lock);
+	lck_rw_percpu_lock_shared(&namecache_rw_lock);
 }
 
 void
 name_cache_lock(void)
 {
-	lck_rw_lock_exclusive(&namecache_rw_lock);
+	lck_rw_percpu_lock_exclusive(&namecache_rw_lock);
 }
 
 void
 name_cache_unlock(void)
 {
-	lck_rw_done(&namecache_rw_lock);
+	lck_rw_percpu_done(&namecache_rw_lock);
 }
 
 
@@ -3390,6 +3390,13 @@ SYSCTL_QUAD(_vm, OID_AUTO, map_lookup_locked_copy_shadow_size,
 SYSCTL_QUAD(_vm, OID_AUTO, map_lookup_locked_copy_shadow_max,
     CTLFLAG_RD | CTLFLAG_LOCKED, &vm_map_lookup_locked_copy_shadow_max, "");
 
+extern uint64_t vm_map_copyin_move_count;
+extern uint64_t vm_map_copyin_move_size;
+SYSCTL_QUAD(_vm, OID_AUTO, map_copyin_move_count,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &vm_map_copyin_move_count, "");
+SYSCTL_QUAD(_vm, OID_AUTO, map_copyin_move_size,
+    CTLFLAG_RD | CTLFLAG_LOCKED, &vm_map_copyin_move_size, "");
+
 extern int vm_protect_privileged_from_untrusted;
 SYSCTL_INT(_vm, OID_AUTO, protect_privileged_from_untrusted,
     CTLFLAG_RW | CTLFLAG_LOCKED, &vm_protect_privileged_from_untrusted, 0, "");
@@ -199,6 +199,75 @@ mach_msg_size_t rcv_scatter_size;
 	return mr;
 }
 
+/*
+ *	Routine:	mach_msg_vector
+ *	Purpose:
+ *		Perform a batch of mach_msg operations in one trap.
+ *		Entries that were interrupted, when the user did not
+ *		request an indication of that fact, are restarted one by
+ *		one once the trap has processed the whole batch.
+ *
+ *		The kernel only writes the results of the entries it
+ *		reached, so they are all reset before the trap: a batch
+ *		the kernel gave up on early can't leave a stale
+ *		*_INTERRUPTED result behind that would get restarted.
+ */
+mach_msg_return_t
+mach_msg_vector(mach_msg_vector_t *vec, mach_msg_size_t count)
+{
+	mach_msg_return_t mr;
+	boolean_t restarted = FALSE;
+
+	if (count == 0 || count > MACH_MSG_VECTOR_MAX) {
+		return MACH_SEND_INVALID_DATA;
+	}
+
+	for (mach_msg_size_t i = 0; i < count; i++) {
+		vec[i].msgv_result = MACH_SEND_INVALID_DATA;
+	}
+
+	mr = mach_msg_vector_trap(vec, count);
+	if (mr == MACH_MSG_SUCCESS) {
+		return MACH_MSG_SUCCESS;
+	}
+
+	for (mach_msg_size_t i = 0; i < count; i++) {
+		mach_msg_vector_t *v = &vec[i];
+		mach_msg_header_t *msg = (mach_msg_header_t *)(uintptr_t)v->msgv_data;
+
+		if ((v->msgv_option & MACH_SEND_INTERRUPT) == 0) {
+			while (v->msgv_result == MACH_SEND_INTERRUPTED) {
+				v->msgv_result = MACH_MSG_TRAP(msg,
+				    v->msgv_option & ~LIBMACH_OPTIONS,
+				    v->msgv_send_size, v->msgv_rcv_size,
+				    v->msgv_rcv_name, v->msgv_timeout, MACH_PORT_NULL);
+				restarted = TRUE;
+			}
+		}
+
+		if ((v->msgv_option & MACH_RCV_INTERRUPT) == 0) {
+			while (v->msgv_result == MACH_RCV_INTERRUPTED) {
+				v->msgv_result = MACH_MSG_TRAP(msg,
+				    v->msgv_option & ~(LIBMACH_OPTIONS | MACH_SEND_MSG),
+				    0, v->msgv_rcv_size,
+				    v->msgv_rcv_name, v->msgv_timeout, MACH_PORT_NULL);
+				restarted = TRUE;
+			}
+		}
+	}
+
+	if (restarted) {
+		mr = MACH_MSG_SUCCESS;
+		for (mach_msg_size_t i = 0; i < count; i++) {
+			if (vec[i].msgv_result != MACH_MSG_SUCCESS) {
+				return vec[i].msgv_result;
+			}
+		}
+	}
+
+	return mr;
+}
+
 
 mach_msg_return_t
 mach_msg_send(mach_msg_header_t *msg)
@@ -125,6 +125,7 @@ typedef enum lck_mtx_spinwait_ret_type {
 } lck_mtx_spinwait_ret_type_t;
 
 extern lck_mtx_spinwait_ret_type_t              lck_mtx_lock_spinwait_x86(lck_mtx_t *mutex);
+extern void                                     lck_mtx_grp_spin_class_release(struct _lck_grp_ *grp);
 struct turnstile;
 extern void                                     lck_mtx_lock_wait_x86(lck_mtx_t *mutex, struct turnstile **ts);
 extern void                                     lck_mtx_lock_acquire_x86(lck_mtx_t *mutex);
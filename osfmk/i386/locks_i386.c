@@ -2335,6 +2335,153 @@ lck_mtx_free(
 	zfree(ZV_LCK_MTX, lck);
 }
 
+/*
+ * Adaptive mutex spinning.
+ *
+ * Contended acquisitions feed an estimate of the mutex hold time back into
+ * the lock group, and the spin budget of later acquisitions in the group is
+ * derived from it.  Groups with short hold times spin for a few hold
+ * periods, groups whose mutexes outlast the spin ceiling only spin through
+ * the first learning window before blocking.
+ *
+ * Indirect mutexes reach their group through the extension.  Direct
+ * mutexes have no room for a group pointer, so the group's spin class is
+ * kept in the unused priority byte of the state word and mapped back
+ * through lck_mtx_spin_grps.
+ */
+#define LCK_MTX_SPIN_CLASS_SHIFT        16
+#define LCK_MTX_SPIN_CLASS_MAX          0xfd    /* 0xfe and 0xff are part of the mutex tags */
+#define LCK_MTX_HOLD_AVG_SHIFT          3       /* weight of a new hold time sample: 1/8 */
+
+TUNABLE_WRITEABLE(uint32_t, lck_mtx_adaptive_spin, "mtx_adaptive_spin", 1);
+TUNABLE_WRITEABLE(uint32_t, lck_mtx_spin_hold_mult, "mtx_spin_hold_mult", 4);
+
+static lck_grp_t *lck_mtx_spin_grps[LCK_MTX_SPIN_CLASS_MAX + 1];
+static uint32_t lck_mtx_spin_classes_used;
+
+static uint32_t
+lck_mtx_grp_spin_class(lck_grp_t *grp)
+{
+	uint32_t class = os_atomic_load(&grp->lck_grp_mtx_spin_class, relaxed);
+
+	if (__improbable(class == 0)) {
+		if (os_atomic_load(&lck_mtx_spin_classes_used, relaxed) >= LCK_MTX_SPIN_CLASS_MAX) {
+			/* out of classes, these mutexes use the static spin budget */
+			return 0;
+		}
+
+		for (class = 1; class <= LCK_MTX_SPIN_CLASS_MAX; class++) {
+			if (os_atomic_cmpxchg(&lck_mtx_spin_grps[class], NULL, grp, relaxed)) {
+				break;
+			}
+		}
+		if (class > LCK_MTX_SPIN_CLASS_MAX) {
+			return 0;
+		}
+		os_atomic_inc(&lck_mtx_spin_classes_used, relaxed);
+
+		if (!os_atomic_cmpxchg(&grp->lck_grp_mtx_spin_class, 0, class, release)) {
+			/* lost the race to another initializer, no mutex uses this class */
+			os_atomic_store(&lck_mtx_spin_grps[class], NULL, relaxed);
+			os_atomic_dec(&lck_mtx_spin_classes_used, relaxed);
+			class = os_atomic_load(&grp->lck_grp_mtx_spin_class, relaxed);
+		}
+	}
+
+	return class;
+}
+
+/*
+ * Called when the last reference on a group goes away: none of its
+ * mutexes is left, so its spin class can be handed out again.
+ */
+void
+lck_mtx_grp_spin_class_release(lck_grp_t *grp)
+{
+	uint32_t class = os_atomic_load(&grp->lck_grp_mtx_spin_class, relaxed);
+
+	if (class != 0) {
+		assert(lck_mtx_spin_grps[class] == grp);
+		os_atomic_store(&lck_mtx_spin_grps[class], NULL, relaxed);
+		os_atomic_dec(&lck_mtx_spin_classes_used, relaxed);
+		grp->lck_grp_mtx_spin_class = 0;
+	}
+}
+
+static inline lck_grp_t *
+lck_mtx_spin_grp(lck_mtx_t *mutex)
+{
+	if (mutex->lck_mtx_is_ext) {
+		return ((lck_mtx_ext_t *)mutex)->lck_mtx_grp;
+	}
+
+	uint32_t class = (ordered_load_mtx_state(mutex) & LCK_MTX_PRIORITY_MSK) >>
+	    LCK_MTX_SPIN_CLASS_SHIFT;
+
+	return class ? os_atomic_load(&lck_mtx_spin_grps[class], relaxed) : NULL;
+}
+
+/*
+ * Spin budget for a contended acquisition, given the
+ * static ceiling configured through high_MutexSpin.
+ */
+static uint64_t
+lck_mtx_spin_budget(lck_grp_t *grp, uint64_t max_budget)
+{
+	uint64_t hold_avg, budget;
+
+	if (grp == NULL || !lck_mtx_adaptive_spin) {
+		return max_budget;
+	}
+
+	hold_avg = os_atomic_load(&grp->lck_grp_mtx_hold_avg, relaxed);
+	if (hold_avg == 0) {
+		return max_budget;
+	}
+
+	if (hold_avg >= max_budget) {
+		/* the owner is likely to outlast any spin, only try the learning window */
+		return low_MutexSpin;
+	}
+
+	budget = hold_avg * lck_mtx_spin_hold_mult;
+	return MIN(MAX(budget, low_MutexSpin), max_budget);
+}
+
+/*
+ * Fold the hold time observed by one spin into the group estimate.
+ */
+static void
+lck_mtx_spin_learn(
+	lck_grp_t                       *grp,
+	lck_mtx_spinwait_ret_type_t     retval,
+	uint64_t                        elapsed,
+	int                             hold_time_samples,
+	uint64_t                        max_budget)
+{
+	uint64_t sample, hold_avg;
+
+	if (hold_time_samples > 0) {
+		sample = elapsed / hold_time_samples;
+	} else if (retval == LCK_MTX_SPINWAIT_SPUN_HIGH_THR) {
+		/* same owner for the whole budget: count it as a long hold */
+		sample = 2 * max_budget;
+	} else {
+		/* owner went off core, or released right away, nothing learned */
+		return;
+	}
+
+	hold_avg = os_atomic_load(&grp->lck_grp_mtx_hold_avg, relaxed);
+	if (hold_avg == 0) {
+		hold_avg = sample;
+	} else if (sample > hold_avg) {
+		hold_avg += (sample - hold_avg) >> LCK_MTX_HOLD_AVG_SHIFT;
+	} else {
+		hold_avg -= (hold_avg - sample) >> LCK_MTX_HOLD_AVG_SHIFT;
+	}
+	os_atomic_store(&grp->lck_grp_mtx_hold_avg, hold_avg, relaxed);
+}
+
 /*
  *      Routine:        lck_mtx_ext_init
  */
@@ -2386,7 +2533,7 @@ lck_mtx_init(
 		lck->lck_mtx_ptr = lck_ext;
 	} else {
 		lck->lck_mtx_owner = 0;
-		lck->lck_mtx_state = 0;
+		lck->lck_mtx_state = lck_mtx_grp_spin_class(grp) << LCK_MTX_SPIN_CLASS_SHIFT;
 	}
 	lck->lck_mtx_pad32 = 0xFFFFFFFF;
 	lck_grp_reference(grp);
@@ -2417,7 +2564,7 @@ lck_mtx_init_ext(
 		lck->lck_mtx_ptr = lck_ext;
 	} else {
 		lck->lck_mtx_owner = 0;
-		lck->lck_mtx_state = 0;
+		lck->lck_mtx_state = lck_mtx_grp_spin_class(grp) << LCK_MTX_SPIN_CLASS_SHIFT;
 	}
 	lck->lck_mtx_pad32 = 0xFFFFFFFF;
 
@@ -2853,9 +3000,14 @@ try_again:
 		assert(state & LCK_MTX_ILOCKED_MSK);
 
 		if (state & LCK_MTX_MLOCKED_MSK) {
+			lck_grp_t *grp = lck_mtx_spin_grp(lock);
+
 			if (indirect) {
 				lck_grp_mtx_update_wait((struct _lck_mtx_ext_*)lock, first_miss);
 			}
+			if (grp != NULL) {
+				lck_grp_mtx_update_spin_block(grp);
+			}
 			lck_mtx_lock_wait_x86(lock, &ts);
 			/*
 			 * interlock is not held here.
@@ -3413,6 +3565,8 @@ lck_mtx_lock_spinwait_x86(
 	thread_t        owner, prev_owner;
 	uint64_t        window_deadline, sliding_deadline, high_deadline;
 	uint64_t        start_time, cur_time, avg_hold_time, bias, delta;
+	uint64_t        max_budget;
+	lck_grp_t       *grp = lck_mtx_spin_grp(mutex);
 	lck_mtx_spinwait_ret_type_t             retval = LCK_MTX_SPINWAIT_SPUN_HIGH_THR;
 	int             loopcount = 0;
 	int             total_hold_time_samples, window_hold_time_samples, unfairness;
@@ -3441,12 +3595,15 @@ lck_mtx_lock_spinwait_x86(
 	/*
 	 * High_deadline is a hard deadline. No thread
 	 * can spin more than this deadline.
+	 * It is further bounded by what the lock group's
+	 * history says is worth spinning for.
 	 */
 	if (high_MutexSpin >= 0) {
-		high_deadline = start_time + high_MutexSpin;
+		max_budget = high_MutexSpin;
 	} else {
-		high_deadline = start_time + low_MutexSpin * real_ncpus;
+		max_budget = low_MutexSpin * real_ncpus;
 	}
+	high_deadline = start_time + lck_mtx_spin_budget(grp, max_budget);
 
 	/*
 	 * Do not know yet which is the owner cpu.
@@ -3627,6 +3784,17 @@ lck_mtx_lock_spinwait_x86(
 		loopcount++;
 	} while (TRUE);
 
+	if (grp != NULL && retval != LCK_MTX_SPINWAIT_NO_SPIN) {
+		uint64_t elapsed = mach_absolute_time() - start_time;
+
+		if (lck_mtx_adaptive_spin) {
+			lck_mtx_spin_learn(grp, retval, elapsed,
+			    total_hold_time_samples, max_budget);
+		}
+		lck_grp_mtx_update_spin(grp,
+		    retval == LCK_MTX_SPINWAIT_ACQUIRED, elapsed);
+	}
+
 #if     CONFIG_DTRACE
 	/*
 	 * Note that we record a different probe id depending on whether
@@ -68,6 +68,7 @@
 #include <mach/kern_return.h>
 #include <mach/port.h>
 #include <kern/assert.h>
+#include <kern/kalloc.h>
 #include <kern/sched_prim.h>
 #include <kern/zalloc.h>
 #include <kern/misc_protos.h>
@@ -102,7 +103,7 @@ ipc_entry_lookup(
 
 	index = MACH_PORT_INDEX(name);
 	if (index < space->is_table_size) {
-		entry = &space->is_table[index];
+		entry = is_table_entry(space, index);
 		if (IE_BITS_GEN(entry->ie_bits) != MACH_PORT_GEN(name) ||
 		    IE_BITS_TYPE(entry->ie_bits) == MACH_PORT_TYPE_NONE) {
 			entry = IE_NULL;
@@ -134,30 +135,26 @@ ipc_entries_hold(
 	ipc_space_t             space,
 	uint32_t                entries_needed)
 {
-	ipc_entry_t table;
-	mach_port_index_t next_free = 0;
+	ipc_entry_t entry = &space->is_table[0];
 	uint32_t i;
 
 	/*
 	 * Assume that all new entries will need hashing.
-	 * If the table is more than 87.5% full pretend we didn't have space.
+	 * If the reverse hash is too full pretend we didn't have space,
+	 * ipc_entry_grow_table() will grow it.
 	 */
-	if (space->is_table_hashed + entries_needed >
-	    space->is_table_size * 7 / 8) {
+	if (!ipc_hash_reserve(space, entries_needed)) {
 		return KERN_NO_SPACE;
 	}
 
 	assert(is_active(space));
 
-	table = &space->is_table[0];
-
 	for (i = 0; i < entries_needed; i++) {
-		next_free = table[next_free].ie_next;
-		if (next_free == 0) {
+		if (entry->ie_next == 0) {
 			return KERN_NO_SPACE;
 		}
-		assert(next_free < space->is_table_size);
-		assert(table[next_free].ie_object == IO_NULL);
+		entry = is_table_entry(space, entry->ie_next);
+		assert(entry->ie_object == IO_NULL);
 	}
 	return KERN_SUCCESS;
 }
@@ -191,7 +188,7 @@ ipc_entry_claim(
 	first_free = table->ie_next;
 	assert(first_free != 0);
 
-	entry = &table[first_free];
+	entry = is_table_entry(space, first_free);
 	table->ie_next = entry->ie_next;
 	space->is_table_free--;
 
@@ -318,9 +315,7 @@ ipc_entry_alloc_name(
 		 *	cases 1) and 3), because ports cannot be renamed.
 		 */
 		if (index < space->is_table_size) {
-			ipc_entry_t table = space->is_table;
-
-			entry = &table[index];
+			entry = is_table_entry(space, index);
 
 			if (index == 0) {
 				/* case #1 - the entry is reserved */
@@ -339,30 +334,30 @@ ipc_entry_alloc_name(
 					is_write_unlock(space);
 					return KERN_FAILURE;
 				}
-			} else {
-				mach_port_index_t free_index, next_index;
+			} else if (ipc_hash_reserve(space, 1)) {
+				mach_port_index_t free_index;
+				ipc_entry_t free_entry;
 
 				/*
 				 *      case #4 -- the entry is free
 				 *	Rip the entry out of the free list.
 				 */
 
-				for (free_index = 0;
-				    (next_index = table[free_index].ie_next)
-				    != index;
-				    free_index = next_index) {
-					continue;
+				free_index = 0;
+				free_entry = &space->is_table[0];
+				while (free_entry->ie_next != index) {
+					free_index = free_entry->ie_next;
+					free_entry = is_table_entry(space, free_index);
 				}
 
-				table[free_index].ie_next =
-				    table[next_index].ie_next;
+				free_entry->ie_next = entry->ie_next;
 				space->is_table_free--;
 
 				/* mark the previous entry modified - reconstructing the name */
 				ipc_entry_modified(space,
 				    MACH_PORT_MAKE(free_index,
-				    IE_BITS_GEN(table[free_index].ie_bits)),
-				    &table[free_index]);
+				    IE_BITS_GEN(free_entry->ie_bits)),
+				    free_entry);
 
 				entry->ie_bits = gen;
 				entry->ie_request = IE_REQ_NONE;
@@ -375,7 +370,8 @@ ipc_entry_alloc_name(
 
 		/*
 		 *      We grow the table so that the name
-		 *	index fits in the array space.
+		 *	index fits in the array space,
+		 *	or the reverse hash if it was too full.
 		 *      Because the space will be unlocked,
 		 *      we must restart.
 		 */
@@ -422,7 +418,7 @@ ipc_entry_dealloc(
 	table = space->is_table;
 	size = space->is_table_size;
 
-	if ((index < size) && (entry == &table[index])) {
+	if ((index < size) && (entry == is_table_entry(space, index))) {
 		assert(IE_BITS_GEN(entry->ie_bits) == MACH_PORT_GEN(name));
 		entry->ie_bits &= (IE_BITS_GEN_MASK | IE_BITS_ROLL_MASK);
 		entry->ie_next = table->ie_next;
@@ -434,7 +430,7 @@ ipc_entry_dealloc(
 		 * so there is nothing to deallocate.
 		 */
 		assert(index < size);
-		assert(entry == &table[index]);
+		assert(entry == is_table_entry(space, index));
 		assert(IE_BITS_GEN(entry->ie_bits) == MACH_PORT_GEN(name));
 	}
 	ipc_entry_modified(space, name, entry);
@@ -456,16 +452,14 @@ ipc_entry_modified(
 	mach_port_name_t        name,
 	__assert_only ipc_entry_t entry)
 {
-	ipc_entry_t table;
 	ipc_entry_num_t size;
 	mach_port_index_t index;
 
 	index = MACH_PORT_INDEX(name);
-	table = space->is_table;
 	size = space->is_table_size;
 
 	assert(index < size);
-	assert(entry == &table[index]);
+	assert(entry == is_table_entry(space, index));
 
 	assert(space->is_low_mod <= size);
 	assert(space->is_high_mod < size);
@@ -495,12 +489,212 @@ static uint64_t ipc_entry_grow_rescan_entries = 0;
 static uint64_t ipc_entry_grow_rescan_entries_max = 0;
 static uint64_t ipc_entry_grow_freelist_entries = 0;
 static uint64_t ipc_entry_grow_freelist_entries_max = 0;
+static uint64_t ipc_entry_grow_segments_count = 0;
+#endif
+
+/*
+ *	Routine:	ipc_entry_table_segs_size
+ *	Purpose:
+ *		Returns the size of the array of segments of a
+ *		segmented table, which can hold as many segments
+ *		as the largest table needs.
+ */
+
+vm_size_t
+ipc_entry_table_segs_size(void)
+{
+	ipc_entry_num_t max = ipc_table_max_entries();
+
+	return ((max + IS_TABLE_SEG_MASK) >> IS_TABLE_SEG_SHIFT) *
+	       sizeof(ipc_entry_t);
+}
+
+/*
+ *	Routine:	ipc_entry_table_next_size
+ *	Purpose:
+ *		Returns the size the table of a space will have
+ *		after its next growth.
+ *	Conditions:
+ *		The space must be locked (read or write) and active.
+ */
+
+ipc_entry_num_t
+ipc_entry_table_next_size(
+	ipc_space_t             space)
+{
+	ipc_entry_num_t size = space->is_table_size;
+
+	if (size >= IS_TABLE_SEG_SIZE) {
+		return MIN(size + IS_TABLE_SEG_SIZE, ipc_table_max_entries());
+	}
+	return MIN(space->is_table_next->its_size, IS_TABLE_SEG_SIZE);
+}
+
+/*
+ *	Routine:	ipc_entry_grow_segments
+ *	Purpose:
+ *		Grows a table that already has IS_TABLE_SEG_SIZE entries
+ *		or more, by adding segments to it.
+ *
+ *		Existing entries never move: the new segments are
+ *		allocated and threaded on a free list of their own
+ *		with the space unlocked, and only linked to the space
+ *		(and to the head of its free list) under the lock.
+ *	Conditions:
+ *		The space must be write-locked, active and not growing.
+ *		If successful, the space is also returned locked.
+ *		On failure, the space is returned unlocked.
+ *		Allocates memory.
+ *	Returns:
+ *		KERN_SUCCESS		Grew the table.
+ *		KERN_SUCCESS		The space died.
+ *		KERN_NO_SPACE		Table has maximum size already.
+ *		KERN_RESOURCE_SHORTAGE	Couldn't allocate a new segment.
+ */
+
+static kern_return_t
+ipc_entry_grow_segments(
+	ipc_space_t             space,
+	ipc_table_elems_t       target_size)
+{
+	ipc_entry_num_t osize, size, max;
+	ipc_entry_t *segs, *nsegs = NULL;
+	ipc_entry_t seg, last = IE_NULL;
+	mach_port_index_t base, tail;
+	kern_return_t kr;
+
+	osize = space->is_table_size;
+	max = ipc_table_max_entries();
+
+	if (target_size == ITS_SIZE_NONE) {
+		target_size = osize + 1;
+	} else if (target_size <= osize) {
+		/* the space is locked */
+		return KERN_SUCCESS;
+	}
+
+	if (target_size > max) {
+		is_write_unlock(space);
+		return KERN_NO_SPACE;
+	}
+
+	assert((osize & IS_TABLE_SEG_MASK) == 0);
+	size = MIN((target_size + IS_TABLE_SEG_MASK) & ~IS_TABLE_SEG_MASK, max);
+
+	is_start_growing(space);
+#if IPC_ENTRY_GROW_STATS
+	ipc_entry_grow_count++;
+	ipc_entry_grow_segments_count++;
 #endif
+	is_write_unlock(space);
+
+	/*
+	 * Only the thread growing the space changes is_table_segs,
+	 * so it can be looked at unlocked.
+	 */
+	segs = space->is_table_segs;
+	if (segs == NULL) {
+		nsegs = kalloc_flags(ipc_entry_table_segs_size(), Z_WAITOK | Z_ZERO);
+		if (nsegs == NULL) {
+			goto no_memory;
+		}
+		segs = nsegs;
+	}
+
+	/*
+	 * Segments beyond is_table_size are never looked at,
+	 * so they can be added to the array before the new size
+	 * is published.
+	 */
+	for (base = osize; base < size; base += IS_TABLE_SEG_SIZE) {
+		seg = ipc_table_alloc(IS_TABLE_SEG_SIZE * sizeof(struct ipc_entry));
+		if (seg == IE_NULL) {
+			goto no_memory;
+		}
+		segs[base >> IS_TABLE_SEG_SHIFT] = seg;
+
+		tail = ipc_space_rand_freelist(space, seg, base, base,
+		    MIN(base + IS_TABLE_SEG_SIZE, size));
+		if (last != IE_NULL) {
+			last->ie_next = base;
+		}
+		last = &seg[tail - base];
+	}
+
+	is_write_lock(space);
+
+	if (!is_active(space)) {
+		/*
+		 *	The space died while it was unlocked.
+		 */
+
+		is_write_unlock(space);
+		kr = KERN_SUCCESS;
+		goto free_segments;
+	}
+
+	if (nsegs) {
+		nsegs[0] = space->is_table;
+		space->is_table_segs = nsegs;
+	}
+	/* put the new entries at the head of the free list */
+	last->ie_next = space->is_table[0].ie_next;
+	space->is_table[0].ie_next = osize;
+	space->is_table_size = size;
+	space->is_table_free += size - osize;
+
+	is_done_growing(space);
+	is_write_unlock(space);
+
+	thread_wakeup((event_t) space);
+
+	is_write_lock(space);
+
+	return KERN_SUCCESS;
+
+no_memory:
+	kr = KERN_RESOURCE_SHORTAGE;
+
+free_segments:
+	/*
+	 * We are still growing the space, so nobody else
+	 * can be looking at the segments we added.
+	 */
+	for (base = osize; base < size; base += IS_TABLE_SEG_SIZE) {
+		seg = segs ? segs[base >> IS_TABLE_SEG_SHIFT] : IE_NULL;
+		if (seg == IE_NULL) {
+			break;
+		}
+		segs[base >> IS_TABLE_SEG_SHIFT] = IE_NULL;
+		ipc_table_free(IS_TABLE_SEG_SIZE * sizeof(struct ipc_entry), seg);
+	}
+	if (nsegs) {
+		kfree(nsegs, ipc_entry_table_segs_size());
+	}
+
+	is_write_lock(space);
+	is_done_growing(space);
+	is_write_unlock(space);
+	thread_wakeup((event_t) space);
+
+	if (kr == KERN_SUCCESS) {
+		/* the space died, it is returned locked */
+		is_write_lock(space);
+	}
+	return kr;
+}
 
 /*
  *	Routine:	ipc_entry_grow_table
  *	Purpose:
  *		Grows the table in a space.
+ *
+ *		Up to IS_TABLE_SEG_SIZE entries, the table is
+ *		reallocated and copied, past that it grows
+ *		by segments (see ipc_entry_grow_segments).
+ *		If ipc_hash_reserve() failed and the table
+ *		already holds target_size entries, the reverse
+ *		hash is grown instead (see ipc_hash_grow).
  *	Conditions:
  *		The space must be write-locked and active before.
  *		If successful, the space is also returned locked.
@@ -541,6 +735,23 @@ ipc_entry_grow_table(
 		return KERN_SUCCESS;
 	}
 
+	if (space->is_hash_wanted != 0 &&
+	    (target_size == ITS_SIZE_NONE ||
+	    target_size <= space->is_table_size)) {
+		/*
+		 *	The reverse hash ran out of room,
+		 *	rather than the table.  An explicit
+		 *	target past the table still sizes the
+		 *	table; the hash is grown on the retry.
+		 */
+
+		return ipc_hash_grow(space);
+	}
+
+	if (space->is_table_size >= IS_TABLE_SEG_SIZE) {
+		return ipc_entry_grow_segments(space, target_size);
+	}
+
 	otable = space->is_table;
 
 	its = space->is_table_next;
@@ -585,6 +796,11 @@ ipc_entry_grow_table(
 	nsize = nits->its_size;
 	assert((osize < size) && (size <= nsize));
 
+	/* past IS_TABLE_SEG_SIZE entries, the table grows by segments */
+	if (size > IS_TABLE_SEG_SIZE) {
+		size = IS_TABLE_SEG_SIZE;
+	}
+
 	/*
 	 * We'll attempt to grow the table.
 	 *
@@ -602,7 +818,7 @@ ipc_entry_grow_table(
 #endif
 	is_write_unlock(space);
 
-	table = it_entries_alloc(its);
+	table = ipc_table_alloc(size * sizeof(struct ipc_entry));
 	if (table == IE_NULL) {
 		is_write_lock(space);
 		is_done_growing(space);
@@ -611,46 +827,22 @@ ipc_entry_grow_table(
 		return KERN_RESOURCE_SHORTAGE;
 	}
 
-	ipc_space_rand_freelist(space, table, osize, size);
-
-	/* clear out old entries in new table */
-	memset((void *)table, 0, osize * sizeof(*table));
+	ipc_space_rand_freelist(space, table, 0, osize, size);
 
 	low_mod = 0;
 	hi_mod = osize - 1;
 rescan:
 	/*
-	 * Within the range of the table that changed, determine what we
-	 * have to take action on. For each entry, take a snapshot of the
-	 * corresponding entry in the old table (so it won't change
-	 * during this iteration). The snapshot may not be self-consistent
-	 * (if we caught it in the middle of being changed), so be very
-	 * cautious with the values.
+	 * Within the range of the table that changed, copy the entries
+	 * of the old table.  The copy may not be self-consistent (if we
+	 * caught an entry in the middle of being changed), but such
+	 * entries will have been marked modified, and copied again.
+	 *
+	 * The reverse hash only records entry indices, which don't
+	 * change, so there is nothing to rehash here.
 	 */
 	for (i = low_mod; i <= hi_mod; i++) {
-		ipc_entry_t entry = &table[i];
-		struct ipc_entry osnap = otable[i];
-
-		if (entry->ie_object != osnap.ie_object ||
-		    IE_BITS_TYPE(entry->ie_bits) != IE_BITS_TYPE(osnap.ie_bits)) {
-			if (entry->ie_object != IO_NULL &&
-			    IE_BITS_TYPE(entry->ie_bits) == MACH_PORT_TYPE_SEND) {
-				ipc_hash_table_delete(table, size, entry->ie_object, i, entry);
-			}
-
-			entry->ie_object = osnap.ie_object;
-			entry->ie_bits = osnap.ie_bits;
-			entry->ie_request = osnap.ie_request; /* or ie_next */
-
-			if (entry->ie_object != IO_NULL &&
-			    IE_BITS_TYPE(entry->ie_bits) == MACH_PORT_TYPE_SEND) {
-				ipc_hash_table_insert(table, size, entry->ie_object, i, entry);
-			}
-		} else {
-			assert(entry->ie_object == osnap.ie_object);
-			entry->ie_bits = osnap.ie_bits;
-			entry->ie_request = osnap.ie_request; /* or ie_next */
-		}
+		table[i] = otable[i];
 	}
 	table[0].ie_next = otable[0].ie_next;  /* always rebase the freelist */
 
@@ -694,7 +886,7 @@ rescan:
 		is_done_growing(space);
 		is_write_unlock(space);
 		thread_wakeup((event_t) space);
-		it_entries_free(its, table);
+		ipc_table_free(size * sizeof(struct ipc_entry), table);
 		is_write_lock(space);
 		return KERN_SUCCESS;
 	}
@@ -745,9 +937,15 @@ rescan:
 	/*
 	 *	Now we need to free the old table.
 	 */
-	it_entries_free(oits, otable);
+	ipc_table_free(osize * sizeof(struct ipc_entry), otable);
 	is_write_lock(space);
 
+	/* a target past the first segment needs segments too */
+	if (target_size != ITS_SIZE_NONE && target_size > size &&
+	    is_active(space) && !is_growing(space)) {
+		return ipc_entry_grow_segments(space, target_size);
+	}
+
 	return KERN_SUCCESS;
 }
 
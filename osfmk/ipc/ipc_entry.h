@@ -81,38 +81,20 @@
  *	Each ipc_entry_t records a capability.  Most capabilities have
  *	small names, and the entries are elements of a table.
  *
- *	The ie_index field of entries in the table implements
- *	a ordered hash table with open addressing and linear probing.
- *
- *	The ie_dist field holds the distance to the desired spot,
- *	which is used to implement robin-hood hashing.
- *
- *	This hash table converts (space, object) -> name.
- *	It is used independently of the other fields.
- *
  *	Free (unallocated) entries in the table have null ie_object
  *	fields.  The ie_bits field is zero except for IE_BITS_GEN.
  *	The ie_next (ie_request) field links free entries into a free list.
  *
  *	The first entry in the table (index 0) is always free.
  *	It is used as the head of the free list.
+ *
+ *	The (space, object) -> name reverse hash table is kept
+ *	on the side, see ipc_hash.c.
  */
 
-#define IPC_ENTRY_DIST_BITS   12
-#define IPC_ENTRY_DIST_MAX    ((1 << IPC_ENTRY_DIST_BITS) - 1)
-#ifdef __LP64__
-#define IPC_ENTRY_INDEX_BITS  32
-#define IPC_ENTRY_INDEX_MAX   (UINT32_MAX)
-#else
-#define IPC_ENTRY_INDEX_BITS  20
-#define IPC_ENTRY_INDEX_MAX   ((1 << IPC_ENTRY_INDEX_BITS) - 1)
-#endif
-
 struct ipc_entry {
 	struct ipc_object  *XNU_PTRAUTH_SIGNED_PTR("ipc_entry.ie_object") ie_object;
 	ipc_entry_bits_t    ie_bits;
-	uint32_t            ie_dist  : IPC_ENTRY_DIST_BITS;
-	mach_port_index_t   ie_index : IPC_ENTRY_INDEX_BITS;
 	union {
 		mach_port_index_t next;         /* next in freelist, or...  */
 		ipc_table_index_t request;      /* dead name request notify */
@@ -264,6 +246,13 @@ extern kern_return_t ipc_entry_grow_table(
 	ipc_space_t             space,
 	ipc_table_elems_t       target_size);
 
+/* Size of the segment array of a segmented table */
+extern vm_size_t ipc_entry_table_segs_size(void);
+
+/* Size the table in a space would have after growing */
+extern ipc_entry_num_t ipc_entry_table_next_size(
+	ipc_space_t             space);
+
 /* mask on/off default entry generation bits */
 extern mach_port_name_t ipc_entry_name_mask(
 	mach_port_name_t name);
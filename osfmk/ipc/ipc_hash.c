@@ -71,6 +71,10 @@
 #include <ipc/ipc_entry.h>
 #include <ipc/ipc_hash.h>
 #include <ipc/ipc_init.h>
+#include <kern/counter.h>
+#include <kern/kalloc.h>
+#include <kern/misc_protos.h>
+#include <kern/sched_prim.h>
 #include <os/hash.h>
 
 #include <mach_ipc_debug.h>
@@ -83,15 +87,279 @@
 #endif  /* MACH_IPC_DEBUG */
 
 /*
- * Forward declarations
+ *	Each space has a local reverse hash table, which holds
+ *	the send rights of the space's table.  It is an array of
+ *	cache line sized buckets (see struct ipc_hash_bucket),
+ *	with a power of two number of them, separate from the
+ *	entry table: a bucket only records the index of entries,
+ *	so the entry table can grow without touching it.
+ *
+ *	An object hashes to a home bucket, and to a tag stored
+ *	next to the entry index.  The tags of a bucket are compared
+ *	all at once (a byte per slot, in two words), and only the
+ *	slots with a matching tag have their entry looked at.
+ *	When a bucket is full, entries go to the next bucket with
+ *	a free slot (linear probing, by bucket), and the overflow
+ *	count of the buckets passed over is incremented, which
+ *	bounds how far a lookup has to go.
+ *
+ *	The hash table is sized for the number of names in use in
+ *	the space, not the size of the entry table, and grows by
+ *	itself: ipc_hash_reserve() is called before names are
+ *	allocated, and fails when the table would be more than
+ *	3/4 full, leaving the caller to grow it with ipc_hash_grow().
+ *	Because entries are only entered into the reverse table if they
+ *	are pure send rights (not receive, send-once, port-set,
+ *	or dead-name rights), and free entries of course aren't entered,
+ *	this keeps the table well under its load limit.
+ *
+ *	Growing installs the new table right away, and moves the
+ *	entries of the old one a few buckets at a time, dropping
+ *	the space lock in between.  Until that is done, lookups
+ *	and deletions look at the new table first, then the old one.
+ */
+
+#define IH_TABLE_HASH(obj)                                      \
+	        ((uint32_t)os_hash_kernel_pointer(obj))
+#define IH_BUCKET_TAG(hash)                                     \
+	        ((uint8_t)(0x80 | ((hash) >> 25)))
+#define IH_TABLE_CAPACITY(mask)                                 \
+	        (((mask) + 1) * IPC_HASH_BUCKET_SLOTS * 3 / 4)
+
+/* buckets moved from the old table per hold of the space lock */
+#define IH_MIGRATE_BATCH        16
+
+SCALABLE_COUNTER_DEFINE(ipc_hash_lookups);
+SCALABLE_COUNTER_DEFINE(ipc_hash_lookup_probes);
+SCALABLE_COUNTER_DEFINE(ipc_hash_inserts);
+SCALABLE_COUNTER_DEFINE(ipc_hash_insert_probes);
+SCALABLE_COUNTER_DEFINE(ipc_hash_resizes);
+SCALABLE_COUNTER_DEFINE(ipc_hash_migrated);
+uint32_t ipc_hash_probe_max;
+
+static inline void
+ipc_hash_probe_stat(uint32_t probes)
+{
+	if (probes > os_atomic_load(&ipc_hash_probe_max, relaxed)) {
+		os_atomic_max(&ipc_hash_probe_max, probes, relaxed);
+	}
+}
+
+/*
+ *	Tag matching, a word at a time.
+ *
+ *	The tags are bytes, in slot order in memory, so on our
+ *	(little endian) targets tag i is byte i of ihb_tags_lo
+ *	for i < 8, and byte i - 8 of ihb_tags_hi after that.
+ */
+
+#define IH_BYTES_LOW7   0x7f7f7f7f7f7f7f7full
+#define IH_BYTES_HIGH   0x8080808080808080ull
+#define IH_BYTES_ONE    0x0101010101010101ull
+
+/* gathers the top bit of each byte into a mask with one bit per byte */
+static inline uint32_t
+ipc_hash_byte_mask(uint64_t bytes)
+{
+	return (uint32_t)((((bytes & IH_BYTES_HIGH) >> 7) *
+	       0x0102040810204080ull) >> 56);
+}
+
+/* sets the top bit of the bytes of "x" that are zero, and only those */
+static inline uint64_t
+ipc_hash_zero_bytes(uint64_t x)
+{
+	return ~(((x & IH_BYTES_LOW7) + IH_BYTES_LOW7) | x | IH_BYTES_LOW7);
+}
+
+/* returns a mask of the slots of the bucket that have "tag" */
+static inline uint32_t
+ipc_hash_bucket_match(
+	const struct ipc_hash_bucket    *bucket,
+	uint8_t                         tag)
+{
+	uint64_t tags = IH_BYTES_ONE * tag;
+
+	/* the upper bytes of the second word are "tag", never a match */
+	return ipc_hash_byte_mask(ipc_hash_zero_bytes(bucket->ihb_tags_lo ^ tags)) |
+	       (ipc_hash_byte_mask(ipc_hash_zero_bytes(bucket->ihb_tags_hi ^ tags)) << 8);
+}
+
+/* returns a mask of the empty slots of the bucket */
+static inline uint32_t
+ipc_hash_bucket_empty(
+	const struct ipc_hash_bucket    *bucket)
+{
+	return ipc_hash_byte_mask(~bucket->ihb_tags_lo) |
+	       (ipc_hash_byte_mask(~(uint64_t)bucket->ihb_tags_hi) & 0xf) << 8;
+}
+
+/*
+ *	Routine:	ipc_hash_table_find
+ *	Purpose:
+ *		Looks for the entry holding obj in a hash table.
+ *		Returns TRUE and its bucket and slot if found.
+ *	Conditions:
+ *		Must have read consistency on the space.
  */
 
-/* Delete an entry from the local reverse hash table */
-void ipc_hash_local_delete(
+static boolean_t
+ipc_hash_table_find(
 	ipc_space_t             space,
+	struct ipc_hash_bucket  *table,
+	ipc_entry_num_t         mask,
 	ipc_object_t            obj,
-	mach_port_index_t       index,
-	ipc_entry_t             entry);
+	uint32_t                hash,
+	uint32_t                *bucketp,
+	uint32_t                *slotp,
+	uint32_t                *probesp)
+{
+	uint8_t tag = IH_BUCKET_TAG(hash);
+	uint32_t hindex = hash & mask;
+	uint32_t probes = 0;
+
+	for (;;) {
+		struct ipc_hash_bucket *bucket = &table[hindex];
+		uint32_t match = ipc_hash_bucket_match(bucket, tag);
+
+		probes++;
+
+		/*
+		 *	A matching tag only says the object might be
+		 *	there, check ie_object to verify it.
+		 */
+		while (match) {
+			uint32_t slot = __builtin_ctz(match);
+			ipc_entry_t entry;
+
+			match &= match - 1;
+			entry = is_table_entry(space, bucket->ihb_index[slot]);
+			if (entry->ie_object == obj) {
+				*bucketp = hindex;
+				*slotp = slot;
+				*probesp += probes;
+				return TRUE;
+			}
+		}
+
+		/*
+		 *	If no entry was pushed past this bucket,
+		 *	ours can't be any farther.
+		 */
+		if (bucket->ihb_overflow == 0 || probes > mask) {
+			*probesp += probes;
+			return FALSE;
+		}
+		hindex = (hindex + 1) & mask;
+	}
+}
+
+/*
+ *	Routine:	ipc_hash_table_insert
+ *	Purpose:
+ *		Inserts an entry index into a reverse hash table.
+ *		Returns the number of buckets looked at.
+ *	Conditions:
+ *		Exclusive access to the table.
+ *		The table has a free slot.
+ */
+
+static uint32_t
+ipc_hash_table_insert(
+	struct ipc_hash_bucket  *table,
+	ipc_entry_num_t         mask,
+	uint32_t                hash,
+	mach_port_index_t       index)
+{
+	uint32_t hindex = hash & mask;
+	uint32_t probes = 1;
+
+	assert(index != 0);
+
+	for (;;) {
+		struct ipc_hash_bucket *bucket = &table[hindex];
+		uint32_t empty = ipc_hash_bucket_empty(bucket);
+
+		if (empty) {
+			uint32_t slot = __builtin_ctz(empty);
+
+			bucket->ihb_tags[slot] = IH_BUCKET_TAG(hash);
+			bucket->ihb_index[slot] = index;
+			return probes;
+		}
+
+		assert(probes <= mask);
+		bucket->ihb_overflow++;
+		hindex = (hindex + 1) & mask;
+		probes++;
+	}
+}
+
+/*
+ *	Routine:	ipc_hash_table_remove
+ *	Purpose:
+ *		Empties a slot of a reverse hash table, and fixes
+ *		the overflow counts of the buckets before it.
+ *	Conditions:
+ *		Exclusive access to the table.
+ */
+
+static void
+ipc_hash_table_remove(
+	struct ipc_hash_bucket  *table,
+	ipc_entry_num_t         mask,
+	uint32_t                hash,
+	uint32_t                hindex,
+	uint32_t                slot)
+{
+	table[hindex].ihb_tags[slot] = 0;
+
+	for (uint32_t i = hash & mask; i != hindex; i = (i + 1) & mask) {
+		assert(table[i].ihb_overflow > 0);
+		table[i].ihb_overflow--;
+	}
+}
+
+/*
+ *	Routine:	ipc_hash_table_migrate
+ *	Purpose:
+ *		Moves the entries of up to "count" buckets of the
+ *		old hash table of a space to its current one.
+ *	Conditions:
+ *		The space must be write-locked, and growing.
+ */
+
+static void
+ipc_hash_table_migrate(
+	ipc_space_t             space,
+	uint32_t                count)
+{
+	struct ipc_hash_bucket *otable = space->is_hash_old;
+	ipc_entry_num_t omask = space->is_hash_old_mask;
+	uint64_t moved = 0;
+
+	while (count-- > 0 && space->is_hash_migrated <= omask) {
+		uint32_t hindex = space->is_hash_migrated++;
+		struct ipc_hash_bucket *bucket = &otable[hindex];
+		uint32_t used = ~ipc_hash_bucket_empty(bucket) &
+		    ((1u << IPC_HASH_BUCKET_SLOTS) - 1);
+
+		while (used) {
+			uint32_t slot = __builtin_ctz(used);
+			mach_port_index_t index = bucket->ihb_index[slot];
+			uint32_t hash;
+
+			used &= used - 1;
+			hash = IH_TABLE_HASH(is_table_entry(space, index)->ie_object);
+			ipc_hash_table_remove(otable, omask, hash, hindex, slot);
+			ipc_hash_table_insert(space->is_hash, space->is_hash_mask,
+			    hash, index);
+			moved++;
+		}
+	}
+
+	counter_add_preemption_disabled(&ipc_hash_migrated, moved);
+}
 
 /*
  *	Routine:	ipc_hash_lookup
@@ -109,7 +377,38 @@ ipc_hash_lookup(
 	mach_port_name_t        *namep,
 	ipc_entry_t             *entryp)
 {
-	return ipc_hash_table_lookup(space->is_table, space->is_table_size, obj, namep, entryp);
+	struct ipc_hash_bucket *table = space->is_hash;
+	uint32_t hash, hindex, slot, probes = 0;
+	mach_port_index_t index;
+	ipc_entry_t entry;
+	boolean_t found;
+
+	if (obj == IO_NULL) {
+		return FALSE;
+	}
+
+	hash = IH_TABLE_HASH(obj);
+	found = ipc_hash_table_find(space, table, space->is_hash_mask,
+	    obj, hash, &hindex, &slot, &probes);
+	if (!found && space->is_hash_old) {
+		table = space->is_hash_old;
+		found = ipc_hash_table_find(space, table, space->is_hash_old_mask,
+		    obj, hash, &hindex, &slot, &probes);
+	}
+
+	counter_inc_preemption_disabled(&ipc_hash_lookups);
+	counter_add_preemption_disabled(&ipc_hash_lookup_probes, probes);
+	ipc_hash_probe_stat(probes);
+
+	if (!found) {
+		return FALSE;
+	}
+
+	index = table[hindex].ihb_index[slot];
+	entry = is_table_entry(space, index);
+	*entryp = entry;
+	*namep = MACH_PORT_MAKE(index, IE_BITS_GEN(entry->ie_bits));
+	return TRUE;
 }
 
 /*
@@ -126,13 +425,24 @@ ipc_hash_insert(
 	ipc_space_t             space,
 	ipc_object_t            obj,
 	mach_port_name_t        name,
-	ipc_entry_t             entry)
+	__assert_only ipc_entry_t entry)
 {
 	mach_port_index_t index;
+	uint32_t probes;
 
 	index = MACH_PORT_INDEX(name);
+	assert(entry == is_table_entry(space, index));
+	assert(entry->ie_object == obj);
+	assert(obj != IO_NULL);
+
 	space->is_table_hashed++;
-	ipc_hash_table_insert(space->is_table, space->is_table_size, obj, index, entry);
+	assert(space->is_table_hashed <= IH_TABLE_CAPACITY(space->is_hash_mask));
+	probes = ipc_hash_table_insert(space->is_hash, space->is_hash_mask,
+	    IH_TABLE_HASH(obj), index);
+
+	counter_inc_preemption_disabled(&ipc_hash_inserts);
+	counter_add_preemption_disabled(&ipc_hash_insert_probes, probes);
+	ipc_hash_probe_stat(probes);
 }
 
 /*
@@ -148,275 +458,196 @@ ipc_hash_delete(
 	ipc_space_t             space,
 	ipc_object_t            obj,
 	mach_port_name_t        name,
-	ipc_entry_t             entry)
+	__assert_only ipc_entry_t entry)
 {
-	mach_port_index_t index;
+	uint32_t hash, hindex, slot, probes = 0;
+	__assert_only mach_port_index_t index;
 
 	index = MACH_PORT_INDEX(name);
+	assert(entry == is_table_entry(space, index));
+	assert(entry->ie_object == obj);
+
 	space->is_table_hashed--;
-	ipc_hash_table_delete(space->is_table, space->is_table_size, obj, index, entry);
+	hash = IH_TABLE_HASH(obj);
+
+	if (ipc_hash_table_find(space, space->is_hash, space->is_hash_mask,
+	    obj, hash, &hindex, &slot, &probes)) {
+		assert(space->is_hash[hindex].ihb_index[slot] == index);
+		ipc_hash_table_remove(space->is_hash, space->is_hash_mask,
+		    hash, hindex, slot);
+		return;
+	}
+
+	if (space->is_hash_old && ipc_hash_table_find(space, space->is_hash_old,
+	    space->is_hash_old_mask, obj, hash, &hindex, &slot, &probes)) {
+		assert(space->is_hash_old[hindex].ihb_index[slot] == index);
+		ipc_hash_table_remove(space->is_hash_old, space->is_hash_old_mask,
+		    hash, hindex, slot);
+		return;
+	}
+
+	panic("ipc_hash_delete: space %p name 0x%x isn't hashed", space, name);
 }
 
 /*
- *	Each space has a local reverse hash table, which holds
- *	entries from the space's table.  In fact, the hash table
- *	just uses a field (ie_index) in the table itself.
- *
- *	The local hash table is an open-addressing hash table,
- *	which means that when a collision occurs, instead of
- *	throwing the entry into a bucket, the entry is rehashed
- *	to another position in the table.  In this case the rehash
- *	is very simple: linear probing (ie, just increment the position).
- *	This simple rehash makes deletions tractable (they're still a pain),
- *	but it means that collisions tend to build up into clumps.
- *
- *	Because at least one entry in the table (index 0) is always unused,
- *	there will always be room in the reverse hash table.  If a table
- *	with n slots gets completely full, the reverse hash table will
- *	have one giant clump of n-1 slots and one free slot somewhere.
- *	Because entries are only entered into the reverse table if they
- *	are pure send rights (not receive, send-once, port-set,
- *	or dead-name rights), and free entries of course aren't entered,
- *	I expect the reverse hash table won't get unreasonably full.
- *
- *	Ordered hash tables (Amble & Knuth, Computer Journal, v. 17, no. 2,
- *	pp. 135-142.) may be desirable here.  They can dramatically help
- *	unsuccessful lookups.  But unsuccessful lookups are almost always
- *	followed by insertions, and those slow down somewhat.  They
- *	also can help deletions somewhat.  Successful lookups aren't affected.
- *	So possibly a small win; probably nothing significant.
+ *	Routine:	ipc_hash_table_alloc
+ *	Purpose:
+ *		Allocates an empty reverse hash table.
+ *		Power of two sizes come from naturally aligned
+ *		kalloc zones or pages, so buckets are cache aligned.
+ *	Conditions:
+ *		Nothing locked.  May block.
  */
 
-#define IH_TABLE_HASH(obj, size)                                \
-	        ((mach_port_index_t)(os_hash_kernel_pointer(obj) % (size)))
+struct ipc_hash_bucket *
+ipc_hash_table_alloc(
+	ipc_entry_num_t         nbuckets)
+{
+	assert((nbuckets & (nbuckets - 1)) == 0);
+	return kalloc_flags(nbuckets * sizeof(struct ipc_hash_bucket),
+	           Z_WAITOK | Z_ZERO);
+}
 
 /*
- *	Routine:	ipc_hash_table_lookup
+ *	Routine:	ipc_hash_table_free
  *	Purpose:
- *		Converts (table, obj) -> (name, entry).
+ *		Frees a reverse hash table.
  *	Conditions:
- *		Must have read consistency on the table.
+ *		Nothing locked.  May block.
  */
 
-boolean_t
-ipc_hash_table_lookup(
-	ipc_entry_t             table,
-	ipc_entry_num_t         size,
-	ipc_object_t            obj,
-	mach_port_name_t        *namep,
-	ipc_entry_t             *entryp)
+void
+ipc_hash_table_free(
+	struct ipc_hash_bucket  *table,
+	ipc_entry_num_t         nbuckets)
 {
-	mach_port_index_t hindex, index, hdist;
-
-	if (obj == IO_NULL) {
-		return FALSE;
-	}
-
-	hindex = IH_TABLE_HASH(obj, size);
-	hdist  = 0;
-
-	/*
-	 *	Ideally, table[hindex].ie_index is the name we want.
-	 *	However, must check ie_object to verify this,
-	 *	because collisions can happen.  In case of a collision,
-	 *	search farther along in the clump.
-	 */
-
-	while ((index = table[hindex].ie_index) != 0) {
-		ipc_entry_t entry = &table[index];
-
-		/*
-		 * if our current displacement is strictly larger
-		 * than the current slot one, then insertion would
-		 * have stolen his place so we can't possibly exist.
-		 */
-		if (hdist > table[hindex].ie_dist) {
-			return FALSE;
-		}
-
-		/*
-		 * If our current displacement is exactly the current
-		 * slot displacement, then it can be a match, let's check.
-		 */
-		if (hdist == table[hindex].ie_dist) {
-			assert(index < size);
-			if (entry->ie_object == obj) {
-				*entryp = entry;
-				*namep = MACH_PORT_MAKE(index,
-				    IE_BITS_GEN(entry->ie_bits));
-				return TRUE;
-			}
-		} else {
-			assert(entry->ie_object != obj);
-		}
-
-		if (hdist < IPC_ENTRY_DIST_MAX) {
-			/* peg the displacement distance at IPC_ENTRY_DIST_MAX */
-			++hdist;
-		}
-		if (++hindex == size) {
-			hindex = 0;
-		}
-	}
-
-	return FALSE;
+	kfree(table, nbuckets * sizeof(struct ipc_hash_bucket));
 }
 
 /*
- *	Routine:	ipc_hash_table_insert
+ *	Routine:	ipc_hash_reserve
  *	Purpose:
- *		Inserts an entry into the space's reverse hash table.
+ *		Checks that the reverse hash table has room for
+ *		"count" more names in the space.  Otherwise, notes
+ *		how big it needs to be for ipc_hash_grow().
+ *
+ *		Any name in use may end up hashed, so they are
+ *		all accounted for, not just the hashed ones.
  *	Conditions:
  *		The space must be write-locked.
  */
 
-void
-ipc_hash_table_insert(
-	ipc_entry_t                     table,
-	ipc_entry_num_t                 size,
-	ipc_object_t                    obj,
-	mach_port_index_t               index,
-	__assert_only ipc_entry_t       entry)
+boolean_t
+ipc_hash_reserve(
+	ipc_space_t             space,
+	ipc_entry_num_t         count)
 {
-	mach_port_index_t hindex, hdist;
+	ipc_entry_num_t used = space->is_table_size - space->is_table_free;
 
-	assert(index != 0);
-	assert(obj != IO_NULL);
-
-	hindex = IH_TABLE_HASH(obj, size);
-	hdist  = 0;
-
-	assert(entry == &table[index]);
-	assert(entry->ie_object == obj);
-
-	/*
-	 *	We want to insert at hindex, but there may be collisions.
-	 *	If a collision occurs, search for the end of the clump
-	 *	and insert there.
-	 *
-	 *	However, Robin Hood steals from the rich, and as we go
-	 *	through the clump, if we go over an item that is less
-	 *	displaced than we'd be, we steal his slot and
-	 *	keep inserting him in our stead.
-	 */
-	while (table[hindex].ie_index != 0) {
-		if (table[hindex].ie_dist < hdist) {
-#define swap(a, b)  ({ typeof(a) _tmp = (b); (b) = (a); (a) = _tmp; })
-			swap(hdist, table[hindex].ie_dist);
-			swap(index, table[hindex].ie_index);
-#undef swap
-		}
-		if (hdist < IPC_ENTRY_DIST_MAX) {
-			/* peg the displacement distance at IPC_ENTRY_DIST_MAX */
-			++hdist;
-		}
-		if (++hindex == size) {
-			hindex = 0;
-		}
+	if (used + count <= IH_TABLE_CAPACITY(space->is_hash_mask)) {
+		return TRUE;
 	}
 
-	table[hindex].ie_index = index;
-	table[hindex].ie_dist = hdist;
+	space->is_hash_wanted = MAX(space->is_hash_wanted, used + count);
+	return FALSE;
 }
 
 /*
- *	Routine:	ipc_hash_table_delete
+ *	Routine:	ipc_hash_grow
  *	Purpose:
- *		Deletes an entry from the table's reverse hash.
+ *		Grows the reverse hash table of a space to hold
+ *		the number of names the last failed call to
+ *		ipc_hash_reserve() needed.
+ *
+ *		The new table is installed as soon as it is allocated,
+ *		and the entries of the old one are moved over a batch
+ *		of buckets at a time, with the space unlocked between
+ *		batches, so that the space is never locked for long.
  *	Conditions:
- *		Exclusive access to the table.
+ *		The space must be write-locked, active and not growing.
+ *		If successful, the space is also returned locked.
+ *		On failure, the space is returned unlocked.
+ *		Allocates memory.
+ *	Returns:
+ *		KERN_SUCCESS		Grew the hash table.
+ *		KERN_SUCCESS		The space died.
+ *		KERN_RESOURCE_SHORTAGE	Couldn't allocate a new table.
  */
 
-void
-ipc_hash_table_delete(
-	ipc_entry_t                     table,
-	ipc_entry_num_t                 size,
-	ipc_object_t                    obj,
-	mach_port_index_t               index,
-	__assert_only ipc_entry_t       entry)
+kern_return_t
+ipc_hash_grow(
+	ipc_space_t             space)
 {
-	mach_port_index_t hindex, dindex, dist;
+	struct ipc_hash_bucket *table, *otable;
+	ipc_entry_num_t mask, omask;
 
-	assert(index != MACH_PORT_NULL);
-	assert(obj != IO_NULL);
+	assert(is_active(space) && !is_growing(space));
 
-	hindex = IH_TABLE_HASH(obj, size);
+	mask = space->is_hash_mask;
+	while (IH_TABLE_CAPACITY(mask) < space->is_hash_wanted) {
+		mask = 2 * mask + 1;
+	}
+	space->is_hash_wanted = 0;
+	if (mask == space->is_hash_mask) {
+		/* the space is locked */
+		return KERN_SUCCESS;
+	}
 
-	assert(entry == &table[index]);
-	assert(entry->ie_object == obj);
+	is_start_growing(space);
+	is_write_unlock(space);
 
-	/*
-	 *	First check we have the right hindex for this index.
-	 *	In case of collision, we have to search farther
-	 *	along in this clump.
-	 */
+	table = ipc_hash_table_alloc(mask + 1);
+
+	is_write_lock(space);
 
-	while (table[hindex].ie_index != index) {
-		if (++hindex == size) {
-			hindex = 0;
+	if (table == NULL || !is_active(space)) {
+		is_done_growing(space);
+		is_write_unlock(space);
+		thread_wakeup((event_t) space);
+		if (table == NULL) {
+			return KERN_RESOURCE_SHORTAGE;
 		}
+		/* the space died while it was unlocked */
+		ipc_hash_table_free(table, mask + 1);
+		is_write_lock(space);
+		return KERN_SUCCESS;
 	}
 
+	/* growing always finishes moving the old table */
+	assert(space->is_hash_old == NULL);
+	space->is_hash_old = space->is_hash;
+	space->is_hash_old_mask = space->is_hash_mask;
+	space->is_hash_migrated = 0;
+	space->is_hash = table;
+	space->is_hash_mask = mask;
+	counter_inc_preemption_disabled(&ipc_hash_resizes);
+
 	/*
-	 *	Now we want to set table[hindex].ie_index = 0.
-	 *	But if we aren't the last index in a clump,
-	 *	this might cause problems for lookups of objects
-	 *	farther along in the clump that are displaced
-	 *	due to collisions.  Searches for them would fail
-	 *	at hindex instead of succeeding.
-	 *
-	 *	So we must check the clump after hindex for objects
-	 *	that are so displaced, and move one up to the new hole.
-	 *
-	 *		hindex - index of new hole in the clump
-	 *		dindex - index we are checking for a displaced object
-	 *
-	 *	When we move a displaced object up into the hole,
-	 *	it creates a new hole, and we have to repeat the process
-	 *	until we get to the end of the clump.
+	 * Even if the space dies while unlocked, its entries
+	 * stay put until we are done growing, so just finish.
 	 */
-
 	for (;;) {
-		dindex = hindex + 1;
-		if (dindex == size) {
-			dindex = 0;
+		ipc_hash_table_migrate(space, IH_MIGRATE_BATCH);
+		if (space->is_hash_migrated > space->is_hash_old_mask) {
+			break;
 		}
+		is_write_unlock(space);
+		is_write_lock(space);
+	}
 
-		/*
-		 * If the next element is empty or isn't displaced,
-		 * then lookup will end on the next element anyway,
-		 * so we can leave the hole right here, we're done
-		 */
-		index = table[dindex].ie_index;
-		dist  = table[dindex].ie_dist;
-		if (index == 0 || dist == 0) {
-			table[hindex].ie_index = 0;
-			table[hindex].ie_dist = 0;
-			return;
-		}
+	otable = space->is_hash_old;
+	omask = space->is_hash_old_mask;
+	space->is_hash_old = NULL;
+	space->is_hash_old_mask = 0;
+	space->is_hash_migrated = 0;
 
-		/*
-		 * Move this object closer to its own slot by occupying the hole.
-		 * If its displacement was pegged, recompute it.
-		 */
-		if (dist-- == IPC_ENTRY_DIST_MAX) {
-			uint32_t desired = IH_TABLE_HASH(table[index].ie_object, size);
-			if (hindex >= desired) {
-				dist = hindex - desired;
-			} else {
-				dist = hindex + size - desired;
-			}
-			if (dist > IPC_ENTRY_DIST_MAX) {
-				dist = IPC_ENTRY_DIST_MAX;
-			}
-		}
+	is_done_growing(space);
+	is_write_unlock(space);
 
-		/*
-		 * Move the displaced element closer to its ideal bucket,
-		 * and keep shifting elements back.
-		 */
-		table[hindex].ie_index = index;
-		table[hindex].ie_dist = dist;
-		hindex = dindex;
-	}
+	thread_wakeup((event_t) space);
+
+	ipc_hash_table_free(otable, omask + 1);
+	is_write_lock(space);
+
+	return KERN_SUCCESS;
 }
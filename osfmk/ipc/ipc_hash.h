@@ -96,34 +96,62 @@ extern void ipc_hash_delete(
 	mach_port_name_t        name,
 	ipc_entry_t             entry);
 
+/*
+ *	The reverse hash table of a space is separate from the entry
+ *	table, and sized for the number of names in use rather than
+ *	for the size of the entry table.  It is made of cache line
+ *	sized buckets, each holding up to IPC_HASH_BUCKET_SLOTS
+ *	entry indices, and a one byte tag per slot made of bits of
+ *	the object hash, so that a bucket can be searched by looking
+ *	at all its tags at once.  A zero tag is an empty slot.
+ *
+ *	ihb_overflow counts the entries that hash to this bucket or
+ *	one before it, but were placed after it because it was full.
+ *	A lookup can stop at the first bucket where it is zero.
+ */
+
+#define IPC_HASH_BUCKET_SLOTS   12
+#define IPC_HASH_MIN_BUCKETS    4
+
+struct ipc_hash_bucket {
+	union {
+		struct {
+			uint8_t         ihb_tags[IPC_HASH_BUCKET_SLOTS];
+			uint32_t        ihb_overflow;
+		};
+		struct {
+			uint64_t        ihb_tags_lo;
+			uint32_t        ihb_tags_hi;
+		};
+	};
+	mach_port_index_t       ihb_index[IPC_HASH_BUCKET_SLOTS];
+};
+
+_Static_assert(sizeof(struct ipc_hash_bucket) == 64,
+    "ipc hash buckets are one cache line");
+
 /*
  *	For use by functions that know what they're doing:
- *	local primitives are for table entries.
+ *	primitives used to size the reverse hash table of a space.
  */
 
-/* Lookup (space, obj) in local hash table */
-extern boolean_t ipc_hash_table_lookup(
-	ipc_entry_t             table,
-	ipc_entry_num_t         size,
-	ipc_object_t            obj,
-	mach_port_name_t        *namep,
-	ipc_entry_t             *entryp);
+/* Allocate an empty hash table */
+extern struct ipc_hash_bucket *ipc_hash_table_alloc(
+	ipc_entry_num_t         nbuckets);
 
-/* Inserts an entry into the local reverse hash table */
-extern void ipc_hash_table_insert(
-	ipc_entry_t             table,
-	ipc_entry_num_t         size,
-	ipc_object_t            obj,
-	mach_port_index_t       index,
-	ipc_entry_t             entry);
+/* Free a hash table */
+extern void ipc_hash_table_free(
+	struct ipc_hash_bucket  *table,
+	ipc_entry_num_t         nbuckets);
 
-/* Delete an entry from the appropriate reverse hash table */
-extern void ipc_hash_table_delete(
-	ipc_entry_t             table,
-	ipc_entry_num_t         size,
-	ipc_object_t            obj,
-	mach_port_name_t        name,
-	ipc_entry_t             entry);
+/* Check that the hash table has room for "count" more names */
+extern boolean_t ipc_hash_reserve(
+	ipc_space_t             space,
+	ipc_entry_num_t         count);
+
+/* Grow the hash table to the size the last failed reservation needed */
+extern kern_return_t ipc_hash_grow(
+	ipc_space_t             space);
 
 #include <mach_ipc_debug.h>
 
@@ -89,6 +89,7 @@
 #include <kern/processor.h>
 #include <kern/thread.h>
 #include <kern/sched_prim.h>
+#include <kern/sched.h>
 #include <kern/misc_protos.h>
 #include <kern/cpu_data.h>
 #include <kern/policy_internal.h>
@@ -1178,6 +1179,51 @@ ZONE_DECLARE(ipc_kmsg_zone, "ipc kmsgs", IKM_SAVED_KMSG_SIZE,
     ZC_CACHING | ZC_ZFREE_CLEARMEM);
 static TUNABLE(bool, enforce_strict_reply, "ipc_strict_reply", false);
 
+/*
+ * Messages the kernel sends to a given port (MIG replies to a thread's
+ * reply port, notifications, ...) tend to have the same size over and
+ * over again.  Ports that receive enough of them learn that size, and
+ * keep a few kmsgs of that size when they are freed after receive,
+ * see ipc_kmsg_alloc_for_port().
+ *
+ * Until a port is sent IKM_POOL_RATE kernel messages within one rate
+ * window, ip_kmsg_pool holds a tagged counter instead of a pool, so that
+ * ports the kernel rarely talks to never pay for one.
+ *
+ * The pools are linked on a global list so that the cached kmsgs
+ * can be given back under memory pressure, see ipc_kmsg_pool_drain().
+ */
+#define IKM_POOL_DEPTH          2       /* kmsgs cached per port */
+#define IKM_POOL_STREAK         4       /* votes for a size before caching it */
+#define IKM_POOL_MAX_SIZE       2048    /* largest ikm_size cached */
+#define IKM_POOL_RATE           64      /* kernel messages per window to get a pool */
+#define IKM_POOL_RATE_SHIFT     SCHED_TICK_SHIFT /* window: sched ticks per second */
+
+#define IKP_RATE_TAG            ((uintptr_t)1)
+#define IKP_RATE_COUNT_BITS     16
+#define IKP_RATE_COUNT(v)       (((v) >> 1) & ((1ul << IKP_RATE_COUNT_BITS) - 1))
+#define IKP_RATE_WINDOW(v)      ((v) >> (IKP_RATE_COUNT_BITS + 1))
+#define IKP_RATE_MAKE(w, c) \
+	(((uintptr_t)(w) << (IKP_RATE_COUNT_BITS + 1)) | ((uintptr_t)(c) << 1) | IKP_RATE_TAG)
+#define IKP_IS_POOL(v)          ((v) != 0 && ((v) & IKP_RATE_TAG) == 0)
+
+struct ipc_kmsg_pool {
+	lck_spin_t              ikp_lock;
+	queue_chain_t           ikp_link;       /* ipc_kmsg_pools linkage */
+	ipc_kmsg_t              ikp_free;       /* cached kmsgs, linked by ikm_next */
+	mach_msg_size_t         ikp_size;       /* learned ikm_size */
+	uint16_t                ikp_count;      /* number of cached kmsgs */
+	uint16_t                ikp_streak;     /* votes for ikp_size */
+	uint32_t                ikp_hits;
+	uint32_t                ikp_misses;
+};
+
+static TUNABLE(bool, ipc_kmsg_pool_enabled, "ipc_kmsg_pool", true);
+static ZONE_DECLARE(ipc_kmsg_pool_zone, "ipc kmsg pools",
+    sizeof(struct ipc_kmsg_pool), ZC_NONE);
+static LCK_SPIN_DECLARE_ATTR(ipc_kmsg_pools_lock, &ipc_lck_grp, &ipc_lck_attr);
+static queue_head_t ipc_kmsg_pools = QUEUE_HEAD_INITIALIZER(ipc_kmsg_pools);
+
 /*
  * Forward declarations
  */
@@ -1261,20 +1307,16 @@ ikm_set_header(
 }
 
 /*
- *	Routine:	ipc_kmsg_alloc
+ *	Routine:	ipc_kmsg_alloc_size
  *	Purpose:
- *		Allocate a kernel message structure.  If we can get one from
- *		the cache, that is best.  Otherwise, allocate a new one.
- *	Conditions:
- *		Nothing locked.
+ *		Compute the ikm_size of a kmsg able to hold a message
+ *		of the specified size, or 0 if it is too large.
  */
-ipc_kmsg_t
-ipc_kmsg_alloc(
+static mach_msg_size_t
+ipc_kmsg_alloc_size(
 	mach_msg_size_t msg_and_trailer_size)
 {
 	mach_msg_size_t max_expanded_size;
-	ipc_kmsg_t kmsg;
-	void *data;
 
 	/*
 	 * LP64support -
@@ -1293,7 +1335,7 @@ ipc_kmsg_alloc(
 
 	/* compare against implementation upper limit for the body */
 	if (size > ipc_kmsg_max_body_space) {
-		return IKM_NULL;
+		return 0;
 	}
 
 	if (size > sizeof(mach_msg_base_t)) {
@@ -1303,7 +1345,7 @@ ipc_kmsg_alloc(
 
 		/* make sure expansion won't cause wrap */
 		if (msg_and_trailer_size > MACH_MSG_SIZE_MAX - max_desc) {
-			return IKM_NULL;
+			return 0;
 		}
 
 		max_expanded_size = msg_and_trailer_size + max_desc;
@@ -1311,6 +1353,30 @@ ipc_kmsg_alloc(
 		max_expanded_size = msg_and_trailer_size;
 	}
 
+	return MAX(max_expanded_size, IKM_SAVED_MSG_SIZE);
+}
+
+/*
+ *	Routine:	ipc_kmsg_alloc
+ *	Purpose:
+ *		Allocate a kernel message structure.  If we can get one from
+ *		the cache, that is best.  Otherwise, allocate a new one.
+ *	Conditions:
+ *		Nothing locked.
+ */
+ipc_kmsg_t
+ipc_kmsg_alloc(
+	mach_msg_size_t msg_and_trailer_size)
+{
+	mach_msg_size_t max_expanded_size;
+	ipc_kmsg_t kmsg;
+	void *data;
+
+	max_expanded_size = ipc_kmsg_alloc_size(msg_and_trailer_size);
+	if (max_expanded_size == 0) {
+		return IKM_NULL;
+	}
+
 	if (max_expanded_size > IKM_SAVED_MSG_SIZE) {
 		data = kheap_alloc(KHEAP_DATA_BUFFERS, max_expanded_size, Z_WAITOK);
 		if (data == NULL) {
@@ -1318,7 +1384,6 @@ ipc_kmsg_alloc(
 		}
 	} else {
 		data = NULL;
-		max_expanded_size = IKM_SAVED_MSG_SIZE;
 	}
 
 	kmsg = zalloc_flags(ipc_kmsg_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
@@ -1330,6 +1395,298 @@ ipc_kmsg_alloc(
 	return kmsg;
 }
 
+/*
+ *	Routine:	ipc_kmsg_pool_get
+ *	Purpose:
+ *		Count a kernel message sent to the port, and return
+ *		its pool, creating it if the port just went past
+ *		IKM_POOL_RATE messages in the current window.
+ *	Returns:
+ *		NULL if the port doesn't deserve a pool (yet).
+ */
+static struct ipc_kmsg_pool *
+ipc_kmsg_pool_get(
+	ipc_port_t      port)
+{
+	struct ipc_kmsg_pool *npool;
+	uintptr_t value, nvalue, count;
+	/* truncated the way the counter stores it */
+	uintptr_t window = IKP_RATE_WINDOW(IKP_RATE_MAKE(sched_tick >> IKM_POOL_RATE_SHIFT, 0));
+
+	os_atomic_rmw_loop(&port->ip_kmsg_pool, value, nvalue, acquire, {
+		if (IKP_IS_POOL(value)) {
+		        os_atomic_rmw_loop_give_up(return (struct ipc_kmsg_pool *)value);
+		}
+		count = 1;
+		if (value != 0 && IKP_RATE_WINDOW(value) == window) {
+		        count += IKP_RATE_COUNT(value);
+		}
+		if (count >= IKM_POOL_RATE) {
+		        os_atomic_rmw_loop_give_up(break);
+		}
+		nvalue = IKP_RATE_MAKE(window, count);
+	});
+
+	if (count < IKM_POOL_RATE) {
+		return NULL;
+	}
+
+	npool = zalloc_flags(ipc_kmsg_pool_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	lck_spin_init(&npool->ikp_lock, &ipc_lck_grp, &ipc_lck_attr);
+
+	/* the counter may have moved while we allocated, only a pool wins */
+	while (!os_atomic_cmpxchgv(&port->ip_kmsg_pool, value,
+	    (uintptr_t)npool, &value, acq_rel)) {
+		if (IKP_IS_POOL(value)) {
+			lck_spin_destroy(&npool->ikp_lock, &ipc_lck_grp);
+			zfree(ipc_kmsg_pool_zone, npool);
+			return (struct ipc_kmsg_pool *)value;
+		}
+	}
+
+	lck_spin_lock(&ipc_kmsg_pools_lock);
+	enqueue_tail(&ipc_kmsg_pools, &npool->ikp_link);
+	lck_spin_unlock(&ipc_kmsg_pools_lock);
+
+	return npool;
+}
+
+static void
+ipc_kmsg_pool_free_list(
+	ipc_kmsg_t      kmsg)
+{
+	ipc_kmsg_t next;
+
+	for (; kmsg != IKM_NULL; kmsg = next) {
+		next = kmsg->ikm_next;
+		ipc_kmsg_free(kmsg);
+	}
+}
+
+/*
+ *	Routine:	ipc_kmsg_alloc_for_port
+ *	Purpose:
+ *		Allocate a kernel message that the kernel will send
+ *		to the specified port.
+ *
+ *		The size of these messages is learned with a majority
+ *		vote: an allocation of the learned size is a vote for it,
+ *		any other size is a vote against it, and replaces it once
+ *		it has no votes left.  Once the learned size has enough
+ *		votes, its kmsgs return to the port when they are freed,
+ *		and the next allocations of that size reuse them.
+ *
+ *		Ports only get a pool once the kernel sends them
+ *		messages often enough, see ipc_kmsg_pool_get().
+ *
+ *		A kmsg from a pool holds a reference on its port.
+ *	Conditions:
+ *		Nothing locked.  The caller holds a reference on the port.
+ */
+ipc_kmsg_t
+ipc_kmsg_alloc_for_port(
+	mach_msg_size_t msg_and_trailer_size,
+	ipc_port_t      dest_port)
+{
+	struct ipc_kmsg_pool *pool;
+	ipc_kmsg_t kmsg, stale = IKM_NULL;
+	mach_msg_size_t size;
+	void *data;
+	bool cache = false;
+
+	if (!ipc_kmsg_pool_enabled || !IP_VALID(dest_port) ||
+	    ip_kotype(dest_port) != IKOT_NONE) {
+		return ipc_kmsg_alloc(msg_and_trailer_size);
+	}
+
+	size = ipc_kmsg_alloc_size(msg_and_trailer_size);
+	if (size == 0 || size > IKM_POOL_MAX_SIZE) {
+		return ipc_kmsg_alloc(msg_and_trailer_size);
+	}
+
+	pool = ipc_kmsg_pool_get(dest_port);
+	if (pool == NULL) {
+		return ipc_kmsg_alloc(msg_and_trailer_size);
+	}
+
+	lck_spin_lock(&pool->ikp_lock);
+	if (pool->ikp_size == size) {
+		kmsg = pool->ikp_free;
+		if (kmsg != IKM_NULL) {
+			pool->ikp_free = kmsg->ikm_next;
+			pool->ikp_count--;
+			pool->ikp_hits++;
+			lck_spin_unlock(&pool->ikp_lock);
+
+			data = (size > IKM_SAVED_MSG_SIZE) ? kmsg->ikm_data : NULL;
+			bzero(kmsg, sizeof(*kmsg));
+			kmsg->ikm_size = size;
+			ikm_qos_init(kmsg);
+			ikm_set_header(kmsg, data, msg_and_trailer_size);
+			assert((kmsg->ikm_prev = kmsg->ikm_next = IKM_BOGUS));
+			goto pooled;
+		}
+		if (pool->ikp_streak < IKM_POOL_STREAK) {
+			pool->ikp_streak++;
+		}
+		cache = (pool->ikp_streak == IKM_POOL_STREAK);
+	} else if (pool->ikp_streak > 0) {
+		pool->ikp_streak--;
+	} else {
+		/* the new size wins, drop the kmsgs of the old one */
+		stale = pool->ikp_free;
+		pool->ikp_free = IKM_NULL;
+		pool->ikp_count = 0;
+		pool->ikp_size = size;
+		pool->ikp_streak = 1;
+	}
+	pool->ikp_misses++;
+	lck_spin_unlock(&pool->ikp_lock);
+
+	ipc_kmsg_pool_free_list(stale);
+
+	kmsg = ipc_kmsg_alloc(msg_and_trailer_size);
+	if (kmsg == IKM_NULL || !cache) {
+		return kmsg;
+	}
+
+pooled:
+	ip_reference(dest_port);
+	kmsg->ikm_pool_port = dest_port;
+	return kmsg;
+}
+
+/*
+ *	Routine:	ipc_kmsg_pool_put
+ *	Purpose:
+ *		Return a kmsg allocated by ipc_kmsg_alloc_for_port()
+ *		to its port, if the pool still wants it.
+ *	Returns:
+ *		TRUE if the kmsg is now cached by the port.
+ */
+static bool
+ipc_kmsg_pool_put(
+	ipc_kmsg_t      kmsg)
+{
+	ipc_port_t port = kmsg->ikm_pool_port;
+	struct ipc_kmsg_pool *pool = (struct ipc_kmsg_pool *)port->ip_kmsg_pool;
+	bool cached = false;
+
+	/* only kmsgs of an existing pool point back to their port */
+	assert(IKP_IS_POOL(port->ip_kmsg_pool));
+
+	kmsg->ikm_pool_port = IP_NULL;
+
+	/*
+	 * ipc_kmsg_zone clears elements on free: clear the inline
+	 * message here too, so a cached kmsg holds no stale bytes.
+	 */
+	bzero(kmsg + 1, IKM_SAVED_MSG_SIZE);
+
+	/* racy, the pool of a dead port is freed with the port anyway */
+	if (ip_active(port)) {
+		lck_spin_lock(&pool->ikp_lock);
+		if (pool->ikp_size == kmsg->ikm_size &&
+		    pool->ikp_count < IKM_POOL_DEPTH) {
+			kmsg->ikm_next = pool->ikp_free;
+			pool->ikp_free = kmsg;
+			pool->ikp_count++;
+			cached = true;
+		}
+		lck_spin_unlock(&pool->ikp_lock);
+	}
+
+	ip_release(port);
+	return cached;
+}
+
+/*
+ *	Routine:	ipc_kmsg_pool_destroy
+ *	Purpose:
+ *		Free the kmsg pool of a port.
+ *	Conditions:
+ *		The port is being freed.
+ */
+void
+ipc_kmsg_pool_destroy(
+	ipc_port_t      port)
+{
+	struct ipc_kmsg_pool *pool;
+	uintptr_t value = port->ip_kmsg_pool;
+
+	port->ip_kmsg_pool = 0;
+	if (!IKP_IS_POOL(value)) {
+		return;
+	}
+	pool = (struct ipc_kmsg_pool *)value;
+
+	lck_spin_lock(&ipc_kmsg_pools_lock);
+	remqueue(&pool->ikp_link);
+	lck_spin_unlock(&ipc_kmsg_pools_lock);
+
+	ipc_kmsg_pool_free_list(pool->ikp_free);
+	lck_spin_destroy(&pool->ikp_lock, &ipc_lck_grp);
+	zfree(ipc_kmsg_pool_zone, pool);
+}
+
+/*
+ *	Routine:	ipc_kmsg_pool_stats
+ *	Purpose:
+ *		Report how often kernel messages sent to the port
+ *		reused a cached kmsg.
+ *	Conditions:
+ *		The port is locked.
+ */
+void
+ipc_kmsg_pool_stats(
+	ipc_port_t      port,
+	uint32_t        *hits,
+	uint32_t        *misses)
+{
+	uintptr_t value = os_atomic_load(&port->ip_kmsg_pool, acquire);
+	struct ipc_kmsg_pool *pool = (struct ipc_kmsg_pool *)value;
+
+	if (IKP_IS_POOL(value)) {
+		*hits = os_atomic_load(&pool->ikp_hits, relaxed);
+		*misses = os_atomic_load(&pool->ikp_misses, relaxed);
+	} else {
+		*hits = 0;
+		*misses = 0;
+	}
+}
+
+/*
+ *	Routine:	ipc_kmsg_pool_drain
+ *	Purpose:
+ *		Free the kmsgs cached by every port, and make the
+ *		pools learn their size again before caching more.
+ *		Called when the VM is short on memory.
+ *	Conditions:
+ *		Nothing locked.
+ */
+void
+ipc_kmsg_pool_drain(void)
+{
+	struct ipc_kmsg_pool *pool;
+	ipc_kmsg_t drained = IKM_NULL, kmsg;
+
+	lck_spin_lock(&ipc_kmsg_pools_lock);
+	qe_foreach_element(pool, &ipc_kmsg_pools, ikp_link) {
+		lck_spin_lock(&pool->ikp_lock);
+		while ((kmsg = pool->ikp_free) != IKM_NULL) {
+			pool->ikp_free = kmsg->ikm_next;
+			kmsg->ikm_next = drained;
+			drained = kmsg;
+		}
+		pool->ikp_count = 0;
+		pool->ikp_streak = 0;
+		lck_spin_unlock(&pool->ikp_lock);
+	}
+	lck_spin_unlock(&ipc_kmsg_pools_lock);
+
+	ipc_kmsg_pool_free_list(drained);
+}
+
 /*
  *	Routine:	ipc_kmsg_free
  *	Purpose:
@@ -1355,6 +1712,10 @@ ipc_kmsg_free(
 	    VM_KERNEL_ADDRPERM((uintptr_t)kmsg),
 	    0, 0, 0, 0);
 
+	if (kmsg->ikm_pool_port != IP_NULL && ipc_kmsg_pool_put(kmsg)) {
+		return;
+	}
+
 	/*
 	 * Check to see if the message is bound to the port.  If so,
 	 * mark it not in use.  If the port isn't already dead, then
@@ -2129,7 +2490,7 @@ ipc_kmsg_get_from_kernel(
 		ikm_set_header(kmsg, NULL, msg_and_trailer_size);
 		ip_unlock(dest_port);
 	} else {
-		kmsg = ipc_kmsg_alloc(msg_and_trailer_size);
+		kmsg = ipc_kmsg_alloc_for_port(msg_and_trailer_size, dest_port);
 		if (kmsg == IKM_NULL) {
 			return MACH_SEND_NO_BUFFER;
 		}
@@ -3471,6 +3832,9 @@ ipc_kmsg_copyin_ool_descriptor(
 		 *
 		 * NOTE: A virtual copy is OK if the original is being
 		 * deallocted, even if a physical copy was requested.
+		 * When the data is a whole anonymous mapping, it is then
+		 * moved to the receiver without copy-on-write (see
+		 * vm_map_copyin_can_move()).
 		 */
 		kern_return_t kr = vm_map_copyin(map, addr,
 		    (vm_map_size_t)length, dealloc, copy);
@@ -114,6 +114,7 @@ struct ipc_kmsg {
 	struct ipc_importance_elem *ikm_importance;  /* inherited from */
 	queue_chain_t              ikm_inheritance;  /* inherited from link */
 	struct turnstile           *ikm_turnstile;   /* send turnstile for ikm_prealloc port */
+	ipc_port_t                 ikm_pool_port;    /* port whose kmsg pool we return to */
 #if MACH_FLIPC
 	struct mach_node           *ikm_node;        /* Originating node - needed for ack */
 #endif
@@ -238,10 +239,28 @@ extern ipc_kmsg_t ipc_kmsg_queue_next(
 extern ipc_kmsg_t ipc_kmsg_alloc(
 	mach_msg_size_t size);
 
+/* Allocate a kernel message sent by the kernel to the specified port */
+extern ipc_kmsg_t ipc_kmsg_alloc_for_port(
+	mach_msg_size_t size,
+	ipc_port_t      dest_port);
+
 /* Free a kernel message buffer */
 extern void ipc_kmsg_free(
 	ipc_kmsg_t      kmsg);
 
+/* Free the kmsgs cached by a port */
+extern void ipc_kmsg_pool_destroy(
+	ipc_port_t      port);
+
+/* Free the kmsgs cached by all ports */
+extern void ipc_kmsg_pool_drain(void);
+
+/* Get the kmsg pool statistics of a port */
+extern void ipc_kmsg_pool_stats(
+	ipc_port_t      port,
+	uint32_t        *hits,
+	uint32_t        *misses);
+
 /* Destroy kernel message */
 extern void ipc_kmsg_destroy(
 	ipc_kmsg_t      kmsg);
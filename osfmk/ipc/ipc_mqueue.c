@@ -1578,7 +1578,6 @@ ipc_mqueue_set_gather_member_names(
 	mach_port_name_t *names,
 	ipc_entry_num_t *actualp)
 {
-	ipc_entry_t table;
 	ipc_entry_num_t tsize;
 	struct waitq_set *wqset;
 	ipc_entry_num_t actual = 0;
@@ -1598,10 +1597,9 @@ ipc_mqueue_set_gather_member_names(
 		goto out;
 	}
 
-	table = space->is_table;
 	tsize = space->is_table_size;
 	for (ipc_entry_num_t idx = 0; idx < tsize; idx++) {
-		ipc_entry_t entry = &table[idx];
+		ipc_entry_t entry = is_table_entry(space, idx);
 
 		/* only receive rights can be members of port sets */
 		if ((entry->ie_bits & MACH_PORT_TYPE_RECEIVE) != MACH_PORT_TYPE_NONE) {
@@ -3028,6 +3028,7 @@ ipc_port_finalize(
 		port->ip_requests = IPR_NULL;
 	}
 
+	ipc_kmsg_pool_destroy(port);
 	ipc_mqueue_deinit(&port->ip_messages);
 
 #if     MACH_ASSERT
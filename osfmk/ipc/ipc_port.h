@@ -140,6 +140,7 @@ struct ipc_port {
 	struct ipc_port *ip_nsrequest;
 	struct ipc_port *ip_pdrequest;
 	struct ipc_port_request *ip_requests;
+	uintptr_t ip_kmsg_pool;                 /* cached kmsgs for kernel sends, or their rate, see ipc_kmsg_pool_get() */
 	union {
 		struct ipc_kmsg *XNU_PTRAUTH_SIGNED_PTR("ipc_port.premsg") premsg;
 		struct turnstile *send_turnstile;
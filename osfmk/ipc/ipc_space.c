@@ -73,6 +73,7 @@
 #include <mach/kern_return.h>
 #include <mach/port.h>
 #include <kern/assert.h>
+#include <kern/kalloc.h>
 #include <kern/sched_prim.h>
 #include <kern/zalloc.h>
 #include <ipc/port.h>
@@ -138,16 +139,19 @@ ipc_space_get_rollpoint(
  *	Routine:	ipc_entry_rand_freelist
  *	Purpose:
  *		Pseudo-randomly permute the order of entries in an IPC space
+ *		and return the index of the last entry of the free list.
  *	Arguments:
  *		space:	the ipc space to initialize.
- *		table:	the corresponding ipc table to initialize.
+ *		table:	the corresponding ipc table (or segment) to initialize.
+ *		base:	the index of the first entry of table.
  *		bottom:	the start of the range to initialize (inclusive).
  *		top:	the end of the range to initialize (noninclusive).
  */
-void
+mach_port_index_t
 ipc_space_rand_freelist(
 	ipc_space_t             space,
 	ipc_entry_t             table,
+	mach_port_index_t       base,
 	mach_port_index_t       bottom,
 	mach_port_index_t       top)
 {
@@ -171,7 +175,7 @@ ipc_space_rand_freelist(
 	 *	number, in order to frustrate attacks involving port name reuse.
 	 */
 	while (bottom <= top) {
-		ipc_entry_t entry = &table[curr];
+		ipc_entry_t entry = &table[curr - base];
 		int which;
 #ifdef CONFIG_SEMI_RANDOM_ENTRIES
 		/*
@@ -205,20 +209,18 @@ ipc_space_rand_freelist(
 		entry->ie_bits   = IE_BITS_GEN_MASK;
 		entry->ie_next   = next;
 		entry->ie_object = IO_NULL;
-		entry->ie_dist   = 0;
-		entry->ie_index  = 0;
 		curr = next;
 	}
-	table[curr].ie_next   = 0;
-	table[curr].ie_object = IO_NULL;
-	table[curr].ie_index  = 0;
-	table[curr].ie_dist   = 0;
-	table[curr].ie_bits   = IE_BITS_GEN_MASK;
+	table[curr - base].ie_next   = 0;
+	table[curr - base].ie_object = IO_NULL;
+	table[curr - base].ie_bits   = IE_BITS_GEN_MASK;
 
 	/* The freelist head should always have generation number set to 0 */
 	if (at_start) {
 		table[0].ie_bits = 0;
 	}
+
+	return curr;
 }
 
 
@@ -244,8 +246,11 @@ ipc_space_create(
 {
 	ipc_space_t space;
 	ipc_entry_t table;
+	struct ipc_hash_bucket *hash;
 	ipc_entry_num_t new_size;
 
+	assert(initial->its_size <= IS_TABLE_SEG_SIZE);
+
 	space = is_alloc();
 	if (space == IS_NULL) {
 		return KERN_RESOURCE_SHORTAGE;
@@ -260,11 +265,18 @@ ipc_space_create(
 	new_size = initial->its_size;
 	memset((void *) table, 0, new_size * sizeof(struct ipc_entry));
 
+	hash = ipc_hash_table_alloc(IPC_HASH_MIN_BUCKETS);
+	if (hash == NULL) {
+		it_entries_free(initial, table);
+		is_free(space);
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
 	/* Set to 0 so entropy pool refills */
 	memset((void *) space->is_entropy, 0, sizeof(space->is_entropy));
 
 	random_bool_init(&space->bool_gen);
-	ipc_space_rand_freelist(space, table, 0, new_size);
+	ipc_space_rand_freelist(space, table, 0, 0, new_size);
 
 	is_lock_init(space);
 	space->is_bits = 2; /* 2 refs, active, not growing */
@@ -273,6 +285,13 @@ ipc_space_create(
 	space->is_table_free = new_size - 1;
 	space->is_table = table;
 	space->is_table_next = initial + 1;
+	space->is_table_segs = NULL;
+	space->is_hash = hash;
+	space->is_hash_old = NULL;
+	space->is_hash_mask = IPC_HASH_MIN_BUCKETS - 1;
+	space->is_hash_old_mask = 0;
+	space->is_hash_migrated = 0;
+	space->is_hash_wanted = 0;
 	space->is_task = NULL;
 	space->is_label = label;
 	space->is_low_mod = new_size;
@@ -377,6 +396,13 @@ ipc_space_create_special(
 	space->is_task       = TASK_NULL;
 	space->is_label      = IPC_LABEL_SPECIAL;
 	space->is_table_next = 0;
+	space->is_table_segs = NULL;
+	space->is_hash       = NULL;
+	space->is_hash_old   = NULL;
+	space->is_hash_mask  = 0;
+	space->is_hash_old_mask = 0;
+	space->is_hash_migrated = 0;
+	space->is_hash_wanted = 0;
 	space->is_low_mod    = 0;
 	space->is_high_mod   = 0;
 	space->is_node_id = HOST_LOCAL_NODE; /* HOST_LOCAL_NODE, except proxy spaces */
@@ -396,7 +422,6 @@ void
 ipc_space_clean(
 	ipc_space_t space)
 {
-	ipc_entry_t table;
 	ipc_entry_num_t size;
 	mach_port_index_t index;
 
@@ -420,11 +445,10 @@ retry:
 	 *	Now we can futz with it	since we have the write lock.
 	 */
 
-	table = space->is_table;
 	size = space->is_table_size;
 
 	for (index = 0; index < size; index++) {
-		ipc_entry_t entry = &table[index];
+		ipc_entry_t entry = is_table_entry(space, index);
 		mach_port_type_t type;
 
 		type = IE_BITS_TYPE(entry->ie_bits);
@@ -459,7 +483,6 @@ void
 ipc_space_terminate(
 	ipc_space_t     space)
 {
-	ipc_entry_t table;
 	ipc_entry_num_t size;
 	mach_port_index_t index;
 
@@ -488,11 +511,10 @@ ipc_space_terminate(
 	 *	Now we can futz with it	unlocked.
 	 */
 
-	table = space->is_table;
 	size = space->is_table_size;
 
 	for (index = 0; index < size; index++) {
-		ipc_entry_t entry = &table[index];
+		ipc_entry_t entry = is_table_entry(space, index);
 		mach_port_type_t type;
 
 		type = IE_BITS_TYPE(entry->ie_bits);
@@ -505,7 +527,21 @@ ipc_space_terminate(
 		}
 	}
 
-	it_entries_free(space->is_table_next - 1, table);
+	if (space->is_table_segs) {
+		for (index = IS_TABLE_SEG_SIZE; index < size; index += IS_TABLE_SEG_SIZE) {
+			ipc_table_free(IS_TABLE_SEG_SIZE * sizeof(struct ipc_entry),
+			    space->is_table_segs[index >> IS_TABLE_SEG_SHIFT]);
+		}
+		kfree(space->is_table_segs, ipc_entry_table_segs_size());
+		space->is_table_segs = NULL;
+		size = IS_TABLE_SEG_SIZE;
+	}
+	ipc_table_free(size * sizeof(struct ipc_entry), space->is_table);
+	/* growing the hash always finishes moving the old table */
+	assert(space->is_hash_old == NULL);
+	ipc_hash_table_free(space->is_hash, space->is_hash_mask + 1);
+	space->is_hash = NULL;
+	space->is_hash_mask = 0;
 	space->is_table_size = 0;
 	space->is_table_free = 0;
 
@@ -100,6 +100,14 @@
  *
  *	Every space has a non-NULL is_table with is_table_size entries.
  *
+ *	The first IS_TABLE_SEG_SIZE entries live in is_table, which is
+ *	reallocated (following the ipc_table_entries sizes) as it grows.
+ *	Past that, the table grows by whole segments of IS_TABLE_SEG_SIZE
+ *	entries, which are never moved: is_table_segs[i] holds entries
+ *	[i * IS_TABLE_SEG_SIZE, (i + 1) * IS_TABLE_SEG_SIZE), with
+ *	is_table_segs[0] == is_table.  Use is_table_entry() to find
+ *	the entry for an index.
+ *
  *	Only one thread can be growing the space at a time.  Others
  *	that need it grown wait for the first.  We do almost all the
  *	work with the space unlocked, so lookups proceed pretty much
@@ -112,6 +120,12 @@ typedef natural_t ipc_space_refs_t;
 #define IS_GROWING      0x20000000      /* space is growing */
 #define IS_ENTROPY_CNT  1               /* per-space entropy pool size */
 
+#define IS_TABLE_SEG_SHIFT      12
+#define IS_TABLE_SEG_SIZE       (1u << IS_TABLE_SEG_SHIFT)
+#define IS_TABLE_SEG_MASK       (IS_TABLE_SEG_SIZE - 1)
+
+struct ipc_hash_bucket;
+
 struct ipc_space {
 	lck_spin_t      is_lock_data;
 	ipc_space_refs_t is_bits;       /* holds refs, active, growing */
@@ -120,6 +134,13 @@ struct ipc_space {
 	ipc_entry_num_t is_table_free;  /* count of free elements */
 	ipc_entry_t XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_table") is_table; /* an array of entries */
 	struct ipc_table_size * XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_table_next") is_table_next; /* info for larger table */
+	ipc_entry_t * XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_table_segs") is_table_segs; /* segments, once segmented */
+	struct ipc_hash_bucket * XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_hash") is_hash; /* reverse hash table */
+	struct ipc_hash_bucket * XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_hash_old") is_hash_old; /* table being moved from while growing */
+	ipc_entry_num_t is_hash_mask;   /* number of hash buckets - 1 */
+	ipc_entry_num_t is_hash_old_mask; /* number of old hash buckets - 1 */
+	ipc_entry_num_t is_hash_migrated; /* old hash buckets already moved */
+	ipc_entry_num_t is_hash_wanted; /* names the hash must fit when it grows */
 	task_t XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_task") is_task; /* associated task */
 	ipc_label_t is_label;           /* [private] mandatory access label */
 	ipc_entry_num_t is_low_mod;     /* lowest modified entry during growth */
@@ -134,6 +155,16 @@ struct ipc_space {
 
 #define is_active(is)           (((is)->is_bits & IS_INACTIVE) != IS_INACTIVE)
 
+static inline ipc_entry_t
+is_table_entry(ipc_space_t is, mach_port_index_t index)
+{
+	assert(index < is->is_table_size);
+	if (index < IS_TABLE_SEG_SIZE) {
+		return &is->is_table[index];
+	}
+	return &is->is_table_segs[index >> IS_TABLE_SEG_SHIFT][index & IS_TABLE_SEG_MASK];
+}
+
 static inline void
 is_mark_inactive(ipc_space_t is)
 {
@@ -248,9 +279,10 @@ extern void ipc_space_clean(
 	ipc_space_t     space);
 
 /* Permute the order of a range within an IPC space */
-extern void ipc_space_rand_freelist(
+extern mach_port_index_t ipc_space_rand_freelist(
 	ipc_space_t             space,
 	ipc_entry_t             table,
+	mach_port_index_t       base,
 	mach_port_index_t       bottom,
 	mach_port_index_t       top);
 
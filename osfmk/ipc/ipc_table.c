@@ -131,10 +131,6 @@ ipc_table_init(void)
 	ipc_table_entries[IPC_TABLE_ENTRIES_SIZE - 1].its_size =
 	    ipc_table_entries[IPC_TABLE_ENTRIES_SIZE - 2].its_size;
 
-	/* make sure the robin hood hashing in ipc hash will work */
-	assert(ipc_table_entries[IPC_TABLE_ENTRIES_SIZE - 1].its_size <=
-	    IPC_ENTRY_INDEX_MAX);
-
 	ipc_table_fill(ipc_table_requests, IPC_TABLE_REQUESTS_SIZE - 1,
 	    2, sizeof(struct ipc_port_request));
 
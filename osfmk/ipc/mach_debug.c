@@ -191,7 +191,6 @@ mach_port_space_info(
 	ipc_info_name_t *table_info;
 	vm_offset_t table_addr;
 	vm_size_t table_size, table_size_needed;
-	ipc_entry_t table;
 	ipc_entry_num_t tsize;
 	mach_port_index_t index;
 	kern_return_t kr;
@@ -250,15 +249,14 @@ mach_port_space_info(
 	/* get the overall space info */
 	infop->iis_genno_mask = MACH_PORT_NGEN(MACH_PORT_DEAD);
 	infop->iis_table_size = space->is_table_size;
-	infop->iis_table_next = space->is_table_next->its_size;
+	infop->iis_table_next = ipc_entry_table_next_size(space);
 
 	/* walk the table for this space */
-	table = space->is_table;
 	tsize = space->is_table_size;
 	table_info = (ipc_info_name_array_t)table_addr;
 	for (index = 0; index < tsize; index++) {
 		ipc_info_name_t *iin = &table_info[index];
-		ipc_entry_t entry = &table[index];
+		ipc_entry_t entry = is_table_entry(space, index);
 		ipc_entry_bits_t bits;
 
 		bits = entry->ie_bits;
@@ -278,7 +276,7 @@ mach_port_space_info(
 		iin->iin_urefs = IE_BITS_UREFS(bits);
 		iin->iin_object = (dbg_ok) ? (natural_t)VM_KERNEL_ADDRPERM((uintptr_t)entry->ie_object) : 0;
 		iin->iin_next = entry->ie_next;
-		iin->iin_hash = entry->ie_index;
+		iin->iin_hash = 0;      /* the reverse hash isn't indexed by name */
 	}
 
 	is_read_unlock(space);
@@ -381,7 +379,7 @@ mach_port_space_basic_info(
 	/* get the basic space info */
 	infop->iisb_genno_mask = MACH_PORT_NGEN(MACH_PORT_DEAD);
 	infop->iisb_table_size = space->is_table_size;
-	infop->iisb_table_next = space->is_table_next->its_size;
+	infop->iisb_table_next = ipc_entry_table_next_size(space);
 	infop->iisb_table_inuse = space->is_table_size - space->is_table_free - 1;
 	infop->iisb_reserved[0] = 0;
 	infop->iisb_reserved[1] = 0;
@@ -500,29 +500,29 @@ mach_msg_receive_continue(void)
 
 
 /*
- *	Routine:	mach_msg_overwrite_trap [mach trap]
+ *	Routine:	mach_msg_overwrite_common [internal]
  *	Purpose:
  *		Possibly send a message; possibly receive a message.
+ *
+ *		A blocking receive resumes in the specified continuation,
+ *		or returns to the caller when it is NULL.
  *	Conditions:
  *		Nothing locked.
  *	Returns:
  *		All of mach_msg_send and mach_msg_receive error codes.
  */
-
-mach_msg_return_t
-mach_msg_overwrite_trap(
-	struct mach_msg_overwrite_trap_args *args)
+static mach_msg_return_t
+mach_msg_overwrite_common(
+	mach_vm_address_t       msg_addr,
+	mach_msg_option_t       option,
+	mach_msg_size_t         send_size,
+	mach_msg_size_t         rcv_size,
+	mach_port_name_t        rcv_name,
+	mach_msg_timeout_t      msg_timeout,
+	mach_msg_priority_t     priority,
+	mach_vm_address_t       rcv_msg_addr,
+	mach_msg_continue_t     continuation)
 {
-	mach_vm_address_t       msg_addr = args->msg;
-	mach_msg_option_t       option = args->option;
-	mach_msg_size_t         send_size = args->send_size;
-	mach_msg_size_t         rcv_size = args->rcv_size;
-	mach_port_name_t        rcv_name = args->rcv_name;
-	mach_msg_timeout_t      msg_timeout = args->timeout;
-	mach_msg_priority_t     priority = args->priority;
-	mach_vm_address_t       rcv_msg_addr = args->rcv_msg;
-	__unused mach_port_seqno_t temp_seqno = 0;
-
 	mach_msg_return_t  mr = MACH_MSG_SUCCESS;
 	vm_map_t map = current_map();
 
@@ -600,7 +600,7 @@ mach_msg_overwrite_trap(
 		self->ith_msize = 0;
 		self->ith_option = option;
 		self->ith_receiver_name = MACH_PORT_NULL;
-		self->ith_continuation = thread_syscall_return;
+		self->ith_continuation = continuation;
 		self->ith_knote = ITH_KNOTE_NULL;
 
 		ipc_mqueue_receive(mqueue, option, rcv_size, msg_timeout, THREAD_ABORTSAFE);
@@ -616,6 +616,80 @@ end:
 	return mr;
 }
 
+/*
+ *	Routine:	mach_msg_overwrite_trap [mach trap]
+ *	Purpose:
+ *		Possibly send a message; possibly receive a message.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		All of mach_msg_send and mach_msg_receive error codes.
+ */
+
+mach_msg_return_t
+mach_msg_overwrite_trap(
+	struct mach_msg_overwrite_trap_args *args)
+{
+	return mach_msg_overwrite_common(args->msg, args->option,
+	           args->send_size, args->rcv_size, args->rcv_name,
+	           args->timeout, args->priority, args->rcv_msg,
+	           thread_syscall_return);
+}
+
+/*
+ *	Routine:	mach_msg_vector_trap [mach trap]
+ *	Purpose:
+ *		Perform the sends and/or receives described by an array
+ *		of mach_msg_vector_t, in order, in one kernel entry.
+ *
+ *		Every entry is processed, whether previous ones failed
+ *		or not, and its result is copied out to its msgv_result.
+ *		Blocking receives block the whole batch.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		MACH_MSG_SUCCESS	All entries succeeded.
+ *		MACH_SEND_INVALID_DATA	Bad count, or the array couldn't be
+ *					copied in (entries before the bad
+ *					one have been processed).
+ *		Otherwise, the result of the first entry that failed.
+ */
+mach_msg_return_t
+mach_msg_vector_trap(
+	struct mach_msg_vector_trap_args *args)
+{
+	user_addr_t             uaddr = args->vec;
+	mach_msg_size_t         count = args->count;
+	mach_msg_return_t       first_mr = MACH_MSG_SUCCESS;
+	mach_msg_return_t       mr;
+	mach_msg_vector_t       vec;
+
+	if (count == 0 || count > MACH_MSG_VECTOR_MAX) {
+		return MACH_SEND_INVALID_DATA;
+	}
+
+	for (mach_msg_size_t i = 0; i < count; i++, uaddr += sizeof(vec)) {
+		if (copyin(uaddr, &vec, sizeof(vec))) {
+			return MACH_SEND_INVALID_DATA;
+		}
+
+		mr = mach_msg_overwrite_common(vec.msgv_data, vec.msgv_option,
+		    vec.msgv_send_size, vec.msgv_rcv_size, vec.msgv_rcv_name,
+		    vec.msgv_timeout, MACH_MSG_PRIORITY_UNSPECIFIED, 0,
+		    MACH_MSG_CONTINUE_NULL);
+
+		if (copyout(&mr, uaddr + offsetof(mach_msg_vector_t, msgv_result),
+		    sizeof(mr))) {
+			return MACH_SEND_INVALID_DATA;
+		}
+		if (mr != MACH_MSG_SUCCESS && first_mr == MACH_MSG_SUCCESS) {
+			first_mr = mr;
+		}
+	}
+
+	return first_mr;
+}
+
 /*
  *	Routine:	mach_msg_rcv_link_special_reply_port
  *	Purpose:
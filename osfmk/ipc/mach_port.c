@@ -210,7 +210,6 @@ mach_port_names(
 	mach_port_type_t        **typesp,
 	mach_msg_type_number_t  *typesCnt)
 {
-	ipc_entry_t table;
 	ipc_entry_num_t tsize;
 	mach_port_index_t index;
 	ipc_entry_num_t actual; /* this many names */
@@ -316,11 +315,10 @@ mach_port_names(
 
 	timestamp = ipc_port_timestamp();
 
-	table = space->is_table;
 	tsize = space->is_table_size;
 
 	for (index = 0; index < tsize; index++) {
-		ipc_entry_t entry = &table[index];
+		ipc_entry_t entry = is_table_entry(space, index);
 		ipc_entry_bits_t bits = entry->ie_bits;
 
 		if (IE_BITS_TYPE(bits) != MACH_PORT_TYPE_NONE) {
@@ -2013,6 +2011,8 @@ mach_port_get_attributes(
 		/* port is locked and active */
 		mach_port_get_status_helper(port, &mp_info->mpie_status);
 		mp_info->mpie_boost_cnt = port->ip_impcount;
+		ipc_kmsg_pool_stats(port, &mp_info->mpie_kmsg_pool_hits,
+		    &mp_info->mpie_kmsg_pool_misses);
 		*count = MACH_PORT_INFO_EXT_COUNT;
 		ip_unlock(port);
 		break;
@@ -386,7 +386,8 @@ ipc_kobject_server(
 
 	/* round up for trailer size */
 	reply_size += MAX_TRAILER_SIZE;
-	reply = ipc_kmsg_alloc(reply_size);
+	reply = ipc_kmsg_alloc_for_port(reply_size,
+	    request->ikm_header->msgh_local_port);
 
 	if (reply == IKM_NULL) {
 		printf("ipc_kobject_server: dropping request\n");
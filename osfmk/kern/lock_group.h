@@ -87,6 +87,10 @@ typedef struct _lck_grp_stats_ {
 	lck_grp_stat_t          lgss_mtx_direct_wait;
 	lck_grp_stat_t          lgss_mtx_miss;
 	lck_grp_stat_t          lgss_mtx_wait;
+	lck_grp_stat_t          lgss_mtx_spin;          /* contended acquisitions that spun */
+	lck_grp_stat_t          lgss_mtx_spin_acquired; /* spins that ended owning the mutex */
+	lck_grp_stat_t          lgss_mtx_spin_block;    /* contended acquisitions that blocked */
+	lck_grp_stat_t          lgss_mtx_spin_time;     /* time spent spinning, abs units */
 } lck_grp_stats_t;
 
 #define LCK_GRP_MAX_NAME        64
@@ -101,6 +105,8 @@ typedef struct _lck_grp_ {
 	uint32_t                lck_grp_attr;
 	char                    lck_grp_name[LCK_GRP_MAX_NAME];
 	lck_grp_stats_t         lck_grp_stats;
+	uint64_t                lck_grp_mtx_hold_avg;   /* learned mutex hold time, abs units */
+	uint32_t                lck_grp_mtx_spin_class; /* adaptive spin class, 0 if none */
 } lck_grp_t;
 
 #else
@@ -386,5 +386,30 @@ lck_grp_mtx_update_held(
 	lck_grp_inc_stats(grp, stat);
 }
 
+static void inline
+lck_grp_mtx_update_spin(
+	lck_grp_t *grp,
+	boolean_t acquired,
+	uint64_t time)
+{
+	lck_grp_inc_stats(grp, &grp->lck_grp_stats.lgss_mtx_spin);
+	if (acquired) {
+		lck_grp_inc_stats(grp, &grp->lck_grp_stats.lgss_mtx_spin_acquired);
+	}
+
+	lck_grp_stat_t *stat = &grp->lck_grp_stats.lgss_mtx_spin_time;
+	if (__improbable(stat->lgs_enablings)) {
+		os_atomic_add(&stat->lgs_count, time, relaxed);
+	}
+}
+
+static void inline
+lck_grp_mtx_update_spin_block(
+	lck_grp_t *grp)
+{
+	lck_grp_stat_t *stat = &grp->lck_grp_stats.lgss_mtx_spin_block;
+	lck_grp_inc_stats(grp, stat);
+}
+
 #endif /* MACH_KERNEL_PRIVATE */
 #endif /* _KERN_LOCKSTAT_H */
@@ -283,6 +283,10 @@ lck_grp_init(lck_grp_t * grp, const char * grp_name, lck_grp_attr_t * attr)
 		lck_grp_stat_enable(&stats->lgss_mtx_miss);
 		lck_grp_stat_enable(&stats->lgss_mtx_direct_wait);
 		lck_grp_stat_enable(&stats->lgss_mtx_wait);
+		lck_grp_stat_enable(&stats->lgss_mtx_spin);
+		lck_grp_stat_enable(&stats->lgss_mtx_spin_acquired);
+		lck_grp_stat_enable(&stats->lgss_mtx_spin_block);
+		lck_grp_stat_enable(&stats->lgss_mtx_spin_time);
 	}
 	if (grp->lck_grp_attr & LCK_GRP_ATTR_TIME_STAT) {
 #if LOCK_STATS
@@ -339,6 +343,9 @@ lck_grp_deallocate(
 		return;
 	}
 
+#if defined(__x86_64__)
+	lck_mtx_grp_spin_class_release(grp);
+#endif /* __x86_64__ */
 	zfree(ZV_LCK_GRP, grp);
 }
 
@@ -1708,6 +1715,70 @@ host_lockgroup_info(
 	return KERN_SUCCESS;
 }
 
+kern_return_t
+host_lockgroup_spin_info(
+	host_t                          host,
+	lockgroup_spin_info_array_t     *spin_infop,
+	mach_msg_type_number_t          *spin_infoCntp)
+{
+	lockgroup_spin_info_t   *spin_info;
+	vm_offset_t             spin_info_addr;
+	vm_size_t               spin_info_size;
+	vm_size_t               spin_info_vmsize;
+	lck_grp_t               *lck_grp;
+	unsigned int            i;
+	vm_map_copy_t           copy;
+	kern_return_t           kr;
+
+	if (host == HOST_NULL) {
+		return KERN_INVALID_HOST;
+	}
+
+	lck_mtx_lock(&lck_grp_lock);
+
+	spin_info_size = lck_grp_cnt * sizeof(*spin_info);
+	spin_info_vmsize = round_page(spin_info_size);
+	kr = kmem_alloc_pageable(ipc_kernel_map,
+	    &spin_info_addr, spin_info_vmsize, VM_KERN_MEMORY_IPC);
+	if (kr != KERN_SUCCESS) {
+		lck_mtx_unlock(&lck_grp_lock);
+		return kr;
+	}
+
+	lck_grp = (lck_grp_t *)queue_first(&lck_grp_queue);
+	spin_info = (lockgroup_spin_info_t *)spin_info_addr;
+
+	for (i = 0; i < lck_grp_cnt; i++) {
+		spin_info->lock_mtx_spin_cnt = lck_grp->lck_grp_stats.lgss_mtx_spin.lgs_count;
+		spin_info->lock_mtx_spin_acquired_cnt = lck_grp->lck_grp_stats.lgss_mtx_spin_acquired.lgs_count;
+		spin_info->lock_mtx_spin_block_cnt = lck_grp->lck_grp_stats.lgss_mtx_spin_block.lgs_count;
+		absolutetime_to_nanoseconds(lck_grp->lck_grp_stats.lgss_mtx_spin_time.lgs_count,
+		    &spin_info->lock_mtx_spin_time_cum);
+		absolutetime_to_nanoseconds(lck_grp->lck_grp_mtx_hold_avg,
+		    &spin_info->lock_mtx_hold_avg);
+
+		(void) strncpy(spin_info->lockgroup_name, lck_grp->lck_grp_name, LOCKGROUP_MAX_NAME);
+
+		lck_grp = (lck_grp_t *)(queue_next((queue_entry_t)(lck_grp)));
+		spin_info++;
+	}
+
+	*spin_infoCntp = lck_grp_cnt;
+	lck_mtx_unlock(&lck_grp_lock);
+
+	if (spin_info_size != spin_info_vmsize) {
+		bzero((char *)spin_info, spin_info_vmsize - spin_info_size);
+	}
+
+	kr = vm_map_copyin(ipc_kernel_map, (vm_map_address_t)spin_info_addr,
+	    (vm_map_size_t)spin_info_size, TRUE, &copy);
+	assert(kr == KERN_SUCCESS);
+
+	*spin_infop = (lockgroup_spin_info_t *) copy;
+
+	return KERN_SUCCESS;
+}
+
 /*
  * sleep_with_inheritor and wakeup_with_inheritor KPI
  *
@@ -3202,6 +3273,304 @@ lck_mtx_gate_assert(__assert_only lck_mtx_t *lock, gate_t *gate, int flags)
 	gate_assert(gate, flags);
 }
 
+#pragma mark - lck_rw_percpu
+
+/*
+ * Per-cpu reader writer locks.
+ *
+ * A reader increments its CPU's count, then checks lrp_draining.  A
+ * writer sets lrp_draining, then sums the counts.  Both sides issue a
+ * full barrier between their store and their load, so either the reader
+ * sees the writer and backs off, or the writer sees the reader's count
+ * and waits for it to drop.
+ *
+ * Readers that back off wait for the writer by taking lrp_rw shared, and
+ * publish their count while still holding it, so no later writer can
+ * miss them.  Every shared holder is thus accounted in the per-cpu
+ * counts, whichever path it took, and unlocking is the same for all.
+ *
+ * Readers may migrate while holding the lock, so a single CPU's count
+ * can wrap below zero; only the sum is meaningful.
+ */
+static SECURITY_READ_ONLY_LATE(zone_t) lck_rw_percpu_zone;
+ZONE_INIT(&lck_rw_percpu_zone, "lck_rw_percpu", sizeof(uint64_t),
+    ZC_PERCPU | ZC_ALIGNMENT_REQUIRED, ZONE_ID_ANY, NULL);
+
+static uint64_t
+lck_rw_percpu_readers(lck_rw_percpu_t *lck)
+{
+	uint64_t readers = 0;
+
+	zpercpu_foreach(it, lck->lrp_readers) {
+		readers += os_atomic_load_wide(it, relaxed);
+	}
+	return readers;
+}
+
+/*
+ * Wait for the readers that got in before lrp_draining was set.
+ * Read sections are short, so spin like a contended mutex would
+ * before blocking.  Called with lrp_rw held exclusive.
+ */
+static void
+lck_rw_percpu_drain(lck_rw_percpu_t *lck)
+{
+	uint64_t deadline = mach_absolute_time() + MutexSpin;
+
+	while (lck_rw_percpu_readers(lck) != 0) {
+		if (mach_absolute_time() < deadline) {
+			cpu_pause();
+			continue;
+		}
+		assert_wait((event_t)&lck->lrp_draining, THREAD_UNINT);
+		if (lck_rw_percpu_readers(lck) == 0) {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+			break;
+		}
+		thread_block(THREAD_CONTINUE_NULL);
+	}
+
+	/* pairs with the release of the readers' decrements */
+	os_atomic_thread_fence(acquire);
+}
+
+/*
+ * Drop this CPU's reader count, and wake the writer
+ * if it is waiting for the readers to drain.
+ */
+static void
+lck_rw_percpu_reader_exit(lck_rw_percpu_t *lck)
+{
+	uint32_t draining;
+
+	disable_preemption();
+	os_atomic_dec(zpercpu_get(lck->lrp_readers), release);
+	os_atomic_thread_fence(seq_cst);
+	draining = os_atomic_load(&lck->lrp_draining, relaxed);
+	enable_preemption();
+
+	if (__improbable(draining)) {
+		thread_wakeup((event_t)&lck->lrp_draining);
+	}
+}
+
+/*
+ * Fast path: returns TRUE if the reader was admitted
+ * without involving lrp_rw.
+ */
+static inline boolean_t
+lck_rw_percpu_reader_enter(lck_rw_percpu_t *lck)
+{
+	uint32_t draining;
+
+	disable_preemption();
+	os_atomic_inc(zpercpu_get(lck->lrp_readers), relaxed);
+	os_atomic_thread_fence(seq_cst);
+	draining = os_atomic_load(&lck->lrp_draining, acquire);
+	enable_preemption();
+
+	if (__probable(!draining)) {
+		return TRUE;
+	}
+
+	lck_rw_percpu_reader_exit(lck);
+	return FALSE;
+}
+
+/*
+ * Called with lrp_rw held shared, which keeps writers out.
+ */
+static void
+lck_rw_percpu_reader_enter_locked(lck_rw_percpu_t *lck)
+{
+	disable_preemption();
+	os_atomic_inc(zpercpu_get(lck->lrp_readers), relaxed);
+	enable_preemption();
+	lck_rw_unlock_shared(&lck->lrp_rw);
+}
+
+void
+lck_rw_percpu_init(
+	lck_rw_percpu_t *lck,
+	lck_grp_t       *grp,
+	lck_attr_t      *attr)
+{
+	lck_rw_init(&lck->lrp_rw, grp, attr);
+	lck->lrp_readers = zalloc_percpu(lck_rw_percpu_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	lck->lrp_owner = THREAD_NULL;
+	lck->lrp_draining = 0;
+}
+
+void
+lck_rw_percpu_destroy(
+	lck_rw_percpu_t *lck,
+	lck_grp_t       *grp)
+{
+	if (lck_rw_percpu_readers(lck) != 0 || lck->lrp_owner != THREAD_NULL) {
+		panic("lck_rw_percpu_destroy(): lock %p is held", lck);
+	}
+
+	zfree_percpu(lck_rw_percpu_zone, lck->lrp_readers);
+	lck->lrp_readers = NULL;
+	lck_rw_destroy(&lck->lrp_rw, grp);
+}
+
+void
+lck_rw_percpu_lock(
+	lck_rw_percpu_t *lck,
+	lck_rw_type_t   lck_rw_type)
+{
+	if (lck_rw_type == LCK_RW_TYPE_SHARED) {
+		lck_rw_percpu_lock_shared(lck);
+	} else if (lck_rw_type == LCK_RW_TYPE_EXCLUSIVE) {
+		lck_rw_percpu_lock_exclusive(lck);
+	} else {
+		panic("lck_rw_percpu_lock(): Invalid RW lock type: %x\n", lck_rw_type);
+	}
+}
+
+void
+lck_rw_percpu_unlock(
+	lck_rw_percpu_t *lck,
+	lck_rw_type_t   lck_rw_type)
+{
+	if (lck_rw_type == LCK_RW_TYPE_SHARED) {
+		lck_rw_percpu_unlock_shared(lck);
+	} else if (lck_rw_type == LCK_RW_TYPE_EXCLUSIVE) {
+		lck_rw_percpu_unlock_exclusive(lck);
+	} else {
+		panic("lck_rw_percpu_unlock(): Invalid RW lock type: %x\n", lck_rw_type);
+	}
+}
+
+void
+lck_rw_percpu_lock_shared(lck_rw_percpu_t *lck)
+{
+	if (__probable(lck_rw_percpu_reader_enter(lck))) {
+		return;
+	}
+
+	/* a writer is in, queue behind it on lrp_rw */
+	lck_rw_lock_shared(&lck->lrp_rw);
+	lck_rw_percpu_reader_enter_locked(lck);
+}
+
+void
+lck_rw_percpu_unlock_shared(lck_rw_percpu_t *lck)
+{
+	lck_rw_percpu_reader_exit(lck);
+}
+
+boolean_t
+lck_rw_percpu_try_lock_shared(lck_rw_percpu_t *lck)
+{
+	if (__probable(lck_rw_percpu_reader_enter(lck))) {
+		return TRUE;
+	}
+
+	if (!lck_rw_try_lock_shared(&lck->lrp_rw)) {
+		return FALSE;
+	}
+	lck_rw_percpu_reader_enter_locked(lck);
+	return TRUE;
+}
+
+void
+lck_rw_percpu_lock_exclusive(lck_rw_percpu_t *lck)
+{
+	lck_rw_lock_exclusive(&lck->lrp_rw);
+
+	os_atomic_store(&lck->lrp_draining, 1, relaxed);
+	os_atomic_thread_fence(seq_cst);
+	lck_rw_percpu_drain(lck);
+
+	lck->lrp_owner = current_thread();
+}
+
+boolean_t
+lck_rw_percpu_try_lock_exclusive(lck_rw_percpu_t *lck)
+{
+	if (!lck_rw_try_lock_exclusive(&lck->lrp_rw)) {
+		return FALSE;
+	}
+
+	os_atomic_store(&lck->lrp_draining, 1, relaxed);
+	os_atomic_thread_fence(seq_cst);
+	if (lck_rw_percpu_readers(lck) != 0) {
+		/* readers that backed off are parked on lrp_rw */
+		os_atomic_store(&lck->lrp_draining, 0, relaxed);
+		lck_rw_unlock_exclusive(&lck->lrp_rw);
+		return FALSE;
+	}
+	os_atomic_thread_fence(acquire);
+
+	lck->lrp_owner = current_thread();
+	return TRUE;
+}
+
+void
+lck_rw_percpu_unlock_exclusive(lck_rw_percpu_t *lck)
+{
+	if (lck->lrp_owner != current_thread()) {
+		panic("lck_rw_percpu_unlock_exclusive(): lock %p not owned by %p", lck, current_thread());
+	}
+
+	lck->lrp_owner = THREAD_NULL;
+	os_atomic_store(&lck->lrp_draining, 0, release);
+	lck_rw_unlock_exclusive(&lck->lrp_rw);
+}
+
+/*
+ * Readers never appear as owners, so the exclusive holder
+ * is the only thread that can find itself in lrp_owner.
+ */
+lck_rw_type_t
+lck_rw_percpu_done(lck_rw_percpu_t *lck)
+{
+	if (lck->lrp_owner == current_thread()) {
+		lck_rw_percpu_unlock_exclusive(lck);
+		return LCK_RW_TYPE_EXCLUSIVE;
+	}
+
+	lck_rw_percpu_unlock_shared(lck);
+	return LCK_RW_TYPE_SHARED;
+}
+
+void
+lck_rw_percpu_assert(
+	lck_rw_percpu_t *lck,
+	unsigned int    type)
+{
+	boolean_t owned = (lck->lrp_owner == current_thread());
+
+	switch (type) {
+	case LCK_RW_ASSERT_SHARED:
+		if (!owned && lck_rw_percpu_readers(lck) != 0) {
+			return;
+		}
+		break;
+	case LCK_RW_ASSERT_EXCLUSIVE:
+		if (owned) {
+			return;
+		}
+		break;
+	case LCK_RW_ASSERT_HELD:
+		if (owned || lck_rw_percpu_readers(lck) != 0) {
+			return;
+		}
+		break;
+	case LCK_RW_ASSERT_NOTHELD:
+		if (!owned) {
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+
+	panic("rw percpu lock (%p) not held (mode=%u)", lck, type);
+}
+
 #pragma mark - LCK_*_DECLARE support
 
 __startup_func
@@ -3256,6 +3625,13 @@ lck_rw_startup_init(struct lck_rw_startup_spec *sp)
 	lck_rw_init(sp->lck, sp->lck_grp, sp->lck_attr);
 }
 
+__startup_func
+void
+lck_rw_percpu_startup_init(struct lck_rw_percpu_startup_spec *sp)
+{
+	lck_rw_percpu_init(sp->lck, sp->lck_grp, sp->lck_attr);
+}
+
 __startup_func
 void
 usimple_lock_startup_init(struct usimple_lock_startup_spec *sp)
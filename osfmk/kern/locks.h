@@ -838,6 +838,10 @@ extern int              lck_mtx_test_mtx_uncontended(int iter, char* buffer, int
 extern int              lck_mtx_test_mtx_contended(int iter, char* buffer, int buffer_size, int type);
 extern int              lck_mtx_test_mtx_uncontended_loop_time(int iter, char* buffer, int buffer_size);
 extern int              lck_mtx_test_mtx_contended_loop_time(int iter, char* buffer, int buffer_size, int type);
+extern void             lck_rw_test_init(void);
+extern int              lck_rw_test_contended(int iter, int percpu, int write_every, char* buffer, int buffer_size);
+extern void             lck_mtx_test_spin_init(void);
+extern int              lck_mtx_test_spin_contended(int iter, int hold_ns, char* buffer, int buffer_size);
 #endif
 #ifdef  KERNEL_PRIVATE
 
@@ -1095,6 +1099,15 @@ extern void             lck_mtx_startup_init(
 extern void             lck_rw_startup_init(
 	struct lck_rw_startup_spec *spec);
 
+struct lck_rw_percpu_startup_spec {
+	struct lck_rw_percpu    *lck;
+	lck_grp_t               *lck_grp;
+	lck_attr_t              *lck_attr;
+};
+
+extern void             lck_rw_percpu_startup_init(
+	struct lck_rw_percpu_startup_spec *spec);
+
 /*
  * Auto-initializing locks declarations
  * ------------------------------------
@@ -1107,7 +1120,8 @@ extern void             lck_rw_startup_init(
  * - LCK_MTX_EARLY_DECLARE for mutexes initialized before memory
  *   allocations are possible,
  * - LCK_MTX_DECLARE for mutexes,
- * - LCK_RW_DECLARE for reader writer locks.
+ * - LCK_RW_DECLARE for reader writer locks,
+ * - LCK_RW_PERCPU_DECLARE for read-mostly reader writer locks.
  *
  * For cases when some particular attributes need to be used,
  * these come in *_ATTR variants that take a variable declared with
@@ -1161,6 +1175,89 @@ extern void             lck_rw_startup_init(
 #define LCK_RW_DECLARE(var, grp) \
 	LCK_RW_DECLARE_ATTR(var, grp, LCK_ATTR_NULL)
 
+/*
+ * Per-cpu reader writer locks
+ * ---------------------------
+ *
+ * lck_rw_percpu_t is a reader biased variant of lck_rw_t for locks that
+ * are taken shared on hot paths and exclusive rarely.
+ *
+ * Readers only touch a counter private to their CPU, so they do not
+ * bounce a shared cache line between cores.  A writer first takes the
+ * embedded lck_rw_t exclusive, which turns new readers away onto it,
+ * then waits for the per-cpu counts to drain to zero.  This makes
+ * exclusive acquisitions much more expensive than for lck_rw_t: only
+ * opt in for locks where writers are rare.
+ *
+ * The per-cpu counts are allocated when the lock is initialized, so
+ * unlike lck_rw_t these locks can't be used before zalloc is up.
+ * Shared to exclusive upgrades, downgrades and lck_rw_sleep() have no
+ * equivalent.
+ */
+typedef struct lck_rw_percpu {
+	lck_rw_t                lrp_rw;         /* serializes writers, parks readers */
+	uint64_t                *lrp_readers;   /* per-cpu reader counts */
+	thread_t                lrp_owner;      /* exclusive holder */
+	uint32_t                lrp_draining;   /* a writer is waiting for readers */
+} lck_rw_percpu_t;
+
+extern void             lck_rw_percpu_init(
+	lck_rw_percpu_t         *lck,
+	lck_grp_t               *grp,
+	lck_attr_t              *attr);
+
+extern void             lck_rw_percpu_destroy(
+	lck_rw_percpu_t         *lck,
+	lck_grp_t               *grp);
+
+extern void             lck_rw_percpu_lock(
+	lck_rw_percpu_t         *lck,
+	lck_rw_type_t           lck_rw_type);
+
+extern void             lck_rw_percpu_unlock(
+	lck_rw_percpu_t         *lck,
+	lck_rw_type_t           lck_rw_type);
+
+extern void             lck_rw_percpu_lock_shared(
+	lck_rw_percpu_t         *lck);
+
+extern void             lck_rw_percpu_unlock_shared(
+	lck_rw_percpu_t         *lck);
+
+extern void             lck_rw_percpu_lock_exclusive(
+	lck_rw_percpu_t         *lck);
+
+extern void             lck_rw_percpu_unlock_exclusive(
+	lck_rw_percpu_t         *lck);
+
+extern boolean_t        lck_rw_percpu_try_lock_shared(
+	lck_rw_percpu_t         *lck);
+
+extern boolean_t        lck_rw_percpu_try_lock_exclusive(
+	lck_rw_percpu_t         *lck);
+
+extern lck_rw_type_t    lck_rw_percpu_done(
+	lck_rw_percpu_t         *lck);
+
+/*
+ * CAUTION
+ * like lck_rw_assert(), LCK_RW_ASSERT_SHARED only asserts that
+ * some reader holds the lock, not necessarily the caller.
+ */
+extern void             lck_rw_percpu_assert(
+	lck_rw_percpu_t         *lck,
+	unsigned int            type);
+
+#define LCK_RW_PERCPU_DECLARE_ATTR(var, grp, attr) \
+	lck_rw_percpu_t var; \
+	static __startup_data struct lck_rw_percpu_startup_spec \
+	__startup_lck_rw_percpu_spec_ ## var = { &var, grp, attr }; \
+	STARTUP_ARG(LOCKS, STARTUP_RANK_FIRST, lck_rw_percpu_startup_init, \
+	    &__startup_lck_rw_percpu_spec_ ## var)
+
+#define LCK_RW_PERCPU_DECLARE(var, grp) \
+	LCK_RW_PERCPU_DECLARE_ATTR(var, grp, LCK_ATTR_NULL)
+
 #endif /* XNU_KERNEL_PRIVATE */
 
 __END_DECLS
@@ -231,6 +231,30 @@ extern char *proc_name_address(struct proc *p);
 uint64_t        sched_one_second_interval;
 boolean_t       allow_direct_handoff = TRUE;
 
+/*
+ * Wake-affine placement
+ *
+ * Producer/consumer pairs handing work to each other through waitqs (Mach
+ * messages, ulocks, semaphores, turnstiles) benefit from running on
+ * processors that share a cache with each other. A wakee is considered
+ * paired with its waker once it has been woken sched_wake_affine_pair_threshold
+ * times in a row by the same thread, or immediately for WQ_OPTION_HANDOFF
+ * wakeups. Paired wakees are placed in the waker's cluster.
+ *
+ * A waker that keeps blocking within sched_wake_affine_sync_window of waking
+ * its partner is expected to do so again; in that case the wakee is enqueued
+ * on the waker's processor without a preemption, so that it runs there as
+ * soon as the waker blocks instead of migrating to another core.
+ */
+boolean_t       sched_wake_affine_enabled = TRUE;
+uint32_t        sched_wake_affine_pair_threshold = 2;
+uint32_t        sched_wake_affine_sync_window_us = 50;
+static uint64_t sched_wake_affine_sync_window;
+#define SCHED_WAKE_AFFINE_SYNC_THRESHOLD        2
+
+uint64_t        sched_wake_affine_sync_placements;
+uint64_t        sched_wake_affine_cluster_placements;
+
 /* Forwards */
 
 #if defined(CONFIG_SCHED_TIMESHARE_CORE)
@@ -341,6 +365,9 @@ sched_init(void)
 	if (PE_parse_boot_argn("direct_handoff", &direct_handoff, sizeof(direct_handoff))) {
 		allow_direct_handoff = direct_handoff;
 	}
+
+	PE_parse_boot_argn("sched_wake_affine", &sched_wake_affine_enabled,
+	    sizeof(sched_wake_affine_enabled));
 }
 
 void
@@ -353,6 +380,9 @@ sched_timebase_init(void)
 
 	SCHED(timebase_init)();
 	sched_realtime_timebase_init();
+
+	clock_interval_to_absolutetime_interval(sched_wake_affine_sync_window_us,
+	    NSEC_PER_USEC, &sched_wake_affine_sync_window);
 }
 
 #if defined(CONFIG_SCHED_TIMESHARE_CORE)
@@ -787,6 +817,80 @@ thread_allowed_for_handoff(
 	return FALSE;
 }
 
+/*
+ *	Routine:	sched_wake_affine_options
+ *	Purpose:
+ *		Track producer/consumer pairs on wakeup and return the
+ *		wake-affine placement options for the wakee.
+ *	Conditions:
+ *		thread lock held, called from the waker's context.
+ */
+static sched_options_t
+sched_wake_affine_options(
+	thread_t         self,
+	thread_t         thread,
+	waitq_options_t  option)
+{
+	sched_options_t options = SCHED_WAKE_AFFINE;
+	uint64_t waker = thread_tid(self);
+
+	if (!sched_wake_affine_enabled || ml_at_interrupt_context() ||
+	    (self->state & TH_IDLE) ||
+	    thread->bound_processor != PROCESSOR_NULL ||
+	    thread->sched_pri >= BASEPRI_RTQUEUES) {
+		thread->wake_affine_pair_count = 0;
+		return SCHED_NONE;
+	}
+
+	if (thread->wake_affine_waker == waker) {
+		if (thread->wake_affine_pair_count < UINT8_MAX) {
+			thread->wake_affine_pair_count++;
+		}
+	} else {
+		thread->wake_affine_waker = waker;
+		thread->wake_affine_pair_count = 1;
+	}
+
+	if ((option & WQ_OPTION_HANDOFF) == 0 &&
+	    thread->wake_affine_pair_count < sched_wake_affine_pair_threshold) {
+		return SCHED_NONE;
+	}
+
+	/* Only ever written by the waker itself, no lock needed */
+	self->wake_affine_wakeup_time = mach_absolute_time();
+	if ((option & WQ_OPTION_HANDOFF) ||
+	    self->wake_affine_sync_count >= SCHED_WAKE_AFFINE_SYNC_THRESHOLD) {
+		options |= SCHED_WAKE_SYNC;
+	}
+	return options;
+}
+
+/*
+ *	Routine:	sched_wake_affine_block
+ *	Purpose:
+ *		Learn whether the current thread tends to block right after
+ *		waking up a paired thread.
+ *	Conditions:
+ *		called at splsched() by the blocking thread.
+ */
+static void
+sched_wake_affine_block(
+	thread_t         self)
+{
+	if (self->wake_affine_wakeup_time == 0) {
+		return;
+	}
+
+	if (mach_absolute_time() - self->wake_affine_wakeup_time <= sched_wake_affine_sync_window) {
+		if (self->wake_affine_sync_count < UINT8_MAX) {
+			self->wake_affine_sync_count++;
+		}
+	} else {
+		self->wake_affine_sync_count = 0;
+	}
+	self->wake_affine_wakeup_time = 0;
+}
+
 /*
  *	Routine:	thread_go
  *	Purpose:
@@ -829,7 +933,8 @@ thread_go(
 			assert(self->handoff_thread == NULL);
 			self->handoff_thread = thread;
 		} else {
-			thread_setrun(thread, SCHED_PREEMPT | SCHED_TAILQ);
+			thread_setrun(thread, SCHED_PREEMPT | SCHED_TAILQ |
+			    sched_wake_affine_options(self, thread, option));
 		}
 	}
 
@@ -3147,6 +3252,10 @@ thread_block_reason(
 		    reason, VM_KERNEL_UNSLIDE(continuation), 0, 0, 0);
 	}
 
+	if (self->state & TH_WAIT) {
+		sched_wake_affine_block(self);
+	}
+
 	do {
 		thread_lock(self);
 		new_thread = thread_select(self, processor, &reason);
@@ -4574,6 +4683,69 @@ out:
 	return pset;
 }
 
+/*
+ *	sched_wake_affine_choose_processor:
+ *
+ *	Choose a processor for a wakee paired with the
+ *	current thread. For SCHED_WAKE_SYNC wakeups this is
+ *	the waker's processor if nothing else is queued
+ *	there and no processor of the cluster is idle,
+ *	otherwise the best processor in the waker's cluster.
+ *
+ *	Returns PROCESSOR_NULL if the waker's cluster is not
+ *	suitable. Otherwise the pset of the returned processor
+ *	is locked, and SCHED_PREEMPT may have been cleared
+ *	from the options if the wakee does not have a higher
+ *	priority than the waker.
+ *
+ *	The thread must be locked.
+ */
+static processor_t
+sched_wake_affine_choose_processor(
+	pset_node_t             node,
+	thread_t                thread,
+	sched_options_t         *options)
+{
+	processor_t processor = current_processor();
+	processor_set_t pset = processor->processor_set;
+
+	if (thread->affinity_set != AFFINITY_SET_NULL ||
+	    !bit_test(node->pset_map, pset->pset_id) ||
+	    !pset_is_recommended(pset)) {
+		return PROCESSOR_NULL;
+	}
+
+	pset_lock(pset);
+
+	/*
+	 * An idle processor in the cluster runs the wakee right away,
+	 * which beats waiting for the waker to block.
+	 */
+	if ((*options & SCHED_WAKE_SYNC) &&
+	    processor->state == PROCESSOR_RUNNING &&
+	    processor->is_recommended &&
+	    !thread_no_smt(thread) &&
+	    (pset->recommended_bitmask & pset->cpu_state_map[PROCESSOR_IDLE]) == 0 &&
+	    rt_runq_count(pset) == 0 &&
+	    SCHED(processor_runq_count)(processor) == 0) {
+		/*
+		 * The waker blocks shortly, let the wakee take its place.
+		 * A wakee of higher priority than the waker still preempts.
+		 */
+		if (thread->sched_pri <= processor->current_pri) {
+			*options &= ~SCHED_PREEMPT;
+		}
+		os_atomic_inc(&sched_wake_affine_sync_placements, relaxed);
+		return processor;
+	}
+
+	processor = SCHED(choose_processor)(pset, processor, thread);
+	if (processor->processor_set == pset) {
+		os_atomic_inc(&sched_wake_affine_cluster_placements, relaxed);
+	}
+	return processor;
+}
+
 /*
  *	thread_setrun:
  *
@@ -4609,13 +4781,20 @@ thread_setrun(
 		/*
 		 *	Unbound case.
 		 */
-		processor_t processor_hint = PROCESSOR_NULL;
 		pset_node_t node = SCHED(choose_node)(thread);
-		processor_set_t starting_pset = choose_starting_pset(node, thread, &processor_hint);
 
-		pset_lock(starting_pset);
+		processor = PROCESSOR_NULL;
+		if (options & SCHED_WAKE_AFFINE) {
+			processor = sched_wake_affine_choose_processor(node, thread, &options);
+		}
+		if (processor == PROCESSOR_NULL) {
+			processor_t processor_hint = PROCESSOR_NULL;
+			processor_set_t starting_pset = choose_starting_pset(node, thread, &processor_hint);
 
-		processor = SCHED(choose_processor)(starting_pset, processor_hint, thread);
+			pset_lock(starting_pset);
+
+			processor = SCHED(choose_processor)(starting_pset, processor_hint, thread);
+		}
 		pset = processor->processor_set;
 		task_t task = thread->task;
 		task->pset_hint = pset; /* NRG this is done without holding the task lock */
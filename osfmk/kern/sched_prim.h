@@ -246,6 +246,8 @@ __options_decl(sched_options_t, uint32_t, {
 	SCHED_HEADQ     = 0x2,
 	SCHED_PREEMPT   = 0x4,
 	SCHED_REBALANCE = 0x8,
+	SCHED_WAKE_AFFINE = 0x10,       /* wakee shares data with its waker, keep it in the waker's cluster */
+	SCHED_WAKE_SYNC = 0x20,         /* waker is about to block, the wakee may run on its processor */
 });
 
 /* Reschedule thread for execution */
@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <machine/machine_cpu.h>
+#include <kern/clock.h>
+#include <kern/cpu_data.h>
+#include <kern/locks.h>
+#include <kern/processor.h>
+#include <kern/sched_prim.h>
+#include <kern/smr.h>
+#include <kern/thread_call.h>
+#include <kern/zalloc.h>
+
+/*
+ * Retired elements are batched per CPU in buckets.  A full bucket is
+ * stamped with the goal sequence of the domain and queued for the
+ * reclaim thread call, which frees the buckets whose grace period has
+ * elapsed in FIFO order, and rearms itself while some are still
+ * waiting.
+ *
+ * Buckets of all domains share the reclaim queue: read sections are
+ * short, so a bucket waiting on one domain only delays the others by
+ * about one grace period.
+ *
+ * A CPU that stops retiring elements would keep its partially filled
+ * buckets forever, so the flush thread call periodically binds itself
+ * to every CPU in turn and retires them, for as long as new buckets
+ * get started.
+ */
+#define SMR_BUCKET_SIZE         32
+#define SMR_RECLAIM_DELAY_US    1000
+#define SMR_FLUSH_DELAY_MS      1000
+
+struct smr_bucket {
+	struct smr_bucket      *smrb_next;
+	smr_t                   smrb_smr;
+	smr_seq_t               smrb_seq;
+	uint32_t                smrb_count;
+	struct {
+		zone_t          zone;
+		void           *elem;
+	} smrb_entries[SMR_BUCKET_SIZE];
+};
+
+static SECURITY_READ_ONLY_LATE(zone_t) smr_pcpu_zone;
+ZONE_INIT(&smr_pcpu_zone, "smr_pcpu", sizeof(struct smr_pcpu),
+    ZC_PERCPU | ZC_ALIGNMENT_REQUIRED, ZONE_ID_ANY, NULL);
+
+static ZONE_DECLARE(smr_bucket_zone, "smr_buckets",
+    sizeof(struct smr_bucket), ZC_NONE);
+
+static LCK_GRP_DECLARE(smr_lck_grp, "smr");
+static LCK_SPIN_DECLARE(smr_reclaim_lock, &smr_lck_grp);
+static LCK_MTX_EARLY_DECLARE(smr_domains_lock, &smr_lck_grp);
+
+static struct smr_bucket *smr_reclaim_head;
+static struct smr_bucket **smr_reclaim_tailp = &smr_reclaim_head;
+static struct thread_call smr_reclaim_call;
+static bool smr_reclaim_ready;
+
+static smr_t smr_domains;
+static struct thread_call smr_flush_call;
+static bool smr_flush_armed;
+
+#pragma mark sequences
+
+smr_seq_t
+smr_advance(smr_t smr)
+{
+	/* orders the unlinking of retired elements before the new clock */
+	return os_atomic_add(&smr->smr_clock, SMR_SEQ_INC, release);
+}
+
+bool
+smr_poll(smr_t smr, smr_seq_t goal)
+{
+	smr_seq_t clock, rd_seq, min_seq;
+
+	rd_seq = os_atomic_load(&smr->smr_rd_seq, relaxed);
+	if (SMR_SEQ_LEQ(goal, rd_seq)) {
+		return true;
+	}
+
+	clock = os_atomic_load(&smr->smr_clock, relaxed);
+	assert(SMR_SEQ_LEQ(goal, clock));
+
+	/*
+	 * A reader that published its sequence after this fence
+	 * will observe the unlinking done before smr_advance().
+	 */
+	os_atomic_thread_fence(seq_cst);
+
+	min_seq = clock;
+	zpercpu_foreach(pcpu, smr->smr_pcpu) {
+		smr_seq_t seq = os_atomic_load(&pcpu->c_rd_seq, relaxed);
+
+		if (seq != SMR_SEQ_INVALID && SMR_SEQ_LT(seq, min_seq)) {
+			min_seq = seq;
+		}
+	}
+
+	/* the cached lower bound only moves forward */
+	os_atomic_rmw_loop(&smr->smr_rd_seq, rd_seq, min_seq, relaxed, {
+		if (SMR_SEQ_GEQ(rd_seq, min_seq)) {
+		        os_atomic_rmw_loop_give_up(break);
+		}
+	});
+
+	/* pairs with the release in smr_leave() */
+	os_atomic_thread_fence(acquire);
+
+	return SMR_SEQ_LEQ(goal, min_seq);
+}
+
+void
+smr_wait(smr_t smr, smr_seq_t goal)
+{
+	assert(!smr_entered(smr));
+
+	while (!smr_poll(smr, goal)) {
+		cpu_pause();
+	}
+}
+
+void
+smr_synchronize(smr_t smr)
+{
+	smr_wait(smr, smr_advance(smr));
+}
+
+bool
+smr_entered(smr_t smr)
+{
+	bool entered;
+
+	disable_preemption();
+	entered = zpercpu_get(smr->smr_pcpu)->c_rd_seq != SMR_SEQ_INVALID;
+	enable_preemption();
+
+	return entered;
+}
+
+#pragma mark deferred reclamation
+
+static void
+smr_bucket_free(struct smr_bucket *bucket)
+{
+	for (uint32_t i = 0; i < bucket->smrb_count; i++) {
+		zfree(bucket->smrb_entries[i].zone, bucket->smrb_entries[i].elem);
+	}
+	os_atomic_add(&bucket->smrb_smr->smr_reclaimed, bucket->smrb_count, relaxed);
+	zfree(smr_bucket_zone, bucket);
+}
+
+static void
+smr_reclaim_arm(bool delayed)
+{
+	uint64_t deadline;
+
+	if (!os_atomic_load(&smr_reclaim_ready, acquire)) {
+		/* smr_reclaim_startup() will pick the queue up */
+		return;
+	}
+
+	if (delayed) {
+		clock_interval_to_deadline(SMR_RECLAIM_DELAY_US, NSEC_PER_USEC, &deadline);
+		thread_call_enter_delayed_with_leeway(&smr_reclaim_call, NULL,
+		    deadline, 0, THREAD_CALL_DELAY_SYS_BACKGROUND);
+	} else {
+		thread_call_enter(&smr_reclaim_call);
+	}
+}
+
+static void
+smr_reclaim(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	struct smr_bucket *bucket;
+
+	for (;;) {
+		lck_spin_lock(&smr_reclaim_lock);
+		bucket = smr_reclaim_head;
+		if (bucket == NULL) {
+			lck_spin_unlock(&smr_reclaim_lock);
+			return;
+		}
+		if (!smr_poll(bucket->smrb_smr, bucket->smrb_seq)) {
+			lck_spin_unlock(&smr_reclaim_lock);
+			smr_reclaim_arm(true);
+			return;
+		}
+		smr_reclaim_head = bucket->smrb_next;
+		if (smr_reclaim_head == NULL) {
+			smr_reclaim_tailp = &smr_reclaim_head;
+		}
+		lck_spin_unlock(&smr_reclaim_lock);
+
+		smr_bucket_free(bucket);
+	}
+}
+
+static void
+smr_flush_arm(void)
+{
+	uint64_t deadline;
+
+	if (os_atomic_load(&smr_flush_armed, relaxed) ||
+	    os_atomic_xchg(&smr_flush_armed, true, relaxed)) {
+		return;
+	}
+
+	if (!os_atomic_load(&smr_reclaim_ready, acquire)) {
+		/* smr_reclaim_startup() will arm the flush */
+		return;
+	}
+
+	clock_interval_to_deadline(SMR_FLUSH_DELAY_MS, NSEC_PER_MSEC, &deadline);
+	thread_call_enter_delayed_with_leeway(&smr_flush_call, NULL,
+	    deadline, 0, THREAD_CALL_DELAY_SYS_BACKGROUND);
+}
+
+static void
+smr_bucket_retire(struct smr_bucket *bucket)
+{
+	bool was_empty;
+
+	bucket->smrb_seq = smr_advance(bucket->smrb_smr);
+	bucket->smrb_next = NULL;
+
+	lck_spin_lock(&smr_reclaim_lock);
+	was_empty = (smr_reclaim_head == NULL);
+	*smr_reclaim_tailp = bucket;
+	smr_reclaim_tailp = &bucket->smrb_next;
+	lck_spin_unlock(&smr_reclaim_lock);
+
+	if (was_empty) {
+		smr_reclaim_arm(false);
+	}
+}
+
+void
+smr_zfree(smr_t smr, zone_t zone, void *elem)
+{
+	struct smr_bucket *bucket;
+	struct smr_pcpu *pcpu;
+
+	os_atomic_inc(&smr->smr_deferred, relaxed);
+
+	disable_preemption();
+	pcpu = zpercpu_get(smr->smr_pcpu);
+	/*
+	 * The fallback below waits for the readers, which would never
+	 * finish if this thread is one of them: catch the misuse
+	 * even when the bucket allocation succeeds.
+	 */
+	assert(pcpu->c_rd_seq == SMR_SEQ_INVALID);
+	bucket = pcpu->c_bucket;
+	if (bucket == NULL) {
+		bucket = zalloc_flags(smr_bucket_zone, Z_NOWAIT);
+		if (__improbable(bucket == NULL)) {
+			enable_preemption();
+			smr_synchronize(smr);
+			zfree(zone, elem);
+			os_atomic_inc(&smr->smr_reclaimed, relaxed);
+			return;
+		}
+		bucket->smrb_smr = smr;
+		bucket->smrb_count = 0;
+		pcpu->c_bucket = bucket;
+		smr_flush_arm();
+	}
+
+	bucket->smrb_entries[bucket->smrb_count].zone = zone;
+	bucket->smrb_entries[bucket->smrb_count].elem = elem;
+	if (++bucket->smrb_count < SMR_BUCKET_SIZE) {
+		bucket = NULL;
+	} else {
+		pcpu->c_bucket = NULL;
+	}
+	enable_preemption();
+
+	if (bucket) {
+		smr_bucket_retire(bucket);
+	}
+}
+
+#pragma mark domains
+
+void
+smr_init(smr_t smr, const char *name)
+{
+	smr->smr_clock = SMR_SEQ_INIT;
+	smr->smr_rd_seq = SMR_SEQ_INIT;
+	smr->smr_pcpu = zalloc_percpu(smr_pcpu_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	smr->smr_name = name;
+	smr->smr_deferred = 0;
+	smr->smr_reclaimed = 0;
+
+	lck_mtx_lock(&smr_domains_lock);
+	smr->smr_next = smr_domains;
+	smr_domains = smr;
+	lck_mtx_unlock(&smr_domains_lock);
+}
+
+__startup_func
+void
+smr_startup_init(smr_t smr)
+{
+	smr_init(smr, smr->smr_name);
+}
+
+void
+smr_destroy(smr_t smr)
+{
+	struct smr_bucket *bucket, *mine = NULL, **prevp;
+	smr_t *smrp;
+
+	/* once unlinked, smr_flush() can't steal the per-CPU buckets */
+	lck_mtx_lock(&smr_domains_lock);
+	for (smrp = &smr_domains; *smrp != smr; smrp = &(*smrp)->smr_next) {
+		assert(*smrp != NULL);
+	}
+	*smrp = smr->smr_next;
+	smr->smr_next = NULL;
+	lck_mtx_unlock(&smr_domains_lock);
+
+	/* flush the partially filled buckets */
+	zpercpu_foreach(pcpu, smr->smr_pcpu) {
+		assert(pcpu->c_rd_seq == SMR_SEQ_INVALID);
+		bucket = pcpu->c_bucket;
+		if (bucket) {
+			pcpu->c_bucket = NULL;
+			bucket->smrb_next = mine;
+			mine = bucket;
+		}
+	}
+
+	/* take this domain's buckets off the reclaim queue */
+	lck_spin_lock(&smr_reclaim_lock);
+	prevp = &smr_reclaim_head;
+	while ((bucket = *prevp) != NULL) {
+		if (bucket->smrb_smr == smr) {
+			*prevp = bucket->smrb_next;
+			bucket->smrb_next = mine;
+			mine = bucket;
+		} else {
+			prevp = &bucket->smrb_next;
+		}
+	}
+	smr_reclaim_tailp = prevp;
+	lck_spin_unlock(&smr_reclaim_lock);
+
+	smr_synchronize(smr);
+
+	while ((bucket = mine) != NULL) {
+		mine = bucket->smrb_next;
+		smr_bucket_free(bucket);
+	}
+
+	/* the reclaim thread call might still be freeing a bucket it dequeued */
+	while (os_atomic_load(&smr->smr_reclaimed, relaxed) != smr->smr_deferred) {
+		delay(1);
+	}
+	zfree_percpu(smr_pcpu_zone, smr->smr_pcpu);
+	smr->smr_pcpu = NULL;
+}
+
+/*
+ * Per-CPU buckets are only touched by their CPU with preemption
+ * disabled, so they are stolen from a thread bound to that CPU.
+ * CPUs that are offline can't be running smr_zfree() but could
+ * come back at any time, and keep their buckets until they do.
+ */
+static void
+smr_flush(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	struct smr_bucket *bucket, *mine = NULL;
+	struct smr_pcpu *pcpu;
+	processor_t processor;
+	smr_t smr;
+
+	os_atomic_store(&smr_flush_armed, false, relaxed);
+
+	lck_mtx_lock(&smr_domains_lock);
+
+	for (processor = processor_list; processor != PROCESSOR_NULL;
+	    processor = processor->processor_list) {
+		if (processor->state == PROCESSOR_OFF_LINE ||
+		    processor->state == PROCESSOR_SHUTDOWN) {
+			continue;
+		}
+
+		thread_bind(processor);
+		thread_block(THREAD_CONTINUE_NULL);
+
+		disable_preemption();
+		for (smr = smr_domains; smr != NULL; smr = smr->smr_next) {
+			pcpu = zpercpu_get(smr->smr_pcpu);
+			bucket = pcpu->c_bucket;
+			if (bucket) {
+				pcpu->c_bucket = NULL;
+				bucket->smrb_next = mine;
+				mine = bucket;
+			}
+		}
+		enable_preemption();
+	}
+
+	thread_bind(PROCESSOR_NULL);
+	thread_block(THREAD_CONTINUE_NULL);
+
+	/* retire before smr_destroy() can look for this domain's buckets */
+	while ((bucket = mine) != NULL) {
+		mine = bucket->smrb_next;
+		smr_bucket_retire(bucket);
+	}
+
+	lck_mtx_unlock(&smr_domains_lock);
+}
+
+__startup_func
+static void
+smr_reclaim_startup(void)
+{
+	bool pending;
+
+	thread_call_setup_with_options(&smr_reclaim_call, smr_reclaim, NULL,
+	    THREAD_CALL_PRIORITY_KERNEL, THREAD_CALL_OPTIONS_ONCE);
+	thread_call_setup_with_options(&smr_flush_call, smr_flush, NULL,
+	    THREAD_CALL_PRIORITY_LOW, THREAD_CALL_OPTIONS_ONCE);
+	os_atomic_store(&smr_reclaim_ready, true, release);
+
+	/* buckets started during early boot */
+	if (os_atomic_xchg(&smr_flush_armed, false, relaxed)) {
+		smr_flush_arm();
+	}
+
+	/* buckets retired during early boot */
+	lck_spin_lock(&smr_reclaim_lock);
+	pending = (smr_reclaim_head != NULL);
+	lck_spin_unlock(&smr_reclaim_lock);
+	if (pending) {
+		smr_reclaim_arm(false);
+	}
+}
+STARTUP(EARLY_BOOT, STARTUP_RANK_MIDDLE, smr_reclaim_startup);
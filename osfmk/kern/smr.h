@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _KERN_SMR_H_
+#define _KERN_SMR_H_
+
+#include <sys/cdefs.h>
+
+#ifdef XNU_KERNEL_PRIVATE
+
+#include <machine/atomic.h>
+#include <kern/assert.h>
+#include <kern/cpu_data.h>
+#include <kern/startup.h>
+#include <kern/zalloc.h>
+
+__BEGIN_DECLS
+
+/*!
+ * @file <kern/smr.h>
+ *
+ * @brief
+ * Safe memory reclamation: lets readers traverse data structures
+ * without locks, while writers unlink and retire elements concurrently.
+ *
+ * @discussion
+ * An SMR domain has a global write sequence (its clock), and every CPU
+ * publishes the value of the clock it observed when entering a read
+ * section.
+ *
+ * A writer unlinks an element, then advances the clock: the new value
+ * is the goal after which the element may be freed.  Once every CPU is
+ * either outside of a read section, or in one it entered after the
+ * clock reached the goal, no reader can still hold a reference to the
+ * element.
+ *
+ * Read sections disable preemption and must not block.  Entering and
+ * leaving one only touches the current CPU's cache line, so they are
+ * cheap enough for fast paths.
+ *
+ * Usage:
+ * <code>
+ *   SMR_DEFINE(foo_smr, "foo");
+ *
+ *   // reader
+ *   smr_enter(&foo_smr);
+ *   elem = smr_entered_load(&head->first);
+ *   ...
+ *   smr_leave(&foo_smr);
+ *
+ *   // writer, with the structure's lock held
+ *   unlink(elem);
+ *   smr_zfree(&foo_smr, foo_zone, elem);
+ * </code>
+ */
+
+/*!
+ * @typedef smr_seq_t
+ *
+ * @brief
+ * A value of an SMR domain clock.
+ *
+ * @discussion
+ * Valid sequences are odd, so that 0 can denote a CPU
+ * outside of any read section.  They are compared modulo wrap-around.
+ */
+typedef unsigned long           smr_seq_t;
+
+#define SMR_SEQ_INVALID         ((smr_seq_t)0)
+#define SMR_SEQ_INIT            ((smr_seq_t)1)
+#define SMR_SEQ_INC             ((smr_seq_t)2)
+
+#define SMR_SEQ_DELTA(a, b)     ((long)((a) - (b)))
+#define SMR_SEQ_LT(a, b)        (SMR_SEQ_DELTA(a, b) < 0)
+#define SMR_SEQ_LEQ(a, b)       (SMR_SEQ_DELTA(a, b) <= 0)
+#define SMR_SEQ_GT(a, b)        (SMR_SEQ_DELTA(a, b) > 0)
+#define SMR_SEQ_GEQ(a, b)       (SMR_SEQ_DELTA(a, b) >= 0)
+
+struct smr_bucket;
+
+struct smr_pcpu {
+	smr_seq_t               c_rd_seq;       /* clock observed by the reader, or SMR_SEQ_INVALID */
+	struct smr_bucket      *c_bucket;       /* elements waiting for their grace period */
+};
+
+typedef struct smr {
+	smr_seq_t               smr_clock;      /* write sequence */
+	smr_seq_t               smr_rd_seq;     /* cached lower bound of the readers' sequences */
+	struct smr_pcpu __zpercpu *smr_pcpu;
+	const char             *smr_name;
+	struct smr             *smr_next;       /* domains with per-CPU buckets to flush */
+	uint64_t                smr_deferred;   /* elements handed to smr_zfree() */
+	uint64_t                smr_reclaimed;  /* elements freed after their grace period */
+} *smr_t;
+
+/*!
+ * @function smr_enter()
+ *
+ * @brief
+ * Enter a read section of the specified domain.
+ *
+ * @discussion
+ * Read sections disable preemption and can't nest for a given domain.
+ */
+static inline void
+smr_enter(smr_t smr)
+{
+	struct smr_pcpu *pcpu;
+
+	disable_preemption();
+	pcpu = zpercpu_get(smr->smr_pcpu);
+	assert(pcpu->c_rd_seq == SMR_SEQ_INVALID);
+	os_atomic_store(&pcpu->c_rd_seq,
+	    os_atomic_load(&smr->smr_clock, relaxed), relaxed);
+	/*
+	 * Publish the sequence before any load done in the read section,
+	 * pairs with the fence in smr_poll().
+	 */
+	os_atomic_thread_fence(seq_cst);
+}
+
+/*!
+ * @function smr_leave()
+ *
+ * @brief
+ * Leave a read section of the specified domain.
+ */
+static inline void
+smr_leave(smr_t smr)
+{
+	struct smr_pcpu *pcpu = zpercpu_get(smr->smr_pcpu);
+
+	assert(pcpu->c_rd_seq != SMR_SEQ_INVALID);
+	os_atomic_store(&pcpu->c_rd_seq, SMR_SEQ_INVALID, release);
+	enable_preemption();
+}
+
+/*!
+ * @function smr_entered()
+ *
+ * @brief
+ * Returns whether the current CPU is in a read section of the domain.
+ */
+extern bool smr_entered(smr_t smr);
+
+/*!
+ * @macro smr_entered_load()
+ *
+ * @brief
+ * Loads an SMR protected pointer from within a read section.
+ */
+#define smr_entered_load(ptr) \
+	os_atomic_load(ptr, dependency)
+
+/*!
+ * @macro smr_serialized_store()
+ *
+ * @brief
+ * Publishes an SMR protected pointer, with the writer side lock held.
+ */
+#define smr_serialized_store(ptr, value) \
+	os_atomic_store(ptr, value, release)
+
+/*!
+ * @function smr_advance()
+ *
+ * @brief
+ * Advance the domain clock, and return the goal sequence
+ * for elements unlinked before the call.
+ */
+extern smr_seq_t smr_advance(smr_t smr);
+
+/*!
+ * @function smr_poll()
+ *
+ * @brief
+ * Returns whether all readers that could observe elements
+ * retired with the specified goal are gone.
+ */
+extern bool smr_poll(smr_t smr, smr_seq_t goal);
+
+/*!
+ * @function smr_wait()
+ *
+ * @brief
+ * Spin until @c smr_poll() passes for the specified goal.
+ *
+ * @discussion
+ * Must not be called from within a read section of the same domain.
+ */
+extern void smr_wait(smr_t smr, smr_seq_t goal);
+
+/*!
+ * @function smr_synchronize()
+ *
+ * @brief
+ * Wait for all readers of the domain that entered before the call.
+ */
+extern void smr_synchronize(smr_t smr);
+
+/*!
+ * @function smr_zfree()
+ *
+ * @brief
+ * Free an element to its zone once the current readers are gone.
+ *
+ * @discussion
+ * The element must have been unlinked from anything readers can reach.
+ *
+ * Elements are batched per CPU, so an element is only considered for
+ * reclamation once its CPU has retired enough of them to fill a batch,
+ * or when batches left partially filled are flushed about every second.
+ * This can be called with preemption disabled, but not from within
+ * a read section of the same domain: if no batch can be allocated,
+ * it waits for the current readers before freeing the element.
+ */
+extern void smr_zfree(smr_t smr, zone_t zone, void *elem);
+
+/*!
+ * @function smr_init()
+ *
+ * @brief
+ * Initialize a dynamically allocated domain.
+ */
+extern void smr_init(smr_t smr, const char *name);
+
+/*!
+ * @function smr_destroy()
+ *
+ * @brief
+ * Reclaim everything retired to a domain, and tear it down.
+ *
+ * @discussion
+ * There must be no concurrent readers or calls to @c smr_zfree().
+ */
+extern void smr_destroy(smr_t smr);
+
+extern void smr_startup_init(smr_t smr);
+
+/*!
+ * @macro SMR_DEFINE()
+ *
+ * @brief
+ * Define a statically allocated SMR domain.
+ * The domain can be used once the LOCKS phase of startup is complete.
+ */
+#define SMR_DEFINE(var, name) \
+	struct smr var = { .smr_name = name }; \
+	STARTUP_ARG(LOCKS, STARTUP_RANK_FIRST, smr_startup_init, &var)
+
+#pragma mark tests
+#if DEBUG || DEVELOPMENT
+
+extern int smr_test_stress(uint64_t count, uint64_t *out);
+
+#endif /* DEBUG || DEVELOPMENT */
+
+__END_DECLS
+
+#endif /* XNU_KERNEL_PRIVATE */
+
+#endif /* _KERN_SMR_H_ */
@@ -132,7 +132,7 @@ const mach_trap_t       mach_trap_table[MACH_TRAP_TABLE_COUNT] = {
 /* 27 */ MACH_TRAP(thread_self_trap, 0, 0, NULL),
 /* 28 */ MACH_TRAP(task_self_trap, 0, 0, NULL),
 /* 29 */ MACH_TRAP(host_self_trap, 0, 0, NULL),
-/* 30 */ MACH_TRAP(kern_invalid, 0, 0, NULL),
+/* 30 */ MACH_TRAP(mach_msg_vector_trap, 2, 2, munge_ww),
 /* 31 */ MACH_TRAP(mach_msg_trap, 7, 7, munge_wwwwwww),
 /* 32 */ MACH_TRAP(mach_msg_overwrite_trap, 8, 8, munge_wwwwwwww),
 /* 33 */ MACH_TRAP(semaphore_signal_trap, 1, 1, munge_w),
@@ -264,7 +264,7 @@ const char * const mach_syscall_name_table[MACH_TRAP_TABLE_COUNT] = {
 /* 27 */ "thread_self_trap",
 /* 28 */ "task_self_trap",
 /* 29 */ "host_self_trap",
-/* 30 */ "kern_invalid",
+/* 30 */ "mach_msg_vector_trap",
 /* 31 */ "mach_msg_trap",
 /* 32 */ "mach_msg_overwrite_trap",
 /* 33 */ "semaphore_signal_trap",
@@ -1022,3 +1022,273 @@ lck_mtx_test_mtx_contended_loop_time(
 
 	return ret;
 }
+
+/*
+ * Reader writer lock scalability test.
+ *
+ * One thread per available CPU takes the same lock shared in a tight
+ * loop, optionally taking it exclusive once every write_every
+ * iterations, either as a lck_rw_t or as a lck_rw_percpu_t.
+ */
+#define TEST_RW_MAX_THREADS     64
+
+static lck_grp_t        test_rw_grp;
+static lck_rw_t         test_rw;
+static lck_rw_percpu_t  test_rw_percpu;
+
+static int rw_test_synch;
+static int rw_test_done;
+static int rw_test_threads;
+static int rw_test_iterations;
+static int rw_test_percpu;
+static int rw_test_write_every;
+static uint64_t rw_test_time;
+
+void
+lck_rw_test_init(void)
+{
+	static int first = 0;
+
+	if (os_atomic_load(&first, acquire) >= 2) {
+		return;
+	}
+
+	if (os_atomic_cmpxchg(&first, 0, 1, relaxed)) {
+		lck_grp_init(&test_rw_grp, "testlck_rw", LCK_GRP_ATTR_NULL);
+		lck_rw_init(&test_rw, &test_rw_grp, LCK_ATTR_NULL);
+		lck_rw_percpu_init(&test_rw_percpu, &test_rw_grp, LCK_ATTR_NULL);
+
+		os_atomic_inc(&first, release);
+	}
+
+	while (os_atomic_load(&first, acquire) < 2) {
+		;
+	}
+}
+
+static void
+test_rw_lock_unlock_contended_thread(
+	__unused void *arg,
+	__unused wait_result_t wr)
+{
+	int i;
+	uint64_t start;
+
+	os_atomic_inc(&rw_test_synch, relaxed);
+	while (os_atomic_load(&rw_test_synch, relaxed) < rw_test_threads) {
+		;
+	}
+
+	start = mach_absolute_time();
+
+	for (i = 0; i < rw_test_iterations; i++) {
+		boolean_t write = rw_test_write_every &&
+		    (i % rw_test_write_every) == rw_test_write_every - 1;
+
+		if (rw_test_percpu) {
+			if (write) {
+				lck_rw_percpu_lock_exclusive(&test_rw_percpu);
+				lck_rw_percpu_unlock_exclusive(&test_rw_percpu);
+			} else {
+				lck_rw_percpu_lock_shared(&test_rw_percpu);
+				lck_rw_percpu_unlock_shared(&test_rw_percpu);
+			}
+		} else {
+			if (write) {
+				lck_rw_lock_exclusive(&test_rw);
+				lck_rw_unlock_exclusive(&test_rw);
+			} else {
+				lck_rw_lock_shared(&test_rw);
+				lck_rw_unlock_shared(&test_rw);
+			}
+		}
+	}
+
+	os_atomic_add(&rw_test_time, mach_absolute_time() - start, relaxed);
+
+	os_atomic_inc(&rw_test_done, release);
+	thread_wakeup((event_t) &rw_test_done);
+	thread_terminate_self();
+}
+
+int
+lck_rw_test_contended(
+	int iter,
+	int percpu,
+	int write_every,
+	char *buffer,
+	int buffer_size)
+{
+	thread_t thread;
+	kern_return_t result;
+	int i, started;
+	uint64_t time, avg;
+
+	if (write_every < 0) {
+		printf("%s invalid write ratio %d\n", __func__, write_every);
+		return 0;
+	}
+
+	rw_test_synch = 0;
+	rw_test_done = 0;
+	rw_test_time = 0;
+	rw_test_iterations = iter;
+	rw_test_percpu = percpu;
+	rw_test_write_every = write_every;
+	rw_test_threads = MIN((int)processor_avail_count, TEST_RW_MAX_THREADS);
+
+	for (started = 0; started < rw_test_threads; started++) {
+		result = kernel_thread_start((thread_continue_t)test_rw_lock_unlock_contended_thread, NULL, &thread);
+		if (result != KERN_SUCCESS) {
+			break;
+		}
+		thread_deallocate(thread);
+	}
+
+	if (started != rw_test_threads) {
+		/* let the threads that did start go through */
+		os_atomic_store(&rw_test_threads, started, relaxed);
+	}
+
+	while (os_atomic_load(&rw_test_done, acquire) != started) {
+		assert_wait((event_t) &rw_test_done, THREAD_UNINT);
+		if (os_atomic_load(&rw_test_done, acquire) != started) {
+			(void) thread_block(THREAD_CONTINUE_NULL);
+		} else {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+		}
+	}
+
+	if (started == 0) {
+		return 0;
+	}
+
+	absolutetime_to_nanoseconds(rw_test_time, &time);
+	avg = time / ((uint64_t)started * iter);
+
+	i = scnprintf(buffer, buffer_size, "threads %d total time %llu ns avg %llu ns",
+	    started, time, avg);
+
+	return i;
+}
+
+/*
+ * Adaptive mutex spin test.
+ *
+ * Two threads take turns on a mutex of their own lock group, holding it
+ * for hold_ns every time, so that the group learns a hold time.  The
+ * group has statistics enabled; how the contended acquisitions were
+ * resolved is reported through host_lockgroup_spin_info.
+ */
+static lck_grp_t        test_spin_mtx_grp;
+static lck_grp_attr_t   test_spin_mtx_grp_attr;
+static lck_mtx_t        test_spin_mtx;
+
+static int spin_test_synch;
+static int spin_test_done;
+static int spin_test_iterations;
+static uint64_t spin_test_hold;
+static uint64_t spin_test_time;
+
+void
+lck_mtx_test_spin_init(void)
+{
+	static int first = 0;
+
+	if (os_atomic_load(&first, acquire) >= 2) {
+		return;
+	}
+
+	if (os_atomic_cmpxchg(&first, 0, 1, relaxed)) {
+		lck_grp_attr_setdefault(&test_spin_mtx_grp_attr);
+		lck_grp_attr_setstat(&test_spin_mtx_grp_attr);
+		lck_grp_init(&test_spin_mtx_grp, "testlck_mtx_spin", &test_spin_mtx_grp_attr);
+		lck_mtx_init(&test_spin_mtx, &test_spin_mtx_grp, LCK_ATTR_NULL);
+
+		os_atomic_inc(&first, release);
+	}
+
+	while (os_atomic_load(&first, acquire) < 2) {
+		;
+	}
+}
+
+static void
+test_mtx_spin_contended_thread(
+	__unused void *arg,
+	__unused wait_result_t wr)
+{
+	int i;
+	uint64_t start, stop;
+
+	os_atomic_inc(&spin_test_synch, relaxed);
+	while (os_atomic_load(&spin_test_synch, relaxed) < 2) {
+		;
+	}
+
+	start = mach_absolute_time();
+
+	for (i = 0; i < spin_test_iterations; i++) {
+		lck_mtx_lock(&test_spin_mtx);
+		stop = mach_absolute_time() + spin_test_hold;
+		while (mach_absolute_time() < stop) {
+			;
+		}
+		lck_mtx_unlock(&test_spin_mtx);
+	}
+
+	os_atomic_add(&spin_test_time, mach_absolute_time() - start, relaxed);
+
+	os_atomic_inc(&spin_test_done, release);
+	thread_wakeup((event_t) &spin_test_done);
+	thread_terminate_self();
+}
+
+int
+lck_mtx_test_spin_contended(
+	int iter,
+	int hold_ns,
+	char *buffer,
+	int buffer_size)
+{
+	thread_t thread;
+	kern_return_t result;
+	int started;
+	uint64_t time;
+
+	spin_test_synch = 0;
+	spin_test_done = 0;
+	spin_test_time = 0;
+	spin_test_iterations = iter;
+	nanoseconds_to_absolutetime(hold_ns, &spin_test_hold);
+
+	for (started = 0; started < 2; started++) {
+		result = kernel_thread_start((thread_continue_t)test_mtx_spin_contended_thread, NULL, &thread);
+		if (result != KERN_SUCCESS) {
+			break;
+		}
+		thread_deallocate(thread);
+	}
+
+	if (started != 2) {
+		/* let the thread that did start go through */
+		os_atomic_add(&spin_test_synch, 2 - started, relaxed);
+	}
+
+	while (os_atomic_load(&spin_test_done, acquire) != started) {
+		assert_wait((event_t) &spin_test_done, THREAD_UNINT);
+		if (os_atomic_load(&spin_test_done, acquire) != started) {
+			(void) thread_block(THREAD_CONTINUE_NULL);
+		} else {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+		}
+	}
+
+	if (started == 0) {
+		return 0;
+	}
+
+	absolutetime_to_nanoseconds(spin_test_time, &time);
+
+	return scnprintf(buffer, buffer_size, "threads %d total time %llu ns", started, time);
+}
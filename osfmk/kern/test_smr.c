@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <machine/machine_cpu.h>
+#include <kern/kalloc.h>
+#include <kern/processor.h>
+#include <kern/sched_prim.h>
+#include <kern/smr.h>
+#include <kern/thread.h>
+#include <kern/zalloc.h>
+
+#if !DEBUG && !DEVELOPMENT
+#error "Test only file"
+#endif
+
+#include <sys/errno.h>
+
+#define SMR_TEST_ALIVE          0x616c697665ull
+#define SMR_TEST_DEAD           0xdeadbeefdeadull
+#define SMR_TEST_MAX_READERS    16
+#define SMR_TEST_RETIRED        64
+#define SMR_TEST_FLUSH_WAIT_S   10
+
+struct smr_test_elem {
+	uint64_t                magic;
+	uint64_t                gen;
+	struct smr_test_elem   *next;           /* writer private retire list */
+	smr_seq_t               seq;
+};
+
+static ZONE_DECLARE(smr_test_zone, "smr_test",
+    sizeof(struct smr_test_elem), ZC_NONE);
+
+static struct smr smr_test_static;
+static smr_t smr_test_domain;
+static struct smr_test_elem *smr_test_head;
+static uint64_t smr_test_reads;
+static int smr_test_done;
+static int smr_test_readers;
+static int smr_test_exited;
+
+/*
+ * Readers hold on to the published element for a little while,
+ * and panic if the writer poisoned it before they left.
+ */
+static void
+smr_test_reader(__unused void *arg, __unused wait_result_t wr)
+{
+	struct smr_test_elem *elem;
+	uint64_t gen, reads = 0;
+
+	while (!os_atomic_load(&smr_test_done, relaxed)) {
+		smr_enter(smr_test_domain);
+		elem = smr_entered_load(&smr_test_head);
+		if (elem->magic != SMR_TEST_ALIVE) {
+			panic("smr_test: reader saw a dead element %p", elem);
+		}
+		gen = elem->gen;
+		for (int i = 0; i < 16; i++) {
+			cpu_pause();
+		}
+		if (elem->magic != SMR_TEST_ALIVE || elem->gen != gen) {
+			panic("smr_test: element %p reclaimed under a reader", elem);
+		}
+		smr_leave(smr_test_domain);
+		reads++;
+	}
+
+	os_atomic_add(&smr_test_reads, reads, relaxed);
+	os_atomic_inc(&smr_test_exited, release);
+	thread_wakeup(&smr_test_exited);
+	thread_terminate_self();
+}
+
+static void
+smr_test_poison(struct smr_test_elem *elem)
+{
+	elem->magic = SMR_TEST_DEAD;
+	zfree(smr_test_zone, elem);
+}
+
+/*
+ * Partially filled buckets must be reclaimed without further
+ * calls to smr_zfree(), once the flush got to them.
+ */
+static void
+smr_test_flush(smr_t smr)
+{
+	uint64_t deadline;
+
+	clock_interval_to_deadline(SMR_TEST_FLUSH_WAIT_S, NSEC_PER_SEC, &deadline);
+	while (os_atomic_load(&smr->smr_reclaimed, relaxed) !=
+	    os_atomic_load(&smr->smr_deferred, relaxed)) {
+		if (mach_absolute_time() > deadline) {
+			panic("smr_test: partial buckets not flushed "
+			    "(%lld deferred, %lld reclaimed)",
+			    smr->smr_deferred, smr->smr_reclaimed);
+		}
+		delay(10 * 1000);
+	}
+}
+
+/*
+ * The point of this test is to exercise grace period detection
+ * with readers constantly entering and leaving on every CPU.
+ *
+ * Every other element is retired through smr_zfree(), the others are
+ * tracked by hand with smr_advance()/smr_poll(), and poisoned before
+ * they're freed so that readers can catch early reclamation.
+ *
+ * It will panic if anything goes wrong to help debugging state.
+ */
+static uint64_t
+smr_test_stress_domain(smr_t smr, uint64_t count)
+{
+	struct smr_test_elem *elem, *old, *retired = NULL, **tailp = &retired;
+	uint64_t start, end, reads, nsecs;
+	kern_return_t kr;
+	thread_t thread;
+	int started;
+
+	smr_test_domain = smr;
+	smr_init(smr_test_domain, "smr_test");
+	smr_test_reads = 0;
+	smr_test_done = 0;
+	smr_test_exited = 0;
+
+	elem = zalloc_flags(smr_test_zone, Z_WAITOK | Z_ZERO);
+	elem->magic = SMR_TEST_ALIVE;
+	smr_serialized_store(&smr_test_head, elem);
+
+	smr_test_readers = MAX(1, MIN((int)processor_avail_count - 1, SMR_TEST_MAX_READERS));
+	for (started = 0; started < smr_test_readers; started++) {
+		kr = kernel_thread_start(smr_test_reader, NULL, &thread);
+		if (kr != KERN_SUCCESS) {
+			break;
+		}
+		thread_deallocate(thread);
+	}
+
+	start = mach_absolute_time();
+
+	for (uint64_t gen = 1; gen <= count; gen++) {
+		elem = zalloc_flags(smr_test_zone, Z_WAITOK | Z_ZERO);
+		elem->magic = SMR_TEST_ALIVE;
+		elem->gen = gen;
+
+		old = smr_test_head;
+		smr_serialized_store(&smr_test_head, elem);
+
+		if (gen & 1) {
+			smr_zfree(smr_test_domain, smr_test_zone, old);
+			continue;
+		}
+
+		old->seq = smr_advance(smr_test_domain);
+		old->next = NULL;
+		*tailp = old;
+		tailp = &old->next;
+
+		while ((old = retired) != NULL &&
+		    smr_poll(smr_test_domain, old->seq)) {
+			retired = old->next;
+			if (retired == NULL) {
+				tailp = &retired;
+			}
+			smr_test_poison(old);
+		}
+
+		if (gen % (count / 10) == 0) {
+			printf("smr_test_stress: %lld elements left\n", count - gen);
+		}
+	}
+
+	end = mach_absolute_time();
+
+	os_atomic_store(&smr_test_done, 1, relaxed);
+	while (os_atomic_load(&smr_test_exited, acquire) != started) {
+		assert_wait(&smr_test_exited, THREAD_UNINT);
+		if (os_atomic_load(&smr_test_exited, acquire) != started) {
+			thread_block(THREAD_CONTINUE_NULL);
+		} else {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+		}
+	}
+
+	printf("smr_test_stress: CLEANUP\n");
+
+	while ((old = retired) != NULL) {
+		smr_wait(smr_test_domain, old->seq);
+		retired = old->next;
+		smr_test_poison(old);
+	}
+
+	smr_zfree(smr_test_domain, smr_test_zone, smr_test_head);
+	smr_test_head = NULL;
+	smr_test_flush(smr_test_domain);
+	smr_destroy(smr_test_domain);
+	smr_test_domain = NULL;
+
+	absolutetime_to_nanoseconds(end - start, &nsecs);
+	reads = os_atomic_load(&smr_test_reads, relaxed);
+
+	printf("smr_test_stress: %lld retires with %d readers (%lld reads) in %lld ns (%lld ns/retire)\n",
+	    count, started, reads, nsecs, nsecs / count);
+	return nsecs;
+}
+
+/*
+ * Runs the stress once with a statically allocated domain,
+ * and once with one allocated and freed around it.
+ */
+int
+smr_test_stress(uint64_t count, uint64_t *out)
+{
+	smr_t smr;
+
+	if (count < 1000 || count > 10 * 1000 * 1000) {
+		return EINVAL;
+	}
+
+	printf("smr_test_stress: START\n");
+
+	*out = smr_test_stress_domain(&smr_test_static, count);
+
+	smr = kalloc_flags(sizeof(struct smr), Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	*out += smr_test_stress_domain(smr, count);
+	kfree(smr, sizeof(struct smr));
+
+	printf("smr_test_stress: DONE\n");
+	return 0;
+}
@@ -379,6 +379,12 @@ struct thread {
 	processor_t             last_processor;         /* processor last dispatched on */
 	processor_t             chosen_processor;       /* Where we want to run this thread */
 
+	/* Wake-affine placement state, see sched_wake_affine_options() */
+	uint64_t                wake_affine_waker;      /* thread_tid() of the last thread to wake us */
+	uint64_t                wake_affine_wakeup_time;        /* when we last woke a paired thread */
+	uint8_t                 wake_affine_pair_count; /* consecutive wakeups by wake_affine_waker */
+	uint8_t                 wake_affine_sync_count; /* consecutive blocks right after waking a paired thread */
+
 	/* Fail-safe computation since last unblock or qualifying yield */
 	uint64_t                computation_metered;
 	uint64_t                computation_epoch;
@@ -68,6 +68,40 @@ __options_decl(thread_call_group_flags_t, uint32_t, {
 	TCG_DEALLOC_ACTIVE      = 0x2,
 });
 
+/*
+ * Hashed hierarchical timer wheel.
+ *
+ * Delayed calls whose leeway is at least as large as a wheel tick are
+ * hashed into a slot instead of the delayed priority queue, which makes
+ * arm and cancel O(1).  Each level has TCW_SLOTS slots, and the tick of
+ * level n is TCW_SLOTS times the tick of level n - 1.  A call is placed on
+ * the coarsest level whose tick boundary still falls within
+ * [soft deadline, hard deadline], so all calls of a slot share a single
+ * expiry and are delivered together.  A slot only ever holds one expiry:
+ * when the hashed slot is in use for a different expiry, a finer level is
+ * tried, and failing that the call stays on the priority queue.
+ *
+ * Calls without sufficient leeway and rate-limited calls, which must not
+ * fire before their hard deadline, always use the priority queue.
+ */
+#define TCW_LEVELS              3
+#define TCW_SLOT_BITS           5
+#define TCW_SLOTS               (1u << TCW_SLOT_BITS)
+#define TCW_NONE                UINT32_MAX
+#define THREAD_CALL_WHEEL_TICK_NS (NSEC_PER_MSEC)  /* 1 ms, 32 ms, 1.024 s */
+
+struct thread_call_wheel_slot {
+	queue_head_t            tws_calls;
+	uint64_t                tws_expire;     /* expiry shared by every call in the slot */
+	uint64_t                tws_deadline;   /* earliest hard deadline of the calls */
+};
+
+struct thread_call_wheel {
+	uint32_t                tcw_next;       /* slot with the earliest expiry, or TCW_NONE */
+	uint32_t                tcw_occupied[TCW_LEVELS];
+	struct thread_call_wheel_slot tcw_slots[TCW_LEVELS * TCW_SLOTS];
+};
+
 static struct thread_call_group {
 	__attribute__((aligned(128))) lck_ticket_t tcg_lock;
 
@@ -78,6 +112,7 @@ static struct thread_call_group {
 
 	queue_head_t            delayed_queues[TCF_COUNT];
 	struct priority_queue_deadline_min delayed_pqueues[TCF_COUNT];
+	struct thread_call_wheel delayed_wheels[TCF_COUNT];
 	timer_call_data_t       delayed_timers[TCF_COUNT];
 
 	timer_call_data_t       dealloc_timer;
@@ -175,6 +210,14 @@ static thread_call_data_t       internal_call_storage[INTERNAL_CALL_COUNT];
 static queue_head_t             thread_call_internal_queue;
 int                                             thread_call_internal_queue_count = 0;
 static uint64_t                 thread_call_dealloc_interval_abs;
+static uint64_t                 thread_call_wheel_tick_abs[TCW_LEVELS];
+
+/* Place delayed calls with enough leeway on the timer wheel */
+TUNABLE_WRITEABLE(int, thread_call_wheel_enabled, "thread_call_wheel", 0);
+
+uint64_t                        thread_call_wheel_inserts;
+uint64_t                        thread_call_wheel_bypassed;
+uint64_t                        thread_call_wheel_expired;
 
 static void                     _internal_call_init(void);
 
@@ -277,6 +320,195 @@ thread_call_set_flavor(thread_call_t call, thread_call_flavor_t flavor)
 	return old_flavor;
 }
 
+static inline uint64_t
+thread_call_wheel_next_expire(struct thread_call_wheel *wheel)
+{
+	if (wheel->tcw_next == TCW_NONE) {
+		return UINT64_MAX;
+	}
+	return wheel->tcw_slots[wheel->tcw_next].tws_expire;
+}
+
+/*
+ * Returns the earliest hard deadline of the calls on the wheel.
+ * Every call's deadline is past its slot's expiry, so slots that
+ * expire after the best deadline found so far can be skipped.
+ */
+static uint64_t
+thread_call_wheel_min_deadline(struct thread_call_wheel *wheel)
+{
+	uint64_t deadline = UINT64_MAX;
+
+	for (uint32_t level = 0; level < TCW_LEVELS; level++) {
+		uint32_t occupied = wheel->tcw_occupied[level];
+
+		while (occupied != 0) {
+			struct thread_call_wheel_slot *slot =
+			    &wheel->tcw_slots[level * TCW_SLOTS + __builtin_ctz(occupied)];
+
+			occupied &= occupied - 1;
+			if (slot->tws_expire < deadline && slot->tws_deadline < deadline) {
+				deadline = slot->tws_deadline;
+			}
+		}
+	}
+	return deadline;
+}
+
+/*
+ * Recompute the earliest occupied slot, only needed when the
+ * current earliest slot drains.  Bounded by the number of slots.
+ */
+static void
+thread_call_wheel_update_next(struct thread_call_wheel *wheel)
+{
+	uint64_t expire = UINT64_MAX;
+
+	wheel->tcw_next = TCW_NONE;
+
+	for (uint32_t level = 0; level < TCW_LEVELS; level++) {
+		uint32_t occupied = wheel->tcw_occupied[level];
+
+		while (occupied != 0) {
+			uint32_t index = level * TCW_SLOTS + __builtin_ctz(occupied);
+
+			occupied &= occupied - 1;
+			if (wheel->tcw_slots[index].tws_expire < expire) {
+				expire = wheel->tcw_slots[index].tws_expire;
+				wheel->tcw_next = index;
+			}
+		}
+	}
+}
+
+/*
+ * Returns the slot a delayed call with the given hard deadline
+ * should be hashed into, or TCW_NONE if it belongs on the priority queue.
+ */
+static uint32_t
+thread_call_wheel_find_slot(
+	struct thread_call_wheel *wheel,
+	thread_call_t           call,
+	uint64_t                deadline)
+{
+	uint64_t soft_deadline = call->tc_soft_deadline;
+
+	if (!thread_call_wheel_enabled) {
+		return TCW_NONE;
+	}
+
+	if ((call->tc_flags & THREAD_CALL_RATELIMITED) == 0 &&
+	    soft_deadline != 0 && soft_deadline < deadline) {
+		for (int level = TCW_LEVELS - 1; level >= 0; level--) {
+			uint64_t tick = thread_call_wheel_tick_abs[level];
+
+			if (deadline - soft_deadline < tick ||
+			    soft_deadline > UINT64_MAX - tick) {
+				continue;
+			}
+
+			uint64_t expire = ((soft_deadline + tick - 1) / tick) * tick;
+			if (expire > deadline) {
+				continue;
+			}
+
+			uint32_t index = level * TCW_SLOTS + (uint32_t)((expire / tick) % TCW_SLOTS);
+			struct thread_call_wheel_slot *slot = &wheel->tcw_slots[index];
+
+			if (queue_empty(&slot->tws_calls) || slot->tws_expire == expire) {
+				return index;
+			}
+		}
+	}
+
+	os_atomic_inc(&thread_call_wheel_bypassed, relaxed);
+	return TCW_NONE;
+}
+
+static void
+thread_call_wheel_insert(
+	struct thread_call_wheel *wheel,
+	thread_call_t           call,
+	uint32_t                index)
+{
+	uint32_t level = index / TCW_SLOTS;
+	struct thread_call_wheel_slot *slot = &wheel->tcw_slots[index];
+	uint64_t tick = thread_call_wheel_tick_abs[level];
+	uint64_t deadline = call->tc_pqlink.deadline;
+
+	if (queue_empty(&slot->tws_calls)) {
+		slot->tws_expire = ((call->tc_soft_deadline + tick - 1) / tick) * tick;
+		slot->tws_deadline = deadline;
+		wheel->tcw_occupied[level] |= 1u << (index % TCW_SLOTS);
+	} else if (deadline < slot->tws_deadline) {
+		slot->tws_deadline = deadline;
+	}
+
+	assert(slot->tws_expire >= call->tc_soft_deadline &&
+	    slot->tws_expire <= deadline);
+
+	enqueue_tail(&slot->tws_calls, &call->tc_wheel_link);
+	call->tc_wheel_slot = index;
+	call->tc_flags |= THREAD_CALL_WHEEL;
+
+	if (slot->tws_expire < thread_call_wheel_next_expire(wheel)) {
+		wheel->tcw_next = index;
+	}
+
+	os_atomic_inc(&thread_call_wheel_inserts, relaxed);
+}
+
+static void
+thread_call_wheel_remove(
+	struct thread_call_wheel *wheel,
+	thread_call_t           call)
+{
+	uint32_t index = call->tc_wheel_slot;
+	struct thread_call_wheel_slot *slot = &wheel->tcw_slots[index];
+
+	assert(call->tc_flags & THREAD_CALL_WHEEL);
+
+	remqueue(&call->tc_wheel_link);
+	call->tc_flags &= ~THREAD_CALL_WHEEL;
+
+	if (queue_empty(&slot->tws_calls)) {
+		wheel->tcw_occupied[index / TCW_SLOTS] &= ~(1u << (index % TCW_SLOTS));
+		if (wheel->tcw_next == index) {
+			thread_call_wheel_update_next(wheel);
+		}
+	}
+}
+
+/*
+ * Returns a call from the earliest slot if that slot has expired.
+ */
+static thread_call_t
+thread_call_wheel_expired_call(
+	struct thread_call_wheel *wheel,
+	uint64_t                now)
+{
+	if (thread_call_wheel_next_expire(wheel) > now) {
+		return NULL;
+	}
+
+	return qe_queue_first(&wheel->tcw_slots[wheel->tcw_next].tws_calls,
+	           struct thread_call, tc_wheel_link);
+}
+
+/* Unlink a call on a delayed queue from the wheel or priority queue tracking its deadline */
+static void
+thread_call_delayed_remove(
+	thread_call_t           call,
+	thread_call_group_t     group,
+	thread_call_flavor_t    flavor)
+{
+	if (call->tc_flags & THREAD_CALL_WHEEL) {
+		thread_call_wheel_remove(&group->delayed_wheels[flavor], call);
+	} else {
+		priority_queue_remove(&group->delayed_pqueues[flavor], &call->tc_pqlink);
+	}
+}
+
 /* returns true if it was on a queue */
 static bool
 thread_call_enqueue_tail(
@@ -294,7 +526,7 @@ thread_call_enqueue_tail(
 	}
 
 	if (old_queue == &group->delayed_queues[flavor]) {
-		priority_queue_remove(&group->delayed_pqueues[flavor], &call->tc_pqlink);
+		thread_call_delayed_remove(call, group, flavor);
 	}
 
 	if (old_queue == NULL) {
@@ -324,7 +556,7 @@ thread_call_dequeue(
 	}
 
 	if (old_queue == &group->delayed_queues[flavor]) {
-		priority_queue_remove(&group->delayed_pqueues[flavor], &call->tc_pqlink);
+		thread_call_delayed_remove(call, group, flavor);
 	}
 
 	if (old_queue != NULL) {
@@ -353,7 +585,18 @@ thread_call_enqueue_deadline(
 		panic("thread call (%p) on bad queue (old_queue: %p)", call, old_queue);
 	}
 
-	if (old_queue == new_queue) {
+	bool was_delayed = (old_queue == &group->delayed_queues[old_flavor]);
+	bool on_pqueue = was_delayed && (call->tc_flags & THREAD_CALL_WHEEL) == 0;
+
+	/* leave the wheel first so the call's own slot can be reused */
+	if (was_delayed && !on_pqueue) {
+		thread_call_wheel_remove(&group->delayed_wheels[old_flavor], call);
+	}
+
+	uint32_t index = thread_call_wheel_find_slot(&group->delayed_wheels[flavor],
+	    call, deadline);
+
+	if (on_pqueue && old_queue == new_queue && index == TCW_NONE) {
 		/* optimize the same-queue case to avoid a full re-insert */
 		uint64_t old_deadline = call->tc_pqlink.deadline;
 		call->tc_pqlink.deadline = deadline;
@@ -366,14 +609,18 @@ thread_call_enqueue_deadline(
 			    &call->tc_pqlink);
 		}
 	} else {
-		if (old_queue == &group->delayed_queues[old_flavor]) {
+		if (on_pqueue) {
 			priority_queue_remove(&group->delayed_pqueues[old_flavor],
 			    &call->tc_pqlink);
 		}
 
 		call->tc_pqlink.deadline = deadline;
 
-		priority_queue_insert(&group->delayed_pqueues[flavor], &call->tc_pqlink);
+		if (index != TCW_NONE) {
+			thread_call_wheel_insert(&group->delayed_wheels[flavor], call, index);
+		} else {
+			priority_queue_insert(&group->delayed_pqueues[flavor], &call->tc_pqlink);
+		}
 	}
 
 	if (old_queue == NULL) {
@@ -453,6 +700,10 @@ thread_call_group_setup(thread_call_group_t group)
 	for (thread_call_flavor_t flavor = 0; flavor < TCF_COUNT; flavor++) {
 		queue_init(&group->delayed_queues[flavor]);
 		priority_queue_init(&group->delayed_pqueues[flavor]);
+		group->delayed_wheels[flavor].tcw_next = TCW_NONE;
+		for (uint32_t i = 0; i < TCW_LEVELS * TCW_SLOTS; i++) {
+			queue_init(&group->delayed_wheels[flavor].tcw_slots[i].tws_calls);
+		}
 		timer_call_setup(&group->delayed_timers[flavor], thread_call_delayed_timer, group);
 	}
 
@@ -511,6 +762,10 @@ void
 thread_call_initialize(void)
 {
 	nanotime_to_absolutetime(0, THREAD_CALL_DEALLOC_INTERVAL_NS, &thread_call_dealloc_interval_abs);
+	nanoseconds_to_absolutetime(THREAD_CALL_WHEEL_TICK_NS, &thread_call_wheel_tick_abs[0]);
+	for (uint32_t level = 1; level < TCW_LEVELS; level++) {
+		thread_call_wheel_tick_abs[level] = thread_call_wheel_tick_abs[level - 1] * TCW_SLOTS;
+	}
 	waitq_init(&daemon_waitq, SYNC_POLICY_DISABLE_IRQ | SYNC_POLICY_FIFO);
 
 	for (uint32_t i = 0; i < THREAD_CALL_INDEX_MAX; i++) {
@@ -808,36 +1063,66 @@ _arm_delayed_call_timer(thread_call_t           new_call,
 		return false;
 	}
 
+	struct thread_call_wheel *wheel = &group->delayed_wheels[flavor];
 	thread_call_t call = priority_queue_min(&group->delayed_pqueues[flavor], struct thread_call, tc_pqlink);
+	uint64_t fire_at, leeway, deadline;
+	bool ratelimited = false;
+	bool first;
 
-	/* We only need to change the hard timer if this new call is the first in the list */
-	if (new_call != NULL && new_call != call) {
-		return false;
+	/*
+	 * The timer may only fire as late as the earliest hard deadline
+	 * of both structures, whichever of them provides the fire time.
+	 */
+	deadline = thread_call_wheel_min_deadline(wheel);
+	if (call != NULL && call->tc_pqlink.deadline < deadline) {
+		deadline = call->tc_pqlink.deadline;
 	}
 
-	assert((call->tc_soft_deadline != 0) && ((call->tc_soft_deadline <= call->tc_pqlink.deadline)));
+	if (call != NULL && call->tc_soft_deadline <= thread_call_wheel_next_expire(wheel)) {
+		assert((call->tc_soft_deadline != 0) && ((call->tc_soft_deadline <= call->tc_pqlink.deadline)));
 
-	uint64_t fire_at = call->tc_soft_deadline;
+		first = (new_call == call);
+		fire_at = call->tc_soft_deadline;
 
-	if (flavor == TCF_CONTINUOUS) {
-		assert(call->tc_flags & THREAD_CALL_FLAG_CONTINUOUS);
-		fire_at = continuoustime_to_absolutetime(fire_at);
+		if (flavor == TCF_CONTINUOUS) {
+			assert(call->tc_flags & THREAD_CALL_FLAG_CONTINUOUS);
+		} else {
+			assert((call->tc_flags & THREAD_CALL_FLAG_CONTINUOUS) == 0);
+		}
+
+		/*
+		 * Note: This picks the soonest-deadline call's leeway as the hard timer's leeway,
+		 * which does not take into account later-deadline timers with a larger leeway.
+		 * This is a valid coalescing behavior, but masks a possible window to
+		 * fire a timer instead of going idle.
+		 */
+		ratelimited = ((call->tc_flags & THREAD_CALL_RATELIMITED) == THREAD_CALL_RATELIMITED);
 	} else {
-		assert((call->tc_flags & THREAD_CALL_FLAG_CONTINUOUS) == 0);
+		assert(wheel->tcw_next != TCW_NONE);
+
+		first = (new_call != NULL && (new_call->tc_flags & THREAD_CALL_WHEEL) &&
+		    new_call->tc_wheel_slot == wheel->tcw_next);
+		fire_at = wheel->tcw_slots[wheel->tcw_next].tws_expire;
 	}
 
 	/*
-	 * Note: This picks the soonest-deadline call's leeway as the hard timer's leeway,
-	 * which does not take into account later-deadline timers with a larger leeway.
-	 * This is a valid coalescing behavior, but masks a possible window to
-	 * fire a timer instead of going idle.
+	 * We only need to change the hard timer if the new call provides
+	 * the fire time or the earliest hard deadline.
 	 */
-	uint64_t leeway = call->tc_pqlink.deadline - call->tc_soft_deadline;
+	if (new_call != NULL && !first && new_call->tc_pqlink.deadline > deadline) {
+		return false;
+	}
+
+	leeway = (deadline > fire_at) ? deadline - fire_at : 0;
+
+	if (flavor == TCF_CONTINUOUS) {
+		fire_at = continuoustime_to_absolutetime(fire_at);
+	}
 
 	timer_call_enter_with_leeway(&group->delayed_timers[flavor], (timer_call_param_t)flavor,
 	    fire_at, leeway,
 	    TIMER_CALL_SYS_CRITICAL | TIMER_CALL_LEEWAY,
-	    ((call->tc_flags & THREAD_CALL_RATELIMITED) == THREAD_CALL_RATELIMITED));
+	    ratelimited);
 
 	return true;
 }
@@ -1298,7 +1583,10 @@ thread_call_cancel_locked(thread_call_t call)
 		thread_call_flavor_t flavor = thread_call_get_flavor(call);
 		thread_call_group_t  group  = thread_call_get_group(call);
 
-		if (call->tc_pqlink.deadline != 0 &&
+		if (call->tc_flags & THREAD_CALL_WHEEL) {
+			assert(call->tc_queue == &group->delayed_queues[flavor]);
+			queue_head_changed = (call->tc_wheel_slot == group->delayed_wheels[flavor].tcw_next);
+		} else if (call->tc_pqlink.deadline != 0 &&
 		    call == priority_queue_min(&group->delayed_pqueues[flavor], struct thread_call, tc_pqlink)) {
 			assert(call->tc_queue == &group->delayed_queues[flavor]);
 			queue_head_changed = true;
@@ -1909,10 +2197,9 @@ thread_call_delayed_timer(timer_call_param_t p0, timer_call_param_t p1)
 		panic("invalid timer flavor: %d", flavor);
 	}
 
-	while ((call = priority_queue_min(&group->delayed_pqueues[flavor],
-	    struct thread_call, tc_pqlink)) != NULL) {
-		assert(thread_call_get_group(call) == group);
-		assert(thread_call_get_flavor(call) == flavor);
+	for (;;) {
+		call = priority_queue_min(&group->delayed_pqueues[flavor],
+		    struct thread_call, tc_pqlink);
 
 		/*
 		 * if we hit a call that isn't yet ready to expire,
@@ -1920,8 +2207,8 @@ thread_call_delayed_timer(timer_call_param_t p0, timer_call_param_t p1)
 		 * TODO: The next timer in the list could have a larger leeway
 		 *       and therefore be ready to expire.
 		 */
-		if (call->tc_soft_deadline > now) {
-			break;
+		if (call != NULL && call->tc_soft_deadline > now) {
+			call = NULL;
 		}
 
 		/*
@@ -1931,12 +2218,24 @@ thread_call_delayed_timer(timer_call_param_t p0, timer_call_param_t p1)
 		 * TODO: What if the next timer is not rate-limited?
 		 *       Have a separate rate-limited queue to avoid this
 		 */
-		if ((call->tc_flags & THREAD_CALL_RATELIMITED) &&
+		if (call != NULL && (call->tc_flags & THREAD_CALL_RATELIMITED) &&
 		    (call->tc_pqlink.deadline > now) &&
 		    (ml_timer_forced_evaluation() == FALSE)) {
-			break;
+			call = NULL;
 		}
 
+		/* Wheel slots are only ever filled with calls ready at their expiry */
+		if (call == NULL) {
+			call = thread_call_wheel_expired_call(&group->delayed_wheels[flavor], now);
+			if (call == NULL) {
+				break;
+			}
+			os_atomic_inc(&thread_call_wheel_expired, relaxed);
+		}
+
+		assert(thread_call_get_group(call) == group);
+		assert(thread_call_get_flavor(call) == flavor);
+
 		if (THREAD_CALL_SIGNAL & call->tc_flags) {
 			__assert_only queue_head_t *old_queue;
 			old_queue = thread_call_dequeue(call);
@@ -1961,7 +2260,7 @@ thread_call_delayed_timer(timer_call_param_t p0, timer_call_param_t p1)
 		}
 	}
 
-	_arm_delayed_call_timer(call, group, flavor);
+	_arm_delayed_call_timer(NULL, group, flavor);
 
 	thread_call_unlock(group);
 }
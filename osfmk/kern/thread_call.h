@@ -367,6 +367,7 @@ __options_closed_decl(thread_call_flags_t, uint16_t, {
 	THREAD_CALL_RESCHEDULE          = 0x0040,       /* enqueue is pending due to re-arm while running */
 	THREAD_CALL_RATELIMITED         = 0x0080,       /* timer doesn't fire until slop+deadline */
 	THREAD_CALL_FLAG_CONTINUOUS     = 0x0100,       /* deadline is in continuous time */
+	THREAD_CALL_WHEEL               = 0x0200,       /* deadline tracked by the timer wheel, not tc_pqlink */
 });
 
 struct thread_call {
@@ -389,6 +390,9 @@ struct thread_call {
 	thread_call_param_t                     tc_param1;
 	uint64_t                                tc_submit_count;
 	uint64_t                                tc_finish_count;
+	/* Timer wheel slot linkage, valid while THREAD_CALL_WHEEL is set */
+	queue_chain_t                           tc_wheel_link;
+	uint32_t                                tc_wheel_slot;
 };
 
 typedef struct thread_call thread_call_data_t;
@@ -171,6 +171,30 @@ uint64_t past_deadline_timer_adjustment;
 static boolean_t timer_call_enter_internal(timer_call_t call, timer_call_param_t param1, uint64_t deadline, uint64_t leeway, uint32_t flags, boolean_t ratelimited);
 boolean_t       mach_timer_coalescing_enabled = TRUE;
 
+/*
+ * Cross-queue deadline coalescing.
+ *
+ * A timer armed with a leeway window [soft deadline, deadline] is aligned onto
+ * the next wakeup already programmed for the local CPU when that wakeup falls
+ * inside the window, so that both expire from the same interrupt.
+ *
+ * When a housekeeping CPU is designated (timer_housekeeping_cpu boot-arg or
+ * kern.timer.housekeeping_cpu), non-urgent timers that tolerate the
+ * housekeeping CPU's next wakeup are queued there instead, which lets idle
+ * CPUs stay in deep idle states. A timer is only moved if the housekeeping
+ * CPU is already due to wake up no later than the timer's deadline. If
+ * that wakeup expires before the timer is queued, the timer is taken back
+ * onto the local queue; the housekeeping CPU is never interrupted, and
+ * timer arming never waits on another CPU.
+ */
+int             timer_housekeeping_cpu = -1;
+uint64_t        timer_coalesce_aligned;         /* timers merged into an existing wakeup */
+uint64_t        timer_housekeeping_migrated;    /* timers queued on the housekeeping CPU */
+uint64_t        timer_housekeeping_resyncs;     /* timers taken back from the housekeeping CPU */
+
+static mpqueue_head_t *timer_call_coalesce(uint64_t *deadline, uint64_t soft_deadline, uint32_t flags);
+static void     timer_call_housekeeping_resync(mpqueue_head_t *queue, timer_call_t call, uint64_t deadline);
+
 mpqueue_head_t  *timer_call_enqueue_deadline_unlocked(
 	timer_call_t            call,
 	mpqueue_head_t          *queue,
@@ -236,6 +260,9 @@ timer_call_init(void)
 {
 	timer_longterm_init();
 	timer_call_init_abstime();
+
+	PE_parse_boot_argn("timer_housekeeping_cpu", &timer_housekeeping_cpu,
+	    sizeof(timer_housekeeping_cpu));
 }
 
 
@@ -674,8 +701,13 @@ timer_call_enter_internal(
 	}
 
 	if (queue == NULL) {
-		queue = timer_queue_assign(deadline);
+		mpqueue_head_t *hk_queue = timer_call_coalesce(&deadline, sdeadline, flags);
+
+		queue = hk_queue ? hk_queue : timer_queue_assign(deadline);
 		old_queue = timer_call_enqueue_deadline_unlocked(call, queue, deadline, sdeadline, ttd, param1, flags);
+		if (hk_queue) {
+			timer_call_housekeeping_resync(hk_queue, call, deadline);
+		}
 	}
 
 #if TIMER_TRACE
@@ -692,6 +724,138 @@ timer_call_enter_internal(
 	return old_queue != NULL;
 }
 
+/*
+ * Return the hard deadline of the earliest timer on a queue,
+ * which is the next wakeup programmed for the owning CPU.
+ */
+static uint64_t
+timer_queue_earliest_deadline(mpqueue_head_t *queue)
+{
+	timer_call_t    call;
+	uint64_t        deadline = UINT64_MAX;
+
+	timer_queue_lock_spin(queue);
+	call = priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink);
+	if (call != NULL) {
+		deadline = call->tc_pqlink.deadline;
+	}
+	timer_queue_unlock(queue);
+
+	return deadline;
+}
+
+/*
+ * Coalesce a timer being armed with the wakeups already programmed.
+ * May pull *deadline in (never below soft_deadline) to share a wakeup.
+ *
+ * Returns the housekeeping CPU's queue if the timer should be queued
+ * there, or NULL to use timer_queue_assign().
+ *
+ * Called at splclock.
+ */
+static mpqueue_head_t *
+timer_call_coalesce(
+	uint64_t                *deadline,
+	uint64_t                soft_deadline,
+	uint32_t                flags)
+{
+	uint32_t        urgency = (flags & TIMER_CALL_URGENCY_MASK);
+	int             hk_cpu = os_atomic_load(&timer_housekeeping_cpu, relaxed);
+	int             cpu = cpu_number();
+	mpqueue_head_t  *queue;
+	uint64_t        next;
+
+	if (!mach_timer_coalescing_enabled || *deadline == soft_deadline ||
+	    *deadline == UINT64_MAX) {
+		return NULL;
+	}
+
+	/*
+	 * Share the local CPU's next wakeup if it is within the leeway.
+	 * Timers whose soft deadline has passed all expire from the same
+	 * interrupt, so the earliest soft deadline is as good a target as
+	 * the hard one, and it can be read without the queue lock.
+	 */
+	next = os_atomic_load(&timer_queue_cpu(cpu)->earliest_soft_deadline, relaxed);
+	if (soft_deadline <= next && next <= *deadline) {
+		*deadline = next;
+		os_atomic_inc(&timer_coalesce_aligned, relaxed);
+		return NULL;
+	}
+
+	if (hk_cpu < 0 || hk_cpu == cpu || hk_cpu >= MAX_SCHED_CPUS ||
+	    (flags & TIMER_CALL_LOCAL) ||
+	    urgency == TIMER_CALL_SYS_CRITICAL ||
+	    urgency == TIMER_CALL_USER_CRITICAL) {
+		return NULL;
+	}
+
+	processor_t hk_processor = cpu_to_processor(hk_cpu);
+	if (hk_processor == PROCESSOR_NULL ||
+	    hk_processor->state == PROCESSOR_OFF_LINE ||
+	    hk_processor->state == PROCESSOR_SHUTDOWN) {
+		return NULL;
+	}
+
+	/* Only move the timer if the housekeeping CPU wakes up before it is due */
+	queue = timer_queue_cpu(hk_cpu);
+	next = timer_queue_earliest_deadline(queue);
+	if (next > *deadline) {
+		return NULL;
+	}
+	if (next >= soft_deadline) {
+		*deadline = next;
+		os_atomic_inc(&timer_coalesce_aligned, relaxed);
+	}
+	os_atomic_inc(&timer_housekeeping_migrated, relaxed);
+	return queue;
+}
+
+/*
+ * The housekeeping CPU's earliest timer may have expired between
+ * timer_call_coalesce() and the enqueue. If the timer just queued
+ * there became the earliest one, no wakeup is programmed for it on
+ * that CPU; take it back onto the local queue rather than interrupt
+ * the housekeeping CPU, since callers may hold locks its callouts need.
+ *
+ * Called at splclock.
+ */
+static void
+timer_call_housekeeping_resync(
+	mpqueue_head_t          *queue,
+	timer_call_t            call,
+	uint64_t                deadline)
+{
+	timer_call_t    new_head;
+	mpqueue_head_t  *local;
+
+	simple_lock(&call->tc_lock, LCK_GRP_NULL);
+	timer_queue_lock_spin(queue);
+	if (mpqueue_for_timer_call(call) != queue || call->tc_async_dequeue ||
+	    priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink) != call) {
+		/* expired, cancelled, or an earlier wakeup is still programmed */
+		timer_queue_unlock(queue);
+		simple_unlock(&call->tc_lock);
+		return;
+	}
+	timer_call_entry_dequeue(call);
+	new_head = priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink);
+	if (new_head) {
+		queue->earliest_soft_deadline = new_head->tc_flags & TIMER_CALL_RATELIMITED ? new_head->tc_pqlink.deadline : new_head->tc_soft_deadline;
+	} else {
+		queue->earliest_soft_deadline = UINT64_MAX;
+	}
+	timer_queue_unlock(queue);
+
+	local = timer_queue_assign(deadline);
+	timer_queue_lock_spin(local);
+	timer_call_entry_enqueue_deadline(call, local, deadline);
+	timer_queue_unlock(local);
+	simple_unlock(&call->tc_lock);
+
+	os_atomic_inc(&timer_housekeeping_resyncs, relaxed);
+}
+
 /*
  * timer_call_*()
  *	return boolean indicating whether the call was previously queued.
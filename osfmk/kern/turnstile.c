@@ -48,6 +48,11 @@
 #include <libkern/section_keywords.h>
 
 static TUNABLE(int, turnstile_max_hop, "turnstile_max_hop", TURNSTILE_MAX_HOP_DEFAULT);
+/*
+ * Stop priority propagation at the first hop whose push is unchanged,
+ * unless that hop was already updated by turnstile_update_inheritor().
+ */
+static TUNABLE(bool, turnstile_chain_early_exit, "turnstile_chain_early_exit", true);
 static ZONE_DECLARE(turnstiles_zone, "turnstiles", sizeof(struct turnstile), ZC_NONE);
 
 static struct mpsc_daemon_queue turnstile_deallocate_queue;
@@ -97,6 +102,7 @@ static LCK_SPIN_DECLARE(global_turnstile_lock, &turnstiles_dev_lock_grp);
 /* Array to store stats for multi-hop boosting */
 static struct turnstile_stats turnstile_boost_stats[TURNSTILE_MAX_HOP_DEFAULT] = {};
 static struct turnstile_stats turnstile_unboost_stats[TURNSTILE_MAX_HOP_DEFAULT] = {};
+static struct turnstile_chain_stats turnstile_chain_stats = {};
 uint64_t thread_block_on_turnstile_count;
 uint64_t thread_block_on_regular_waitq_count;
 #endif /* DEVELOPMENT || DEBUG */
@@ -120,14 +126,17 @@ static void
 turnstile_update_inheritor_workq_priority_chain(struct turnstile *in_turnstile, spl_t s);
 static void
 turnstile_update_inheritor_thread_priority_chain(struct turnstile **in_turnstile,
-    thread_t *out_thread, int total_hop, turnstile_stats_update_flags_t tsu_flags);
+    thread_t *out_thread, int total_hop, boolean_t first_update,
+    turnstile_stats_update_flags_t tsu_flags);
 static void
 turnstile_update_inheritor_turnstile_priority_chain(struct turnstile **in_out_turnstile,
-    int total_hop, turnstile_stats_update_flags_t tsu_flags);
+    int total_hop, boolean_t first_update, turnstile_stats_update_flags_t tsu_flags);
 static void
 thread_update_waiting_turnstile_priority_chain(thread_t *in_thread,
     struct turnstile **out_turnstile, int thread_hop, int total_hop,
-    turnstile_stats_update_flags_t tsu_flags);
+    boolean_t first_update, turnstile_stats_update_flags_t tsu_flags);
+static void
+turnstile_chain_stats_update(int hop, bool early_exit);
 static boolean_t
 turnstile_update_turnstile_promotion_locked(struct turnstile *dst_turnstile,
     struct turnstile *src_turnstile);
@@ -2629,6 +2638,13 @@ turnstile_has_waiters(struct turnstile *turnstile)
  * Description: Update turnstile inheritor's priority and propagate
  *              the priority if the inheritor is blocked on a turnstile.
  *
+ *              Each hop compares the priority it pushes with the key of
+ *              its link in the next hop's priority queue, which caches
+ *              the last push, and the walk stops at the first hop where
+ *              they match.  The first hop is always walked if
+ *              TURNSTILE_NEEDS_PRI_UPDATE is passed, since
+ *              turnstile_update_inheritor() already updated its link.
+ *
  * Arg1: inheritor
  * Arg2: inheritor flags
  *
@@ -2645,6 +2661,9 @@ turnstile_update_inheritor_priority_chain(
 	spl_t s;
 	turnstile_stats_update_flags_t tsu_flags = ((turnstile_flags & TURNSTILE_UPDATE_BOOST) ?
 	    TSU_BOOST_ARG : TSU_FLAGS_NONE) | TSU_PRI_PROPAGATION;
+	boolean_t force_first_hop = !turnstile_chain_early_exit ||
+	    (turnstile_flags & TURNSTILE_NEEDS_PRI_UPDATE);
+	boolean_t first_update;
 
 	if (inheritor == NULL) {
 		return;
@@ -2671,6 +2690,8 @@ turnstile_update_inheritor_priority_chain(
 	}
 
 	while (turnstile != TURNSTILE_NULL || thread != THREAD_NULL) {
+		first_update = (total_hop == 0) && force_first_hop;
+
 		if (turnstile != TURNSTILE_NULL) {
 			if (turnstile->ts_inheritor == NULL) {
 				turnstile_stats_update(total_hop + 1, TSU_NO_INHERITOR |
@@ -2678,31 +2699,34 @@ turnstile_update_inheritor_priority_chain(
 				    turnstile);
 				waitq_unlock(&turnstile->ts_waitq);
 				turnstile = TURNSTILE_NULL;
+				total_hop++;
 				break;
 			}
 			if (turnstile->ts_inheritor_flags & TURNSTILE_INHERITOR_THREAD) {
 				turnstile_update_inheritor_thread_priority_chain(&turnstile, &thread,
-				    total_hop, tsu_flags);
+				    total_hop, first_update, tsu_flags);
 			} else if (turnstile->ts_inheritor_flags & TURNSTILE_INHERITOR_TURNSTILE) {
 				turnstile_update_inheritor_turnstile_priority_chain(&turnstile,
-				    total_hop, tsu_flags);
+				    total_hop, first_update, tsu_flags);
 			} else if (turnstile->ts_inheritor_flags & TURNSTILE_INHERITOR_WORKQ) {
 				turnstile_update_inheritor_workq_priority_chain(turnstile, s);
 				turnstile_stats_update(total_hop + 1, TSU_NO_PRI_CHANGE_NEEDED | tsu_flags,
 				    NULL);
+				turnstile_chain_stats_update(total_hop + 1, false);
 				return;
 			} else {
 				panic("Inheritor flags not passed in turnstile_update_inheritor");
 			}
 		} else if (thread != THREAD_NULL) {
 			thread_update_waiting_turnstile_priority_chain(&thread, &turnstile,
-			    thread_hop, total_hop, tsu_flags);
+			    thread_hop, total_hop, first_update, tsu_flags);
 			thread_hop++;
 		}
 		total_hop++;
 	}
 
 	splx(s);
+	turnstile_chain_stats_update(total_hop, false);
 	return;
 }
 
@@ -2735,7 +2759,8 @@ turnstile_update_inheritor_complete(
 	/* Perform priority update for new inheritor */
 	if (inheritor_flags & TURNSTILE_NEEDS_PRI_UPDATE) {
 		turnstile_update_inheritor_priority_chain(turnstile,
-		    TURNSTILE_INHERITOR_TURNSTILE | TURNSTILE_UPDATE_BOOST);
+		    TURNSTILE_INHERITOR_TURNSTILE | TURNSTILE_UPDATE_BOOST |
+		    TURNSTILE_NEEDS_PRI_UPDATE);
 	}
 }
 
@@ -2765,10 +2790,14 @@ turnstile_cleanup(void)
 		return;
 	}
 
-	/* Perform priority demotion for old inheritor */
+	/*
+	 * Perform priority demotion for old inheritor, its link in the
+	 * next hop still holds the old push, so the first hop can be
+	 * skipped if that push didn't change.
+	 */
 	if (inheritor_flags & TURNSTILE_INHERITOR_NEEDS_PRI_UPDATE) {
 		turnstile_update_inheritor_priority_chain(old_inheritor,
-		    inheritor_flags);
+		    inheritor_flags & ~TURNSTILE_NEEDS_PRI_UPDATE);
 	}
 
 	/* Drop thread reference for old inheritor */
@@ -2848,7 +2877,8 @@ turnstile_update_inheritor_workq_priority_chain(struct turnstile *turnstile, spl
  * Arg1: in_turnstile: address to turnstile
  * Arg2: out_thread: address to return the thread inheritor
  * Arg3: thread_hop: number to thread hop in propagation chain
- * Arg4: tsu_flags: turnstile update flags
+ * Arg4: first_update: whether to propagate even if the push didn't change
+ * Arg5: tsu_flags: turnstile update flags
  *
  * Returns: Implicit returns locked thread in out_thread if it needs
  *          further propagation.
@@ -2861,12 +2891,12 @@ turnstile_update_inheritor_thread_priority_chain(
 	struct turnstile **in_turnstile,
 	thread_t *out_thread,
 	int total_hop,
+	boolean_t first_update,
 	turnstile_stats_update_flags_t tsu_flags)
 {
 	boolean_t needs_update = FALSE;
 	struct turnstile *turnstile = *in_turnstile;
 	thread_t thread_inheritor = turnstile->ts_inheritor;
-	boolean_t first_update = !total_hop;
 
 	assert(turnstile->ts_inheritor_flags & TURNSTILE_INHERITOR_THREAD);
 	*in_turnstile = TURNSTILE_NULL;
@@ -2876,6 +2906,7 @@ turnstile_update_inheritor_thread_priority_chain(
 	if (!needs_update && !first_update) {
 		turnstile_stats_update(total_hop + 1, TSU_NO_PRI_CHANGE_NEEDED |
 		    TSU_TURNSTILE_ARG | tsu_flags, turnstile);
+		turnstile_chain_stats_update(total_hop + 1, true);
 		waitq_unlock(&turnstile->ts_waitq);
 		return;
 	}
@@ -2899,6 +2930,7 @@ turnstile_update_inheritor_thread_priority_chain(
 		    (thread_get_update_flags_for_turnstile_propagation_stoppage(thread_inheritor)) |
 		    TSU_TURNSTILE_ARG | tsu_flags,
 		    turnstile);
+		turnstile_chain_stats_update(total_hop + 1, true);
 		thread_unlock(thread_inheritor);
 		waitq_unlock(&turnstile->ts_waitq);
 		return;
@@ -2918,7 +2950,8 @@ turnstile_update_inheritor_thread_priority_chain(
  *
  * Arg1: in_out_turnstile: address to turnstile
  * Arg2: thread_hop: number of thread hop in propagation chain
- * Arg3: tsu_flags: turnstile update flags
+ * Arg3: first_update: whether to propagate even if the push didn't change
+ * Arg4: tsu_flags: turnstile update flags
  *
  * Returns: Implicit returns locked turnstile in in_out_turnstile if it needs
  *          further propagation.
@@ -2931,12 +2964,12 @@ static void
 turnstile_update_inheritor_turnstile_priority_chain(
 	struct turnstile **in_out_turnstile,
 	int total_hop,
+	boolean_t first_update,
 	turnstile_stats_update_flags_t tsu_flags)
 {
 	boolean_t needs_update = FALSE;
 	struct turnstile *turnstile = *in_out_turnstile;
 	struct turnstile *inheritor_turnstile = turnstile->ts_inheritor;
-	boolean_t first_update = !total_hop;
 
 	assert(turnstile->ts_inheritor_flags & TURNSTILE_INHERITOR_TURNSTILE);
 	*in_out_turnstile = TURNSTILE_NULL;
@@ -2947,6 +2980,7 @@ turnstile_update_inheritor_turnstile_priority_chain(
 		turnstile_stats_update(total_hop + 1, TSU_NO_PRI_CHANGE_NEEDED |
 		    TSU_TURNSTILE_ARG | tsu_flags,
 		    turnstile);
+		turnstile_chain_stats_update(total_hop + 1, true);
 		waitq_unlock(&turnstile->ts_waitq);
 		return;
 	}
@@ -2969,6 +3003,7 @@ turnstile_update_inheritor_turnstile_priority_chain(
 		    (inheritor_turnstile->ts_inheritor ? TSU_NO_PRI_CHANGE_NEEDED : TSU_NO_INHERITOR) |
 		    TSU_TURNSTILE_ARG | tsu_flags,
 		    turnstile);
+		turnstile_chain_stats_update(total_hop + 1, true);
 		waitq_unlock(&inheritor_turnstile->ts_waitq);
 		waitq_unlock(&turnstile->ts_waitq);
 		return;
@@ -2990,7 +3025,8 @@ turnstile_update_inheritor_turnstile_priority_chain(
  * Arg2: out_turnstile: pointer to turnstile to return to caller
  * Arg3: thread_hop: Number of thread hops visited
  * Arg4: total_hop: total hops visited
- * Arg5: tsu_flags: turnstile update flags
+ * Arg5: first_update: whether to propagate even if the push didn't change
+ * Arg6: tsu_flags: turnstile update flags
  *
  * Returns: *out_turnstile returns the inheritor if it needs further propagation.
  *
@@ -3002,13 +3038,13 @@ thread_update_waiting_turnstile_priority_chain(
 	struct turnstile **out_turnstile,
 	int thread_hop,
 	int total_hop,
+	boolean_t first_update,
 	turnstile_stats_update_flags_t tsu_flags)
 {
 	boolean_t needs_update = FALSE;
 	thread_t thread = *in_thread;
 	struct turnstile *waiting_turnstile = TURNSTILE_NULL;
 	uint32_t turnstile_gencount;
-	boolean_t first_update = !total_hop;
 
 	*in_thread = THREAD_NULL;
 
@@ -3035,6 +3071,7 @@ thread_update_waiting_turnstile_priority_chain(
 	if (!needs_update && !first_update) {
 		turnstile_stats_update(total_hop + 1, TSU_NO_PRI_CHANGE_NEEDED |
 		    TSU_THREAD_ARG | tsu_flags, thread);
+		turnstile_chain_stats_update(total_hop + 1, true);
 		thread_unlock(thread);
 		return;
 	}
@@ -3084,6 +3121,7 @@ thread_update_waiting_turnstile_priority_chain(
 		turnstile_stats_update(total_hop + 1,
 		    (waiting_turnstile->ts_inheritor ? TSU_NO_PRI_CHANGE_NEEDED : TSU_NO_INHERITOR) |
 		    TSU_THREAD_ARG | tsu_flags, thread);
+		turnstile_chain_stats_update(total_hop + 1, true);
 		thread_unlock(thread);
 		waitq_unlock(&waiting_turnstile->ts_waitq);
 		return;
@@ -3185,6 +3223,34 @@ turnstile_stats_update(
 #endif
 }
 
+/*
+ * Name: turnstile_chain_stats_update
+ *
+ * Description: Function to update the propagation walk histograms
+ *              for dev kernel.
+ *
+ * Arg1: hop : number of hops visited
+ * Arg2: early_exit : whether the walk stopped on an unchanged push
+ *
+ * Returns: Nothing
+ */
+static void
+turnstile_chain_stats_update(
+	int hop,
+	bool early_exit)
+{
+#if DEVELOPMENT || DEBUG
+	hop = MIN(hop, TURNSTILE_MAX_HOP_DEFAULT);
+	if (early_exit) {
+		os_atomic_inc(&turnstile_chain_stats.tcs_early_exit[hop], relaxed);
+	} else {
+		os_atomic_inc(&turnstile_chain_stats.tcs_walk_length[hop], relaxed);
+	}
+#else
+#pragma unused(hop, early_exit)
+#endif
+}
+
 static uint64_t
 kdp_turnstile_traverse_inheritor_chain(struct turnstile *ts, uint64_t *flags, uint8_t *hops)
 {
@@ -3341,6 +3407,22 @@ turnstile_get_unboost_stats_sysctl(
 	return sysctl_io_opaque(req, turnstile_unboost_stats, sizeof(struct turnstile_stats) * TURNSTILE_MAX_HOP_DEFAULT, NULL);
 }
 
+/*
+ * Name: turnstile_get_chain_stats_sysctl
+ *
+ * Description: Function to get the propagation walk histograms.
+ *
+ * Args: req : opaque struct to pass to sysctl_io_opaque
+ *
+ * Returns: errorno
+ */
+int
+turnstile_get_chain_stats_sysctl(
+	void *req)
+{
+	return sysctl_io_opaque(req, &turnstile_chain_stats, sizeof(struct turnstile_chain_stats), NULL);
+}
+
 /* Testing interface for Development kernels */
 #define tstile_test_prim_lock_interlock(test_prim) \
 	lck_spin_lock(&test_prim->ttprim_interlock)
@@ -43,6 +43,19 @@ struct turnstile_stats {
 	uint64_t ts_above_ui_pri_change;
 	uint64_t ts_no_turnstile;
 };
+
+/*
+ * Histograms of priority propagation walks, indexed by hop count.
+ * The last bucket also counts longer walks.
+ *
+ * tcs_walk_length:  number of hops visited by a walk.
+ * tcs_early_exit:   hop at which a walk stopped because the priority
+ *                   pushed by that hop didn't change.
+ */
+struct turnstile_chain_stats {
+	uint64_t tcs_walk_length[TURNSTILE_MAX_HOP_DEFAULT + 1];
+	uint64_t tcs_early_exit[TURNSTILE_MAX_HOP_DEFAULT + 1];
+};
 #endif
 
 #ifdef KERNEL_PRIVATE
@@ -665,6 +678,8 @@ int
 turnstile_get_boost_stats_sysctl(void *req);
 int
 turnstile_get_unboost_stats_sysctl(void *req);
+int
+turnstile_get_chain_stats_sysctl(void *req);
 #endif /* DEVELOPMENT || DEBUG */
 #endif /* XNU_KERNEL_PRIVATE */
 
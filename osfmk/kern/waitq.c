@@ -626,6 +626,7 @@ struct wq_prepost {
 		/* wqt_type == WQP_WQ (LT_ELEM) */
 		struct {
 			struct waitq *wqp_wq_ptr;
+			uint64_t      wqp_wq_set_gen; /* see wq_prepost_set_hint() */
 		} wqp_wq;
 		/* wqt_type == WQP_POST (LT_LINK) */
 		struct {
@@ -943,6 +944,53 @@ wq_prepost_reset_rnext(struct wq_prepost *wqp)
 	(void)lt_elem_list_break(&g_prepost_table, &wqp->wqte);
 }
 
+/*
+ * Finding out whether a waitq already preposted to a set used to walk the
+ * set's prepost list, which is as long as the number of preposted members:
+ * posting to a port set or kqueue with a lot of active members was linear.
+ *
+ * Instead, the WQP_WQ object of a waitq remembers the prepost generation
+ * of the last set it preposted to.  Generations are unique across sets,
+ * a set draws a new one whenever its prepost list is dropped wholesale,
+ * and removing a single prepost from a set forgets the hint of its waitq,
+ * so a hint matching the set's generation means the waitq is on its list.
+ *
+ * Hints are only set with both the waitq and the set locked, and only
+ * cleared with the set locked, which the atomics make safe against
+ * concurrent updates on behalf of other sets.
+ */
+static uint64_t g_wqset_prepost_gen;
+
+static void
+wqset_prepost_new_gen(struct waitq_set *wqset)
+{
+	wqset->wqset_prepost_gen = os_atomic_inc(&g_wqset_prepost_gen, relaxed);
+}
+
+static void
+wq_prepost_set_hint(struct wq_prepost *wqp, struct waitq_set *wqset)
+{
+	assert(wqp_type(wqp) == WQP_WQ);
+	os_atomic_store(&wqp->wqp_wq.wqp_wq_set_gen,
+	    wqset->wqset_prepost_gen, relaxed);
+}
+
+static bool
+wq_prepost_has_hint(struct wq_prepost *wqp, struct waitq_set *wqset)
+{
+	assert(wqp_type(wqp) == WQP_WQ);
+	return os_atomic_load(&wqp->wqp_wq.wqp_wq_set_gen, relaxed) ==
+	       wqset->wqset_prepost_gen;
+}
+
+static void
+wq_prepost_clear_hint(struct wq_prepost *wqp, struct waitq_set *wqset)
+{
+	assert(wqp_type(wqp) == WQP_WQ);
+	os_atomic_cmpxchg(&wqp->wqp_wq.wqp_wq_set_gen,
+	    wqset->wqset_prepost_gen, 0, relaxed);
+}
+
 
 /**
  * remove 'wqp' from the prepost list on 'wqset'
@@ -963,11 +1011,17 @@ wq_prepost_remove(struct waitq_set *wqset,
 	int more_posts = 1;
 	uint64_t next_id = wqp->wqp_post.wqp_next_id;
 	uint64_t wqp_id = wqp->wqp_prepostid.id;
-	struct wq_prepost *prev_wqp, *next_wqp;
+	struct wq_prepost *prev_wqp, *next_wqp, *wq_wqp;
 
 	assert(wqp_type(wqp) == WQP_POST);
 	assert(wqset->wqset_q.waitq_prepost == 1);
 
+	wq_wqp = wq_prepost_get(wqp->wqp_post.wqp_wq_id);
+	if (wq_wqp) {
+		wq_prepost_clear_hint(wq_wqp, wqset);
+		wq_prepost_put(wq_wqp);
+	}
+
 	if (next_id == wqp_id) {
 		/* the list is singular and becoming empty */
 		wqset->wqset_prepost_id = 0;
@@ -1116,6 +1170,7 @@ restart:
 		 * set's prepost id.
 		 */
 		wqset->wqset_prepost_id = 0;
+		wqset_prepost_new_gen(wqset);
 		return WQ_ITERATE_SUCCESS;
 	}
 
@@ -1129,6 +1184,7 @@ restart:
 			/* the caller wants to remove the only prepost here */
 			assert(wqp_id == wqset->wqset_prepost_id);
 			wqset->wqset_prepost_id = 0;
+			wq_prepost_clear_hint(wqp, wqset);
 			OS_FALLTHROUGH;
 		case WQ_ITERATE_CONTINUE:
 			wq_prepost_put(wqp);
@@ -1401,23 +1457,41 @@ wq_is_preposted_on_set_cb(struct waitq_set *wqset, void *ctx,
 static int
 wq_is_preposted_on_set(struct waitq *waitq, struct waitq_set *wqset)
 {
-	int ret;
 	struct _is_posted_ctx pctx;
+	struct wq_prepost *wqp;
+
+	/* a waitq without a WQP_WQ object can't be on any prepost list */
+	if (waitq->waitq_prepost_id == 0) {
+		return 0;
+	}
 
 	/*
 	 * If the set's only prepost matches the waitq's prepost ID,
 	 * then it obviously already preposted to the set.
 	 */
-	if (waitq->waitq_prepost_id != 0 &&
-	    wqset->wqset_prepost_id == waitq->waitq_prepost_id) {
+	if (wqset->wqset_prepost_id == waitq->waitq_prepost_id) {
 		return 1;
 	}
 
-	/* use full prepost iteration: always trim the list */
+	wqp = wq_prepost_get(waitq->waitq_prepost_id);
+	assert(wqp != NULL);
+	if (wq_prepost_has_hint(wqp, wqset)) {
+		wq_prepost_put(wqp);
+		return 1;
+	}
+
+	/*
+	 * The waitq last preposted to another set: use full prepost
+	 * iteration, which also trims the list.
+	 */
 	pctx.posting_wq = waitq;
 	pctx.did_prepost = 0;
-	ret = wq_prepost_foreach_locked(wqset, (void *)&pctx,
+	(void)wq_prepost_foreach_locked(wqset, (void *)&pctx,
 	    wq_is_preposted_on_set_cb);
+	if (pctx.did_prepost) {
+		wq_prepost_set_hint(wqp, wqset);
+	}
+	wq_prepost_put(wqp);
 	return pctx.did_prepost;
 }
 
@@ -1485,15 +1559,23 @@ wq_prepost_do_post_locked(struct waitq_set *wqset,
 	/*
 	 * This function is called because an event is being posted to 'waitq'.
 	 * We need a prepost object associated with this queue. Allocate one
-	 * now if the waitq isn't already associated with one.
+	 * now if the waitq isn't already associated with one, and remember
+	 * that the waitq is preposted to this set (nothing below can fail).
 	 */
 	if (waitq->waitq_prepost_id == 0) {
 		struct wq_prepost *wqp;
 		wqp = wq_get_prepost_obj(reserved, WQP_WQ);
 		wqp->wqp_wq.wqp_wq_ptr = waitq;
+		wqp->wqp_wq.wqp_wq_set_gen = wqset->wqset_prepost_gen;
 		wqp_set_valid(wqp);
 		waitq->waitq_prepost_id = wqp->wqp_prepostid.id;
 		wq_prepost_put(wqp);
+	} else {
+		struct wq_prepost *wqp;
+		wqp = wq_prepost_get(waitq->waitq_prepost_id);
+		assert(wqp != NULL);
+		wq_prepost_set_hint(wqp, wqset);
+		wq_prepost_put(wqp);
 	}
 
 #if CONFIG_LTABLE_STATS
@@ -1514,6 +1596,10 @@ wq_prepost_do_post_locked(struct waitq_set *wqset,
 	if (!wqp_head) {
 		/* the previous prepost has become invalid */
 		wqset->wqset_prepost_id = waitq->waitq_prepost_id;
+		wqset_prepost_new_gen(wqset);
+		wqp_head = wq_prepost_get(waitq->waitq_prepost_id);
+		wq_prepost_set_hint(wqp_head, wqset);
+		wq_prepost_put(wqp_head);
 		return;
 	}
 
@@ -3514,6 +3600,7 @@ waitq_set_init(struct waitq_set *wqset,
 	if (policy & SYNC_POLICY_PREPOST) {
 		wqset->wqset_q.waitq_prepost = 1;
 		wqset->wqset_prepost_id = 0;
+		wqset_prepost_new_gen(wqset);
 		assert(prepost_hook == NULL);
 	} else {
 		wqset->wqset_q.waitq_prepost = 0;
@@ -4492,6 +4579,7 @@ waitq_unlink_prepost_cb(struct waitq_set __unused *wqset, void *ctx,
 		/* this is the only prepost on this wait queue set */
 		wqdbg_v("unlink wqp (WQ) 0x%llx", wqp->wqp_prepostid.id);
 		ulctx->unlink_wqset->wqset_prepost_id = 0;
+		wq_prepost_clear_hint(wqp, ulctx->unlink_wqset);
 		return WQ_ITERATE_BREAK;
 	}
 
@@ -4863,6 +4951,7 @@ waitq_set_unlink_all_unlock(struct waitq_set *wqset)
 	prepost_id = 0;
 	if (wqset->wqset_q.waitq_prepost && wqset->wqset_prepost_id) {
 		prepost_id = wqset->wqset_prepost_id;
+		wqset_prepost_new_gen(wqset);
 	}
 	/* else { TODO: notify kqueue subsystem? } */
 	wqset->wqset_prepost_id = 0;
@@ -5239,6 +5328,7 @@ waitq_set_clear_preposts(struct waitq_set *wqset)
 	waitq_set_lock(wqset);
 	prepost_id = wqset->wqset_prepost_id;
 	wqset->wqset_prepost_id = 0;
+	wqset_prepost_new_gen(wqset);
 	waitq_set_unlock(wqset);
 	if (waitq_irq_safe(&wqset->wqset_q)) {
 		splx(spl);
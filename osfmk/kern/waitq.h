@@ -65,16 +65,16 @@ typedef enum e_waitq_lock_state {
 	#define WQS_OPAQUE_ALIGN  __BIGGEST_ALIGNMENT__
 	#if __arm__
 		#define WQ_OPAQUE_SIZE   32
-		#define WQS_OPAQUE_SIZE  48
+		#define WQS_OPAQUE_SIZE  56
 	#else
 		#define WQ_OPAQUE_SIZE   40
-		#define WQS_OPAQUE_SIZE  56
+		#define WQS_OPAQUE_SIZE  64
 	#endif
 #elif __x86_64__
 	#define WQ_OPAQUE_ALIGN   8
 	#define WQS_OPAQUE_ALIGN  8
 	#define WQ_OPAQUE_SIZE   48
-	#define WQS_OPAQUE_SIZE  64
+	#define WQS_OPAQUE_SIZE  72
 #else
 	#error Unknown size requirement
 #endif
@@ -188,6 +188,7 @@ struct waitq_set {
 		uint64_t     wqset_prepost_id;
 		void        *wqset_prepost_hook;
 	};
+	uint64_t     wqset_prepost_gen;
 };
 
 #define WQSET_NOT_LINKED       ((uint64_t)(~0))
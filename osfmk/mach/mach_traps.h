@@ -113,6 +113,10 @@ extern mach_msg_return_t mach_msg_overwrite_trap(
 	mach_msg_header_t *rcv_msg,
 	mach_msg_size_t rcv_limit);
 
+extern mach_msg_return_t mach_msg_vector_trap(
+	mach_msg_vector_t *vec,
+	mach_msg_size_t count);
+
 extern kern_return_t semaphore_signal_trap(
 	mach_port_name_t signal_name);
 
@@ -449,6 +453,13 @@ extern mach_msg_return_t mach_msg_trap(
 extern mach_msg_return_t mach_msg_overwrite_trap(
 	struct mach_msg_overwrite_trap_args *args);
 
+struct mach_msg_vector_trap_args {
+	PAD_ARG_(user_addr_t, vec);
+	PAD_ARG_(mach_msg_size_t, count);
+};
+extern mach_msg_return_t mach_msg_vector_trap(
+	struct mach_msg_vector_trap_args *args);
+
 struct semaphore_signal_trap_args {
 	PAD_ARG_(mach_port_name_t, signal_name);
 };
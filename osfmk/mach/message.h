@@ -1123,6 +1123,25 @@ typedef kern_return_t mach_msg_return_t;
 /* Waiting for a peek. (Internal use only.) */
 #endif
 
+#ifdef PRIVATE
+/*
+ *  An entry of a batch of mach_msg operations, see mach_msg_vector().
+ *
+ *  msgv_data is used as both the send and the receive buffer, as with
+ *  mach_msg().  The layout is the same for 32 and 64-bit processes.
+ */
+typedef struct {
+	uint64_t                        msgv_data;
+	mach_msg_option_t               msgv_option;
+	mach_msg_size_t                 msgv_send_size;
+	mach_msg_size_t                 msgv_rcv_size;
+	mach_port_name_t                msgv_rcv_name;
+	mach_msg_timeout_t              msgv_timeout;
+	mach_msg_return_t               msgv_result;    /* out */
+} mach_msg_vector_t;
+
+#define MACH_MSG_VECTOR_MAX             64
+#endif /* PRIVATE */
 
 __BEGIN_DECLS
 
@@ -1174,6 +1193,29 @@ extern mach_msg_return_t        mach_msg(
 	mach_msg_timeout_t timeout,
 	mach_port_name_t notify);
 
+#ifdef PRIVATE
+/*
+ *	Routine:	mach_msg_vector
+ *	Purpose:
+ *		Perform the operations of an array of up to
+ *		MACH_MSG_VECTOR_MAX mach_msg_vector_t entries, in order,
+ *		in a single trap.  Every entry is processed and gets its
+ *		own result, regardless of whether earlier ones failed.
+ *
+ *		Interrupted operations are restarted as with mach_msg(),
+ *		after the rest of the batch has been processed.
+ *
+ *		Entries the kernel didn't get to, because the array
+ *		couldn't be read, report MACH_SEND_INVALID_DATA.
+ *
+ *		Returns MACH_MSG_SUCCESS, or the first error of the batch.
+ */
+__WATCHOS_PROHIBITED __TVOS_PROHIBITED
+extern mach_msg_return_t        mach_msg_vector(
+	mach_msg_vector_t *vec,
+	mach_msg_size_t count);
+#endif /* PRIVATE */
+
 /*
  *	Routine:	mach_voucher_deallocate
  *	Purpose:
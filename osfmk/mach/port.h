@@ -357,7 +357,9 @@ typedef struct mach_port_limits {
 typedef struct mach_port_info_ext {
 	mach_port_status_t      mpie_status;
 	mach_port_msgcount_t    mpie_boost_cnt;
-	uint32_t                reserved[6];
+	uint32_t                mpie_kmsg_pool_hits;    /* kernel messages that reused a cached buffer */
+	uint32_t                mpie_kmsg_pool_misses;  /* kernel messages that allocated one */
+	uint32_t                reserved[4];
 } mach_port_info_ext_t;
 
 typedef integer_t *mach_port_info_t;            /* varying array of natural_t */
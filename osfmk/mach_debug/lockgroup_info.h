@@ -71,4 +71,19 @@ typedef struct lockgroup_info {
 
 typedef lockgroup_info_t *lockgroup_info_array_t;
 
+/*
+ * Adaptive mutex spinning statistics, returned by host_lockgroup_spin_info.
+ * The counts are only maintained for lock groups with statistics enabled.
+ */
+typedef struct lockgroup_spin_info {
+	char            lockgroup_name[LOCKGROUP_MAX_NAME];
+	uint64_t        lock_mtx_spin_cnt;
+	uint64_t        lock_mtx_spin_acquired_cnt;
+	uint64_t        lock_mtx_spin_block_cnt;
+	uint64_t        lock_mtx_spin_time_cum;         /* nanoseconds */
+	uint64_t        lock_mtx_hold_avg;              /* nanoseconds */
+} lockgroup_spin_info_t;
+
+typedef lockgroup_spin_info_t *lockgroup_spin_info_array_t;
+
 #endif  /* _MACH_DEBUG_LOCKGROUP_INFO_H_ */
@@ -145,6 +145,15 @@ const char *debug4k_category_name[] = {
 #endif /* MACH_ASSERT */
 int debug4k_no_cow_copyin = 0;
 
+/*
+ * vm_map_copyin() with "src_destroy" hands the source VM object over to
+ * the copy, instead of setting up copy-on-write, when nothing else can
+ * see that object.  See vm_map_copyin_can_move().
+ */
+static TUNABLE(bool, vm_map_copyin_move, "vm_map_copyin_move", true);
+uint64_t vm_map_copyin_move_count = 0;
+uint64_t vm_map_copyin_move_size = 0;
+
 
 #if __arm64__
 extern const int fourk_binary_compatibility_unsafe;
@@ -10447,6 +10456,65 @@ slow_copy:
 	return KERN_SUCCESS;
 }/* vm_map_copy_overwrite_aligned */
 
+/*
+ *	Routine: vm_map_copyin_can_move [internal use only]
+ *
+ *	Description:
+ *		Returns whether "src_entry", which covers the entire range
+ *		being copied in and destroyed, can give its VM object to
+ *		the copy as is.
+ *
+ *		That is the case for plain anonymous memory mapped only
+ *		by that entry: nobody else can get to the object without
+ *		the map lock, so once the source range has been removed,
+ *		the copy is its sole owner and neither the source mapping
+ *		nor the copy need copy-on-write protection.
+ *
+ *		The caller must keep the map locked until the source
+ *		range is deleted.  On success, a reference was taken
+ *		on the object for the copy.
+ */
+static boolean_t
+vm_map_copyin_can_move(
+	vm_map_t        src_map,
+	vm_map_entry_t  src_entry)
+{
+	vm_object_t     object;
+	boolean_t       can_move;
+
+	if (!vm_map_copyin_move ||
+	    src_entry->is_sub_map ||
+	    src_entry->is_shared ||
+	    src_entry->wired_count != 0 ||
+	    src_entry->used_for_jit ||
+	    src_entry->iokit_acct ||
+	    !src_entry->use_pmap ||
+	    VM_MAP_PAGE_SHIFT(src_map) != PAGE_SHIFT) {
+		return FALSE;
+	}
+
+	object = VME_OBJECT(src_entry);
+	if (object == VM_OBJECT_NULL) {
+		return FALSE;
+	}
+
+	vm_object_lock(object);
+	can_move = (object->ref_count == 1 &&
+	    object->internal &&
+	    !object->true_share &&
+	    !object->phys_contiguous &&
+	    !object->code_signed &&
+	    object->copy_strategy == MEMORY_OBJECT_COPY_SYMMETRIC &&
+	    object->copy == VM_OBJECT_NULL &&
+	    VM_OBJECT_OWNER(object) == TASK_NULL);
+	if (can_move) {
+		vm_object_reference_locked(object);
+	}
+	vm_object_unlock(object);
+
+	return can_move;
+}
+
 /*
  *	Routine: vm_map_copyin_kernel_buffer [internal use only]
  *
@@ -11638,7 +11706,7 @@ vm_map_copyin_internal(
 
 		/*
 		 * If we are destroying the source, and the object
-		 * is internal, we could move the object reference
+		 * is internal, we move the object reference
 		 * from the source to the copy.  The copy is
 		 * copy-on-write only if the source is.
 		 * We make another reference to the object, because
@@ -11646,10 +11714,23 @@ vm_map_copyin_internal(
 		 *
 		 * This memory transfer has to be atomic, (to prevent
 		 * the VM object from being shared or copied while
-		 * it's being moved here), so we could only do this
+		 * it's being moved here), so we only do this
 		 * if we won't have to unlock the VM map until the
-		 * original mapping has been fully removed.
+		 * original mapping has been fully removed: when this
+		 * entry covers the whole range, this is the last
+		 * iteration.
 		 */
+		if (src_destroy &&
+		    parent_maps == NULL &&
+		    src_entry->vme_start == vm_map_trunc_page(src_addr,
+		    VM_MAP_PAGE_MASK(src_map)) &&
+		    src_entry->vme_end == src_end && src_end != 0 &&
+		    vm_map_copyin_can_move(src_map, src_entry)) {
+			new_entry->needs_copy = src_entry->needs_copy;
+			vm_map_copyin_move_count++;
+			vm_map_copyin_move_size += src_size;
+			goto CopySuccessful;
+		}
 
 RestartCopy:
 		if ((src_object == VM_OBJECT_NULL ||
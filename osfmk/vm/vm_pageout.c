@@ -122,6 +122,7 @@
 extern int cs_debug;
 
 extern void mbuf_drain(boolean_t);
+extern void ipc_kmsg_pool_drain(void);
 
 #if VM_PRESSURE_EVENTS
 #if CONFIG_JETSAM
@@ -4607,6 +4608,7 @@ vm_pageout_garbage_collect(int collect)
 
 			consider_machine_collect();
 			mbuf_drain(FALSE);
+			ipc_kmsg_pool_drain();
 
 			do {
 				if (consider_buffer_cache_collect != NULL) {
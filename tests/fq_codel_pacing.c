@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+
+#include <sys/sysctl.h>
+#include <errno.h>
+#include <string.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+/* wheel, purge, thread call release and drop; teardown ends the run */
+#define PACING_TEST_STAGES      4
+
+T_DECL(fq_codel_pacing, "paced flows are held, released, purged, dropped "
+    "and torn down", T_META_ASROOT(true))
+{
+	size_t size = sizeof(int);
+	int value = 1, stages = 0;
+
+	if (sysctlbyname("net.classq.fq_codel.pacing_test", &stages, &size,
+	    &value, sizeof(value)) != 0) {
+		if (errno == ENOENT) {
+			T_SKIP("net.classq.fq_codel.pacing_test is not available");
+		} else if (errno == ENOTSUP || errno == EBUSY) {
+			T_SKIP("pacing is disabled or lo0 has a send queue");
+		}
+		T_ASSERT_FAIL("net.classq.fq_codel.pacing_test: %s",
+		    strerror(errno));
+	}
+	T_EXPECT_EQ(stages, PACING_TEST_STAGES, "all %d stages passed",
+	    PACING_TEST_STAGES);
+}
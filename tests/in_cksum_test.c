@@ -3,6 +3,9 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <mach/mach_time.h>
+#include <sys/sysctl.h>
 
 #include <darwintest.h>
 
@@ -233,3 +236,86 @@ T_DECL(in_cksum_49479689b, "tests os_cpu_in_cksum with many random packets in va
 		test_one_random_packet(4096);
 	}
 }
+
+/*
+ * os_cpu_copy_in_cksum() and m_copydata_sum() only exist in the kernel;
+ * kern.ipc.copydata_sum_test compares them with m_copydata() and a copy
+ * of dumb_in_cksum() over odd offsets, odd-length mbufs and unaligned
+ * destinations, and returns the number of copies it checked.
+ */
+T_DECL(in_cksum_copydata_sum, "tests copy-and-checksum against a copy followed by a checksum",
+    T_META_ASROOT(true))
+{
+	int rounds = 10, checked = 0;
+	size_t size = sizeof(checked);
+
+	if (sysctlbyname("kern.ipc.copydata_sum_test", NULL, &size, NULL, 0) != 0) {
+		T_SKIP("kern.ipc.copydata_sum_test is not available");
+	}
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.ipc.copydata_sum_test",
+	    &checked, &size, &rounds, sizeof(rounds)),
+	    "copied bytes and folded sums match the reference");
+	T_EXPECT_GT(checked, 0, "%d copies checked", checked);
+}
+
+/* sizes of a header, a full-sized and a jumbo frame, and a TSO segment */
+static const uint32_t cksum_bench_sizes[] = { 64, 1500, 9000, 65536 };
+
+#define CKSUM_BENCH_BYTES       (256u << 20)    /* per size and routine */
+
+static double
+cksum_bench_mbps(const uint8_t *buf, uint32_t len, bool dumb)
+{
+	mach_timebase_info_data_t tb;
+	uint32_t iters = CKSUM_BENCH_BYTES / len;
+	uint64_t start, elapsed;
+	volatile uint16_t sink = 0;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&tb), "mach_timebase_info");
+
+	start = mach_absolute_time();
+	for (uint32_t i = 0; i < iters; i++) {
+		if (dumb) {
+			sink = dumb_in_cksum(buf, len);
+		} else {
+			sink = ~os_cpu_in_cksum(buf, len, 0) & 0xffff;
+		}
+	}
+	elapsed = (mach_absolute_time() - start) * tb.numer / tb.denom;
+	(void)sink;
+
+	return ((double)iters * len / (1 << 20)) / ((double)elapsed / 1e9);
+}
+
+T_DECL(in_cksum_throughput, "measures os_cpu_in_cksum throughput over packet-sized buffers",
+    T_META_TAG_PERF, T_META_CHECK_LEAKS(false), T_META_RUN_CONCURRENTLY(false))
+{
+	uint8_t *buf = malloc(65536 + 1);
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	arc4random_buf(buf, 65536 + 1);
+
+	for (size_t i = 0; i < sizeof(cksum_bench_sizes) / sizeof(cksum_bench_sizes[0]); i++) {
+		uint32_t len = cksum_bench_sizes[i];
+		char metric[64];
+
+		/* aligned and odd-aligned starts take different paths */
+		for (uint32_t align = 0; align < 2; align++) {
+			double fast, dumb;
+
+			T_QUIET; T_ASSERT_EQ((uint16_t)(~os_cpu_in_cksum(buf + align, len, 0) & 0xffff),
+			    dumb_in_cksum(buf + align, len), "checksum of %u bytes at +%u", len, align);
+
+			fast = cksum_bench_mbps(buf + align, len, false);
+			dumb = cksum_bench_mbps(buf + align, len, true);
+
+			snprintf(metric, sizeof(metric), "in_cksum_%u%s", len, align ? "_odd" : "");
+			T_PERF(metric, fast, "MB/s", "os_cpu_in_cksum throughput");
+			T_LOG("%u bytes at +%u: %.0f MB/s (%.1fx the reference)",
+			    len, align, fast, fast / dumb);
+		}
+	}
+
+	free(buf);
+}
@@ -0,0 +1,35 @@
+/*
+ * inpcb_lookup: cost of looking up established pcbs with and without
+ * the pcbinfo lock
+ */
+
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+
+#include <darwintest.h>
+#include <errno.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"),
+    T_META_RUN_CONCURRENTLY(false));
+
+T_DECL(inpcb_lookup_bench, "look up one million established pcbs",
+    T_META_ASROOT(true))
+{
+	uint64_t count = 1000 * 1000, nsecs[2] = { 0, 0 };
+	size_t nlen = sizeof(nsecs);
+	int error;
+
+	error = sysctlbyname("net.inet.ip.pcblookup_bench", nsecs, &nlen,
+	    &count, sizeof(count));
+	if (error != 0 && errno == ENOENT) {
+		T_SKIP("net.inet.ip.pcblookup_bench is not available");
+	}
+	if (error != 0 && errno == ENOMEM) {
+		T_SKIP("not enough memory for %lld pcbs", count);
+	}
+	T_ASSERT_POSIX_SUCCESS(error, "sysctlbyname");
+	T_LOG("%lld pcbs: %lld ns/lookup lockless, %lld ns/lookup locked",
+	    count, nsecs[0], nsecs[1]);
+}
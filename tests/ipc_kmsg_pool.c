@@ -0,0 +1,71 @@
+#define T_NAMESPACE "xnu.ipc"
+#include <darwintest.h>
+
+#include <mach/mach.h>
+#include <mach/mig.h>
+
+T_GLOBAL_META(T_META_RUN_CONCURRENTLY(true));
+
+/* well past the rate at which a port gets a pool */
+#define ITERATIONS      1000
+
+static mach_port_info_ext_t
+port_info_ext(mach_port_t port)
+{
+	mach_port_info_ext_t info = { };
+	mach_msg_type_number_t count = MACH_PORT_INFO_EXT_COUNT;
+	kern_return_t kr;
+
+	kr = mach_port_get_attributes(mach_task_self(), port, MACH_PORT_INFO_EXT,
+	    (mach_port_info_t)&info, &count);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(MACH_PORT_INFO_EXT)");
+	return info;
+}
+
+static void
+task_info_calls(int n)
+{
+	task_basic_info_data_t tinfo;
+	mach_msg_type_number_t count;
+	kern_return_t kr;
+
+	for (int i = 0; i < n; i++) {
+		count = TASK_BASIC_INFO_COUNT;
+		kr = task_info(mach_task_self(), TASK_BASIC_INFO,
+		    (task_info_t)&tinfo, &count);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "task_info");
+	}
+}
+
+T_DECL(ipc_kmsg_pool_mig_reply,
+    "MIG replies to a thread's reply port reuse pooled kmsgs")
+{
+	mach_port_t reply_port = mig_get_reply_port();
+	mach_port_info_ext_t before, after;
+
+	before = port_info_ext(reply_port);
+	task_info_calls(ITERATIONS);
+	after = port_info_ext(reply_port);
+	T_LOG("kmsg pool: %u hits, %u misses",
+	    after.mpie_kmsg_pool_hits - before.mpie_kmsg_pool_hits,
+	    after.mpie_kmsg_pool_misses - before.mpie_kmsg_pool_misses);
+
+	T_EXPECT_GE(after.mpie_kmsg_pool_hits - before.mpie_kmsg_pool_hits,
+	    ITERATIONS / 2, "most replies reused a pooled kmsg");
+}
+
+T_DECL(ipc_kmsg_pool_lazy,
+    "ports the kernel rarely sends to don't get a pool")
+{
+	mach_port_t reply_port = mig_get_reply_port();
+	mach_port_info_ext_t info;
+
+	/* a fresh reply port, only sent a handful of replies */
+	mig_dealloc_reply_port(reply_port);
+	reply_port = mig_get_reply_port();
+	task_info_calls(4);
+
+	info = port_info_ext(reply_port);
+	T_EXPECT_EQ(info.mpie_kmsg_pool_hits + info.mpie_kmsg_pool_misses, 0,
+	    "no pool statistics without a pool");
+}
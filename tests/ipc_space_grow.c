@@ -0,0 +1,186 @@
+#define T_NAMESPACE "xnu.ipc"
+#include <darwintest.h>
+
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <mach/mach.h>
+
+T_GLOBAL_META(T_META_RUN_CONCURRENTLY(true));
+
+/* enough names to need a few segments past the first 4096 entries */
+#define NPORTS          20000
+#define NSEMAS          6000
+
+typedef struct {
+	mach_msg_header_t               header;
+	mach_msg_body_t                 body;
+	mach_msg_port_descriptor_t      port;
+} port_send_msg_t;
+
+typedef struct {
+	port_send_msg_t                 msg;
+	mach_msg_trailer_t              trailer;
+} port_rcv_msg_t;
+
+T_DECL(ipc_space_grow_many_ports,
+    "a space grows to many thousands of names and finds all of them")
+{
+	mach_port_t *ports = calloc(NPORTS, sizeof(mach_port_t));
+	mach_port_name_array_t names;
+	mach_port_type_array_t types;
+	mach_msg_type_number_t ncount, tcount;
+	mach_port_type_t type;
+	kern_return_t kr;
+
+	T_QUIET; T_ASSERT_NOTNULL(ports, "calloc");
+
+	for (int i = 0; i < NPORTS; i++) {
+		kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &ports[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate %d", i);
+	}
+	T_PASS("allocated %d receive rights", NPORTS);
+
+	for (int i = 0; i < NPORTS; i += 97) {
+		kr = mach_port_type(mach_task_self(), ports[i], &type);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_type %d", i);
+		T_QUIET; T_ASSERT_EQ(type, MACH_PORT_TYPE_RECEIVE, "port %d type", i);
+	}
+
+	kr = mach_port_names(mach_task_self(), &names, &ncount, &types, &tcount);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_names");
+	T_EXPECT_GE(ncount, NPORTS, "all the names are listed");
+	vm_deallocate(mach_task_self(), (vm_address_t)names, ncount * sizeof(*names));
+	vm_deallocate(mach_task_self(), (vm_address_t)types, tcount * sizeof(*types));
+
+	for (int i = 0; i < NPORTS; i++) {
+		kr = mach_port_mod_refs(mach_task_self(), ports[i],
+		    MACH_PORT_RIGHT_RECEIVE, -1);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_mod_refs %d", i);
+	}
+	free(ports);
+}
+
+T_DECL(ipc_space_grow_allocate_name,
+    "a name far past the end of the table can be allocated")
+{
+	/* index 3 * 4096 + 123, generation 3 */
+	mach_port_name_t name = ((3 * 4096 + 123) << 8) | 0x3;
+	mach_port_type_t type;
+	kern_return_t kr;
+
+	kr = mach_port_allocate_name(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, name);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate_name(0x%x)", name);
+
+	kr = mach_port_type(mach_task_self(), name, &type);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_type");
+	T_EXPECT_EQ(type, MACH_PORT_TYPE_RECEIVE, "type");
+
+	kr = mach_port_mod_refs(mach_task_self(), name, MACH_PORT_RIGHT_RECEIVE, -1);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_mod_refs");
+}
+
+T_DECL(ipc_space_grow_send_rights,
+    "send rights copied out again keep their name after the space grew")
+{
+	semaphore_t *semas = calloc(NSEMAS, sizeof(semaphore_t));
+	mach_port_t port;
+	kern_return_t kr;
+
+	T_QUIET; T_ASSERT_NOTNULL(semas, "calloc");
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+
+	/* semaphores are plain send rights, which are in the reverse hash */
+	for (int i = 0; i < NSEMAS; i++) {
+		kr = semaphore_create(mach_task_self(), &semas[i], SYNC_POLICY_FIFO, 0);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "semaphore_create %d", i);
+	}
+
+	for (int i = 0; i < NSEMAS; i += 61) {
+		port_rcv_msg_t rmsg = { };
+
+		rmsg.msg = (port_send_msg_t){
+			.header = {
+				.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND_ONCE, 0) |
+				    MACH_MSGH_BITS_COMPLEX,
+				.msgh_size = sizeof(port_send_msg_t),
+				.msgh_remote_port = port,
+			},
+			.body.msgh_descriptor_count = 1,
+			.port = {
+				.name = semas[i],
+				.disposition = MACH_MSG_TYPE_COPY_SEND,
+				.type = MACH_MSG_PORT_DESCRIPTOR,
+			},
+		};
+
+		kr = mach_msg(&rmsg.msg.header, MACH_SEND_MSG | MACH_RCV_MSG,
+		    sizeof(rmsg.msg), sizeof(rmsg), port, MACH_MSG_TIMEOUT_NONE,
+		    MACH_PORT_NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg %d", i);
+		T_QUIET; T_ASSERT_EQ(rmsg.msg.port.name, semas[i],
+		    "semaphore %d was copied out to its existing name", i);
+
+		kr = mach_port_deallocate(mach_task_self(), rmsg.msg.port.name);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_deallocate %d", i);
+	}
+	T_PASS("send rights were found by the reverse lookup");
+
+	for (int i = 0; i < NSEMAS; i++) {
+		kr = semaphore_destroy(mach_task_self(), semas[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "semaphore_destroy %d", i);
+	}
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+	free(semas);
+}
+
+static uint64_t
+hash_stat(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "%s", name);
+	return value;
+}
+
+T_DECL(ipc_space_hash_metrics,
+    "the reverse hash grows with the send rights and keeps probes short")
+{
+	semaphore_t *semas = calloc(NSEMAS, sizeof(semaphore_t));
+	uint64_t lookups, probes, resizes;
+	uint32_t probe_max = 0;
+	size_t size = sizeof(probe_max);
+	kern_return_t kr;
+
+	T_QUIET; T_ASSERT_NOTNULL(semas, "calloc");
+
+	lookups = hash_stat("kern.ipc_hash_lookups");
+	probes = hash_stat("kern.ipc_hash_lookup_probes");
+	resizes = hash_stat("kern.ipc_hash_resizes");
+
+	for (int i = 0; i < NSEMAS; i++) {
+		kr = semaphore_create(mach_task_self(), &semas[i], SYNC_POLICY_FIFO, 0);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "semaphore_create %d", i);
+	}
+
+	lookups = hash_stat("kern.ipc_hash_lookups") - lookups;
+	probes = hash_stat("kern.ipc_hash_lookup_probes") - probes;
+	T_EXPECT_GT(hash_stat("kern.ipc_hash_resizes"), resizes,
+	    "the reverse hash grew");
+	T_EXPECT_GE(lookups, (uint64_t)NSEMAS, "every copyout looked up the hash");
+	T_EXPECT_LT((double)probes / lookups, 2.0,
+	    "lookups look at %.2f buckets on average", (double)probes / lookups);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.ipc_hash_probe_max",
+	    &probe_max, &size, NULL, 0), "kern.ipc_hash_probe_max");
+	T_LOG("longest probe: %u buckets", probe_max);
+
+	for (int i = 0; i < NSEMAS; i++) {
+		kr = semaphore_destroy(mach_task_self(), semas[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "semaphore_destroy %d", i);
+	}
+	free(semas);
+}
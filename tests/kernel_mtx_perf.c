@@ -9,6 +9,7 @@
 #include <launch.h>
 #include <servers/bootstrap.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/event.h>
 #include <unistd.h>
 #include <crt_externs.h>
@@ -16,6 +17,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <spawn.h>
+#include <mach/mach.h>
+#include <mach_debug/lockgroup_info.h>
 
 T_GLOBAL_META(T_META_NAMESPACE("xnu.kernel_mtx_perf_test"));
 
@@ -436,3 +439,116 @@ T_DECL(kernel_mtx_perf_test,
 	test_from_kernel_lock_unlock_uncontended();
 	test_from_kernel_lock_unlock_contended();
 }
+
+#if defined(__x86_64__)
+#define TEST_SPIN_MTX_GRP_NAME  "testlck_mtx_spin"
+#define SPIN_ITER               20000
+
+static uint32_t saved_adaptive_spin;
+
+static void
+restore_adaptive_spin(void)
+{
+	sysctlbyname("kern.mutex_adaptive_spin", NULL, NULL,
+	    &saved_adaptive_spin, sizeof(saved_adaptive_spin));
+}
+
+static void
+get_test_spin_mtx_stats(lockgroup_spin_info_t *out)
+{
+	lockgroup_spin_info_array_t info;
+	mach_msg_type_number_t count;
+	kern_return_t kr;
+
+	memset(out, 0, sizeof(*out));
+
+	kr = host_lockgroup_spin_info(mach_host_self(), &info, &count);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "host_lockgroup_spin_info");
+
+	for (mach_msg_type_number_t i = 0; i < count; i++) {
+		if (strcmp(info[i].lockgroup_name, TEST_SPIN_MTX_GRP_NAME) == 0) {
+			*out = info[i];
+			break;
+		}
+	}
+
+	vm_deallocate(mach_task_self(), (vm_address_t)info, count * sizeof(*info));
+}
+
+/*
+ * Run the kernel's adaptive spin test with the given hold time and
+ * report how contended acquisitions were resolved: by spinning until
+ * the owner released the mutex, or by blocking after a spin that did
+ * not pay off.
+ */
+static void
+test_from_kernel_spin_contended(const char *profile, int hold_ns)
+{
+	lockgroup_spin_info_t before, after;
+	uint64_t spins, acquired, blocks, spin_ns, tot;
+	char input[40], output[200], name[80];
+	size_t size = sizeof(output);
+
+	get_test_spin_mtx_stats(&before);
+
+	snprintf(input, sizeof(input), "%d %d", SPIN_ITER, hold_ns);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.test_mtx_spin_contended",
+	    output, &size, input, strlen(input)), "kern.test_mtx_spin_contended");
+	T_QUIET; T_ASSERT_NOTNULL(strstr(output, "total time "), "total time reported");
+	sscanf(strstr(output, "total time "), "total time %llu", &tot);
+
+	get_test_spin_mtx_stats(&after);
+
+	spins = after.lock_mtx_spin_cnt - before.lock_mtx_spin_cnt;
+	acquired = after.lock_mtx_spin_acquired_cnt - before.lock_mtx_spin_acquired_cnt;
+	blocks = after.lock_mtx_spin_block_cnt - before.lock_mtx_spin_block_cnt;
+	spin_ns = after.lock_mtx_spin_time_cum - before.lock_mtx_spin_time_cum;
+
+	T_LOG("%s: %llu spins, %llu acquired spinning, %llu blocks, %llu ns spinning, hold estimate %llu ns",
+	    profile, spins, acquired, blocks, spin_ns, after.lock_mtx_hold_avg);
+
+	snprintf(name, sizeof(name), "%s avg time", profile);
+	T_PERF(name, tot / (2 * SPIN_ITER), "ns", "average time per acquisition of the contended mutex");
+
+	if (spins == 0) {
+		return;
+	}
+
+	snprintf(name, sizeof(name), "%s spin time per spin", profile);
+	T_PERF(name, spin_ns / spins, "ns", "average time spent spinning on the contended mutex");
+	snprintf(name, sizeof(name), "%s spin success", profile);
+	T_PERF(name, (double)acquired * 100 / spins, "%", "contended acquisitions satisfied by spinning");
+	snprintf(name, sizeof(name), "%s blocks per spin", profile);
+	T_PERF(name, (double)blocks / spins, "blocks", "contended acquisitions that went on to block");
+}
+
+static void
+set_adaptive_spin(uint32_t val)
+{
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.mutex_adaptive_spin", NULL, NULL,
+	    &val, sizeof(val)), "kern.mutex_adaptive_spin = %u", val);
+}
+
+T_DECL(kernel_mtx_adaptive_spin_perf_test,
+    "Kernel mutex contention with and without per lock group adaptive spinning",
+    T_META_ASROOT(YES), T_META_CHECK_LEAKS(NO))
+{
+	size_t size = sizeof(saved_adaptive_spin);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.mutex_adaptive_spin",
+	    &saved_adaptive_spin, &size, NULL, 0), "kern.mutex_adaptive_spin");
+	T_ATEND(restore_adaptive_spin);
+
+	fix_cpu_frequency();
+	T_ATEND(cleanup_cpu_freq);
+
+	/* short holds are worth spinning for, long ones are not */
+	set_adaptive_spin(0);
+	test_from_kernel_spin_contended("static spin short hold", 2000);
+	test_from_kernel_spin_contended("static spin long hold", 200000);
+
+	set_adaptive_spin(1);
+	test_from_kernel_spin_contended("adaptive spin short hold", 2000);
+	test_from_kernel_spin_contended("adaptive spin long hold", 200000);
+}
+#endif /* __x86_64__ */
@@ -0,0 +1,68 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+
+#include <darwintest.h>
+#include <darwintest_utils.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysctl.h>
+#include <sys/types.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.kernel_rw_perf_test"));
+
+#define ITER 100000
+
+/*
+ * Every available CPU hammers the same lock from the kernel, see
+ * lck_rw_test_contended().  The reported average is per acquisition,
+ * so for readers a scalable lock keeps it flat as CPUs are added.
+ */
+static void
+test_from_kernel_rw_contended(int percpu, int write_every)
+{
+	char input[40];
+	char buff[200];
+	size_t size = sizeof(buff);
+	uint64_t avg;
+	int threads, ret;
+	char *avg_p, *threads_p;
+	char name[60];
+	char desc[80];
+	const char *lock = percpu ? "lck_rw_percpu" : "lck_rw";
+
+	memset(buff, 0, sizeof(buff));
+	snprintf(input, sizeof(input), "%d %d %d", ITER, percpu, write_every);
+	ret = sysctlbyname("kern.test_rw_contended", buff, &size, input, strlen(input));
+	T_ASSERT_POSIX_SUCCESS(ret, "sysctlbyname kern.test_rw_contended %s", input);
+
+	T_LOG("%s write every %d: %s\n", lock, write_every, buff);
+
+	threads_p = strstr(buff, "threads ");
+	T_QUIET; T_ASSERT_NOTNULL(threads_p, "thread count not found");
+	sscanf(threads_p, "threads %d", &threads);
+
+	avg_p = strstr(buff, "avg ");
+	T_QUIET; T_ASSERT_NOTNULL(avg_p, "average not found");
+	sscanf(avg_p, "avg %llu", &avg);
+
+	if (write_every == 0) {
+		snprintf(name, sizeof(name), "%s read only", lock);
+	} else {
+		snprintf(name, sizeof(name), "%s 1 write every %d", lock, write_every);
+	}
+	snprintf(desc, sizeof(desc), "avg time per acquisition with %d threads", threads);
+	T_PERF(name, avg, "ns", desc);
+}
+
+T_DECL(kernel_rw_perf_test,
+    "Kernel reader writer lock scalability test, lck_rw_t against lck_rw_percpu_t",
+    T_META_ASROOT(YES), T_META_CHECK_LEAKS(NO))
+{
+	int write_every[] = { 0, 10000, 100 };
+
+	for (unsigned int i = 0; i < sizeof(write_every) / sizeof(write_every[0]); i++) {
+		test_from_kernel_rw_contended(0, write_every[i]);
+		test_from_kernel_rw_contended(1, write_every[i]);
+	}
+}
@@ -0,0 +1,170 @@
+#define T_NAMESPACE "xnu.ipc"
+#include <darwintest.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysctl.h>
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+
+T_GLOBAL_META(T_META_RUN_CONCURRENTLY(false));
+
+#define OOL_PAGES       16
+
+typedef struct {
+	mach_msg_header_t               header;
+	mach_msg_body_t                 body;
+	mach_msg_ool_descriptor_t       ool;
+} ool_send_msg_t;
+
+typedef struct {
+	ool_send_msg_t                  msg;
+	mach_msg_trailer_t              trailer;
+} ool_rcv_msg_t;
+
+static uint64_t
+move_count(void)
+{
+	uint64_t count = 0;
+	size_t size = sizeof(count);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.map_copyin_move_count",
+	    &count, &size, NULL, 0), "vm.map_copyin_move_count");
+	return count;
+}
+
+static mach_port_t
+alloc_port(void)
+{
+	mach_port_t port;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+	kr = mach_port_insert_right(mach_task_self(), port, port,
+	    MACH_MSG_TYPE_MAKE_SEND);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_right");
+	return port;
+}
+
+static void
+fill(unsigned char *buf, size_t size, unsigned char seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		buf[i] = (unsigned char)(seed + i / vm_page_size);
+	}
+}
+
+static void
+check(const unsigned char *buf, size_t size, unsigned char seed)
+{
+	for (size_t i = 0; i < size; i += vm_page_size / 4) {
+		if (buf[i] != (unsigned char)(seed + i / vm_page_size)) {
+			T_ASSERT_FAIL("byte %zu is %d, expected %d", i, buf[i],
+			    (unsigned char)(seed + i / vm_page_size));
+		}
+	}
+}
+
+/*
+ * Sends [addr, addr + size) to ourselves with deallocate set,
+ * and returns where it was received.
+ */
+static unsigned char *
+send_and_receive(mach_port_t port, mach_vm_address_t addr, mach_vm_size_t size)
+{
+	ool_send_msg_t smsg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0) |
+			    MACH_MSGH_BITS_COMPLEX,
+			.msgh_size = sizeof(smsg),
+			.msgh_remote_port = port,
+		},
+		.body.msgh_descriptor_count = 1,
+		.ool = {
+			.address = (void *)addr,
+			.size = (mach_msg_size_t)size,
+			.deallocate = TRUE,
+			.copy = MACH_MSG_VIRTUAL_COPY,
+			.type = MACH_MSG_OOL_DESCRIPTOR,
+		},
+	};
+	ool_rcv_msg_t rmsg = { };
+	kern_return_t kr;
+
+	kr = mach_msg(&smsg.header, MACH_SEND_MSG, sizeof(smsg), 0,
+	    MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(send)");
+
+	kr = mach_msg(&rmsg.msg.header, MACH_RCV_MSG, 0, sizeof(rmsg), port,
+	    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(receive)");
+	T_QUIET; T_ASSERT_EQ((mach_vm_size_t)rmsg.msg.ool.size, size, "OOL size");
+
+	return rmsg.msg.ool.address;
+}
+
+T_DECL(mach_msg_ool_move,
+    "deallocated OOL buffers are moved to the receiver",
+    T_META_CHECK_LEAKS(false))
+{
+	mach_vm_size_t size = OOL_PAGES * vm_page_size;
+	mach_vm_address_t addr = 0;
+	mach_port_t port = alloc_port();
+	unsigned char *rcv;
+	uint64_t before;
+	kern_return_t kr;
+
+	/* a tag of its own keeps the buffer from being coalesced with others */
+	kr = mach_vm_allocate(mach_task_self(), &addr, size, VM_FLAGS_ANYWHERE |
+	    VM_MAKE_TAG(VM_MEMORY_APPLICATION_SPECIFIC_16));
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+	fill((unsigned char *)addr, size, 1);
+
+	before = move_count();
+	rcv = send_and_receive(port, addr, size);
+	T_EXPECT_GT(move_count(), before, "the buffer was moved");
+
+	check(rcv, size, 1);
+	fill(rcv, size, 2);
+	check(rcv, size, 2);
+
+	kr = mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)rcv, size);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_deallocate");
+	mach_port_destroy(mach_task_self(), port);
+}
+
+T_DECL(mach_msg_ool_move_shared,
+    "deallocated OOL buffers with another mapping are copied on write",
+    T_META_CHECK_LEAKS(false))
+{
+	mach_vm_size_t size = OOL_PAGES * vm_page_size;
+	mach_vm_address_t addr = 0, alias = 0;
+	mach_port_t port = alloc_port();
+	vm_prot_t cur, max;
+	unsigned char *rcv;
+	kern_return_t kr;
+
+	kr = mach_vm_allocate(mach_task_self(), &addr, size, VM_FLAGS_ANYWHERE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+	fill((unsigned char *)addr, size, 1);
+
+	kr = mach_vm_remap(mach_task_self(), &alias, size, 0, VM_FLAGS_ANYWHERE,
+	    mach_task_self(), addr, FALSE, &cur, &max, VM_INHERIT_NONE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_remap");
+
+	rcv = send_and_receive(port, addr, size);
+
+	check(rcv, size, 1);
+	fill(rcv, size, 2);
+	check((unsigned char *)alias, size, 1);
+	fill((unsigned char *)alias, size, 3);
+	check(rcv, size, 2);
+	T_PASS("the receiver and the other mapping don't see each other's writes");
+
+	kr = mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)rcv, size);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_deallocate");
+	kr = mach_vm_deallocate(mach_task_self(), alias, size);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_deallocate");
+	mach_port_destroy(mach_task_self(), port);
+}
@@ -0,0 +1,177 @@
+#define T_NAMESPACE "xnu.ipc"
+#include <darwintest.h>
+
+#include <mach/mach.h>
+#include <mach/message.h>
+
+T_GLOBAL_META(T_META_RUN_CONCURRENTLY(true));
+
+#define NMSGS           8
+
+typedef struct {
+	mach_msg_header_t               header;
+	uint32_t                        seq;
+} vec_send_msg_t;
+
+typedef struct {
+	vec_send_msg_t                  msg;
+	mach_msg_trailer_t              trailer;
+} vec_rcv_msg_t;
+
+static mach_port_t
+alloc_port(void)
+{
+	mach_port_t port;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+	kr = mach_port_insert_right(mach_task_self(), port, port,
+	    MACH_MSG_TYPE_MAKE_SEND);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_right");
+	return port;
+}
+
+T_DECL(mach_msg_vector_send_receive,
+    "a batch of sends followed by a batch of receives keeps message order")
+{
+	vec_send_msg_t smsg[NMSGS];
+	vec_rcv_msg_t rmsg[NMSGS + 1];
+	mach_msg_vector_t vec[NMSGS + 1];
+	mach_port_t port = alloc_port();
+	mach_msg_return_t mr;
+
+	for (uint32_t i = 0; i < NMSGS; i++) {
+		smsg[i] = (vec_send_msg_t){
+			.header = {
+				.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+				.msgh_size = sizeof(smsg[i]),
+				.msgh_remote_port = port,
+				.msgh_id = 0x1000 + i,
+			},
+			.seq = i,
+		};
+		vec[i] = (mach_msg_vector_t){
+			.msgv_data = (uintptr_t)&smsg[i],
+			.msgv_option = MACH_SEND_MSG,
+			.msgv_send_size = sizeof(smsg[i]),
+			.msgv_result = ~0,
+		};
+	}
+
+	mr = mach_msg_vector(vec, NMSGS);
+	T_ASSERT_MACH_SUCCESS(mr, "mach_msg_vector(send x %d)", NMSGS);
+	for (uint32_t i = 0; i < NMSGS; i++) {
+		T_QUIET; T_EXPECT_MACH_SUCCESS(vec[i].msgv_result, "send %d", i);
+	}
+
+	/* one receive more than there are messages, that times out */
+	for (uint32_t i = 0; i < NMSGS + 1; i++) {
+		vec[i] = (mach_msg_vector_t){
+			.msgv_data = (uintptr_t)&rmsg[i],
+			.msgv_option = MACH_RCV_MSG | MACH_RCV_TIMEOUT,
+			.msgv_rcv_size = sizeof(rmsg[i]),
+			.msgv_rcv_name = port,
+			.msgv_timeout = 0,
+			.msgv_result = ~0,
+		};
+	}
+
+	mr = mach_msg_vector(vec, NMSGS + 1);
+	T_EXPECT_EQ(mr, MACH_RCV_TIMED_OUT, "the batch reports the failed entry");
+	for (uint32_t i = 0; i < NMSGS; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(vec[i].msgv_result, "receive %d", i);
+		T_QUIET; T_EXPECT_EQ(rmsg[i].msg.seq, i, "message %d is in order", i);
+		T_QUIET; T_EXPECT_EQ(rmsg[i].msg.header.msgh_id, 0x1000 + (int)i,
+		    "message %d id", i);
+	}
+	T_EXPECT_EQ(vec[NMSGS].msgv_result, MACH_RCV_TIMED_OUT,
+	    "the extra receive timed out");
+
+	mach_port_destroy(mach_task_self(), port);
+}
+
+T_DECL(mach_msg_vector_failures,
+    "failed entries don't stop the batch")
+{
+	vec_send_msg_t smsg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+			.msgh_size = sizeof(smsg),
+			.msgh_id = 0x2000,
+		},
+	};
+	vec_rcv_msg_t rmsg = { };
+	mach_port_t port = alloc_port();
+	mach_msg_return_t mr;
+
+	smsg.header.msgh_remote_port = port;
+
+	mach_msg_vector_t vec[] = {
+		{
+			/* bogus destination */
+			.msgv_data = (uintptr_t)&(vec_send_msg_t){
+				.header = {
+					.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+					.msgh_size = sizeof(smsg),
+					.msgh_remote_port = MACH_PORT_NULL,
+				},
+			},
+			.msgv_option = MACH_SEND_MSG,
+			.msgv_send_size = sizeof(smsg),
+		},
+		{
+			.msgv_data = (uintptr_t)&smsg,
+			.msgv_option = MACH_SEND_MSG,
+			.msgv_send_size = sizeof(smsg),
+		},
+		{
+			.msgv_data = (uintptr_t)&rmsg,
+			.msgv_option = MACH_RCV_MSG | MACH_RCV_TIMEOUT,
+			.msgv_rcv_size = sizeof(rmsg),
+			.msgv_rcv_name = port,
+		},
+	};
+
+	mr = mach_msg_vector(vec, sizeof(vec) / sizeof(vec[0]));
+	T_EXPECT_EQ(mr, MACH_SEND_INVALID_DEST, "the first error is returned");
+	T_EXPECT_EQ(vec[0].msgv_result, MACH_SEND_INVALID_DEST, "bad send failed");
+	T_EXPECT_MACH_SUCCESS(vec[1].msgv_result, "next send succeeded");
+	T_EXPECT_MACH_SUCCESS(vec[2].msgv_result, "receive succeeded");
+	T_EXPECT_EQ(rmsg.msg.header.msgh_id, 0x2000, "received the right message");
+
+	mach_port_destroy(mach_task_self(), port);
+}
+
+T_DECL(mach_msg_vector_limits,
+    "rejected batches don't restart stale interrupted entries")
+{
+	static mach_msg_vector_t vec[MACH_MSG_VECTOR_MAX + 1];
+	vec_rcv_msg_t rmsg = { };
+	mach_port_t port = alloc_port();
+	mach_msg_return_t mr;
+
+	/*
+	 * Blocking receives on an empty port, which would hang the test
+	 * if the stale results made the library restart them.
+	 */
+	for (uint32_t i = 0; i < MACH_MSG_VECTOR_MAX + 1; i++) {
+		vec[i] = (mach_msg_vector_t){
+			.msgv_data = (uintptr_t)&rmsg,
+			.msgv_option = MACH_RCV_MSG,
+			.msgv_rcv_size = sizeof(rmsg),
+			.msgv_rcv_name = port,
+			.msgv_result = MACH_RCV_INTERRUPTED,
+		};
+	}
+
+	mr = mach_msg_vector(vec, 0);
+	T_EXPECT_EQ(mr, MACH_SEND_INVALID_DATA, "empty batches are rejected");
+	mr = mach_msg_vector(vec, MACH_MSG_VECTOR_MAX + 1);
+	T_EXPECT_EQ(mr, MACH_SEND_INVALID_DATA, "batches are limited to %d",
+	    MACH_MSG_VECTOR_MAX);
+	T_EXPECT_EQ(vec[0].msgv_result, MACH_RCV_INTERRUPTED,
+	    "rejected batches are left untouched");
+
+	mach_port_destroy(mach_task_self(), port);
+}
@@ -0,0 +1,226 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/sysctl.h>
+
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/mk_timer.h>
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.mktimer"),
+    T_META_TAG_PERF,
+    T_META_ASROOT(true),
+    T_META_CHECK_LEAKS(false));
+
+#define BACKGROUND_TIMERS       4096
+#define TIMEOUT_NS              (200 * NSEC_PER_MSEC)
+#define LEEWAY_NS               (20 * NSEC_PER_MSEC)
+
+static mach_timebase_info_data_t timebase;
+static mach_port_t background[BACKGROUND_TIMERS];
+static int saved_wheel = -1;
+
+static uint64_t
+ns_to_abs(uint64_t ns)
+{
+	return ns * timebase.denom / timebase.numer;
+}
+
+static void
+restore_wheel(void)
+{
+	if (saved_wheel != -1) {
+		sysctlbyname("kern.timer.thread_call_wheel", NULL, NULL,
+		    &saved_wheel, sizeof(saved_wheel));
+	}
+}
+
+static void
+set_wheel(int enabled)
+{
+	size_t size = sizeof(saved_wheel);
+
+	if (saved_wheel == -1) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.timer.thread_call_wheel",
+		    &saved_wheel, &size, NULL, 0), "read kern.timer.thread_call_wheel");
+		T_ATEND(restore_wheel);
+	}
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.timer.thread_call_wheel", NULL, NULL,
+	    &enabled, sizeof(enabled)), "kern.timer.thread_call_wheel = %d", enabled);
+}
+
+/*
+ * Keep a population of armed timers around so that arm and cancel
+ * operate on a loaded delayed queue, like a busy networking or
+ * dispatch workload would.
+ */
+static void
+arm_background_timers(uint64_t leeway)
+{
+	uint64_t now = mach_absolute_time();
+
+	for (int i = 0; i < BACKGROUND_TIMERS; i++) {
+		if (background[i] == MACH_PORT_NULL) {
+			background[i] = mk_timer_create();
+			T_QUIET; T_ASSERT_NE(background[i], (mach_port_t)MACH_PORT_NULL, "mk_timer_create");
+		}
+
+		/* spread deadlines out so they don't all hash together */
+		uint64_t deadline = now + ns_to_abs(NSEC_PER_SEC) + ns_to_abs((uint64_t)i * NSEC_PER_MSEC);
+		kern_return_t kr = mk_timer_arm_leeway(background[i], MK_TIMER_NORMAL, deadline, leeway);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mk_timer_arm_leeway");
+	}
+}
+
+static void
+cancel_background_timers(void)
+{
+	for (int i = 0; i < BACKGROUND_TIMERS; i++) {
+		if (background[i] != MACH_PORT_NULL) {
+			mk_timer_destroy(background[i]);
+			background[i] = MACH_PORT_NULL;
+		}
+	}
+}
+
+static void
+measure_arm_cancel(const char *name, uint64_t leeway_ns)
+{
+	mach_port_t timer_port = mk_timer_create();
+	T_QUIET; T_ASSERT_NE(timer_port, (mach_port_t)MACH_PORT_NULL, "mk_timer_create");
+
+	uint64_t leeway = ns_to_abs(leeway_ns);
+	uint64_t timeout = ns_to_abs(TIMEOUT_NS);
+
+	arm_background_timers(leeway);
+
+	dt_stat_time_t s = dt_stat_time_create("%s", name);
+	T_STAT_MEASURE_LOOP(s) {
+		uint64_t result_time;
+
+		mk_timer_arm_leeway(timer_port, MK_TIMER_NORMAL,
+		    mach_absolute_time() + timeout, leeway);
+		mk_timer_cancel(timer_port, &result_time);
+	}
+	dt_stat_finalize(s);
+
+	cancel_background_timers();
+	mk_timer_destroy(timer_port);
+}
+
+T_DECL(mktimer_arm_cancel_pqueue,
+    "mk_timer arm + cancel with the delayed priority queue")
+{
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&timebase), "mach_timebase_info");
+	set_wheel(0);
+
+	measure_arm_cancel("arm_cancel_pqueue", LEEWAY_NS);
+}
+
+T_DECL(mktimer_arm_cancel_wheel,
+    "mk_timer arm + cancel with the thread call timer wheel")
+{
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&timebase), "mach_timebase_info");
+	set_wheel(1);
+
+	measure_arm_cancel("arm_cancel_wheel", LEEWAY_NS);
+}
+
+T_DECL(mktimer_arm_cancel_wheel_hard,
+    "mk_timer arm + cancel of zero-leeway timers with the wheel enabled")
+{
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&timebase), "mach_timebase_info");
+	set_wheel(1);
+
+	/* no leeway: every call stays on the priority queue */
+	measure_arm_cancel("arm_cancel_wheel_hard", 0);
+}
+
+T_DECL(mktimer_wheel_fires, "mk_timers placed on the timer wheel still fire")
+{
+	mach_port_t timer_port = MACH_PORT_NULL;
+	uint64_t inserts = 0, expired = 0;
+	size_t size = sizeof(uint64_t);
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&timebase), "mach_timebase_info");
+	set_wheel(1);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.timer.thread_call_wheel_expired",
+	    &expired, &size, NULL, 0), "kern.timer.thread_call_wheel_expired");
+
+	timer_port = mk_timer_create();
+	T_QUIET; T_ASSERT_NE(timer_port, (mach_port_t)MACH_PORT_NULL, "mk_timer_create");
+
+	uint64_t start = mach_absolute_time();
+	kern_return_t kr = mk_timer_arm_leeway(timer_port, MK_TIMER_NORMAL,
+	    start + ns_to_abs(10 * NSEC_PER_MSEC), ns_to_abs(LEEWAY_NS));
+	T_ASSERT_MACH_SUCCESS(kr, "mk_timer_arm_leeway");
+
+	mk_timer_expire_msg_t msg = {};
+	kr = mach_msg(&msg.header, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(msg),
+	    timer_port, 5000, MACH_PORT_NULL);
+	T_ASSERT_MACH_SUCCESS(kr, "timer fired");
+
+	uint64_t elapsed = mach_absolute_time() - start;
+	T_EXPECT_GE(elapsed, ns_to_abs(10 * NSEC_PER_MSEC), "timer did not fire early");
+
+	uint64_t expired_after = 0;
+	size = sizeof(uint64_t);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.timer.thread_call_wheel_expired",
+	    &expired_after, &size, NULL, 0), "kern.timer.thread_call_wheel_expired");
+	size = sizeof(uint64_t);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.timer.thread_call_wheel_inserts",
+	    &inserts, &size, NULL, 0), "kern.timer.thread_call_wheel_inserts");
+
+	T_LOG("wheel inserts: %llu", inserts);
+	T_EXPECT_GT(expired_after, expired, "timer was delivered from the wheel");
+
+	mk_timer_destroy(timer_port);
+}
+
+T_DECL(mktimer_wheel_hard_deadline,
+    "a zero-leeway timer fires on time next to wheel timers with a large leeway")
+{
+	mach_port_t wheel_port, hard_port;
+	uint64_t deadline_ns = 50 * NSEC_PER_MSEC;
+	uint64_t slop_ns = 10 * NSEC_PER_MSEC;
+	kern_return_t kr;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&timebase), "mach_timebase_info");
+	set_wheel(1);
+
+	wheel_port = mk_timer_create();
+	T_QUIET; T_ASSERT_NE(wheel_port, (mach_port_t)MACH_PORT_NULL, "mk_timer_create");
+	hard_port = mk_timer_create();
+	T_QUIET; T_ASSERT_NE(hard_port, (mach_port_t)MACH_PORT_NULL, "mk_timer_create");
+
+	/*
+	 * The wheel timer is due first but may fire up to a second late;
+	 * its leeway must not stretch the hard timer's deadline.
+	 */
+	uint64_t start = mach_absolute_time();
+	kr = mk_timer_arm_leeway(wheel_port, MK_TIMER_NORMAL,
+	    start + ns_to_abs(10 * NSEC_PER_MSEC), ns_to_abs(NSEC_PER_SEC));
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "arm the wheel timer");
+	kr = mk_timer_arm_leeway(hard_port, MK_TIMER_CRITICAL,
+	    start + ns_to_abs(deadline_ns), 0);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "arm the hard timer");
+
+	mk_timer_expire_msg_t msg = {};
+	kr = mach_msg(&msg.header, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(msg),
+	    hard_port, 5000, MACH_PORT_NULL);
+	T_ASSERT_MACH_SUCCESS(kr, "hard timer fired");
+
+	uint64_t elapsed = mach_absolute_time() - start;
+	T_EXPECT_GE(elapsed, ns_to_abs(deadline_ns), "hard timer did not fire early");
+	T_EXPECT_LE(elapsed, ns_to_abs(deadline_ns + slop_ns),
+	    "hard timer fired within %llu ms of its deadline", slop_ns / NSEC_PER_MSEC);
+
+	mk_timer_destroy(wheel_port);
+	mk_timer_destroy(hard_port);
+}
@@ -214,3 +214,110 @@ T_DECL(recvmsg_x_test, "exercise revcmsg_x() with various parameter")
 
 	T_LOG("\n================= PASS =================\n");
 }
+
+#define STREAM_NMSGS    8
+
+T_DECL(sendmsg_x_recvmsg_x_stream, "sendmsg_x() and recvmsg_x() on a stream socket")
+{
+	struct msghdr_x msgList[STREAM_NMSGS] = {};
+	struct iovec vec[STREAM_NMSGS][2] = {};
+	char sendBuf[STREAM_NMSGS * 2 * 100];
+	char recvBuf[sizeof(sendBuf)] = {};
+	size_t total = 0, off = 0;
+	ssize_t n;
+	int fd[2];
+
+	for (size_t i = 0; i < sizeof(sendBuf); i++) {
+		sendBuf[i] = (char)(i * 7 + 1);
+	}
+
+	T_ASSERT_POSIX_SUCCESS(socketpair(AF_UNIX, SOCK_STREAM, 0, fd), "socketpair()");
+
+	/* Messages of uneven sizes, each with two iovecs */
+	for (unsigned int i = 0; i < STREAM_NMSGS; i++) {
+		for (unsigned int j = 0; j < 2; j++) {
+			vec[i][j].iov_base = sendBuf + total;
+			vec[i][j].iov_len = 10 * (i + 1) + j;
+			total += vec[i][j].iov_len;
+		}
+		msgList[i].msg_iov = vec[i];
+		msgList[i].msg_iovlen = 2;
+	}
+	T_ASSERT_POSIX_SUCCESS(n = sendmsg_x(fd[0], msgList, STREAM_NMSGS, 0), "sendmsg_x()");
+	T_EXPECT_EQ(n, (ssize_t)STREAM_NMSGS, "all the messages were sent");
+
+	/* Receive into fixed size buffers that do not match the messages */
+	while (off < total) {
+		for (unsigned int i = 0; i < STREAM_NMSGS; i++) {
+			vec[i][0].iov_base = recvBuf + off + i * 40;
+			vec[i][0].iov_len = 40;
+			msgList[i].msg_iov = vec[i];
+			msgList[i].msg_iovlen = 1;
+			msgList[i].msg_datalen = 0;
+		}
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n = recvmsg_x(fd[1], msgList, STREAM_NMSGS, 0), "recvmsg_x()");
+		T_QUIET; T_ASSERT_GT(n, 0L, "recvmsg_x() returned messages");
+		for (unsigned int i = 0; i < (unsigned int)n; i++) {
+			T_QUIET; T_EXPECT_LE(msgList[i].msg_datalen, (size_t)40, NULL);
+			if (i + 1 < (unsigned int)n) {
+				T_QUIET; T_EXPECT_EQ(msgList[i].msg_datalen, (size_t)40,
+				    "only the last message is partially filled");
+			}
+			off += msgList[i].msg_datalen;
+		}
+	}
+	T_EXPECT_EQ(off, total, "received all the bytes");
+	T_EXPECT_EQ(memcmp(sendBuf, recvBuf, total), 0, "the stream is intact");
+
+	close(fd[0]);
+	close(fd[1]);
+}
+
+T_DECL(recvmsg_x_stream_edges, "recvmsg_x() on a stream with empty messages and MSG_PEEK")
+{
+	struct msghdr_x msgList[3] = {};
+	struct iovec vec[3] = {};
+	char sendBuf[20], recvBuf[3][10];
+	ssize_t n;
+	int fd[2];
+
+	for (size_t i = 0; i < sizeof(sendBuf); i++) {
+		sendBuf[i] = (char)(i + 1);
+	}
+	T_ASSERT_POSIX_SUCCESS(socketpair(AF_UNIX, SOCK_STREAM, 0, fd), "socketpair()");
+	T_ASSERT_POSIX_SUCCESS(n = write(fd[0], sendBuf, sizeof(sendBuf)), "write()");
+
+	/* Both buffers peek at the head of the stream, nothing is consumed */
+	for (unsigned int i = 0; i < 2; i++) {
+		vec[i].iov_base = recvBuf[i];
+		vec[i].iov_len = sizeof(recvBuf[i]);
+		msgList[i].msg_iov = &vec[i];
+		msgList[i].msg_iovlen = 1;
+	}
+	T_ASSERT_POSIX_SUCCESS(n = recvmsg_x(fd[1], msgList, 2, MSG_PEEK), "recvmsg_x(MSG_PEEK)");
+	T_EXPECT_EQ(n, 2L, "both messages peeked");
+	for (unsigned int i = 0; i < 2; i++) {
+		T_EXPECT_EQ(msgList[i].msg_datalen, sizeof(recvBuf[i]), "message %u length", i);
+		T_EXPECT_EQ(memcmp(recvBuf[i], sendBuf, sizeof(recvBuf[i])), 0,
+		    "message %u saw the head of the stream", i);
+	}
+
+	/* An empty message between two others keeps its place */
+	memset(msgList, 0, sizeof(msgList));
+	for (unsigned int i = 0; i < 3; i++) {
+		vec[i].iov_base = recvBuf[i];
+		vec[i].iov_len = (i == 1) ? 0 : sizeof(recvBuf[i]);
+		msgList[i].msg_iov = &vec[i];
+		msgList[i].msg_iovlen = 1;
+	}
+	T_ASSERT_POSIX_SUCCESS(n = recvmsg_x(fd[1], msgList, 3, 0), "recvmsg_x()");
+	T_EXPECT_EQ(n, 3L, "the empty message is counted");
+	T_EXPECT_EQ(msgList[0].msg_datalen, (size_t)10, "first message is full");
+	T_EXPECT_EQ(msgList[1].msg_datalen, (size_t)0, "second message is empty");
+	T_EXPECT_EQ(msgList[2].msg_datalen, (size_t)10, "third message is full");
+	T_EXPECT_EQ(memcmp(recvBuf[0], sendBuf, 10), 0, "first message data");
+	T_EXPECT_EQ(memcmp(recvBuf[2], sendBuf + 10, 10), 0, "third message data");
+
+	close(fd[0]);
+	close(fd[1]);
+}
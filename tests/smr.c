@@ -0,0 +1,27 @@
+/*
+ * smr: stress the safe memory reclamation interface
+ */
+
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+
+#include <darwintest.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.smr"),
+    T_META_RUN_CONCURRENTLY(true));
+
+T_DECL(stress, "smr_stress", T_META_ASROOT(true))
+{
+	uint64_t count = 1000 * 1000, nsecs = 0;
+	size_t nlen = sizeof(nsecs);
+	int error;
+
+	error = sysctlbyname("kern.smr_test_stress", &nsecs, &nlen,
+	    &count, sizeof(count));
+	T_ASSERT_POSIX_SUCCESS(error, "sysctlbyname");
+	/* the stress runs on a static and on a heap allocated domain */
+	T_LOG("%lld retires in %lld ns (%g ns/retire)", 2 * count, nsecs,
+	    (double)nsecs / (2 * count));
+}
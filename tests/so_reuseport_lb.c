@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+#define NSOCKS          4
+#define NCONNS          64
+#define NDGRAMS         256
+
+static int
+reuseport_socket(int type, struct sockaddr_in *sin)
+{
+	socklen_t len = sizeof(*sin);
+	int one = 1;
+	int s;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(s = socket(AF_INET, type, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+	    &one, sizeof(one)), "setsockopt(SO_REUSEPORT)");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(s, (struct sockaddr *)sin,
+	    sizeof(*sin)), "bind()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(s, (struct sockaddr *)sin,
+	    &len), "getsockname()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(s, F_SETFL, O_NONBLOCK), "fcntl()");
+	return s;
+}
+
+static void
+check_lb_enabled(void)
+{
+	int lb = 0;
+	size_t len = sizeof(lb);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("net.inet.ip.reuseport_lb",
+	    &lb, &len, NULL, 0), "net.inet.ip.reuseport_lb");
+	if (lb != 1) {
+		T_SKIP("net.inet.ip.reuseport_lb is %d", lb);
+	}
+}
+
+T_DECL(so_reuseport_lb_tcp, "connections are spread across SO_REUSEPORT listeners")
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int lsock[NSOCKS], csock[NCONNS];
+	int accepted[NSOCKS] = {}, total = 0, used = 0;
+
+	check_lb_enabled();
+
+	for (int i = 0; i < NSOCKS; i++) {
+		lsock[i] = reuseport_socket(SOCK_STREAM, &sin);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(listen(lsock[i], NCONNS), "listen()");
+	}
+	for (int i = 0; i < NCONNS; i++) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(csock[i] = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(csock[i], (struct sockaddr *)&sin,
+		    sizeof(sin)), "connect()");
+	}
+
+	for (int i = 0; i < NSOCKS; i++) {
+		int s;
+
+		while ((s = accept(lsock[i], NULL, NULL)) >= 0) {
+			accepted[i]++;
+			close(s);
+		}
+		T_QUIET; T_EXPECT_EQ(errno, EWOULDBLOCK, "accept() ran out of connections");
+		T_LOG("listener %d accepted %d connections", i, accepted[i]);
+		total += accepted[i];
+		used += (accepted[i] != 0);
+	}
+	T_EXPECT_EQ(total, NCONNS, "every connection was accepted once");
+	T_EXPECT_GT(used, 1, "connections went to %d of %d listeners", used, NSOCKS);
+
+	for (int i = 0; i < NCONNS; i++) {
+		close(csock[i]);
+	}
+	for (int i = 0; i < NSOCKS; i++) {
+		close(lsock[i]);
+	}
+}
+
+T_DECL(so_reuseport_lb_udp, "datagrams are spread across SO_REUSEPORT sockets by flow")
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int rsock[NSOCKS], received[NSOCKS] = {};
+	int total = 0, used = 0;
+	char c = 0;
+
+	check_lb_enabled();
+
+	for (int i = 0; i < NSOCKS; i++) {
+		rsock[i] = reuseport_socket(SOCK_DGRAM, &sin);
+	}
+
+	/* one datagram from each of many source ports */
+	for (int i = 0; i < NDGRAMS; i++) {
+		int s;
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(s = socket(AF_INET, SOCK_DGRAM, 0), "socket()");
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(sendto(s, &c, 1, 0,
+		    (struct sockaddr *)&sin, sizeof(sin)), "sendto()");
+		close(s);
+	}
+	usleep(100000);
+
+	for (int i = 0; i < NSOCKS; i++) {
+		while (recv(rsock[i], &c, 1, 0) == 1) {
+			received[i]++;
+		}
+		T_LOG("socket %d received %d datagrams", i, received[i]);
+		total += received[i];
+		used += (received[i] != 0);
+	}
+	T_EXPECT_EQ(total, NDGRAMS, "every datagram was received once");
+	T_EXPECT_GT(used, 1, "datagrams went to %d of %d sockets", used, NSOCKS);
+
+	for (int i = 0; i < NSOCKS; i++) {
+		close(rsock[i]);
+	}
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_cc.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+#define XFER_SIZE       (8 * 1024 * 1024)
+
+static void *
+sender(void *arg)
+{
+	int s = *(int *)arg;
+	char *buf = malloc(XFER_SIZE);
+	size_t off = 0;
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	for (size_t i = 0; i < XFER_SIZE; i++) {
+		buf[i] = (char)i;
+	}
+	while (off < XFER_SIZE) {
+		ssize_t n = send(s, buf + off, XFER_SIZE - off, 0);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "send()");
+		off += (size_t)n;
+	}
+	free(buf);
+	shutdown(s, SHUT_WR);
+	return NULL;
+}
+
+T_DECL(tcp_bbr_sockopt, "TCP_CC_ALGORITHM selects the algorithm of a socket")
+{
+	int s, algo, tc, use_newreno = 0, use_bbr = 0;
+	int expected = TCP_CC_ALGO_CUBIC_INDEX;
+	socklen_t len = sizeof(algo);
+	size_t size = sizeof(int);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(s = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+
+	algo = TCP_CC_ALGO_BBR_INDEX;
+	T_ASSERT_POSIX_SUCCESS(setsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), "select BBR");
+	algo = 0;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, &len), "getsockopt(TCP_CC_ALGORITHM)");
+	T_EXPECT_EQ(algo, TCP_CC_ALGO_BBR_INDEX, "the socket uses BBR");
+
+	algo = TCP_CC_ALGO_BACKGROUND_INDEX;
+	T_EXPECT_POSIX_FAILURE(setsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), EINVAL, "background transport is not selectable");
+	algo = TCP_CC_ALGO_COUNT;
+	T_EXPECT_POSIX_FAILURE(setsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), EINVAL, "out of range algorithm");
+
+	/* A background socket still reports the algorithm it selected */
+	tc = SO_TC_BK_SYS;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(s, SOL_SOCKET, SO_TRAFFIC_CLASS,
+	    &tc, sizeof(tc)), "SO_TRAFFIC_CLASS");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, &len), "getsockopt(TCP_CC_ALGORITHM)");
+	T_EXPECT_EQ(algo, TCP_CC_ALGO_BBR_INDEX, "the background socket reports BBR");
+	T_EXPECT_POSIX_SUCCESS(setsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), "the reported algorithm can be set");
+
+	if (sysctlbyname("net.inet.tcp.use_newreno", &use_newreno, &size,
+	    NULL, 0) == 0 && use_newreno != 0) {
+		expected = TCP_CC_ALGO_NEWRENO_INDEX;
+	} else if (sysctlbyname("net.inet.tcp.use_bbr", &use_bbr, &size,
+	    NULL, 0) == 0 && use_bbr != 0) {
+		expected = TCP_CC_ALGO_BBR_INDEX;
+	}
+	algo = TCP_CC_ALGO_NONE;
+	T_ASSERT_POSIX_SUCCESS(setsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), "back to the default");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(s, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, &len), "getsockopt(TCP_CC_ALGORITHM)");
+	T_EXPECT_EQ(algo, expected, "the socket uses the default algorithm");
+
+	close(s);
+}
+
+T_DECL(tcp_bbr_transfer, "a transfer completes intact with BBR on both ends")
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(sin);
+	struct tcp_info info = {};
+	int algo = TCP_CC_ALGO_BBR_INDEX;
+	socklen_t alen = sizeof(algo);
+	char buf[16 * 1024];
+	size_t total = 0;
+	pthread_t thread;
+	int l, c, a;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(l = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(l, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), "select BBR on the listener");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(l, (struct sockaddr *)&sin,
+	    sizeof(sin)), "bind()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(l, (struct sockaddr *)&sin,
+	    &len), "getsockname()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(listen(l, 1), "listen()");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(c = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(c, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, sizeof(algo)), "select BBR on the client");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(c, (struct sockaddr *)&sin,
+	    sizeof(sin)), "connect()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(a = accept(l, NULL, NULL), "accept()");
+
+	algo = 0;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(a, IPPROTO_TCP, TCP_CC_ALGORITHM,
+	    &algo, &alen), "getsockopt(TCP_CC_ALGORITHM)");
+	T_EXPECT_EQ(algo, TCP_CC_ALGO_BBR_INDEX, "the accepted socket inherited BBR");
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL, sender, &c),
+	    "pthread_create");
+	for (;;) {
+		ssize_t n = recv(a, buf, sizeof(buf), 0);
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "recv()");
+		if (n == 0) {
+			break;
+		}
+		for (ssize_t i = 0; i < n; i++) {
+			if (buf[i] != (char)(total + (size_t)i)) {
+				T_ASSERT_FAIL("byte %zu is corrupt", total + (size_t)i);
+			}
+		}
+		total += (size_t)n;
+	}
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	T_EXPECT_EQ(total, (size_t)XFER_SIZE, "received all the data");
+
+	alen = sizeof(info);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(c, IPPROTO_TCP, TCP_INFO,
+	    &info, &alen), "TCP_INFO");
+	T_LOG("cwnd %u, srtt %u ms, pacing rate %llu bytes/sec",
+	    info.tcpi_snd_cwnd, info.tcpi_srtt, info.tcpi_pacing_rate);
+	T_EXPECT_GT(info.tcpi_pacing_rate, 0ULL, "the sender derived a pacing rate");
+
+	close(a);
+	close(c);
+	close(l);
+}
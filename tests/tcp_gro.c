@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/sysctl.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+#define GRO_TEST_SEGS   8       /* segments built by net.inet.tcp.gro_test */
+
+static int forwarding_saved = -1;
+static int forwarding6_saved = -1;
+
+static void
+forwarding_restore(void)
+{
+	if (forwarding_saved != -1) {
+		(void)sysctlbyname("net.inet.ip.forwarding", NULL, NULL,
+		    &forwarding_saved, sizeof(forwarding_saved));
+	}
+	if (forwarding6_saved != -1) {
+		(void)sysctlbyname("net.inet6.ip6.forwarding", NULL, NULL,
+		    &forwarding6_saved, sizeof(forwarding6_saved));
+	}
+}
+
+static int
+gro_test(int family)
+{
+	size_t size = sizeof(family);
+	int pkts = family;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("net.inet.tcp.gro_test",
+	    &pkts, &size, &family, sizeof(family)), "net.inet.tcp.gro_test(%d)", family);
+	return pkts;
+}
+
+static void
+set_forwarding(const char *name, int *saved, int value)
+{
+	size_t size = sizeof(*saved);
+	int old;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &old, &size,
+	    &value, sizeof(value)), "%s = %d", name, value);
+	if (*saved == -1) {
+		*saved = old;
+	}
+}
+
+T_DECL(tcp_gro_forwarding, "segments are only coalesced when not forwarding",
+    T_META_ASROOT(true))
+{
+	int gro = 0;
+	size_t size = sizeof(gro);
+
+	if (sysctlbyname("net.inet.tcp.gro_test", NULL, &size, NULL, 0) != 0) {
+		T_SKIP("net.inet.tcp.gro_test is not available");
+	}
+	size = sizeof(gro);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("net.inet.tcp.gro", &gro,
+	    &size, NULL, 0), "net.inet.tcp.gro");
+	if (!gro) {
+		T_SKIP("net.inet.tcp.gro is off");
+	}
+	T_ATEND(forwarding_restore);
+
+	set_forwarding("net.inet.ip.forwarding", &forwarding_saved, 0);
+	set_forwarding("net.inet6.ip6.forwarding", &forwarding6_saved, 0);
+	T_EXPECT_EQ(gro_test(4), 1, "IPv4 segments are merged into one packet");
+	T_EXPECT_EQ(gro_test(6), 1, "IPv6 segments are merged into one packet");
+
+	set_forwarding("net.inet.ip.forwarding", &forwarding_saved, 1);
+	T_EXPECT_EQ(gro_test(4), GRO_TEST_SEGS, "IPv4 forwarding disables GRO");
+	T_EXPECT_EQ(gro_test(6), 1, "IPv6 still merges");
+
+	set_forwarding("net.inet6.ip6.forwarding", &forwarding6_saved, 1);
+	T_EXPECT_EQ(gro_test(6), GRO_TEST_SEGS, "IPv6 forwarding disables GRO");
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/sysctl.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+/* net.inet.tcp.gso_test cuts 5500 bytes of payload at an MSS of 1000 */
+#define GSO_TEST_SEGS   6
+
+static void
+gso_test(int family)
+{
+	size_t size = sizeof(family);
+	int segs = 0;
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("net.inet.tcp.gso_test",
+	    &segs, &size, &family, sizeof(family)),
+	    "IPv%d segments have valid headers and checksums", family);
+	T_EXPECT_EQ(segs, GSO_TEST_SEGS, "IPv%d super-segment cut in %d",
+	    family, GSO_TEST_SEGS);
+}
+
+T_DECL(tcp_gso_segment, "software segmentation finalizes every segment",
+    T_META_ASROOT(true))
+{
+	size_t size = 0;
+
+	if (sysctlbyname("net.inet.tcp.gso_test", NULL, &size, NULL, 0) != 0) {
+		T_SKIP("net.inet.tcp.gso_test is not available");
+	}
+
+	gso_test(4);
+	gso_test(6);
+}
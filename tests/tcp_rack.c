@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_var.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+#define XFER_SIZE       (8 * 1024 * 1024)
+#define PF_ANCHOR       "com.apple/xnu.tcp_rack"
+
+static int rack_saved = -1;
+
+static void
+rack_restore(void)
+{
+	if (rack_saved != -1) {
+		(void)sysctlbyname("net.inet.tcp.rack", NULL, NULL,
+		    &rack_saved, sizeof(rack_saved));
+	}
+}
+
+static void
+rack_enable(void)
+{
+	size_t size = sizeof(rack_saved);
+	int one = 1;
+
+	if (sysctlbyname("net.inet.tcp.rack", &rack_saved, &size, &one,
+	    sizeof(one)) != 0) {
+		T_SKIP("net.inet.tcp.rack is not available");
+	}
+	T_ATEND(rack_restore);
+}
+
+static int
+pfctl(const char *cmd)
+{
+	char *argv[] = { "/bin/sh", "-c", (char *)(uintptr_t)cmd, NULL };
+	int exit_status = -1;
+	pid_t pid;
+
+	if (dt_launch_tool(&pid, argv, false, NULL, NULL) != 0 ||
+	    !dt_waitpid(pid, &exit_status, NULL, 30)) {
+		return -1;
+	}
+	return exit_status;
+}
+
+static void
+pf_cleanup(void)
+{
+	(void)pfctl("pfctl -a " PF_ANCHOR " -F rules 2>/dev/null");
+}
+
+static void
+tcp_stats(struct tcpstat *stat)
+{
+	size_t len = sizeof(*stat);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("net.inet.tcp.stats",
+	    stat, &len, NULL, 0), "net.inet.tcp.stats");
+}
+
+static void *
+sender(void *arg)
+{
+	int s = *(int *)arg;
+	char *buf = malloc(XFER_SIZE);
+	size_t off = 0;
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	for (size_t i = 0; i < XFER_SIZE; i++) {
+		buf[i] = (char)i;
+	}
+	while (off < XFER_SIZE) {
+		ssize_t n = send(s, buf + off, XFER_SIZE - off, 0);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "send()");
+		off += (size_t)n;
+	}
+	free(buf);
+	shutdown(s, SHUT_WR);
+	return NULL;
+}
+
+/*
+ * Sends XFER_SIZE bytes over loopback and checks that they all arrive
+ * intact.  `drop' is the percentage of the data segments dropped by pf.
+ */
+static void
+rack_transfer(int drop)
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct tcp_connection_info info = {};
+	socklen_t len = sizeof(sin);
+	char buf[16 * 1024];
+	size_t total = 0;
+	pthread_t thread;
+	int l, c, a;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(l = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(l, (struct sockaddr *)&sin,
+	    sizeof(sin)), "bind()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(l, (struct sockaddr *)&sin,
+	    &len), "getsockname()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(listen(l, 1), "listen()");
+
+	if (drop > 0) {
+		char cmd[256];
+
+		/* Only data segments: the handshake and the acks get through */
+		T_ATEND(pf_cleanup);
+		snprintf(cmd, sizeof(cmd), "echo 'block drop in quick on lo0 "
+		    "proto tcp from any to any port %u flags A/SAF "
+		    "probability %d%%' | pfctl -a " PF_ANCHOR " -f - 2>/dev/null",
+		    ntohs(sin.sin_port), drop);
+		if (pfctl(cmd) != 0) {
+			T_SKIP("cannot load pf rules");
+		}
+		(void)pfctl("pfctl -e 2>/dev/null");
+	}
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(c = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(c, (struct sockaddr *)&sin,
+	    sizeof(sin)), "connect()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(a = accept(l, NULL, NULL), "accept()");
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL, sender, &c),
+	    "pthread_create");
+	for (;;) {
+		ssize_t n = recv(a, buf, sizeof(buf), 0);
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "recv()");
+		if (n == 0) {
+			break;
+		}
+		for (ssize_t i = 0; i < n; i++) {
+			if (buf[i] != (char)(total + (size_t)i)) {
+				T_ASSERT_FAIL("byte %zu is corrupt", total + (size_t)i);
+			}
+		}
+		total += (size_t)n;
+	}
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	T_EXPECT_EQ(total, (size_t)XFER_SIZE, "received all the data");
+
+	len = sizeof(info);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(c, IPPROTO_TCP,
+	    TCP_CONNECTION_INFO, &info, &len), "TCP_CONNECTION_INFO");
+	T_LOG("%llu packets sent, %llu retransmitted", info.tcpi_txpackets,
+	    info.tcpi_txretransmitpackets);
+	if (drop > 0) {
+		T_EXPECT_GT(info.tcpi_txretransmitpackets, 0ULL,
+		    "the dropped data was retransmitted");
+		pf_cleanup();
+	}
+
+	close(a);
+	close(c);
+	close(l);
+}
+
+T_DECL(tcp_rack_transfer, "a transfer completes intact with RACK loss detection",
+    T_META_ASROOT(true))
+{
+	rack_enable();
+	rack_transfer(0);
+}
+
+T_DECL(tcp_rack_loss, "RACK recovers from random losses",
+    T_META_ASROOT(true))
+{
+	struct tcpstat before, after;
+
+	rack_enable();
+	tcp_stats(&before);
+	rack_transfer(2);
+	tcp_stats(&after);
+
+	T_LOG("%u RACK recoveries, %u lost retransmissions, %u reordering timeouts",
+	    after.tcps_rack_recovery_episode - before.tcps_rack_recovery_episode,
+	    after.tcps_rack_lost_rexmit - before.tcps_rack_lost_rexmit,
+	    after.tcps_rack_reorder_timeout - before.tcps_rack_reorder_timeout);
+	T_EXPECT_GT(after.tcps_rack_recovery_episode,
+	    before.tcps_rack_recovery_episode,
+	    "the losses were recovered by RACK rather than by timeouts");
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.net"));
+
+static uint64_t
+wheel_stat(const char *name)
+{
+	uint64_t value = 0;
+	size_t len = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &len, NULL, 0),
+	    "%s", name);
+	return value;
+}
+
+static void
+connection_info(int s, struct tcp_connection_info *info)
+{
+	socklen_t len = sizeof(*info);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockopt(s, IPPROTO_TCP,
+	    TCP_CONNECTION_INFO, info, &len), "TCP_CONNECTION_INFO");
+}
+
+static uint64_t
+txpackets(int s)
+{
+	struct tcp_connection_info info = {};
+
+	connection_info(s, &info);
+	return info.tcpi_txpackets;
+}
+
+#define PF_ANCHOR "com.apple/xnu.tcp_timer_wheel"
+
+static int
+pfctl(const char *cmd)
+{
+	char *argv[] = { "/bin/sh", "-c", (char *)(uintptr_t)cmd, NULL };
+	int exit_status = -1;
+	pid_t pid;
+
+	if (dt_launch_tool(&pid, argv, false, NULL, NULL) != 0 ||
+	    !dt_waitpid(pid, &exit_status, NULL, 30)) {
+		return -1;
+	}
+	return exit_status;
+}
+
+static void
+pf_cleanup(void)
+{
+	(void)pfctl("pfctl -a " PF_ANCHOR " -F rules 2>/dev/null");
+}
+
+T_DECL(tcp_timer_wheel_keepalive, "keepalive timers fire off the timer wheel")
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(sin);
+	uint64_t runs, run_ns, tx;
+	int one = 1;
+	int l, c, a;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(l = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(l, (struct sockaddr *)&sin,
+	    sizeof(sin)), "bind()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(l, (struct sockaddr *)&sin,
+	    &len), "getsockname()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(listen(l, 1), "listen()");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(c = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(c, SOL_SOCKET, SO_KEEPALIVE,
+	    &one, sizeof(one)), "SO_KEEPALIVE");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(c, IPPROTO_TCP, TCP_KEEPALIVE,
+	    &one, sizeof(one)), "TCP_KEEPALIVE");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(c, IPPROTO_TCP, TCP_KEEPINTVL,
+	    &one, sizeof(one)), "TCP_KEEPINTVL");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(c, (struct sockaddr *)&sin,
+	    sizeof(sin)), "connect()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(a = accept(l, NULL, NULL), "accept()");
+
+	runs = wheel_stat("net.inet.tcp.timer_wheel_runs");
+	run_ns = wheel_stat("net.inet.tcp.timer_wheel_run_ns");
+	tx = txpackets(c);
+
+	sleep(4);
+
+	T_EXPECT_GT(txpackets(c), tx, "keepalive probes were sent on the idle connection");
+	runs = wheel_stat("net.inet.tcp.timer_wheel_runs") - runs;
+	run_ns = wheel_stat("net.inet.tcp.timer_wheel_run_ns") - run_ns;
+	T_EXPECT_GT(runs, 0ULL, "the timer wheel ran");
+	if (runs > 0) {
+		T_LOG("%llu runs, %llu ns per run", runs, run_ns / runs);
+	}
+	T_LOG("longest run: %llu ns", wheel_stat("net.inet.tcp.timer_wheel_run_ns_max"));
+
+	close(a);
+	close(c);
+	close(l);
+}
+
+T_DECL(tcp_timer_wheel_rto_earlier,
+    "a retransmit timer armed before a far keepalive deadline fires on time",
+    T_META_ASROOT(true))
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct tcp_connection_info info = {};
+	socklen_t len = sizeof(sin);
+	char buf[1000] = {}, cmd[256];
+	int keepidle = 7200, one = 1;
+	int l, c, a;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(l = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(l, (struct sockaddr *)&sin,
+	    sizeof(sin)), "bind()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(l, (struct sockaddr *)&sin,
+	    &len), "getsockname()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(listen(l, 1), "listen()");
+
+	/* The keepalive deadline puts the entry in a slot hours away */
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(c = socket(AF_INET, SOCK_STREAM, 0), "socket()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(c, SOL_SOCKET, SO_KEEPALIVE,
+	    &one, sizeof(one)), "SO_KEEPALIVE");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(c, IPPROTO_TCP, TCP_KEEPALIVE,
+	    &keepidle, sizeof(keepidle)), "TCP_KEEPALIVE");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(c, (struct sockaddr *)&sin,
+	    sizeof(sin)), "connect()");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(a = accept(l, NULL, NULL), "accept()");
+	sleep(1);
+
+	/* Drop what the client sends, so that its data is never acked */
+	T_ATEND(pf_cleanup);
+	snprintf(cmd, sizeof(cmd), "echo 'block drop in quick on lo0 proto tcp "
+	    "from any to any port %u' | pfctl -a " PF_ANCHOR " -f - 2>/dev/null",
+	    ntohs(sin.sin_port));
+	if (pfctl(cmd) != 0) {
+		T_SKIP("cannot load pf rules");
+	}
+	(void)pfctl("pfctl -e 2>/dev/null");
+
+	/* The retransmit timer brings the deadline forward */
+	T_ASSERT_POSIX_SUCCESS(write(c, buf, sizeof(buf)), "write()");
+	sleep(3);
+
+	connection_info(c, &info);
+	T_EXPECT_GT(info.tcpi_txretransmitpackets, 0ULL,
+	    "the data was retransmitted before the keepalive deadline");
+
+	pf_cleanup();
+	T_EXPECT_EQ(read(a, buf, sizeof(buf)), (ssize_t)sizeof(buf),
+	    "the data got through once the drop rule is gone");
+
+	close(a);
+	close(c);
+	close(l);
+}
@@ -493,3 +493,52 @@ T_DECL(turnstile_test, "Turnstile test", T_META_ASROOT(YES))
 	//test4();
 	//test5();
 }
+
+#define TURNSTILE_MAX_HOP_DEFAULT 10
+
+/* mirrors struct turnstile_chain_stats */
+struct chain_stats {
+	uint64_t walk_length[TURNSTILE_MAX_HOP_DEFAULT + 1];
+	uint64_t early_exit[TURNSTILE_MAX_HOP_DEFAULT + 1];
+};
+
+static void
+get_chain_stats(struct chain_stats *stats, uint64_t *walks, uint64_t *early_exits)
+{
+	size_t size = sizeof(*stats);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.turnstile_chain_stats",
+	    stats, &size, NULL, 0), "sysctlbyname(kern.turnstile_chain_stats)");
+	T_QUIET; T_ASSERT_EQ(size, sizeof(*stats), "kern.turnstile_chain_stats size");
+
+	*walks = *early_exits = 0;
+	for (int i = 0; i <= TURNSTILE_MAX_HOP_DEFAULT; i++) {
+		*walks += stats->walk_length[i];
+		*early_exits += stats->early_exit[i];
+	}
+}
+
+T_DECL(turnstile_chain_stats, "Turnstile propagation walk histograms",
+    T_META_ASROOT(YES))
+{
+	struct chain_stats before, after;
+	uint64_t walks_before, walks_after, exits_before, exits_after;
+
+	get_chain_stats(&before, &walks_before, &exits_before);
+
+	/* boosts and unboosts the owner through a turnstile */
+	test1(SYSCTL_TURNSTILE_TEST_USER_DEFAULT);
+
+	get_chain_stats(&after, &walks_after, &exits_after);
+
+	for (int i = 1; i <= TURNSTILE_MAX_HOP_DEFAULT; i++) {
+		T_LOG("%2d%s hops: %llu walks, %llu early exits", i,
+		    i == TURNSTILE_MAX_HOP_DEFAULT ? "+" : "",
+		    after.walk_length[i] - before.walk_length[i],
+		    after.early_exit[i] - before.early_exit[i]);
+	}
+
+	T_ASSERT_GT(walks_after, walks_before, "propagation walks were counted");
+	T_ASSERT_LE(exits_after - exits_before, walks_after - walks_before,
+	    "every early exit ends a walk");
+}
@@ -90,3 +90,74 @@ T_DECL(ulock_non_owner_wake, "ulock_wake respects non-owner wakes",
 	// won't ever actually join
 	pthread_join(waiter, NULL);
 }
+
+#pragma mark ulock_wake_n
+
+#define WAKE_N_WAITERS  8
+#define WAKE_N_BATCH    3
+
+static _Atomic uint32_t test_wake_n_word;
+static _Atomic uint32_t test_wake_n_returned;
+
+static void *
+test_wake_n_waiter(void *arg __unused)
+{
+	for (;;) {
+		int rc = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO,
+		    &test_wake_n_word, 0, 0);
+		if (rc == -EINTR || rc == -EFAULT) {
+			continue;
+		}
+		T_QUIET; T_ASSERT_GE(rc, 0, "__ulock_wait");
+		break;
+	}
+
+	atomic_fetch_add_explicit(&test_wake_n_returned, 1, memory_order_relaxed);
+	return NULL;
+}
+
+T_DECL(ulock_wake_n, "ULF_WAKE_N wakes up to N waiters per call",
+    T_META_CHECK_LEAKS(false))
+{
+	pthread_t waiters[WAKE_N_WAITERS];
+	int woken = 0;
+	int rc;
+
+	rc = __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO | ULF_WAKE_N,
+	    &test_wake_n_word, 0);
+	T_ASSERT_EQ(rc, -EINVAL, "ULF_WAKE_N rejects a count of 0");
+	rc = __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO | ULF_WAKE_N | ULF_WAKE_ALL,
+	    &test_wake_n_word, 1);
+	T_ASSERT_EQ(rc, -EINVAL, "ULF_WAKE_N rejects ULF_WAKE_ALL");
+	rc = __ulock_wake(UL_UNFAIR_LOCK | ULF_NO_ERRNO | ULF_WAKE_N,
+	    &test_wake_n_word, 1);
+	T_ASSERT_EQ(rc, -EINVAL, "ULF_WAKE_N rejects UL_UNFAIR_LOCK");
+
+	for (int i = 0; i < WAKE_N_WAITERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&waiters[i], NULL,
+		    test_wake_n_waiter, NULL), "create waiter");
+	}
+
+	/*
+	 * Waiters trickle into the kernel, so keep waking batches
+	 * until every one of them has been accounted for.
+	 */
+	while (woken < WAKE_N_WAITERS) {
+		rc = __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO | ULF_WAKE_N,
+		    &test_wake_n_word, WAKE_N_BATCH);
+		if (rc == -ENOENT || rc == 0) {
+			usleep(100);
+			continue;
+		}
+		T_QUIET; T_ASSERT_GT(rc, 0, "__ulock_wake(ULF_WAKE_N)");
+		T_QUIET; T_ASSERT_LE(rc, WAKE_N_BATCH, "woke at most %d waiters", WAKE_N_BATCH);
+		woken += rc;
+	}
+	T_ASSERT_EQ(woken, WAKE_N_WAITERS, "woke every waiter");
+
+	for (int i = 0; i < WAKE_N_WAITERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(waiters[i], NULL), "join waiter");
+	}
+	T_ASSERT_EQ(atomic_load(&test_wake_n_returned), (uint32_t)WAKE_N_WAITERS,
+	    "every waiter returned");
+}
@@ -10,6 +10,20 @@ from waitq import *
 from ioreg import *
 import xnudefines
 
+def GetIPCEntryAtIndex(space, index):
+    """ Returns the ipc_entry at an index in the table of a space
+        params:
+            space - value representing an ipc_space_t
+            index - int index of the entry (MACH_PORT_INDEX of its name)
+        returns:
+            value of type struct ipc_entry
+    """
+    seg_shift = 12 # IS_TABLE_SEG_SHIFT
+    if index < (1 << seg_shift):
+        return GetObjectAtIndexFromArray(space.is_table, index)
+    seg = GetObjectAtIndexFromArray(space.is_table_segs, index >> seg_shift)
+    return GetObjectAtIndexFromArray(seg, index & ((1 << seg_shift) - 1))
+
 @header("{0: <20s} {1: <6s} {2: <6s} {3: <10s} {4: <32s}".format("task", "pid", '#acts', "tablesize", "command"))
 def GetTaskIPCSummary(task, show_busy = False):
     """ Display a task's ipc summary. 
@@ -49,7 +63,7 @@ def GetTaskBusyPortsSummary(task):
     nbusy = 0
     nmsgs = 0
     while i < isp.is_table_size:
-        iep = addressof(isp.is_table[i])
+        iep = addressof(GetIPCEntryAtIndex(isp, i))
         if iep.ie_bits & 0x00020000:
             port = Cast(iep.ie_object, 'ipc_port_t')
             if port.ip_messages.data.port.msgcount > 0:
@@ -328,7 +342,6 @@ def PrintPortSetMembers(space, setid, show_kmsg_summary):
     """ Print out the members of a given IPC PSet
     """
     num_entries = int(space.is_table_size)
-    is_tableval = space.is_table
     setid_str = GetWaitqSetidString(setid)
 
     prefix_str = "{0:<21s}".format(' '*21)
@@ -339,7 +352,7 @@ def PrintPortSetMembers(space, setid, show_kmsg_summary):
 
     idx = 0
     while idx < num_entries:
-        entryval = GetObjectAtIndexFromArray(is_tableval, idx)
+        entryval = GetIPCEntryAtIndex(space, idx)
         ie_bits = unsigned(entryval.ie_bits)
         if not (ie_bits & 0x00180000):
             # It's a port entry that's _not_ dead
@@ -365,10 +378,9 @@ def FindEntryName(obj, space):
         return 0
 
     num_entries = int(space.is_table_size)
-    is_tableval = space.is_table
     idx = 0
     while idx < num_entries:
-        entry_val = GetObjectAtIndexFromArray(is_tableval, idx)
+        entry_val = GetIPCEntryAtIndex(space, idx)
         entry_bits= unsigned(entry_val.ie_bits)
         entry_obj = 0
         if (int(entry_bits) & 0x001f0000) != 0: ## it's a valid entry
@@ -704,7 +716,6 @@ def PrintIPCInformation(space, show_entries=False, show_userstack=False, rights_
     """
     out_str = ''
     format_string = "{0: <#020x} {1: <#020x} {2: <#020x} {3: <8s} {4: <10d} {5: <#18x} {6: >8d} {7: <8d}"
-    is_tableval = space.is_table
     ports = int(space.is_table_size)
     flags =''
     is_bits = int(space.is_bits)
@@ -719,7 +730,7 @@ def PrintIPCInformation(space, show_entries=False, show_userstack=False, rights_
         num_entries = ports
         index = 0
         while index < num_entries:
-            entryval = GetObjectAtIndexFromArray(is_tableval, index)
+            entryval = GetIPCEntryAtIndex(space, index)
             entry_ie_bits = unsigned(entryval.ie_bits)
             if (int(entry_ie_bits) & 0x001f0000 ) != 0:
                 entry_name = "{0: <#020x}".format( (index <<8 | entry_ie_bits >> 24) )
@@ -819,11 +830,10 @@ def ShowTaskRights(cmd_args=None, cmd_options={}):
 @header("{: <20s} {: <6s} {: <12s} {: <8s}".format("task", "pid", "name", "#vouchers"))
 def GetTaskVoucherCount(t):
     space = t.itk_space
-    is_tableval = space.is_table
     num_entries = int(space.is_table_size)
     count = 0
     for index in range (0, num_entries):
-        entryval = GetObjectAtIndexFromArray(is_tableval, index)
+        entryval = GetIPCEntryAtIndex(space, index)
         entry_ie_bits = unsigned(entryval.ie_bits)
         if (int(entry_ie_bits) & 0x00070000 ) != 0:
             port = Cast(entryval.ie_object, 'ipc_port_t')
@@ -1191,10 +1201,9 @@ def IterateAllPorts(tasklist, func, ctx, include_psets, follow_busyports, should
         port_iteration_do_print_taskname = True
         space = t.itk_space
         num_entries = int(space.is_table_size)
-        is_tableval = space.is_table
         idx = 0
         while idx < num_entries:
-            entry_val = GetObjectAtIndexFromArray(is_tableval, idx)
+            entry_val = GetIPCEntryAtIndex(space, idx)
             entry_bits= unsigned(entry_val.ie_bits)
             entry_obj = 0
             entry_str = ''
@@ -1493,7 +1502,7 @@ def PrintTaskBusyPorts(task):
     isp = task.itk_space
     i = 0
     while i < isp.is_table_size:
-        iep = addressof(isp.is_table[i])
+        iep = addressof(GetIPCEntryAtIndex(isp, i))
         if iep.ie_bits & 0x00020000:
             port = Cast(iep.ie_object, 'ipc_port_t')
             if port.ip_messages.data.port.msgcount > 0:
@@ -2074,13 +2083,12 @@ def GetSpaceSendRightEntries(space, port):
             port_addr - the port address to match, or 0 to get all send rights
         returns: an array of IPC entries
     """
-    entry_table = space.is_table
     ports = int(space.is_table_size)
     i = 0
     entries = []
 
     while i < ports:
-        entry = GetObjectAtIndexFromArray(entry_table, i)
+        entry = GetIPCEntryAtIndex(space, i)
 
         entry_ie_bits = unsigned(entry.ie_bits)
         if (entry_ie_bits & 0x00010000) != 0 and (not port or entry.ie_object == port):
@@ -23,6 +23,7 @@
  *	Utility to display kernel lock contention statistics.
  *	Usage:
  *	lockstat [all, spin, mutex, rw, <lock group name>] {<repeat interval>} {abs}
+ *	lockstat spinwait
  *
  *	Argument 1 specifies the type of lock to display contention statistics
  *	for; alternatively, a lock group (a logically grouped set of locks,
@@ -55,6 +56,13 @@
  *	locks, such as mutexes, incremented if the owner of the mutex
  *	wasn't active on another processor at the time of the lock
  *	attempt. This indicates that no adaptive spin occurred.
+ *
+ *	"lockstat spinwait" (currently implemented only on x86_64) shows, for
+ *	mutexes, the number of contended acquisitions that spun on the owner,
+ *	how many of those acquired the mutex while spinning, how many gave up
+ *	and proceeded to block, the total time spent spinning and the lock
+ *	group's learned estimate of how long a contended mutex stays held,
+ *	which bounds the adaptive spin.  These are absolute values.
  */
 
 /*
@@ -75,6 +83,7 @@ void print_all_mutex(lockgroup_info_t *lockgroup);
 void print_rw_hdr(void);
 void print_rw(int requested, lockgroup_info_t *lockgroup);
 void print_all_rw(lockgroup_info_t *lockgroup);
+void print_all_spinwait(void);
 void prime_lockgroup_deltas(void);
 void get_lockgroup_deltas(void);
 
@@ -132,6 +141,8 @@ main(int argc, char **argv)
 		} else if (strcmp(argv[1], "rw") == 0) {
 			print_rw_hdr();
 			print_all_rw(lockgroup_info);
+		} else if (strcmp(argv[1], "spinwait") == 0) {
+			print_all_spinwait();
 		} else {
 			found = 0;
 			for (i = 0; i < count; i++) {
@@ -280,6 +291,7 @@ void
 usage()
 {
 	fprintf(stderr, "Usage: %s [all, spin, mutex, rw, <lock group name>] {<repeat interval>} {abs}\n", pgmname);
+	fprintf(stderr, "       %s spinwait\n", pgmname);
 	exit(EXIT_FAILURE);
 }
 
@@ -378,6 +390,37 @@ print_all_rw(lockgroup_info_t *lockgroup)
 	printf("\n");
 }
 
+void
+print_all_spinwait(void)
+{
+	lockgroup_spin_info_t   *spin_info;
+	mach_msg_type_number_t  spin_count;
+	kern_return_t           kr;
+	unsigned int            i;
+
+	kr = host_lockgroup_spin_info(host_control, &spin_info, &spin_count);
+	if (kr != KERN_SUCCESS) {
+		mach_error("host_lockgroup_spin_info", kr);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("     Spins  Spin Acqs     Blocks      Spin ns  Hold ns Name\n");
+	for (i = 0; i < spin_count; i++) {
+		lockgroup_spin_info_t *curptr = &spin_info[i];
+
+		if (curptr->lock_mtx_spin_cnt != 0 || curptr->lock_mtx_hold_avg != 0) {
+			printf("%10lld %10lld %10lld %12lld %8lld ", curptr->lock_mtx_spin_cnt,
+			    curptr->lock_mtx_spin_acquired_cnt, curptr->lock_mtx_spin_block_cnt,
+			    curptr->lock_mtx_spin_time_cum, curptr->lock_mtx_hold_avg);
+			printf("%-14s\n", curptr->lockgroup_name);
+		}
+	}
+	printf("\n");
+
+	vm_deallocate(mach_task_self(), (vm_address_t)spin_info,
+	    spin_count * sizeof(*spin_info));
+}
+
 void
 prime_lockgroup_deltas(void)
 {
@@ -15,6 +15,7 @@
 #include <mach/mach_time.h>
 #include <mach/notify.h>
 #include <servers/bootstrap.h>
+#include <sys/param.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/signal.h>
@@ -75,6 +76,8 @@ static boolean_t        timeshare = FALSE;
 static boolean_t        threaded = FALSE;
 static boolean_t        oneway = FALSE;
 static boolean_t        useset = FALSE;
+static boolean_t        move_ool = FALSE;
+static int              vector_count = 0;
 static boolean_t        save_perfdata = FALSE;
 int                     msg_type;
 int                     num_ints;
@@ -127,6 +130,10 @@ usage(const char *progname)
 	fprintf(stderr, "    -perf   \t\tCreate perfdata files for metrics.\n");
 	fprintf(stderr, "    -type trivial|inline|complex\ttype of messages to send\n");
 	fprintf(stderr, "    -numints num\tnumber of 32-bit ints to send in messages\n");
+	fprintf(stderr, "    -move\t\tcomplex messages move a fresh page aligned buffer,\n");
+	fprintf(stderr, "         \t\twhich the server writes to\n");
+	fprintf(stderr, "    -vector num\t\tservers receive and reply to up to [num] messages\n");
+	fprintf(stderr, "         \t\tper mach_msg_vector() call (max %d)\n", MACH_MSG_VECTOR_MAX / 2);
 	fprintf(stderr, "    -servers num\tnumber of server threads to run\n");
 	fprintf(stderr, "    -clients num\tnumber of clients per server\n");
 	fprintf(stderr, "    -delay num\t\tmicroseconds to sleep clients between messages\n");
@@ -147,6 +154,7 @@ usage(const char *progname)
 	fprintf(stderr, "    . (num_available_processors+1)%%2 servers\n");
 	fprintf(stderr, "    . 4 clients per server\n");
 	fprintf(stderr, "    . no delay\n");
+	fprintf(stderr, "    . one message per mach_msg() call\n");
 	fprintf(stderr, "    . no sets / extra ports\n");
 	fprintf(stderr, "    . no prepost stress\n");
 	exit(1);
@@ -210,6 +218,18 @@ parse_args(int argc, char *argv[])
 				usage(progname);
 			}
 			argc -= 2; argv += 2;
+		} else if (0 == strcmp("-move", argv[0])) {
+			move_ool = TRUE;
+			argc--; argv++;
+		} else if (0 == strcmp("-vector", argv[0])) {
+			if (argc < 2) {
+				usage(progname);
+			}
+			vector_count = strtoul(argv[1], NULL, 0);
+			if (vector_count < 1 || vector_count > MACH_MSG_VECTOR_MAX / 2) {
+				usage(progname);
+			}
+			argc -= 2; argv += 2;
 		} else if (0 == strcmp("-numints", argv[0])) {
 			if (argc < 2) {
 				usage(progname);
@@ -273,6 +293,11 @@ parse_args(int argc, char *argv[])
 		}
 	}
 
+	if (move_ool && msg_type != msg_type_complex) {
+		fprintf(stderr, "-move requires -type complex\n");
+		exit(1);
+	}
+
 	if (stress_prepost) {
 		if (!threaded) {
 			fprintf(stderr, "Prepost stress test _must_ be threaded\n");
@@ -486,6 +511,119 @@ thread_setup(int tag)
 	}
 }
 
+static void
+server_consume(mach_msg_header_t *req)
+{
+	ipc_complex_message *cmsg = (ipc_complex_message *)req;
+
+	if ((req->msgh_bits & MACH_MSGH_BITS_COMPLEX) == 0) {
+		return;
+	}
+	if (move_ool) {
+		char *buf = cmsg->descriptor.address;
+
+		for (size_t off = 0; off < cmsg->descriptor.size; off += PAGE_SIZE) {
+			buf[off] = 1;
+		}
+	}
+	(void)vm_deallocate(mach_task_self(),
+	    (vm_address_t)cmsg->descriptor.address, cmsg->descriptor.size);
+}
+
+static void
+server_prepare_reply(struct port_args *args, mach_msg_header_t *req,
+    mach_msg_header_t *reply)
+{
+	reply->msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MOVE_SEND_ONCE, 0);
+	reply->msgh_size = args->reply_size;
+	reply->msgh_remote_port = req->msgh_remote_port;
+	reply->msgh_local_port = MACH_PORT_NULL;
+	reply->msgh_id = 2;
+}
+
+/*
+ * Receives requests in batches of up to vector_count messages with
+ * mach_msg_vector(): the first receive of a batch blocks, the others
+ * only pick up what is already queued.  The replies to a batch are sent
+ * by the same call that waits for the next one.
+ */
+static void
+server_vector(struct port_args *args, mach_port_t recv_port, int totalmsg)
+{
+	mach_msg_vector_t vec[MACH_MSG_VECTOR_MAX];
+	mach_msg_header_t *req[MACH_MSG_VECTOR_MAX / 2];
+	mach_msg_header_t *reply[MACH_MSG_VECTOR_MAX / 2];
+	int idx = 0, nreplies = 0, nrcv, n;
+	kern_return_t ret;
+
+	for (int i = 0; i < vector_count; i++) {
+		req[i] = malloc(args->req_size);
+		reply[i] = malloc(args->reply_size);
+	}
+
+	while (idx < totalmsg || nreplies > 0) {
+		n = 0;
+		for (int i = 0; i < nreplies; i++, n++) {
+			vec[n] = (mach_msg_vector_t){
+				.msgv_data = (uintptr_t)reply[i],
+				.msgv_option = MACH_SEND_MSG,
+				.msgv_send_size = args->reply_size,
+			};
+		}
+		nrcv = MIN(vector_count, totalmsg - idx);
+		for (int i = 0; i < nrcv; i++, n++) {
+			vec[n] = (mach_msg_vector_t){
+				.msgv_data = (uintptr_t)req[i],
+				.msgv_option = MACH_RCV_MSG | MACH_RCV_INTERRUPT |
+			    MACH_RCV_LARGE | (i ? MACH_RCV_TIMEOUT : 0),
+				.msgv_rcv_size = args->req_size,
+				.msgv_rcv_name = recv_port,
+				.msgv_timeout = 0,
+			};
+		}
+
+		if (verbose > 2) {
+			printf("server sending %d replies, awaiting %d messages\n",
+			    nreplies, nrcv);
+		}
+		(void)mach_msg_vector(vec, n);
+
+		for (int i = 0; i < nreplies; i++) {
+			if (MACH_MSG_SUCCESS != vec[i].msgv_result) {
+				mach_error("mach_msg_vector (send): ", vec[i].msgv_result);
+				exit(1);
+			}
+		}
+
+		n = nreplies;
+		nreplies = 0;
+		for (int i = 0; i < nrcv; i++) {
+			ret = vec[n + i].msgv_result;
+			if (MACH_RCV_TIMED_OUT == ret) {
+				continue;
+			}
+			if (MACH_RCV_INTERRUPTED == ret) {
+				goto out;
+			}
+			if (MACH_MSG_SUCCESS != ret) {
+				mach_error("mach_msg_vector (receive): ", ret);
+				exit(1);
+			}
+			idx++;
+			server_consume(req[i]);
+			if (1 == req[i]->msgh_id) {
+				server_prepare_reply(args, req[i], reply[nreplies++]);
+			}
+		}
+	}
+
+out:
+	for (int i = 0; i < vector_count; i++) {
+		free(req[i]);
+		free(reply[i]);
+	}
+}
+
 void *
 server(void *serverarg)
 {
@@ -505,56 +643,52 @@ server(void *serverarg)
 
 	recv_port = (useset) ? args->rcv_set : args->port;
 
-	for (idx = 0; idx < totalmsg; idx++) {
-		if (verbose > 2) {
-			printf("server awaiting message %d\n", idx);
-		}
-		ret = mach_msg(args->req_msg,
-		    MACH_RCV_MSG | MACH_RCV_INTERRUPT | MACH_RCV_LARGE,
-		    0,
-		    args->req_size,
-		    recv_port,
-		    MACH_MSG_TIMEOUT_NONE,
-		    MACH_PORT_NULL);
-		if (MACH_RCV_INTERRUPTED == ret) {
-			break;
-		}
-		if (MACH_MSG_SUCCESS != ret) {
-			if (verbose) {
-				printf("mach_msg() ret=%d", ret);
-			}
-			mach_error("mach_msg (receive): ", ret);
-			exit(1);
-		}
-		if (verbose > 2) {
-			printf("server received message %d\n", idx);
-		}
-		if (args->req_msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) {
-			ret = vm_deallocate(mach_task_self(),
-			    (vm_address_t)((ipc_complex_message *)args->req_msg)->descriptor.address,
-			    ((ipc_complex_message *)args->req_msg)->descriptor.size);
-		}
-
-		if (1 == args->req_msg->msgh_id) {
+	if (vector_count) {
+		server_vector(args, recv_port, totalmsg);
+	} else {
+		for (idx = 0; idx < totalmsg; idx++) {
 			if (verbose > 2) {
-				printf("server sending reply %d\n", idx);
+				printf("server awaiting message %d\n", idx);
 			}
-			args->reply_msg->msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MOVE_SEND_ONCE, 0);
-			args->reply_msg->msgh_size = args->reply_size;
-			args->reply_msg->msgh_remote_port = args->req_msg->msgh_remote_port;
-			args->reply_msg->msgh_local_port = MACH_PORT_NULL;
-			args->reply_msg->msgh_id = 2;
-			ret = mach_msg(args->reply_msg,
-			    MACH_SEND_MSG,
-			    args->reply_size,
+			ret = mach_msg(args->req_msg,
+			    MACH_RCV_MSG | MACH_RCV_INTERRUPT | MACH_RCV_LARGE,
 			    0,
-			    MACH_PORT_NULL,
+			    args->req_size,
+			    recv_port,
 			    MACH_MSG_TIMEOUT_NONE,
 			    MACH_PORT_NULL);
+			if (MACH_RCV_INTERRUPTED == ret) {
+				break;
+			}
 			if (MACH_MSG_SUCCESS != ret) {
-				mach_error("mach_msg (send): ", ret);
+				if (verbose) {
+					printf("mach_msg() ret=%d", ret);
+				}
+				mach_error("mach_msg (receive): ", ret);
 				exit(1);
 			}
+			if (verbose > 2) {
+				printf("server received message %d\n", idx);
+			}
+			server_consume(args->req_msg);
+
+			if (1 == args->req_msg->msgh_id) {
+				if (verbose > 2) {
+					printf("server sending reply %d\n", idx);
+				}
+				server_prepare_reply(args, args->req_msg, args->reply_msg);
+				ret = mach_msg(args->reply_msg,
+				    MACH_SEND_MSG,
+				    args->reply_size,
+				    0,
+				    MACH_PORT_NULL,
+				    MACH_MSG_TIMEOUT_NONE,
+				    MACH_PORT_NULL);
+				if (MACH_MSG_SUCCESS != ret) {
+					mach_error("mach_msg (send): ", ret);
+					exit(1);
+				}
+			}
 		}
 	}
 
@@ -748,12 +882,29 @@ client(void *threadarg)
 		}
 		req->msgh_id = oneway ? 0 : 1;
 		if (msg_type == msg_type_complex) {
+			void *ool = ints;
+			vm_size_t ool_size = num_ints * sizeof(u_int32_t);
+
+			if (move_ool) {
+				vm_address_t addr = 0;
+
+				ool_size = round_page(ool_size);
+				ret = vm_allocate(mach_task_self(), &addr, ool_size,
+				    VM_FLAGS_ANYWHERE);
+				if (KERN_SUCCESS != ret) {
+					mach_error("vm_allocate: ", ret);
+					exit(1);
+				}
+				for (vm_size_t off = 0; off < ool_size; off += PAGE_SIZE) {
+					((char *)addr)[off] = 1;
+				}
+				ool = (void *)addr;
+			}
 			(req)->msgh_bits |=  MACH_MSGH_BITS_COMPLEX;
 			((ipc_complex_message *)req)->body.msgh_descriptor_count = 1;
-			((ipc_complex_message *)req)->descriptor.address = ints;
-			((ipc_complex_message *)req)->descriptor.size =
-			    num_ints * sizeof(u_int32_t);
-			((ipc_complex_message *)req)->descriptor.deallocate = FALSE;
+			((ipc_complex_message *)req)->descriptor.address = ool;
+			((ipc_complex_message *)req)->descriptor.size = (mach_msg_size_t)ool_size;
+			((ipc_complex_message *)req)->descriptor.deallocate = move_ool;
 			((ipc_complex_message *)req)->descriptor.copy = MACH_MSG_VIRTUAL_COPY;
 			((ipc_complex_message *)req)->descriptor.type = MACH_MSG_OOL_DESCRIPTOR;
 		}
@@ -0,0 +1,1116 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * sched_clutch_sim: user space replay harness for the clutch scheduler
+ *
+ * The simulator models a single cluster running the clutch hierarchy
+ * described in osfmk/kern/sched_clutch.md:
+ *
+ * - root bucket level: EDF on per-bucket WCEL deadlines, with warp windows
+ *   and starvation avoidance identical to sched_clutch_root_highest_root_bucket()
+ * - clutch bucket level: base priority plus the ULE style interactivity
+ *   score from sched_clutch_interactivity_from_cpu_data(), round robin at
+ *   equal priority
+ * - thread level: highest priority first, FIFO at equal priority
+ *
+ * All tunables mirror the values in osfmk/kern/sched_clutch.c. Keep them in
+ * sync when changing the kernel policy so that the simulator keeps evaluating
+ * the same algorithm.
+ *
+ * The input is a thread-state trace (see README for the format) and the
+ * output is a per-QoS report of wakeup-to-oncore latency, per thread group
+ * CPU share and fairness, and migration/preemption counts.
+ *
+ * The harness only depends on libc so that policy changes can be evaluated
+ * on any host, including CI machines that cannot boot the kernel.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIM_MAX_CPUS            64
+#define SIM_MAX_PRI             127
+#define SIM_NOPRI               (-1)
+
+#define SIM_INVALID_TIME        UINT64_MAX
+
+typedef enum {
+	TH_BUCKET_FIXPRI = 0,
+	TH_BUCKET_SHARE_FG,
+	TH_BUCKET_SHARE_IN,
+	TH_BUCKET_SHARE_DF,
+	TH_BUCKET_SHARE_UT,
+	TH_BUCKET_SHARE_BG,
+	TH_BUCKET_SCHED_MAX,
+} sched_bucket_t;
+
+static const char *sim_bucket_names[TH_BUCKET_SCHED_MAX] = {
+	"FIXPRI", "FG", "IN", "DF", "UT", "BG",
+};
+
+/*
+ * Tunables (microseconds), from osfmk/kern/sched_clutch.c
+ */
+static uint64_t sim_root_bucket_wcel[TH_BUCKET_SCHED_MAX] = {
+	SIM_INVALID_TIME,                               /* FIXPRI */
+	0,                                              /* FG */
+	37500,                                          /* IN (37.5ms) */
+	75000,                                          /* DF (75ms) */
+	150000,                                         /* UT (150ms) */
+	250000                                          /* BG (250ms) */
+};
+
+static uint64_t sim_root_bucket_warp[TH_BUCKET_SCHED_MAX] = {
+	SIM_INVALID_TIME,                               /* FIXPRI */
+	8000,                                           /* FG (8ms)*/
+	4000,                                           /* IN (4ms) */
+	2000,                                           /* DF (2ms) */
+	1000,                                           /* UT (1ms) */
+	0                                               /* BG (0ms) */
+};
+
+static const uint64_t sim_thread_quantum_osx[TH_BUCKET_SCHED_MAX] = {
+	10000, 10000, 10000, 10000, 4000, 2000,
+};
+
+static const uint64_t sim_thread_quantum_embedded[TH_BUCKET_SCHED_MAX] = {
+	10000, 10000, 8000, 6000, 4000, 2000,
+};
+
+static uint64_t sim_thread_quantum[TH_BUCKET_SCHED_MAX];
+
+#define SIM_INTERACTIVE_PRI_DEFAULT     8
+#define SIM_ADJUST_THRESHOLD            500000
+#define SIM_ADJUST_RATIO                10
+
+static uint8_t sim_interactive_pri = SIM_INTERACTIVE_PRI_DEFAULT;
+
+/*
+ * Simulation objects
+ */
+typedef enum {
+	SIM_THREAD_WAITING = 0,
+	SIM_THREAD_RUNNABLE,
+	SIM_THREAD_RUNNING,
+} sim_thread_state_t;
+
+struct sim_thread;
+struct sim_clutch_bucket;
+
+struct sim_thread {
+	uint32_t                st_id;
+	uint32_t                st_tg;
+	sched_bucket_t          st_bucket;
+	int                     st_pri;
+	sim_thread_state_t      st_state;
+
+	struct sim_clutch_bucket *st_cb;
+	struct sim_thread       *st_runq_next;
+
+	uint64_t                st_work_remaining;
+	uint64_t                st_made_runnable;
+	uint64_t                st_demand;
+	uint64_t                st_cpu_time;
+	int                     st_last_cpu;
+};
+
+struct sim_clutch_bucket {
+	uint32_t                scb_tg;
+	sched_bucket_t          scb_bucket;
+
+	/* runnable (not running) threads */
+	struct sim_thread       *scb_runq_head;
+	uint32_t                scb_runq_count;
+
+	/* runnable + running threads, for blocked time accounting */
+	uint32_t                scb_run_count;
+	uint64_t                scb_blocked_ts;
+	uint64_t                scb_cpu_used;
+	uint64_t                scb_cpu_blocked;
+	uint8_t                 scb_interactivity;
+
+	/* round robin stamp among equal priority clutch buckets */
+	uint64_t                scb_rr_stamp;
+};
+
+struct sim_root_bucket {
+	sched_bucket_t          scrb_bucket;
+	bool                    scrb_runnable;
+	uint64_t                scrb_deadline;
+	uint64_t                scrb_warp_remaining;
+	uint64_t                scrb_warped_deadline;
+	bool                    scrb_warp_available;
+	bool                    scrb_starvation_avoidance;
+	uint64_t                scrb_starvation_ts;
+};
+
+struct sim_cpu {
+	int                     sc_id;
+	struct sim_thread       *sc_thread;
+	uint64_t                sc_dispatch_ts;
+	uint64_t                sc_quantum_end;
+	uint64_t                sc_busy_time;
+};
+
+struct sim_event {
+	uint64_t                se_ts;
+	uint32_t                se_tid;
+	uint64_t                se_work;
+};
+
+struct sim_latency {
+	uint64_t                *sl_samples;
+	size_t                  sl_count;
+	size_t                  sl_capacity;
+};
+
+struct sim_tg_stats {
+	uint64_t                tgs_cpu_time;
+	uint64_t                tgs_demand;
+};
+
+static struct sim_thread        *sim_threads;
+static size_t                   sim_thread_count;
+static struct sim_clutch_bucket *sim_clutch_buckets;
+static size_t                   sim_clutch_bucket_count;
+static uint32_t                 sim_tg_count;
+static struct sim_event         *sim_events;
+static size_t                   sim_event_count;
+
+static struct sim_root_bucket   sim_root_buckets[TH_BUCKET_SCHED_MAX];
+static struct sim_cpu           sim_cpus[SIM_MAX_CPUS];
+static int                      sim_ncpus = 4;
+static uint64_t                 sim_rr_clock;
+static uint64_t                 sim_end = SIM_INVALID_TIME;
+static bool                     sim_verbose;
+
+static struct sim_latency       sim_latency[TH_BUCKET_SCHED_MAX];
+static uint64_t                 sim_migrations[TH_BUCKET_SCHED_MAX];
+static uint64_t                 sim_dispatches[TH_BUCKET_SCHED_MAX];
+static uint64_t                 sim_coalesced_wakeups;
+static uint64_t                 sim_preemptions;
+static uint64_t                 sim_quantum_expirations;
+static uint64_t                 sim_warp_selections;
+static uint64_t                 sim_starvation_selections;
+
+static void *
+sim_calloc(size_t count, size_t size)
+{
+	void *p = calloc(count, size);
+	if (p == NULL) {
+		fprintf(stderr, "sched_clutch_sim: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void *
+sim_reallocarray(void *ptr, size_t count, size_t size)
+{
+	if (size && count > SIZE_MAX / size) {
+		fprintf(stderr, "sched_clutch_sim: allocation overflow\n");
+		exit(1);
+	}
+	void *p = realloc(ptr, count * size);
+	if (p == NULL) {
+		fprintf(stderr, "sched_clutch_sim: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static void
+sim_latency_record(struct sim_latency *sl, uint64_t sample)
+{
+	if (sl->sl_count == sl->sl_capacity) {
+		sl->sl_capacity = sl->sl_capacity ? sl->sl_capacity * 2 : 256;
+		sl->sl_samples = sim_reallocarray(sl->sl_samples, sl->sl_capacity,
+		    sizeof(uint64_t));
+	}
+	sl->sl_samples[sl->sl_count++] = sample;
+}
+
+static int
+sim_u64_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t
+sim_latency_percentile(struct sim_latency *sl, unsigned pct)
+{
+	if (sl->sl_count == 0) {
+		return 0;
+	}
+	size_t idx = (sl->sl_count * pct) / 100;
+	if (idx >= sl->sl_count) {
+		idx = sl->sl_count - 1;
+	}
+	return sl->sl_samples[idx];
+}
+
+static struct sim_thread *
+sim_thread_lookup(uint32_t tid)
+{
+	for (size_t i = 0; i < sim_thread_count; i++) {
+		if (sim_threads[i].st_id == tid) {
+			return &sim_threads[i];
+		}
+	}
+	return NULL;
+}
+
+static struct sim_clutch_bucket *
+sim_clutch_bucket_lookup(uint32_t tg, sched_bucket_t bucket)
+{
+	for (size_t i = 0; i < sim_clutch_bucket_count; i++) {
+		struct sim_clutch_bucket *cb = &sim_clutch_buckets[i];
+		if (cb->scb_tg == tg && cb->scb_bucket == bucket) {
+			return cb;
+		}
+	}
+	sim_clutch_buckets = sim_reallocarray(sim_clutch_buckets,
+	    sim_clutch_bucket_count + 1, sizeof(struct sim_clutch_bucket));
+	struct sim_clutch_bucket *cb = &sim_clutch_buckets[sim_clutch_bucket_count++];
+	memset(cb, 0, sizeof(*cb));
+	cb->scb_tg = tg;
+	cb->scb_bucket = bucket;
+	/* Matches sched_clutch_bucket_group_init(): start out interactive */
+	cb->scb_interactivity = (bucket == TH_BUCKET_FIXPRI) ?
+	    (uint8_t)(2 * sim_interactive_pri) : sim_interactive_pri;
+	cb->scb_cpu_blocked = (bucket == TH_BUCKET_FIXPRI) ? 0 : SIM_ADJUST_THRESHOLD;
+	return cb;
+}
+
+/*
+ * Clutch bucket level
+ */
+
+/* sched_clutch_bucket_group_cpu_adjust() without the pending ageout */
+static void
+sim_clutch_bucket_cpu_adjust(struct sim_clutch_bucket *cb)
+{
+	if (cb->scb_cpu_used + cb->scb_cpu_blocked >= SIM_ADJUST_THRESHOLD) {
+		cb->scb_cpu_used /= SIM_ADJUST_RATIO;
+		cb->scb_cpu_blocked /= SIM_ADJUST_RATIO;
+	}
+}
+
+/* sched_clutch_interactivity_from_cpu_data() */
+static uint8_t
+sim_clutch_bucket_interactivity_score(struct sim_clutch_bucket *cb)
+{
+	uint64_t used = cb->scb_cpu_used, blocked = cb->scb_cpu_blocked;
+
+	if (cb->scb_bucket == TH_BUCKET_FIXPRI) {
+		return (uint8_t)(2 * sim_interactive_pri);
+	}
+
+	sim_clutch_bucket_cpu_adjust(cb);
+	used = cb->scb_cpu_used;
+	blocked = cb->scb_cpu_blocked;
+
+	if (blocked == 0 && used == 0) {
+		return cb->scb_interactivity;
+	}
+	if (blocked > used) {
+		cb->scb_interactivity = (uint8_t)(sim_interactive_pri +
+		    (sim_interactive_pri * (blocked - used)) / blocked);
+	} else {
+		cb->scb_interactivity = (uint8_t)((sim_interactive_pri * blocked) / used);
+	}
+	return cb->scb_interactivity;
+}
+
+static int
+sim_clutch_bucket_base_pri(struct sim_clutch_bucket *cb)
+{
+	int pri = SIM_NOPRI;
+	for (struct sim_thread *th = cb->scb_runq_head; th; th = th->st_runq_next) {
+		if (th->st_pri > pri) {
+			pri = th->st_pri;
+		}
+	}
+	return pri;
+}
+
+/* sched_clutch_bucket_pri_calculate() */
+static int
+sim_clutch_bucket_pri(struct sim_clutch_bucket *cb)
+{
+	if (cb->scb_runq_count == 0) {
+		return SIM_NOPRI;
+	}
+	return sim_clutch_bucket_base_pri(cb) + sim_clutch_bucket_interactivity_score(cb);
+}
+
+static struct sim_clutch_bucket *
+sim_root_bucket_highest_clutch_bucket(sched_bucket_t bucket)
+{
+	struct sim_clutch_bucket *best = NULL;
+	int best_pri = SIM_NOPRI;
+
+	for (size_t i = 0; i < sim_clutch_bucket_count; i++) {
+		struct sim_clutch_bucket *cb = &sim_clutch_buckets[i];
+		if (cb->scb_bucket != bucket || cb->scb_runq_count == 0) {
+			continue;
+		}
+		int pri = sim_clutch_bucket_pri(cb);
+		if (best == NULL || pri > best_pri ||
+		    (pri == best_pri && cb->scb_rr_stamp < best->scb_rr_stamp)) {
+			best = cb;
+			best_pri = pri;
+		}
+	}
+	return best;
+}
+
+/*
+ * Root bucket level
+ */
+
+static void
+sim_root_bucket_deadline_update(struct sim_root_bucket *rb, uint64_t now)
+{
+	if (rb->scrb_bucket == TH_BUCKET_FIXPRI) {
+		return;
+	}
+	uint64_t deadline = now + sim_root_bucket_wcel[rb->scrb_bucket];
+	if (deadline > rb->scrb_deadline) {
+		rb->scrb_deadline = deadline;
+	}
+}
+
+/* sched_clutch_root_bucket_runnable() */
+static void
+sim_root_bucket_runnable(struct sim_root_bucket *rb, uint64_t now)
+{
+	rb->scrb_runnable = true;
+	if (rb->scrb_bucket == TH_BUCKET_FIXPRI) {
+		return;
+	}
+	if (!rb->scrb_starvation_avoidance) {
+		rb->scrb_deadline = now + sim_root_bucket_wcel[rb->scrb_bucket];
+	}
+	if (rb->scrb_warp_remaining) {
+		rb->scrb_warp_available = true;
+	}
+}
+
+/* sched_clutch_root_bucket_empty() */
+static void
+sim_root_bucket_empty(struct sim_root_bucket *rb, uint64_t now)
+{
+	rb->scrb_runnable = false;
+	if (rb->scrb_bucket == TH_BUCKET_FIXPRI) {
+		return;
+	}
+	rb->scrb_warp_available = false;
+	if (rb->scrb_warped_deadline > now) {
+		rb->scrb_warp_remaining = rb->scrb_warped_deadline - now;
+	} else if (rb->scrb_warped_deadline != SIM_INVALID_TIME) {
+		rb->scrb_warp_remaining = 0;
+	}
+}
+
+static int
+sim_root_highest_runnable_bucket(void)
+{
+	for (int b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+		if (sim_root_buckets[b].scrb_runnable) {
+			return b;
+		}
+	}
+	return -1;
+}
+
+/* sched_clutch_root_highest_root_bucket() for the unbound hierarchy */
+static struct sim_root_bucket *
+sim_root_highest_root_bucket(uint64_t now)
+{
+	int highest = sim_root_highest_runnable_bucket();
+	if (highest == -1) {
+		return NULL;
+	}
+
+	if (sim_root_buckets[TH_BUCKET_FIXPRI].scrb_runnable) {
+		struct sim_clutch_bucket *ui = sim_root_bucket_highest_clutch_bucket(TH_BUCKET_FIXPRI);
+		struct sim_clutch_bucket *fg = sim_root_bucket_highest_clutch_bucket(TH_BUCKET_SHARE_FG);
+		if (fg == NULL || sim_clutch_bucket_base_pri(ui) >= sim_clutch_bucket_base_pri(fg)) {
+			return &sim_root_buckets[TH_BUCKET_FIXPRI];
+		}
+	}
+
+	for (;;) {
+		struct sim_root_bucket *edf = NULL;
+		for (int b = TH_BUCKET_SHARE_FG; b < TH_BUCKET_SCHED_MAX; b++) {
+			struct sim_root_bucket *rb = &sim_root_buckets[b];
+			if (rb->scrb_runnable && (edf == NULL || rb->scrb_deadline < edf->scrb_deadline)) {
+				edf = rb;
+			}
+		}
+		if (edf == NULL) {
+			/* Only an Above UI bucket that lost to an empty FG bucket */
+			return &sim_root_buckets[TH_BUCKET_FIXPRI];
+		}
+
+		int warp_index = -1;
+		for (int b = TH_BUCKET_SHARE_FG; b < TH_BUCKET_SCHED_MAX; b++) {
+			if (sim_root_buckets[b].scrb_warp_available) {
+				warp_index = b;
+				break;
+			}
+		}
+
+		if (warp_index == -1 || warp_index >= (int)edf->scrb_bucket) {
+			if (edf->scrb_starvation_avoidance) {
+				uint64_t window = sim_thread_quantum[edf->scrb_bucket] / (uint64_t)sim_ncpus;
+				if (now < edf->scrb_starvation_ts + window) {
+					sim_starvation_selections++;
+					return edf;
+				}
+				edf->scrb_starvation_avoidance = false;
+				edf->scrb_starvation_ts = 0;
+				sim_root_bucket_deadline_update(edf, now);
+				continue;
+			}
+			if (highest < (int)edf->scrb_bucket) {
+				edf->scrb_starvation_avoidance = true;
+				edf->scrb_starvation_ts = now;
+				sim_starvation_selections++;
+			} else {
+				sim_root_bucket_deadline_update(edf, now);
+				edf->scrb_warp_remaining = sim_root_bucket_warp[edf->scrb_bucket];
+				edf->scrb_warped_deadline = SIM_INVALID_TIME;
+				edf->scrb_warp_available = true;
+			}
+			return edf;
+		}
+
+		struct sim_root_bucket *warp = &sim_root_buckets[warp_index];
+		if (warp->scrb_warped_deadline == SIM_INVALID_TIME) {
+			warp->scrb_warped_deadline = now + warp->scrb_warp_remaining;
+			sim_root_bucket_deadline_update(warp, now);
+			sim_warp_selections++;
+			return warp;
+		}
+		if (warp->scrb_warped_deadline > now) {
+			sim_root_bucket_deadline_update(warp, now);
+			sim_warp_selections++;
+			return warp;
+		}
+		warp->scrb_warp_remaining = 0;
+		warp->scrb_warp_available = false;
+	}
+}
+
+/*
+ * Hierarchy membership
+ */
+
+static void
+sim_thread_insert(struct sim_thread *th, uint64_t now, bool headq)
+{
+	struct sim_clutch_bucket *cb = th->st_cb;
+	struct sim_root_bucket *rb = &sim_root_buckets[th->st_bucket];
+	bool rb_was_empty = !rb->scrb_runnable;
+
+	/* FIFO at equal priority, at the head for preempted threads */
+	if (headq || cb->scb_runq_head == NULL) {
+		th->st_runq_next = cb->scb_runq_head;
+		cb->scb_runq_head = th;
+	} else {
+		struct sim_thread *tail = cb->scb_runq_head;
+		while (tail->st_runq_next) {
+			tail = tail->st_runq_next;
+		}
+		th->st_runq_next = NULL;
+		tail->st_runq_next = th;
+	}
+	cb->scb_runq_count++;
+	if (headq) {
+		cb->scb_rr_stamp = 0;
+	}
+	th->st_state = SIM_THREAD_RUNNABLE;
+
+	if (rb_was_empty) {
+		sim_root_bucket_runnable(rb, now);
+	}
+}
+
+static bool
+sim_bucket_has_runnable(sched_bucket_t bucket)
+{
+	for (size_t i = 0; i < sim_clutch_bucket_count; i++) {
+		struct sim_clutch_bucket *cb = &sim_clutch_buckets[i];
+		if (cb->scb_bucket == bucket && cb->scb_runq_count) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static struct sim_thread *
+sim_thread_highest_remove(uint64_t now)
+{
+	struct sim_root_bucket *rb = sim_root_highest_root_bucket(now);
+	if (rb == NULL) {
+		return NULL;
+	}
+	struct sim_clutch_bucket *cb = sim_root_bucket_highest_clutch_bucket(rb->scrb_bucket);
+	assert(cb != NULL);
+
+	struct sim_thread *best = NULL, *best_prev = NULL, *prev = NULL;
+	for (struct sim_thread *th = cb->scb_runq_head; th; prev = th, th = th->st_runq_next) {
+		if (best == NULL || th->st_pri > best->st_pri) {
+			best = th;
+			best_prev = prev;
+		}
+	}
+	if (best_prev) {
+		best_prev->st_runq_next = best->st_runq_next;
+	} else {
+		cb->scb_runq_head = best->st_runq_next;
+	}
+	best->st_runq_next = NULL;
+	cb->scb_runq_count--;
+	/* SCHED_CLUTCH_BUCKET_OPTIONS_SAMEPRI_RR */
+	cb->scb_rr_stamp = ++sim_rr_clock;
+
+	if (!sim_bucket_has_runnable(rb->scrb_bucket)) {
+		sim_root_bucket_empty(rb, now);
+	}
+	return best;
+}
+
+static int
+sim_root_priority(void)
+{
+	int pri = SIM_NOPRI;
+	for (size_t i = 0; i < sim_clutch_bucket_count; i++) {
+		int cbpri = sim_clutch_bucket_base_pri(&sim_clutch_buckets[i]);
+		if (cbpri > pri) {
+			pri = cbpri;
+		}
+	}
+	return pri;
+}
+
+/*
+ * Processor level
+ */
+
+static void
+sim_cpu_dispatch(struct sim_cpu *cpu, struct sim_thread *th, uint64_t now)
+{
+	th->st_state = SIM_THREAD_RUNNING;
+	cpu->sc_thread = th;
+	cpu->sc_dispatch_ts = now;
+	cpu->sc_quantum_end = now + sim_thread_quantum[th->st_bucket];
+
+	if (th->st_made_runnable != SIM_INVALID_TIME) {
+		uint64_t latency = now - th->st_made_runnable;
+		sim_latency_record(&sim_latency[th->st_bucket], latency);
+		th->st_made_runnable = SIM_INVALID_TIME;
+	}
+	if (th->st_last_cpu != -1 && th->st_last_cpu != cpu->sc_id) {
+		sim_migrations[th->st_bucket]++;
+	}
+	th->st_last_cpu = cpu->sc_id;
+	sim_dispatches[th->st_bucket]++;
+
+	if (sim_verbose) {
+		printf("%12" PRIu64 " cpu%d run tid %u (%s pri %d)\n", now, cpu->sc_id,
+		    th->st_id, sim_bucket_names[th->st_bucket], th->st_pri);
+	}
+}
+
+/* Account CPU time for the running thread and take it off core */
+static struct sim_thread *
+sim_cpu_undispatch(struct sim_cpu *cpu, uint64_t now)
+{
+	struct sim_thread *th = cpu->sc_thread;
+	uint64_t ran = now - cpu->sc_dispatch_ts;
+
+	th->st_cpu_time += ran;
+	th->st_work_remaining -= ran;
+	cpu->sc_busy_time += ran;
+	if (th->st_bucket != TH_BUCKET_FIXPRI) {
+		th->st_cb->scb_cpu_used += (ran < SIM_ADJUST_THRESHOLD) ? ran : SIM_ADJUST_THRESHOLD;
+	}
+	cpu->sc_thread = NULL;
+	return th;
+}
+
+static void
+sim_thread_block(struct sim_thread *th, uint64_t now)
+{
+	struct sim_clutch_bucket *cb = th->st_cb;
+
+	th->st_state = SIM_THREAD_WAITING;
+	if (--cb->scb_run_count == 0) {
+		cb->scb_blocked_ts = now;
+	}
+}
+
+static void
+sim_thread_wakeup(struct sim_thread *th, uint64_t work, uint64_t now)
+{
+	struct sim_clutch_bucket *cb = th->st_cb;
+
+	th->st_demand += work;
+	if (th->st_state != SIM_THREAD_WAITING) {
+		/* Wakeup while still runnable: the new work is coalesced */
+		th->st_work_remaining += work;
+		sim_coalesced_wakeups++;
+		return;
+	}
+
+	if (cb->scb_run_count++ == 0 && cb->scb_bucket != TH_BUCKET_FIXPRI) {
+		uint64_t blocked = now - cb->scb_blocked_ts;
+		cb->scb_cpu_blocked += (blocked < SIM_ADJUST_THRESHOLD) ? blocked : SIM_ADJUST_THRESHOLD;
+	}
+	th->st_work_remaining = work;
+	th->st_made_runnable = now;
+	sim_thread_insert(th, now, false);
+}
+
+static struct sim_cpu *
+sim_cpu_find_idle(struct sim_thread *th)
+{
+	/* Prefer the last CPU the thread ran on to avoid a migration */
+	if (th && th->st_last_cpu != -1 && sim_cpus[th->st_last_cpu].sc_thread == NULL) {
+		return &sim_cpus[th->st_last_cpu];
+	}
+	for (int i = 0; i < sim_ncpus; i++) {
+		if (sim_cpus[i].sc_thread == NULL) {
+			return &sim_cpus[i];
+		}
+	}
+	return NULL;
+}
+
+/* Model of the csw_check()/AST_PREEMPT decision on wakeup */
+static struct sim_cpu *
+sim_cpu_find_preemptible(struct sim_thread *th)
+{
+	struct sim_cpu *victim = NULL;
+	for (int i = 0; i < sim_ncpus; i++) {
+		struct sim_thread *cur = sim_cpus[i].sc_thread;
+		if (cur && cur->st_pri < th->st_pri &&
+		    (victim == NULL || cur->st_pri < victim->sc_thread->st_pri)) {
+			victim = &sim_cpus[i];
+		}
+	}
+	return victim;
+}
+
+static void
+sim_cpu_reschedule(struct sim_cpu *cpu, uint64_t now)
+{
+	struct sim_thread *next = sim_thread_highest_remove(now);
+	if (next) {
+		sim_cpu_dispatch(cpu, next, now);
+	}
+}
+
+static void
+sim_dispatch_idle(uint64_t now)
+{
+	for (;;) {
+		if (sim_root_highest_runnable_bucket() == -1) {
+			return;
+		}
+		struct sim_cpu *cpu = sim_cpu_find_idle(NULL);
+		if (cpu == NULL) {
+			return;
+		}
+		struct sim_thread *next = sim_thread_highest_remove(now);
+		if (next == NULL) {
+			return;
+		}
+		struct sim_cpu *pref = sim_cpu_find_idle(next);
+		sim_cpu_dispatch(pref ? pref : cpu, next, now);
+	}
+}
+
+static void
+sim_process_cpu(struct sim_cpu *cpu, uint64_t now)
+{
+	struct sim_thread *th = cpu->sc_thread;
+	if (th == NULL) {
+		return;
+	}
+	uint64_t work_end = cpu->sc_dispatch_ts + th->st_work_remaining;
+
+	if (work_end <= now) {
+		sim_cpu_undispatch(cpu, now);
+		sim_thread_block(th, now);
+		sim_cpu_reschedule(cpu, now);
+	} else if (cpu->sc_quantum_end <= now) {
+		sim_quantum_expirations++;
+		sim_cpu_undispatch(cpu, now);
+		if (sim_root_priority() == SIM_NOPRI) {
+			/* Nothing else runnable, keep running with a fresh quantum */
+			sim_cpu_dispatch(cpu, th, now);
+			sim_dispatches[th->st_bucket]--;
+			return;
+		}
+		sim_thread_insert(th, now, false);
+		sim_cpu_reschedule(cpu, now);
+	}
+}
+
+static uint64_t
+sim_cpu_next_event(struct sim_cpu *cpu)
+{
+	struct sim_thread *th = cpu->sc_thread;
+	if (th == NULL) {
+		return SIM_INVALID_TIME;
+	}
+	uint64_t work_end = cpu->sc_dispatch_ts + th->st_work_remaining;
+	return (work_end < cpu->sc_quantum_end) ? work_end : cpu->sc_quantum_end;
+}
+
+static uint64_t
+sim_run(void)
+{
+	size_t next_event = 0;
+	uint64_t now = 0;
+
+	for (;;) {
+		uint64_t next = SIM_INVALID_TIME;
+		if (next_event < sim_event_count) {
+			next = sim_events[next_event].se_ts;
+		}
+		for (int i = 0; i < sim_ncpus; i++) {
+			uint64_t ts = sim_cpu_next_event(&sim_cpus[i]);
+			if (ts < next) {
+				next = ts;
+			}
+		}
+		if (next == SIM_INVALID_TIME) {
+			break;
+		}
+		if (next > sim_end) {
+			now = sim_end;
+			break;
+		}
+		now = next;
+
+		for (int i = 0; i < sim_ncpus; i++) {
+			if (sim_cpu_next_event(&sim_cpus[i]) <= now) {
+				sim_process_cpu(&sim_cpus[i], now);
+			}
+		}
+
+		while (next_event < sim_event_count && sim_events[next_event].se_ts <= now) {
+			struct sim_event *ev = &sim_events[next_event++];
+			struct sim_thread *th = sim_thread_lookup(ev->se_tid);
+			bool was_waiting = (th->st_state == SIM_THREAD_WAITING);
+
+			sim_thread_wakeup(th, ev->se_work, now);
+			if (!was_waiting) {
+				continue;
+			}
+			if (sim_cpu_find_idle(NULL) == NULL) {
+				struct sim_cpu *victim = sim_cpu_find_preemptible(th);
+				if (victim) {
+					struct sim_thread *cur = sim_cpu_undispatch(victim, now);
+					sim_preemptions++;
+					sim_thread_insert(cur, now, true);
+					sim_cpu_reschedule(victim, now);
+				}
+			}
+		}
+
+		sim_dispatch_idle(now);
+	}
+
+	/* Charge the threads still on core at the end of the window */
+	for (int i = 0; i < sim_ncpus; i++) {
+		if (sim_cpus[i].sc_thread) {
+			sim_cpu_undispatch(&sim_cpus[i], now);
+		}
+	}
+	return now;
+}
+
+/*
+ * Trace parsing
+ */
+
+static int
+sim_parse_bucket(const char *name)
+{
+	for (int b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+		if (strcasecmp(name, sim_bucket_names[b]) == 0) {
+			return b;
+		}
+	}
+	return -1;
+}
+
+static int
+sim_event_compare(const void *a, const void *b)
+{
+	const struct sim_event *x = a, *y = b;
+	return (x->se_ts > y->se_ts) - (x->se_ts < y->se_ts);
+}
+
+static int
+sim_load_trace(FILE *f, const char *path)
+{
+	char line[256];
+	size_t event_capacity = 0;
+	unsigned lineno = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		char kind[16], bucket[16];
+		uint32_t tid, tg;
+		uint64_t ts, work;
+		int pri;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		if (sscanf(line, "thread %u %u %15s %d", &tid, &tg, bucket, &pri) == 4) {
+			int b = sim_parse_bucket(bucket);
+			if (b == -1 || pri < 0 || pri > SIM_MAX_PRI || sim_thread_lookup(tid)) {
+				fprintf(stderr, "%s:%u: invalid thread declaration\n", path, lineno);
+				return EINVAL;
+			}
+			sim_threads = sim_reallocarray(sim_threads, sim_thread_count + 1,
+			    sizeof(struct sim_thread));
+			struct sim_thread *th = &sim_threads[sim_thread_count++];
+			memset(th, 0, sizeof(*th));
+			th->st_id = tid;
+			th->st_tg = tg;
+			th->st_bucket = (sched_bucket_t)b;
+			th->st_pri = pri;
+			th->st_last_cpu = -1;
+			th->st_made_runnable = SIM_INVALID_TIME;
+			if (tg + 1 > sim_tg_count) {
+				sim_tg_count = tg + 1;
+			}
+			continue;
+		}
+		if (sscanf(line, "%" SCNu64 " %15s %u %" SCNu64, &ts, kind, &tid, &work) == 4 &&
+		    strcmp(kind, "wake") == 0) {
+			if (sim_thread_lookup(tid) == NULL || work == 0) {
+				fprintf(stderr, "%s:%u: wakeup of undeclared thread or no work\n", path, lineno);
+				return EINVAL;
+			}
+			if (sim_event_count == event_capacity) {
+				event_capacity = event_capacity ? event_capacity * 2 : 1024;
+				sim_events = sim_reallocarray(sim_events, event_capacity,
+				    sizeof(struct sim_event));
+			}
+			sim_events[sim_event_count++] = (struct sim_event){
+				.se_ts = ts, .se_tid = tid, .se_work = work,
+			};
+			continue;
+		}
+		fprintf(stderr, "%s:%u: unrecognized line\n", path, lineno);
+		return EINVAL;
+	}
+
+	/* Threads must be declared first so that st_cb pointers are stable */
+	for (size_t i = 0; i < sim_thread_count; i++) {
+		sim_clutch_bucket_lookup(sim_threads[i].st_tg, sim_threads[i].st_bucket);
+	}
+	for (size_t i = 0; i < sim_thread_count; i++) {
+		sim_threads[i].st_cb = sim_clutch_bucket_lookup(sim_threads[i].st_tg,
+		    sim_threads[i].st_bucket);
+	}
+	qsort(sim_events, sim_event_count, sizeof(struct sim_event), sim_event_compare);
+	return 0;
+}
+
+/*
+ * Reporting
+ */
+
+static void
+sim_report(uint64_t end)
+{
+	struct sim_tg_stats *tgs = sim_calloc(sim_tg_count ? sim_tg_count : 1, sizeof(*tgs));
+	uint64_t busy = 0;
+
+	for (size_t i = 0; i < sim_thread_count; i++) {
+		struct sim_thread *th = &sim_threads[i];
+		tgs[th->st_tg].tgs_cpu_time += th->st_cpu_time;
+		tgs[th->st_tg].tgs_demand += th->st_demand;
+	}
+	for (int i = 0; i < sim_ncpus; i++) {
+		busy += sim_cpus[i].sc_busy_time;
+	}
+
+	printf("simulated %" PRIu64 " us on %d cpus, utilization %.1f%%\n", end, sim_ncpus,
+	    end ? (100.0 * (double)busy) / ((double)end * sim_ncpus) : 0.0);
+	printf("preemptions %" PRIu64 ", quantum expirations %" PRIu64
+	    ", coalesced wakeups %" PRIu64 "\n", sim_preemptions,
+	    sim_quantum_expirations, sim_coalesced_wakeups);
+	printf("warp selections %" PRIu64 ", starvation avoidance selections %" PRIu64 "\n\n",
+	    sim_warp_selections, sim_starvation_selections);
+
+	printf("%-7s %10s %10s %10s %10s %10s %10s %10s\n", "bucket", "wakeups",
+	    "mean(us)", "p50(us)", "p99(us)", "max(us)", "dispatch", "migrate");
+	for (int b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+		struct sim_latency *sl = &sim_latency[b];
+		uint64_t total = 0;
+		if (sl->sl_count == 0 && sim_dispatches[b] == 0) {
+			continue;
+		}
+		qsort(sl->sl_samples, sl->sl_count, sizeof(uint64_t), sim_u64_compare);
+		for (size_t i = 0; i < sl->sl_count; i++) {
+			total += sl->sl_samples[i];
+		}
+		printf("%-7s %10zu %10.1f %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+		    " %10" PRIu64 " %10" PRIu64 "\n", sim_bucket_names[b], sl->sl_count,
+		    sl->sl_count ? (double)total / (double)sl->sl_count : 0.0,
+		    sim_latency_percentile(sl, 50), sim_latency_percentile(sl, 99),
+		    sim_latency_percentile(sl, 100), sim_dispatches[b], sim_migrations[b]);
+	}
+
+	/*
+	 * Jain's fairness index over the fraction of its demand each thread
+	 * group received: 1.0 means every group got the same fraction.
+	 */
+	double sum = 0, sumsq = 0;
+	unsigned n = 0;
+	printf("\n%-7s %12s %12s %8s\n", "tg", "cpu(us)", "demand(us)", "share");
+	for (uint32_t tg = 0; tg < sim_tg_count; tg++) {
+		if (tgs[tg].tgs_demand == 0) {
+			continue;
+		}
+		double share = (double)tgs[tg].tgs_cpu_time / (double)tgs[tg].tgs_demand;
+		printf("%-7u %12" PRIu64 " %12" PRIu64 " %8.3f\n", tg, tgs[tg].tgs_cpu_time,
+		    tgs[tg].tgs_demand, share);
+		sum += share;
+		sumsq += share * share;
+		n++;
+	}
+	if (n) {
+		printf("\nfairness (Jain) %.4f over %u thread groups\n", (sum * sum) / (n * sumsq), n);
+	}
+	free(tgs);
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-c ncpus] [-d duration_us] [-e] [-i interactive_pri] [-v] trace\n"
+	    "\t-c\tnumber of simulated CPUs in the cluster (default 4)\n"
+	    "\t-d\tlength of the simulated window (default: until the last wakeup)\n"
+	    "\t-e\tuse the embedded thread quantum table\n"
+	    "\t-i\tinteractivity score range (default %d)\n"
+	    "\t-v\tlog every dispatch decision\n", progname,
+	    SIM_INTERACTIVE_PRI_DEFAULT);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const uint64_t *quantum = sim_thread_quantum_osx;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:d:ei:v")) != -1) {
+		switch (ch) {
+		case 'c':
+			sim_ncpus = atoi(optarg);
+			if (sim_ncpus < 1 || sim_ncpus > SIM_MAX_CPUS) {
+				usage(argv[0]);
+			}
+			break;
+		case 'd':
+			sim_end = strtoull(optarg, NULL, 0);
+			if (sim_end == 0) {
+				usage(argv[0]);
+			}
+			break;
+		case 'e':
+			quantum = sim_thread_quantum_embedded;
+			break;
+		case 'i':
+			sim_interactive_pri = (uint8_t)atoi(optarg);
+			if (sim_interactive_pri == 0 || sim_interactive_pri > 32) {
+				usage(argv[0]);
+			}
+			break;
+		case 'v':
+			sim_verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+	}
+
+	memcpy(sim_thread_quantum, quantum, sizeof(sim_thread_quantum));
+	for (int b = 0; b < TH_BUCKET_SCHED_MAX; b++) {
+		sim_root_buckets[b].scrb_bucket = (sched_bucket_t)b;
+		sim_root_buckets[b].scrb_warp_remaining = sim_root_bucket_warp[b];
+		sim_root_buckets[b].scrb_warped_deadline = SIM_INVALID_TIME;
+	}
+	for (int i = 0; i < sim_ncpus; i++) {
+		sim_cpus[i].sc_id = i;
+	}
+
+	FILE *f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+	if (f == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	int error = sim_load_trace(f, argv[optind]);
+	if (f != stdin) {
+		fclose(f);
+	}
+	if (error) {
+		return 1;
+	}
+	if (sim_end == SIM_INVALID_TIME && sim_event_count) {
+		sim_end = sim_events[sim_event_count - 1].se_ts;
+	}
+
+	sim_report(sim_run());
+	return 0;
+}